@@ -0,0 +1,188 @@
+/*
+* Sir Locks-A-Lot - Local event cache
+*
+* Filename: slal_cache.h
+*
+* Description:
+* Append-only file of the logged events a console has received from one
+* Raspberry Pi, so it can show the last known door states and recent history
+* at startup, before (or without) a connection.
+*
+* Each logged event carries the Pi's "seq" (its database id). The cursor is
+* the highest seq up to which the cache has every event; after connecting, the
+* console sends a history_request with "since" set to it and the Pi replays
+* only the newer events, ending with a history_end that moves the cursor to
+* the Pi's newest seq. Catching up therefore costs one message per missed
+* event instead of a full reload. Live events that overtake the replay are
+* kept and counted once.
+*
+* Records are slal_wire.h binary messages written back to back. A record cut
+* short by a crash is dropped on the next load. Once the file holds
+* CACHE_COMPACT_RECORDS records it is rewritten with only the latest event
+* per door and the recent history.
+*/
+
+#ifndef SLAL_CACHE_H
+#define SLAL_CACHE_H
+
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "slal_protocol.h"
+#include "slal_wire.h"
+
+const size_t CACHE_RECENT_MAX = 64;         // Events kept in memory for display
+const size_t CACHE_COMPACT_RECORDS = 4096;
+
+class EventCache {
+private:
+    std::string path;
+    std::string defaultDoor;        // For events that do not name a door
+    std::ofstream out;
+    long long cursor;               // Every seq up to here is cached
+    std::set<long long> ahead;      // Cached seqs past a gap at the cursor
+    std::deque<ProtocolMessage> recent;                 // Ordered by seq
+    std::map<std::string, ProtocolMessage> doors;       // Latest event per door
+    size_t records;
+
+    static long long seqOf(const ProtocolMessage& msg) {
+        return std::atoll(msg.get<Field::Seq>().c_str());
+    }
+
+    // Update the in-memory view; false if the record adds nothing
+    bool apply(const ProtocolMessage& msg) {
+        long long seq = seqOf(msg);
+        if (seq <= 0) return false;
+
+        if (msg.event() == Event::HistoryEnd) {
+            if (seq <= cursor) return false;
+            cursor = seq;
+            ahead.erase(ahead.begin(), ahead.upper_bound(cursor));
+            return true;
+        }
+
+        if (seq <= cursor || ahead.count(seq)) return false;
+        if (seq == cursor + 1) {
+            cursor = seq;
+            while (!ahead.empty() && *ahead.begin() == cursor + 1) {
+                cursor = *ahead.begin();
+                ahead.erase(ahead.begin());
+            }
+        }
+        else {
+            ahead.insert(seq);
+        }
+
+        auto position = recent.end();
+        while (position != recent.begin() && seqOf(*(position - 1)) > seq) --position;
+        recent.insert(position, msg);
+        if (recent.size() > CACHE_RECENT_MAX) recent.pop_front();
+
+        std::string door = msg.get<Field::Door>().empty() ? defaultDoor : msg.get<Field::Door>();
+        auto latest = doors.find(door);
+        if (latest == doors.end() || seqOf(latest->second) < seq) doors[door] = msg;
+        return true;
+    }
+
+    // Replace the file with the given records, written to a temporary first
+    bool rewrite(const std::vector<ProtocolMessage>& messages) {
+        out.close();
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            for (const ProtocolMessage& msg : messages) {
+                std::string record = WireCodec::encode(msg);
+                file.write(record.data(), record.size());     // Empty if it cannot be encoded
+            }
+            if (!file) return false;
+        }
+        std::remove(path.c_str());      // rename() does not replace on Windows
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) return false;
+        records = messages.size();
+        out.open(path, std::ios::binary | std::ios::app);
+        return out.is_open();
+    }
+
+    // Latest event per door and the recent history, then the cursor
+    bool compact() {
+        std::map<long long, ProtocolMessage> kept;
+        for (const auto& entry : doors) kept[seqOf(entry.second)] = entry.second;
+        for (const ProtocolMessage& msg : recent) kept[seqOf(msg)] = msg;
+
+        std::vector<ProtocolMessage> messages;
+        for (const auto& entry : kept) messages.push_back(entry.second);
+        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        ProtocolMessage end = Protocol::create(Source::Laptop, Event::HistoryEnd, WireCodec::epochMsToTimestamp(nowMs.count()));
+        end.set<Field::Seq>(std::to_string(cursor));
+        messages.push_back(end);
+        return rewrite(messages);
+    }
+
+public:
+    EventCache(const std::string& filePath, const std::string& door)
+        : path(filePath), defaultDoor(door), cursor(0), records(0) {}
+
+    // One file per server
+    static std::string fileFor(const std::string& host, int port) {
+        return "slal_events_" + host + "_" + std::to_string(port) + ".cache";
+    }
+
+    // Read the file and open it for appending. A missing file is an empty cache.
+    bool load() {
+        std::string data;
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (file) {
+                std::ostringstream contents;
+                contents << file.rdbuf();
+                data = contents.str();
+            }
+        }
+
+        size_t pos = 0;
+        while (pos < data.size()) {
+            ProtocolMessage msg;
+            long used = WireCodec::decode(data.data() + pos, data.size() - pos, msg);
+            if (used <= 0) break;
+            apply(msg);
+            records++;
+            pos += used;
+        }
+
+        // A torn last record or an oversized file: write back what was read
+        if (pos < data.size() || records >= CACHE_COMPACT_RECORDS) return compact();
+        out.open(path, std::ios::binary | std::ios::app);
+        return out.is_open();
+    }
+
+    // Record a logged event (with "seq") or a history_end. Returns false for
+    // messages without a seq and for events already cached.
+    bool add(const ProtocolMessage& msg) {
+        std::string record = WireCodec::encode(msg);
+        if (record.empty() || !apply(msg)) return false;
+        out.write(record.data(), record.size());
+        out.flush();
+        if (++records >= CACHE_COMPACT_RECORDS) compact();
+        return true;
+    }
+
+    // Ask the Pi for everything after the cursor
+    ProtocolMessage historyRequest(const std::string& timestamp) const {
+        ProtocolMessage request = Protocol::create(Source::Laptop, Event::HistoryRequest, timestamp);
+        request.set<Field::Since>(std::to_string(cursor));
+        return request;
+    }
+
+    long long getCursor() const { return cursor; }
+    const std::deque<ProtocolMessage>& getRecent() const { return recent; }
+    const std::map<std::string, ProtocolMessage>& getDoors() const { return doors; }
+};
+
+#endif // SLAL_CACHE_H
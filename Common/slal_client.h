@@ -0,0 +1,586 @@
+/*
+* Sir Locks-A-Lot - Door client core
+*
+* Filename: slal_client.h
+*
+* Description:
+* Connection and protocol handling for a client of the Raspberry Pi server,
+* without any user interface. Used by the Windows console
+* (Windows/SLAL-windows.cpp) and the Linux headless driver
+* (Linux/SLAL-headless.cpp).
+*
+* After connecting, the client sends a "hello" listing the encodings it
+* supports. If the Pi answers with "encoding":"binary", messages switch to
+* the compact binary format from slal_wire.h; otherwise JSON is kept.
+*
+* With startReceiver() a background thread reads the socket and queues each
+* message with its arrival time; the UI takes them with waitForMessage().
+* The synchronous receiveJSON() must not be used while the receiver runs.
+*
+* With startAutoReconnect() a second thread owns the connection: it connects
+* with a timeout, backs off exponentially with jitter between failures, and
+* retries at once on network changes. submitJSON() queues commands while
+* offline and they are flushed on reconnect unless their TTL has passed.
+*/
+
+#ifndef SLAL_CLIENT_H
+#define SLAL_CLIENT_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include "slal_socket.h"
+#include "slal_protocol.h"
+#include "slal_wire.h"
+
+// One message taken off the socket by the receiver thread
+struct ReceivedMessage {
+    std::string json;
+    std::chrono::steady_clock::time_point receivedAt;
+    int64_t sentMs;             // Pi send time (ms since the epoch), 0 if not stamped
+    size_t site;                // Index of the server it came from (SiteMonitor)
+};
+
+inline ReceivedMessage makeReceivedMessage(const std::string& json, size_t site = 0) {
+    ReceivedMessage received;
+    received.json = json;
+    received.receivedAt = std::chrono::steady_clock::now();
+    received.sentMs = std::atoll(Protocol::parseJSON(json).get<Field::SentMs>().c_str());
+    received.site = site;
+    return received;
+}
+
+// Take one complete message off the front of a receive buffer, as JSON.
+// Returns "" until a whole message has arrived.
+inline std::string takeMessageFrom(std::string& buffer, bool binary) {
+    if (!binary) return Protocol::takeJSON(buffer);
+
+    ProtocolMessage msg;
+    long used = WireCodec::decode(buffer.data(), buffer.size(), msg);
+    if (used < 0) {
+        std::cout << "Invalid binary message from Pi, discarding" << std::endl;
+        buffer.clear();
+        return "";
+    }
+    if (used == 0) return "";
+    buffer.erase(0, used);
+    return Protocol::toJSON(msg);
+}
+
+// Door state text for events that report one, "" for anything else
+inline std::string describeDoorStatus(const ProtocolMessage& msg) {
+    switch (msg.event()) {
+    case Event::Lock:
+    case Event::StatusLocked:
+        return "LOCKED";
+    case Event::Unlock:
+    case Event::StatusUnlocked:
+        return "UNLOCKED";
+    case Event::Error:
+    case Event::StatusError:
+        return "ERROR";
+    case Event::StatusUnknown:
+        return "UNKNOWN";
+    default:
+        return "";
+    }
+}
+
+// Thread-safe FIFO between the receiver thread and the UI
+class MessageQueue {
+private:
+    std::deque<ReceivedMessage> messages;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+public:
+    void push(const ReceivedMessage& message) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            messages.push_back(message);
+        }
+        cv.notify_one();
+    }
+
+    bool waitPop(ReceivedMessage& message, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_for(lock, timeout, [this] { return !messages.empty(); })) {
+            return false;
+        }
+        message = messages.front();
+        messages.pop_front();
+        return true;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        messages.clear();
+    }
+};
+
+// Collects round-trip times for the summaries printed by the drivers
+class LatencyRecorder {
+private:
+    std::vector<double> samples;
+    bool sorted;
+
+public:
+    LatencyRecorder() : sorted(true) {}
+
+    void add(double ms) {
+        samples.push_back(ms);
+        sorted = false;
+    }
+
+    void merge(const LatencyRecorder& other) {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+        sorted = false;
+    }
+
+    size_t count() const { return samples.size(); }
+
+    // Nearest-rank percentile, p in [0, 1]
+    double percentile(double p) {
+        if (samples.empty()) return 0.0;
+        if (!sorted) {
+            std::sort(samples.begin(), samples.end());
+            sorted = true;
+        }
+        return samples[(size_t)(p * (samples.size() - 1))];
+    }
+
+    void print(std::ostream& out) {
+        out << "Latency ms  p50 " << percentile(0.50) << "  p90 " << percentile(0.90)
+            << "  p99 " << percentile(0.99) << "  max " << percentile(1.0) << std::endl;
+    }
+};
+
+// Background reconnect tuning
+const int CLIENT_CONNECT_TIMEOUT_MS = 2000;
+const int CLIENT_BACKOFF_INITIAL_MS = 250;
+const int CLIENT_BACKOFF_MAX_MS = 8000;
+const int CLIENT_RECONNECT_POLL_MS = 100;   // Checks for stop, hints and lost connections
+const size_t CLIENT_OFFLINE_QUEUE_MAX = 32;
+
+// Result of submitting a command while auto-reconnect may be offline
+enum class SendResult { Sent, Queued, Failed };
+
+class DoorClient {
+private:
+    static const int BUFFER_SIZE = 1024;
+    static const int RECEIVER_POLL_MS = 200;   // How often the receiver checks for stop
+
+    struct QueuedCommand {
+        std::string json;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    SocketHandle sock;
+    struct sockaddr_in server_addr;
+    std::string host;
+    int port;
+    std::string doorStatus;
+    mutable std::mutex statusMutex;
+    std::atomic<bool> connected;
+    bool preferBinary;
+    bool binaryEncoding;        // Negotiated with the Pi after connecting
+    std::string receiveBuffer;  // Received bytes not yet forming a whole message
+    bool verbose;
+
+    // Connection attempts are serialized; sends only hold sendMutex
+    std::mutex connectMutex;
+    std::mutex sendMutex;
+
+    std::thread receiverThread;
+    std::atomic<bool> receiverStop;
+    bool receiverWanted;
+    MessageQueue inbox;
+
+    std::thread reconnectThread;
+    std::atomic<bool> reconnectStop;
+    std::atomic<bool> reconnectHint;
+    std::atomic<bool> autoReconnect;
+    std::mt19937 jitter;
+
+    std::deque<QueuedCommand> offlineQueue;
+    std::mutex offlineMutex;
+    std::chrono::milliseconds offlineTTL;
+    std::atomic<int> expiredCommands;
+
+    void receiverLoop() {
+        while (!receiverStop && connected) {
+            std::string message = receiveJSON();
+            if (message.empty()) continue;
+
+            inbox.push(makeReceivedMessage(message));
+        }
+    }
+
+    void launchReceiver() {
+        if (!receiverWanted || !connected || receiverThread.joinable()) return;
+        receiverStop = false;
+        setSocketReceiveTimeout(sock, RECEIVER_POLL_MS);
+        receiverThread = std::thread(&DoorClient::receiverLoop, this);
+    }
+
+    void joinReceiver() {
+        if (!receiverThread.joinable()) return;
+        receiverStop = true;
+        receiverThread.join();
+    }
+
+    // Offer the binary encoding; keep JSON if the Pi does not accept it.
+    // Runs before the connection is published, so it uses the raw calls.
+    void negotiateEncoding() {
+        binaryEncoding = false;
+        receiveBuffer.clear();
+        if (!preferBinary) return;
+
+        ProtocolMessage hello = Protocol::create(Source::Laptop, Event::Hello, getCurrentTimestamp());
+        hello.set<Field::Encodings>("binary,json");
+        if (!sendRaw(Protocol::toJSON(hello))) return;
+
+        // Wait briefly for the reply; older servers do not answer at all
+        setSocketReceiveTimeout(sock, 1000);
+        std::string reply = receiveRaw();
+        setSocketReceiveTimeout(sock, 5000);
+
+        ProtocolMessage msg = Protocol::parseJSON(reply);
+        if (msg.event() == Event::Hello) {
+            binaryEncoding = msg.get<Field::Encoding>() == "binary";
+        }
+        else if (!reply.empty()) {
+            processReceivedMessage(reply);
+        }
+        if (verbose) std::cout << "Using " << (binaryEncoding ? "binary" : "JSON") << " encoding" << std::endl;
+    }
+
+    bool sendRaw(const std::string& jsonMessage) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (sock == INVALID_SOCKET_HANDLE) return false;
+
+        std::string wire = binaryEncoding ? WireCodec::encode(Protocol::parseJSON(jsonMessage)) : jsonMessage;
+        if (wire.empty()) {
+            std::cout << "Message too long for the binary encoding, not sent" << std::endl;
+            return false;
+        }
+        int result = (int)send(sock, wire.data(), (int)wire.length(), 0);
+        if (result < 0) {
+            int error = lastSocketError();
+            std::cout << "Send failed. Error: " << error << ". Connection may be lost." << std::endl;
+            connected = false;
+            return false;
+        }
+
+        if (verbose) std::cout << "Sent to Pi: " << jsonMessage << std::endl;
+        return true;
+    }
+
+    // Blocks up to the socket receive timeout
+    std::string receiveRaw() {
+        std::string pending = takeMessage();
+        if (!pending.empty()) return pending;
+
+        char buffer[BUFFER_SIZE];
+        int bytesReceived = (int)recv(sock, buffer, BUFFER_SIZE - 1, 0);
+
+        if (bytesReceived > 0) {
+            receiveBuffer.append(buffer, bytesReceived);
+            std::string message = takeMessage();
+            if (verbose && !message.empty()) std::cout << "Received from Pi: " << message << std::endl;
+            return message;
+        }
+        else if (bytesReceived == 0) {
+            std::cout << "Connection closed by Raspberry Pi" << std::endl;
+            connected = false;
+        }
+        else {
+            int error = lastSocketError();
+            if (socketWouldBlock(error)) {
+                // No data available or timeout - not an error
+                return "";
+            }
+            std::cout << "Receive failed. Error: " << error << std::endl;
+            connected = false;
+        }
+        return "";
+    }
+
+    // Send what was queued while offline, oldest first, dropping commands
+    // past their TTL. Holding offlineMutex keeps new submits behind them.
+    void flushOfflineQueue() {
+        std::lock_guard<std::mutex> lock(offlineMutex);
+        auto now = std::chrono::steady_clock::now();
+        while (!offlineQueue.empty()) {
+            if (offlineQueue.front().expires < now) {
+                expiredCommands++;
+            }
+            else if (!sendRaw(offlineQueue.front().json)) {
+                return;     // Lost again; keep the rest for the next connection
+            }
+            offlineQueue.pop_front();
+        }
+    }
+
+    // Random delay in [backoff/2, backoff] so many clients do not retry in step
+    std::chrono::milliseconds jittered(int backoffMs) {
+        std::uniform_int_distribution<int> spread(backoffMs / 2, backoffMs);
+        return std::chrono::milliseconds(spread(jitter));
+    }
+
+    void reconnectLoop() {
+        NetworkChangeWatcher watcher;
+        int backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+
+        while (!reconnectStop) {
+            if (connected) {
+                watcher.changed();
+                std::this_thread::sleep_for(std::chrono::milliseconds(CLIENT_RECONNECT_POLL_MS));
+                continue;
+            }
+
+            if (connectToServer()) {
+                backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+                flushOfflineQueue();
+                continue;
+            }
+
+            // Wait out the backoff unless the network changes or a retry is asked for
+            auto retryAt = std::chrono::steady_clock::now() + jittered(backoffMs);
+            backoffMs = std::min(backoffMs * 2, CLIENT_BACKOFF_MAX_MS);
+            while (!reconnectStop && std::chrono::steady_clock::now() < retryAt) {
+                if (watcher.changed() || reconnectHint.exchange(false)) {
+                    backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(CLIENT_RECONNECT_POLL_MS));
+            }
+        }
+    }
+
+public:
+    DoorClient(const std::string& serverHost, int serverPort, bool verboseOutput = true)
+        : sock(INVALID_SOCKET_HANDLE), host(serverHost), port(serverPort), doorStatus("UNKNOWN"),
+          connected(false), preferBinary(true), binaryEncoding(false), verbose(verboseOutput),
+          receiverStop(false), receiverWanted(false), reconnectStop(false), reconnectHint(false),
+          autoReconnect(false), jitter(std::random_device()()), offlineTTL(30000), expiredCommands(0) {
+        if (!socketStartup()) {
+            std::cout << "Socket library startup failed" << std::endl;
+        }
+
+        server_addr = sockaddr_in();
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr);
+    }
+
+    ~DoorClient() {
+        stopAutoReconnect();
+        stopReceiver();
+        disconnect();
+        socketCleanup();
+    }
+
+    bool connectToServer() {
+        std::lock_guard<std::mutex> connectLock(connectMutex);
+
+        // Close existing socket if open
+        joinReceiver();
+        disconnect();
+
+        // Create new socket
+        SocketHandle newSock = socket(AF_INET, SOCK_STREAM, 0);
+        if (newSock == INVALID_SOCKET_HANDLE) {
+            std::cout << "Socket creation failed. Error: " << lastSocketError() << std::endl;
+            return false;
+        }
+
+        // Set socket options for better reconnection
+        int opt = 1;
+        setsockopt(newSock, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+
+        // Set connection timeout
+        setSocketReceiveTimeout(newSock, 5000);
+        setSocketSendTimeout(newSock, 5000);
+
+        if (verbose) std::cout << "Attempting to connect to " << host << ":" << port << std::endl;
+
+        if (!connectWithTimeout(newSock, server_addr, CLIENT_CONNECT_TIMEOUT_MS)) {
+            // Background retries would flood the console with this
+            if (!autoReconnect) {
+                int error = lastSocketError();
+                std::cout << "Connection to Raspberry Pi failed. Error: " << error << std::endl;
+                std::cout << "Operating in offline mode." << std::endl;
+            }
+            closeSocket(newSock);
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            sock = newSock;
+        }
+        if (verbose) std::cout << "Successfully connected to Raspberry Pi!" << std::endl;
+        negotiateEncoding();
+        connected = true;
+        setDoorStatus("CONNECTED");
+        launchReceiver();
+        return true;
+    }
+
+    // Keep the connection up from a background thread: jittered exponential
+    // backoff between attempts, and an immediate retry when the network
+    // changes or requestReconnect() is called. Commands submitted while
+    // offline are queued and sent on reconnect.
+    void startAutoReconnect() {
+        if (reconnectThread.joinable()) return;
+        autoReconnect = true;
+        reconnectStop = false;
+        reconnectThread = std::thread(&DoorClient::reconnectLoop, this);
+    }
+
+    void stopAutoReconnect() {
+        if (!reconnectThread.joinable()) return;
+        reconnectStop = true;
+        reconnectThread.join();
+        autoReconnect = false;
+    }
+
+    // Skip the rest of the current backoff
+    void requestReconnect() {
+        reconnectHint = true;
+    }
+
+    // Read the socket on a background thread from now on, across reconnects
+    void startReceiver() {
+        receiverWanted = true;
+        std::lock_guard<std::mutex> connectLock(connectMutex);
+        launchReceiver();
+    }
+
+    void stopReceiver() {
+        receiverWanted = false;
+        std::lock_guard<std::mutex> connectLock(connectMutex);
+        joinReceiver();
+        inbox.clear();
+    }
+
+    // Next message from the receiver thread, waiting up to timeout
+    bool waitForMessage(ReceivedMessage& message, std::chrono::milliseconds timeout) {
+        return inbox.waitPop(message, timeout);
+    }
+
+    void disconnect() {
+        connected = false;
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (sock != INVALID_SOCKET_HANDLE) {
+            closeSocket(sock);
+            sock = INVALID_SOCKET_HANDLE;
+        }
+    }
+
+    // UTC, as every timestamp in the protocol (slal_protocol.h)
+    static std::string getCurrentTimestamp() {
+        time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+        struct tm timeinfo;
+#ifdef _WIN32
+        gmtime_s(&timeinfo, &now);
+#else
+        gmtime_r(&now, &timeinfo);
+#endif
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        return buffer;
+    }
+
+    std::string createJSON(Source source, Event event) {
+        return Protocol::toJSON(Protocol::create(source, event, getCurrentTimestamp()));
+    }
+
+    bool sendJSON(const std::string& jsonMessage) {
+        if (!connected) {
+            // With auto-reconnect the background thread owns reconnection
+            if (autoReconnect) return false;
+            std::cout << "Not connected to Raspberry Pi. Attempting to reconnect..." << std::endl;
+            if (!connectToServer()) {
+                return false;
+            }
+        }
+        return sendRaw(jsonMessage);
+    }
+
+    // Send now, or queue for up to the offline TTL while auto-reconnect is
+    // working on the connection
+    SendResult submitJSON(const std::string& jsonMessage) {
+        std::lock_guard<std::mutex> lock(offlineMutex);
+        if (connected && offlineQueue.empty() && sendRaw(jsonMessage)) return SendResult::Sent;
+        if (!autoReconnect) return SendResult::Failed;
+
+        if (offlineQueue.size() >= CLIENT_OFFLINE_QUEUE_MAX) {
+            offlineQueue.pop_front();
+            expiredCommands++;
+        }
+        QueuedCommand command;
+        command.json = jsonMessage;
+        command.expires = std::chrono::steady_clock::now() + offlineTTL;
+        offlineQueue.push_back(command);
+        return SendResult::Queued;
+    }
+
+    // Take one complete message from receiveBuffer as JSON
+    std::string takeMessage() {
+        return takeMessageFrom(receiveBuffer, binaryEncoding);
+    }
+
+    // Blocks up to the socket receive timeout
+    std::string receiveJSON() {
+        if (!connected) return "";
+        return receiveRaw();
+    }
+
+    void processReceivedMessage(const std::string& jsonMessage) {
+        ProtocolMessage msg = Protocol::parseJSON(jsonMessage);
+        std::string status = describeDoorStatus(msg);
+        if (status.empty()) return;
+
+        const char* via = (status == "ERROR") ? " (from " : " (via ";
+        setDoorStatus(status + via + msg.get<Field::Source>() + ")");
+    }
+
+    bool isConnected() const { return connected; }
+    bool usesBinary() const { return binaryEncoding; }
+    const std::string& getHost() const { return host; }
+    int getPort() const { return port; }
+    void setPreferBinary(bool binary) { preferBinary = binary; }
+    void setOfflineTTL(std::chrono::milliseconds ttl) { offlineTTL = ttl; }
+    int getExpiredCount() const { return expiredCommands; }
+
+    size_t getOfflineQueueSize() {
+        std::lock_guard<std::mutex> lock(offlineMutex);
+        return offlineQueue.size();
+    }
+
+    // Door status is written by the reconnect thread as well as the UI
+    std::string getDoorStatus() const {
+        std::lock_guard<std::mutex> lock(statusMutex);
+        return doorStatus;
+    }
+
+    void setDoorStatus(const std::string& status) {
+        std::lock_guard<std::mutex> lock(statusMutex);
+        doorStatus = status;
+    }
+};
+
+#endif // SLAL_CLIENT_H
@@ -0,0 +1,276 @@
+/*
+* Sir Locks-A-Lot - Console screen and keyboard
+*
+* Filename: slal_console.h
+*
+* Description:
+* Terminal output and key input for the operator console on Windows and
+* Linux.
+* - ConsoleScreen: the frame is drawn into an off-screen character grid,
+*   and present() compares it with the last presented frame. Only the
+*   changed runs are sent, using ANSI/VT cursor moves, in a single write.
+*   This replaces clearing the screen and reprinting every character.
+* - ConsoleKeyboard: non-blocking single-key reads (conio on Windows,
+*   termios + poll on Linux).
+*/
+
+#ifndef SLAL_CONSOLE_H
+#define SLAL_CONSOLE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <conio.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+class ConsoleScreen {
+private:
+    // Unchanged gaps shorter than this are resent rather than jumped over,
+    // since a cursor move costs about as many bytes
+    static const int MIN_SKIP = 6;
+
+    int rows;
+    int cols;
+    std::vector<std::string> frame;     // Being drawn
+    std::vector<std::string> shown;     // Last presented
+    bool fullRedraw;
+    int cursorRow;
+    int cursorCol;
+    int shownCursorRow;
+    int shownCursorCol;
+
+    static void moveTo(std::string& out, int row, int col) {
+        out += "\x1b[";
+        out += std::to_string(row + 1);
+        out += ';';
+        out += std::to_string(col + 1);
+        out += 'H';
+    }
+
+public:
+    ConsoleScreen(int screenRows, int screenCols)
+        : rows(screenRows), cols(screenCols), frame(screenRows, std::string(screenCols, ' ')),
+          shown(screenRows, std::string(screenCols, ' ')), fullRedraw(true), cursorRow(0), cursorCol(0),
+          shownCursorRow(-1), shownCursorCol(-1) {
+#ifdef _WIN32
+        // Windows 10 consoles understand VT sequences once this is enabled
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (GetConsoleMode(console, &mode)) {
+            SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
+#endif
+    }
+
+    ~ConsoleScreen() {
+        // Leave the shell prompt below the frame
+        std::string out;
+        moveTo(out, rows, 0);
+        out += "\x1b[?25h";
+        std::cout.write(out.data(), out.size());
+        std::cout.flush();
+    }
+
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
+
+    // Start a new frame
+    void clear() {
+        for (std::string& row : frame) {
+            row.assign(cols, ' ');
+        }
+    }
+
+    // Write text at a position, clipped to the screen
+    void text(int row, int col, const std::string& value) {
+        if (row < 0 || row >= rows || col >= cols) return;
+        for (size_t i = 0; i < value.size() && col + (int)i < cols; i++) {
+            if (col + (int)i >= 0) frame[row][col + i] = value[i];
+        }
+    }
+
+    void fill(int row, int col, int count, char c) {
+        text(row, col, std::string(count > 0 ? count : 0, c));
+    }
+
+    // Full-width "+====+" (fill '=') or "|----|" rule
+    void border(int row, char fill) {
+        const char* edge = (fill == '=') ? "+" : "|";
+        text(row, 0, edge);
+        this->fill(row, 1, cols - 2, fill);
+        text(row, cols - 1, edge);
+    }
+
+    // Text at col on a row framed by '|' at both edges
+    void boxLine(int row, int col, const std::string& value) {
+        text(row, 0, "|");
+        text(row, col, value);
+        text(row, cols - 1, "|");
+    }
+
+    void setCursor(int row, int col) {
+        cursorRow = row;
+        cursorCol = col;
+    }
+
+    // Something else wrote to the terminal; repaint everything next time
+    void invalidate() {
+        fullRedraw = true;
+    }
+
+    // Send the differences to the terminal. Returns the bytes written.
+    size_t present() {
+        if (!fullRedraw && frame == shown && cursorRow == shownCursorRow && cursorCol == shownCursorCol) {
+            return 0;
+        }
+
+        std::string out = "\x1b[?25l";
+        if (fullRedraw) {
+            out += "\x1b[2J";
+        }
+
+        for (int r = 0; r < rows; r++) {
+            const std::string& now = frame[r];
+            const std::string& before = shown[r];
+            int c = 0;
+            while (c < cols) {
+                if (!fullRedraw && now[c] == before[c]) {
+                    c++;
+                    continue;
+                }
+                // Extend the run over changes and short unchanged gaps
+                int start = c;
+                int end = c + 1;
+                int scan = end;
+                while (scan < cols && scan - end < MIN_SKIP) {
+                    if (fullRedraw || now[scan] != before[scan]) end = scan + 1;
+                    scan++;
+                }
+                moveTo(out, r, start);
+                out.append(now, start, end - start);
+                c = end;
+            }
+        }
+
+        moveTo(out, cursorRow, cursorCol);
+        out += "\x1b[?25h";
+        std::cout.write(out.data(), out.size());
+        std::cout.flush();
+
+        shown = frame;
+        shownCursorRow = cursorRow;
+        shownCursorCol = cursorCol;
+        fullRedraw = false;
+        return out.size();
+    }
+};
+
+class ConsoleKeyboard {
+private:
+#ifndef _WIN32
+    struct termios saved;
+    bool restore;
+#endif
+
+public:
+    static const int KEY_NONE = 0;
+    static const int KEY_ENTER = '\n';
+    static const int KEY_BACKSPACE = '\b';
+
+    ConsoleKeyboard() {
+#ifndef _WIN32
+        // Keys arrive one at a time and are not echoed; the screen shows them
+        restore = tcgetattr(STDIN_FILENO, &saved) == 0;
+        if (restore) {
+            struct termios raw = saved;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        }
+#endif
+    }
+
+    ~ConsoleKeyboard() {
+#ifndef _WIN32
+        if (restore) tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+#endif
+    }
+
+    bool keyAvailable() {
+#ifdef _WIN32
+        return _kbhit() != 0;
+#else
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        return poll(&pfd, 1, 0) > 0;
+#endif
+    }
+
+    // Printable characters as themselves, KEY_ENTER, KEY_BACKSPACE, or
+    // KEY_NONE for anything else (arrows, function keys)
+    int readKey() {
+#ifdef _WIN32
+        int key = _getch();
+        if (key == 0 || key == 224) {
+            _getch();   // Arrow and function keys come as two codes
+            return KEY_NONE;
+        }
+        if (key == '\r') return KEY_ENTER;
+#else
+        unsigned char byte = 0;
+        if (read(STDIN_FILENO, &byte, 1) != 1) return KEY_NONE;
+        int key = byte;
+        if (key == 27) {
+            // Drop the rest of an escape sequence
+            while (keyAvailable() && read(STDIN_FILENO, &byte, 1) == 1) {
+                if (byte >= 64 && byte != '[') break;
+            }
+            return KEY_NONE;
+        }
+        if (key == '\r' || key == '\n') return KEY_ENTER;
+        if (key == 127) return KEY_BACKSPACE;
+#endif
+        if (key == '\b') return KEY_BACKSPACE;
+        if (key >= 32 && key < 127) return key;
+        return KEY_NONE;
+    }
+
+    // Apply waiting keys to the line being typed in buffer. Returns true
+    // when Enter completes it, moving the text to line. changed is set if
+    // buffer was edited and needs redrawing.
+    bool editLine(std::string& buffer, std::string& line, bool& changed) {
+        changed = false;
+        while (keyAvailable()) {
+            int key = readKey();
+            if (key == KEY_ENTER) {
+                line = buffer;
+                buffer.clear();
+                return true;
+            }
+            else if (key == KEY_BACKSPACE) {
+                if (!buffer.empty()) buffer.pop_back();
+                changed = true;
+            }
+            else if (key != KEY_NONE) {
+                buffer += (char)key;
+                changed = true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif // SLAL_CONSOLE_H
@@ -0,0 +1,369 @@
+/*
+* Sir Locks-A-Lot - Protocol schema
+*
+* Filename: slal_protocol.h
+*
+* Description:
+* Single definition of the message events, sources and fields shared by the
+* Raspberry Pi server, the Windows client and the STM32 firmware.
+* The lists below are the schema; everything else is generated from them:
+* - C (firmware): SLAL_Event / SLAL_Source / SLAL_Field enums and name lookups
+* - C++: Event / Source / Field enum classes, constexpr name tables, and the
+*   Protocol JSON serializer and parser
+*
+* Adding an event or field means adding one line here. Enum values are part
+* of the binary wire format (slal_wire.h), so only append to the lists.
+*
+* JSON Format:
+* {
+*   "source": "laptop|stm32|raspberry_pi",
+*   "event": "lock|unlock|error|status_request|ack|...",
+*   "door": "...",            (optional)
+*   "priority": "emergency",  (optional)
+*   "timestamp": "YYYY-MM-DD HH:MM:SS", (UTC)
+*   "sent_ms": "...",         (optional, Pi send time in ms since the epoch;
+*                              a time_sync sets the STM32 RTC from it)
+*   "id": "...",              (optional, echoed in the Pi's reply or ack)
+*   "seq": "...",             (optional, Pi event log position of a logged event)
+*   "since": "...",           (optional, history_request: replay events after this seq)
+*   "device_ms": "...",       (optional, STM32 RTC time of the event in ms since the epoch)
+*   "entries": "...",         (optional, journal: "event,door,device_ms;..." oldest first)
+*   "doors": "...",           (optional, subscribe: comma separated door ids)
+*   "events": "...",          (optional, subscribe: comma separated event names)
+*   "sources": "...",         (optional, subscribe: comma separated sources)
+*   "severity": "...",        (optional, subscribe: info|warning|error, the least
+*                              severe event to receive)
+*   "version": "...",         (optional, door state version in status replies; in a
+*                              status_request, the version the client already has)
+*   "wait_ms": "...",         (optional, status_request: how long to wait for a
+*                              newer version before answering)
+*   "count": "...",           (optional, how many of this event the Pi's rate
+*                              limits held back since the last such summary)
+*   "epoch": "...",           (optional, journal: the STM32 journal's epoch, which
+*                              changes whenever its seqs could start again)
+*   "superseded_by": "..."    (optional, in the Pi's ack of a lock or unlock that
+*                              a newer command replaced before it was sent: the
+*                              newer command's id)
+* }
+*/
+
+#ifndef SLAL_PROTOCOL_H
+#define SLAL_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* X(Name, "wire string") */
+#define SLAL_EVENT_LIST(X) \
+    X(Lock,           "lock") \
+    X(Unlock,         "unlock") \
+    X(Error,          "error") \
+    X(StatusRequest,  "status_request") \
+    X(StatusLocked,   "LOCKED") \
+    X(StatusUnlocked, "UNLOCKED") \
+    X(StatusError,    "ERROR") \
+    X(StatusUnknown,  "UNKNOWN") \
+    X(Hello,          "hello") \
+    X(Ack,            "ack") \
+    X(HistoryRequest, "history_request") \
+    X(HistoryEnd,     "history_end") \
+    X(TimeSync,       "time_sync") \
+    X(Journal,        "journal") \
+    X(Subscribe,      "subscribe")
+
+#define SLAL_SOURCE_LIST(X) \
+    X(Laptop,      "laptop") \
+    X(Stm32,       "stm32") \
+    X(RaspberryPi, "raspberry_pi")
+
+/* X(Name, "json key", required). JSON output follows this order. */
+#define SLAL_FIELD_LIST(X) \
+    X(Source,    "source",    1) \
+    X(Event,     "event",     1) \
+    X(Door,      "door",      0) \
+    X(Priority,  "priority",  0) \
+    X(Encodings, "encodings", 0) \
+    X(Encoding,  "encoding",  0) \
+    X(Timestamp, "timestamp", 1) \
+    X(SentMs,    "sent_ms",   0) \
+    X(Id,        "id",        0) \
+    X(Seq,       "seq",       0) \
+    X(Since,     "since",     0) \
+    X(DeviceMs,  "device_ms", 0) \
+    X(Entries,   "entries",   0) \
+    X(Doors,     "doors",     0) \
+    X(Events,    "events",    0) \
+    X(Sources,   "sources",   0) \
+    X(Severity,  "severity",  0) \
+    X(Version,   "version",   0) \
+    X(WaitMs,    "wait_ms",   0) \
+    X(EventCount, "count",    0) \
+    X(Epoch,     "epoch",     0) \
+    X(SupersededBy, "superseded_by", 0)
+
+/* --------------------------------------------------------- Link and wire */
+
+/* Largest payload of one reliable serial link frame, the same on the STM32
+   (slal_link.h) and the Pi (SerialLink). Big enough for a journal batch. */
+#define SLAL_LINK_MAX_PAYLOAD      240U
+
+/* Binary wire format (slal_wire.h; slal_msg.h on the STM32) */
+#define SLAL_WIRE_MAGIC            0xA5U
+#define SLAL_WIRE_VERSION          1U
+#define SLAL_WIRE_HEADER_SIZE      14U
+#define SLAL_WIRE_TLV_EVENT_TEXT   0x01U
+#define SLAL_WIRE_TLV_SOURCE_TEXT  0x02U
+#define SLAL_WIRE_TLV_FIELD_BASE   0x10U
+#define SLAL_WIRE_TLV_MAX_VALUE    255U
+
+/* ---------------------------------------------------------------- C view */
+
+#define SLAL_C_ENUM_EVENT(name, str)      SLAL_EVENT_##name,
+#define SLAL_C_ENUM_SOURCE(name, str)     SLAL_SOURCE_##name,
+#define SLAL_C_ENUM_FIELD(name, key, req) SLAL_FIELD_##name,
+#define SLAL_C_NAME(name, str)            str,
+#define SLAL_C_KEY(name, key, req)        key,
+
+typedef enum { SLAL_EVENT_Other = 0, SLAL_EVENT_LIST(SLAL_C_ENUM_EVENT) SLAL_EVENT_COUNT } SLAL_Event;
+typedef enum { SLAL_SOURCE_Other = 0, SLAL_SOURCE_LIST(SLAL_C_ENUM_SOURCE) SLAL_SOURCE_COUNT } SLAL_Source;
+typedef enum { SLAL_FIELD_LIST(SLAL_C_ENUM_FIELD) SLAL_FIELD_COUNT } SLAL_Field;
+
+static inline const char *SLAL_EventName(SLAL_Event event)
+{
+    static const char *const names[] = { "", SLAL_EVENT_LIST(SLAL_C_NAME) };
+    return ((unsigned)event < SLAL_EVENT_COUNT) ? names[event] : "";
+}
+
+static inline const char *SLAL_SourceName(SLAL_Source source)
+{
+    static const char *const names[] = { "", SLAL_SOURCE_LIST(SLAL_C_NAME) };
+    return ((unsigned)source < SLAL_SOURCE_COUNT) ? names[source] : "";
+}
+
+static inline const char *SLAL_FieldKey(SLAL_Field field)
+{
+    static const char *const keys[] = { SLAL_FIELD_LIST(SLAL_C_KEY) };
+    return ((unsigned)field < SLAL_FIELD_COUNT) ? keys[field] : "";
+}
+
+/* Returns SLAL_EVENT_Other for unknown names; name need not be terminated */
+static inline SLAL_Event SLAL_EventFromName(const char *name, size_t len)
+{
+    unsigned i;
+    for (i = 1U; i < SLAL_EVENT_COUNT; i++)
+    {
+        const char *candidate = SLAL_EventName((SLAL_Event)i);
+        if (strlen(candidate) == len && memcmp(candidate, name, len) == 0) return (SLAL_Event)i;
+    }
+    return SLAL_EVENT_Other;
+}
+
+static inline SLAL_Source SLAL_SourceFromName(const char *name, size_t len)
+{
+    unsigned i;
+    for (i = 1U; i < SLAL_SOURCE_COUNT; i++)
+    {
+        const char *candidate = SLAL_SourceName((SLAL_Source)i);
+        if (strlen(candidate) == len && memcmp(candidate, name, len) == 0) return (SLAL_Source)i;
+    }
+    return SLAL_SOURCE_Other;
+}
+
+/* -------------------------------------------------------------- C++ view */
+
+#ifdef __cplusplus
+
+#include <string>
+#include <cstddef>
+
+#define SLAL_CPP_ENUM(name, ...) name,
+#define SLAL_CPP_EVENT_ENTRY(name, str) {Event::name, str},
+#define SLAL_CPP_SOURCE_ENTRY(name, str) {Source::name, str},
+#define SLAL_CPP_FIELD_ENTRY(name, key, req) {Field::name, key, req != 0},
+
+enum class Event : uint8_t { Other = 0, SLAL_EVENT_LIST(SLAL_CPP_ENUM) Count };
+enum class Source : uint8_t { Other = 0, SLAL_SOURCE_LIST(SLAL_CPP_ENUM) Count };
+enum class Field : uint8_t { SLAL_FIELD_LIST(SLAL_CPP_ENUM) Count };
+
+template <typename E>
+struct EnumEntry {
+    E value;
+    const char* name;
+};
+
+struct FieldEntry {
+    Field field;
+    const char* key;
+    bool required;
+};
+
+constexpr EnumEntry<Event> EVENT_TABLE[] = { {Event::Other, ""}, SLAL_EVENT_LIST(SLAL_CPP_EVENT_ENTRY) };
+constexpr EnumEntry<Source> SOURCE_TABLE[] = { {Source::Other, ""}, SLAL_SOURCE_LIST(SLAL_CPP_SOURCE_ENTRY) };
+constexpr FieldEntry FIELD_TABLE[] = { SLAL_FIELD_LIST(SLAL_CPP_FIELD_ENTRY) };
+
+// Tables are indexed by enum value; check that at compile time
+template <typename E, size_t N>
+constexpr bool tableMatchesEnum(const EnumEntry<E> (&table)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if ((size_t)table[i].value != i) return false;
+    }
+    return N == (size_t)E::Count;
+}
+
+constexpr bool fieldTableMatchesEnum() {
+    for (size_t i = 0; i < sizeof(FIELD_TABLE) / sizeof(FIELD_TABLE[0]); i++) {
+        if ((size_t)FIELD_TABLE[i].field != i) return false;
+    }
+    return sizeof(FIELD_TABLE) / sizeof(FIELD_TABLE[0]) == (size_t)Field::Count;
+}
+
+static_assert(tableMatchesEnum(EVENT_TABLE), "EVENT_TABLE out of sync with Event");
+static_assert(tableMatchesEnum(SOURCE_TABLE), "SOURCE_TABLE out of sync with Source");
+static_assert(fieldTableMatchesEnum(), "FIELD_TABLE out of sync with Field");
+static_assert((int)Event::Count == SLAL_EVENT_COUNT && (int)Source::Count == SLAL_SOURCE_COUNT,
+              "C and C++ enums differ");
+
+constexpr const char* eventName(Event event) {
+    return (size_t)event < (size_t)Event::Count ? EVENT_TABLE[(size_t)event].name : "";
+}
+
+constexpr const char* sourceName(Source source) {
+    return (size_t)source < (size_t)Source::Count ? SOURCE_TABLE[(size_t)source].name : "";
+}
+
+template <Field F>
+constexpr const char* fieldKey() {
+    return FIELD_TABLE[(size_t)F].key;
+}
+
+// One message with its fields addressed by Field, so a misspelt field name
+// is a compile error rather than a silently empty lookup
+struct ProtocolMessage {
+    std::string values[(size_t)Field::Count];
+
+    template <Field F>
+    const std::string& get() const { return values[(size_t)F]; }
+
+    template <Field F>
+    ProtocolMessage& set(const std::string& value) {
+        values[(size_t)F] = value;
+        return *this;
+    }
+
+    Event event() const { return parseEvent(get<Field::Event>()); }
+    Source source() const { return parseSource(get<Field::Source>()); }
+
+    static Event parseEvent(const std::string& name) {
+        for (size_t i = 1; i < (size_t)Event::Count; i++) {
+            if (name == EVENT_TABLE[i].name) return (Event)i;
+        }
+        return Event::Other;
+    }
+
+    static Source parseSource(const std::string& name) {
+        for (size_t i = 1; i < (size_t)Source::Count; i++) {
+            if (name == SOURCE_TABLE[i].name) return (Source)i;
+        }
+        return Source::Other;
+    }
+};
+
+class Protocol {
+private:
+    static int fieldIndex(const char* key, size_t len) {
+        for (size_t i = 0; i < (size_t)Field::Count; i++) {
+            if (strlen(FIELD_TABLE[i].key) == len && memcmp(FIELD_TABLE[i].key, key, len) == 0) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+public:
+    static ProtocolMessage create(Source source, Event event, const std::string& timestamp) {
+        ProtocolMessage msg;
+        msg.set<Field::Source>(sourceName(source))
+           .set<Field::Event>(eventName(event))
+           .set<Field::Timestamp>(timestamp);
+        return msg;
+    }
+
+    // Fields in schema order; optional fields only when set
+    static std::string toJSON(const ProtocolMessage& msg) {
+        std::string json = "{";
+        for (const FieldEntry& entry : FIELD_TABLE) {
+            const std::string& value = msg.values[(size_t)entry.field];
+            if (value.empty() && !entry.required) continue;
+            if (json.size() > 1) json += ",";
+            json += "\"";
+            json += entry.key;
+            json += "\":\"";
+            json += value;
+            json += "\"";
+        }
+        json += "}";
+        return json;
+    }
+
+    // Single pass over the flat "key":"value" pairs; unknown keys are ignored
+    static ProtocolMessage parseJSON(const std::string& json) {
+        ProtocolMessage msg;
+        size_t pos = 0;
+        while (true) {
+            size_t keyStart = json.find('"', pos);
+            if (keyStart == std::string::npos) break;
+            size_t keyEnd = json.find('"', keyStart + 1);
+            if (keyEnd == std::string::npos) break;
+            if (json.compare(keyEnd + 1, 2, ":\"") != 0) {
+                pos = keyEnd + 1;
+                continue;
+            }
+            size_t valueStart = keyEnd + 3;
+            size_t valueEnd = json.find('"', valueStart);
+            if (valueEnd == std::string::npos) break;
+
+            int index = fieldIndex(json.data() + keyStart + 1, keyEnd - keyStart - 1);
+            if (index >= 0) {
+                msg.values[index] = json.substr(valueStart, valueEnd - valueStart);
+            }
+            pos = valueEnd + 1;
+        }
+        return msg;
+    }
+
+    // Remove and return the first complete {...} object from a byte stream,
+    // or "" if none has fully arrived. TCP may deliver several messages in
+    // one read or split one across reads. Bytes before a '{' are dropped.
+    static std::string takeJSON(std::string& buffer) {
+        size_t start = buffer.find('{');
+        if (start == std::string::npos) {
+            buffer.clear();
+            return "";
+        }
+        bool quoted = false;
+        for (size_t i = start + 1; i < buffer.size(); i++) {
+            if (buffer[i] == '"') {
+                quoted = !quoted;
+            }
+            else if (buffer[i] == '}' && !quoted) {
+                std::string message = buffer.substr(start, i - start + 1);
+                buffer.erase(0, i + 1);
+                return message;
+            }
+        }
+        buffer.erase(0, start);
+        return "";
+    }
+
+    // True when every required field is present
+    static bool isComplete(const ProtocolMessage& msg) {
+        for (const FieldEntry& entry : FIELD_TABLE) {
+            if (entry.required && msg.values[(size_t)entry.field].empty()) return false;
+        }
+        return true;
+    }
+};
+
+#endif /* __cplusplus */
+
+#endif /* SLAL_PROTOCOL_H */
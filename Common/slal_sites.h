@@ -0,0 +1,354 @@
+/*
+* Sir Locks-A-Lot - Multi-site monitor
+*
+* Filename: slal_sites.h
+*
+* Description:
+* Keeps a connection to each of several Raspberry Pi servers (one per
+* building) from a single thread. Every socket is non-blocking and
+* multiplexed with select(), so a site that is slow to connect, or dead,
+* never holds up the others. Messages from all sites go into one queue,
+* tagged with the index of the site they came from.
+*
+* Each site goes Offline -> Connecting -> Negotiating -> Online. Negotiation
+* is the same hello exchange DoorClient does. Anything sent while it is in
+* progress is held and goes out in the agreed encoding. Failed sites are
+* retried with the client's jittered exponential backoff, or at once when
+* the network changes.
+*/
+
+#ifndef SLAL_SITES_H
+#define SLAL_SITES_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include "slal_client.h"
+
+struct SiteAddress {
+    std::string name;
+    std::string host;
+    int port;
+};
+
+// "name=host[:port]" or "host[:port]"; the name defaults to the host
+inline bool parseSiteAddress(const std::string& text, int defaultPort, SiteAddress& site) {
+    std::string rest = text;
+    size_t equals = rest.find('=');
+    if (equals != std::string::npos) {
+        site.name = rest.substr(0, equals);
+        rest = rest.substr(equals + 1);
+    }
+    size_t colon = rest.find(':');
+    site.host = rest.substr(0, colon);
+    site.port = (colon == std::string::npos) ? defaultPort : std::atoi(rest.c_str() + colon + 1);
+    if (equals == std::string::npos) site.name = site.host;
+    return !site.host.empty() && !site.name.empty() && site.port > 0;
+}
+
+enum class SiteState { Offline, Connecting, Negotiating, Online };
+
+const int SITE_SELECT_WAIT_MS = 50;          // Longest a new deadline can go unnoticed
+const int SITE_NEGOTIATE_TIMEOUT_MS = 1000;
+
+class SiteMonitor {
+private:
+    struct Site {
+        SiteAddress address;
+        struct sockaddr_in addr;
+        SocketHandle sock;
+        SiteState state;
+        std::chrono::steady_clock::time_point deadline;     // Connect, negotiate or retry
+        int backoffMs;
+        bool binary;
+        std::string rx;                     // Partial incoming messages
+        std::string tx;                     // Encoded bytes the socket has not taken yet
+        std::vector<std::string> held;      // JSON waiting for negotiation to finish
+    };
+
+    std::vector<Site> sites;
+    std::mutex mutex;           // Guards sites; not held across select()
+    std::thread worker;
+    std::atomic<bool> stopRequested;
+    MessageQueue inbox;
+    bool preferBinary;
+    std::mt19937 jitter;
+
+    void closeSite(Site& site) {
+        if (site.sock != INVALID_SOCKET_HANDLE) {
+            closeSocket(site.sock);
+            site.sock = INVALID_SOCKET_HANDLE;
+        }
+        site.rx.clear();
+        site.tx.clear();
+        site.held.clear();
+    }
+
+    void scheduleRetry(Site& site, std::chrono::steady_clock::time_point now) {
+        closeSite(site);
+        site.state = SiteState::Offline;
+        std::uniform_int_distribution<int> spread(site.backoffMs / 2, site.backoffMs);
+        site.deadline = now + std::chrono::milliseconds(spread(jitter));
+        site.backoffMs = std::min(site.backoffMs * 2, CLIENT_BACKOFF_MAX_MS);
+    }
+
+    void beginConnect(Site& site, std::chrono::steady_clock::time_point now) {
+        site.sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (site.sock == INVALID_SOCKET_HANDLE) {
+            scheduleRetry(site, now);
+            return;
+        }
+        setSocketNonBlocking(site.sock, true);
+        if (connect(site.sock, (struct sockaddr*)&site.addr, sizeof(site.addr)) == 0) {
+            beginNegotiation(site, now);
+            return;
+        }
+        int error = lastSocketError();
+#ifdef _WIN32
+        bool pending = error == WSAEWOULDBLOCK;
+#else
+        bool pending = error == EINPROGRESS;
+#endif
+        if (!pending) {
+            scheduleRetry(site, now);
+            return;
+        }
+        site.state = SiteState::Connecting;
+        site.deadline = now + std::chrono::milliseconds(CLIENT_CONNECT_TIMEOUT_MS);
+    }
+
+    void beginNegotiation(Site& site, std::chrono::steady_clock::time_point now) {
+        site.backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+        site.binary = false;
+        if (!preferBinary) {
+            site.state = SiteState::Online;
+            return;
+        }
+        ProtocolMessage hello = Protocol::create(Source::Laptop, Event::Hello, DoorClient::getCurrentTimestamp());
+        hello.set<Field::Encodings>("binary,json");
+        site.tx += Protocol::toJSON(hello);
+        site.state = SiteState::Negotiating;
+        site.deadline = now + std::chrono::milliseconds(SITE_NEGOTIATE_TIMEOUT_MS);
+    }
+
+    void finishNegotiation(Site& site, bool binary) {
+        site.binary = binary;
+        site.state = SiteState::Online;
+        for (const std::string& json : site.held) {
+            site.tx += encode(site, json);
+        }
+        site.held.clear();
+    }
+
+    // Empty, so nothing is sent, if the message cannot be encoded
+    static std::string encode(const Site& site, const std::string& json) {
+        return site.binary ? WireCodec::encode(Protocol::parseJSON(json)) : json;
+    }
+
+    // Push as much of tx as the socket takes; false if the connection failed
+    static bool flush(Site& site) {
+        while (!site.tx.empty()) {
+            int sent = (int)::send(site.sock, site.tx.data(), (int)site.tx.size(), 0);
+            if (sent < 0) {
+                return socketWouldBlock(lastSocketError());
+            }
+            site.tx.erase(0, sent);
+        }
+        return true;
+    }
+
+    // Read what is available; false if the connection closed or failed
+    bool receive(size_t index, Site& site) {
+        char buffer[1024];
+        int received = (int)::recv(site.sock, buffer, sizeof(buffer), 0);
+        if (received == 0) return false;
+        if (received < 0) return socketWouldBlock(lastSocketError());
+
+        site.rx.append(buffer, received);
+        std::string json;
+        while (!(json = takeMessageFrom(site.rx, site.binary)).empty()) {
+            if (site.state == SiteState::Negotiating) {
+                ProtocolMessage msg = Protocol::parseJSON(json);
+                if (msg.event() == Event::Hello) {
+                    finishNegotiation(site, msg.get<Field::Encoding>() == "binary");
+                    continue;
+                }
+            }
+            inbox.push(makeReceivedMessage(json, index));
+        }
+        return true;
+    }
+
+    void run() {
+        NetworkChangeWatcher watcher;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!stopRequested) {
+            auto now = std::chrono::steady_clock::now();
+            bool networkChanged = watcher.changed();
+
+            fd_set readable, writable, failed;
+            FD_ZERO(&readable);
+            FD_ZERO(&writable);
+            FD_ZERO(&failed);
+            SocketHandle highest = 0;
+            int watched = 0;
+            auto wake = now + std::chrono::milliseconds(SITE_SELECT_WAIT_MS);
+
+            for (Site& site : sites) {
+                if (site.state == SiteState::Offline && (networkChanged || now >= site.deadline)) {
+                    if (networkChanged) site.backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+                    beginConnect(site, now);
+                }
+                else if (site.state != SiteState::Offline && site.state != SiteState::Online && now >= site.deadline) {
+                    if (site.state == SiteState::Connecting) {
+                        scheduleRetry(site, now);
+                    }
+                    else {
+                        finishNegotiation(site, false);     // Older server: no hello reply
+                    }
+                }
+
+                if (site.state == SiteState::Offline) {
+                    wake = std::min(wake, site.deadline);
+                    continue;
+                }
+                if (site.state != SiteState::Online) {
+                    wake = std::min(wake, site.deadline);
+                }
+                if (site.state == SiteState::Connecting) {
+                    FD_SET(site.sock, &writable);
+                    FD_SET(site.sock, &failed);
+                }
+                else {
+                    FD_SET(site.sock, &readable);
+                    if (!site.tx.empty()) FD_SET(site.sock, &writable);
+                }
+                highest = std::max(highest, site.sock);
+                watched++;
+            }
+
+            long waitMs = (long)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = std::max(0L, waitMs) * 1000;
+
+            // Sends from other threads may run while this thread waits.
+            // Winsock rejects select() with no sockets, so sleep instead.
+            lock.unlock();
+            if (watched > 0) {
+                select((int)highest + 1, &readable, &writable, &failed, &timeout);
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::max(1L, waitMs)));
+            }
+            lock.lock();
+
+            now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < sites.size(); i++) {
+                Site& site = sites[i];
+                if (site.sock == INVALID_SOCKET_HANDLE) continue;
+
+                if (site.state == SiteState::Connecting) {
+                    if (!FD_ISSET(site.sock, &writable) && !FD_ISSET(site.sock, &failed)) continue;
+                    int soError = 0;
+                    socklen_t length = sizeof(soError);
+                    getsockopt(site.sock, SOL_SOCKET, SO_ERROR, (char*)&soError, &length);
+                    if (soError != 0 || FD_ISSET(site.sock, &failed)) {
+                        scheduleRetry(site, now);
+                    }
+                    else {
+                        beginNegotiation(site, now);
+                    }
+                    continue;
+                }
+
+                bool ok = true;
+                if (FD_ISSET(site.sock, &readable)) ok = receive(i, site);
+                if (ok && (FD_ISSET(site.sock, &writable) || !site.tx.empty())) ok = flush(site);
+                if (!ok) scheduleRetry(site, now);
+            }
+        }
+
+        for (Site& site : sites) {
+            closeSite(site);
+            site.state = SiteState::Offline;
+        }
+    }
+
+public:
+    SiteMonitor(const std::vector<SiteAddress>& addresses, bool binary = true)
+        : stopRequested(false), preferBinary(binary), jitter(std::random_device()()) {
+        socketStartup();
+        for (const SiteAddress& address : addresses) {
+            Site site;
+            site.address = address;
+            site.addr = sockaddr_in();
+            site.addr.sin_family = AF_INET;
+            site.addr.sin_port = htons(address.port);
+            inet_pton(AF_INET, address.host.c_str(), &site.addr.sin_addr);
+            site.sock = INVALID_SOCKET_HANDLE;
+            site.state = SiteState::Offline;
+            site.deadline = std::chrono::steady_clock::now();
+            site.backoffMs = CLIENT_BACKOFF_INITIAL_MS;
+            site.binary = false;
+            sites.push_back(site);
+        }
+    }
+
+    ~SiteMonitor() {
+        stop();
+        socketCleanup();
+    }
+
+    void start() {
+        if (worker.joinable()) return;
+        stopRequested = false;
+        worker = std::thread(&SiteMonitor::run, this);
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        stopRequested = true;
+        worker.join();
+    }
+
+    // Queue a message for one site. False if the site is not connected.
+    bool send(size_t index, const std::string& json) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index >= sites.size()) return false;
+        Site& site = sites[index];
+        switch (site.state) {
+        case SiteState::Online:
+            site.tx += encode(site, json);
+            if (!flush(site)) {
+                site.tx.clear();    // The worker notices the failure on its next read
+                return false;
+            }
+            return true;
+        case SiteState::Negotiating:
+            site.held.push_back(json);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool waitForMessage(ReceivedMessage& message, std::chrono::milliseconds timeout) {
+        return inbox.waitPop(message, timeout);
+    }
+
+    size_t siteCount() const { return sites.size(); }
+    const SiteAddress& address(size_t index) const { return sites[index].address; }
+
+    SiteState state(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sites[index].state;
+    }
+};
+
+#endif // SLAL_SITES_H
@@ -0,0 +1,223 @@
+/*
+* Sir Locks-A-Lot - Socket portability layer
+*
+* Filename: slal_socket.h
+*
+* Description:
+* The few socket calls that differ between Winsock and BSD sockets, so the
+* client code in slal_client.h builds on both Windows and Linux.
+*/
+
+#ifndef SLAL_SOCKET_H
+#define SLAL_SOCKET_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "iphlpapi.lib")
+
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+// Winsock needs per-process setup; these are reference counted there and
+// no-ops elsewhere
+inline bool socketStartup() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    return true;
+#endif
+}
+
+inline void socketCleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+inline void closeSocket(SocketHandle sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+inline int lastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// No data yet on a non-blocking socket, or a receive timeout expired
+inline bool socketWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK || error == WSAETIMEDOUT;
+#else
+    return error == EAGAIN || error == EWOULDBLOCK || error == ETIMEDOUT;
+#endif
+}
+
+inline void setSocketNonBlocking(SocketHandle sock, bool nonBlocking) {
+#ifdef _WIN32
+    u_long mode = nonBlocking ? 1 : 0;
+    ioctlsocket(sock, FIONBIO, &mode);
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
+}
+
+inline void setSocketReceiveTimeout(SocketHandle sock, int milliseconds) {
+#ifdef _WIN32
+    DWORD timeout = milliseconds;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+#else
+    struct timeval timeout;
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+inline void setSocketSendTimeout(SocketHandle sock, int milliseconds) {
+#ifdef _WIN32
+    DWORD timeout = milliseconds;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+#else
+    struct timeval timeout;
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+// Connect without blocking for longer than timeoutMs. The socket is left in
+// blocking mode either way.
+inline bool connectWithTimeout(SocketHandle sock, const struct sockaddr_in& addr, int timeoutMs) {
+    setSocketNonBlocking(sock, true);
+    int result = connect(sock, (const struct sockaddr*)&addr, sizeof(addr));
+    if (result != 0) {
+        int error = lastSocketError();
+#ifdef _WIN32
+        bool pending = error == WSAEWOULDBLOCK;
+#else
+        bool pending = error == EINPROGRESS;
+#endif
+        if (!pending) {
+            setSocketNonBlocking(sock, false);
+            return false;
+        }
+
+        fd_set writable, failed;
+        FD_ZERO(&writable);
+        FD_ZERO(&failed);
+        FD_SET(sock, &writable);
+        FD_SET(sock, &failed);
+        struct timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        // Winsock reports a refused connect in the except set
+        if (select((int)sock + 1, NULL, &writable, &failed, &timeout) <= 0 || !FD_ISSET(sock, &writable)) {
+            setSocketNonBlocking(sock, false);
+            return false;
+        }
+
+        int soError = 0;
+        socklen_t length = sizeof(soError);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&soError, &length);
+        if (soError != 0) {
+            setSocketNonBlocking(sock, false);
+            return false;
+        }
+    }
+    setSocketNonBlocking(sock, false);
+    return true;
+}
+
+// Reports when the host's network addresses or links change, as a hint that
+// a failed connection is worth retrying now rather than after the backoff
+class NetworkChangeWatcher {
+private:
+#ifdef _WIN32
+    HANDLE handle;
+    OVERLAPPED overlapped;
+
+    void arm() {
+        handle = NULL;
+        NotifyAddrChange(&handle, &overlapped);
+    }
+#else
+    int fd;
+#endif
+
+public:
+    NetworkChangeWatcher() {
+#ifdef _WIN32
+        overlapped = OVERLAPPED();
+        overlapped.hEvent = WSACreateEvent();
+        arm();
+#else
+        fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+        if (fd >= 0) {
+            struct sockaddr_nl local = sockaddr_nl();
+            local.nl_family = AF_NETLINK;
+            local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+            if (bind(fd, (struct sockaddr*)&local, sizeof(local)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+    }
+
+    ~NetworkChangeWatcher() {
+#ifdef _WIN32
+        CancelIPChangeNotify(&overlapped);
+        WSACloseEvent(overlapped.hEvent);
+#else
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    // Non-blocking; true if anything changed since the last call
+    bool changed() {
+#ifdef _WIN32
+        if (WaitForSingleObject(overlapped.hEvent, 0) != WAIT_OBJECT_0) return false;
+        WSAResetEvent(overlapped.hEvent);
+        arm();
+        return true;
+#else
+        if (fd < 0) return false;
+        bool any = false;
+        char buffer[4096];
+        while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+            any = true;
+        }
+        return any;
+#endif
+    }
+};
+
+#endif // SLAL_SOCKET_H
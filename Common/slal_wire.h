@@ -0,0 +1,175 @@
+/*
+* Sir Locks-A-Lot - Compact binary wire format
+*
+* Filename: slal_wire.h
+*
+* Description:
+* Binary alternative to the JSON messages exchanged between the laptop,
+* the Raspberry Pi and the STM32. Clients negotiate it at connect time;
+* JSON stays the fallback.
+*
+* Layout (little endian):
+*   0   magic      0xA5
+*   1   version    1
+*   2   event      Event (slal_protocol.h)
+*   3   source     Source (slal_protocol.h)
+*   4   timestamp  int64, milliseconds since the Unix epoch
+*   12  tlv_len    uint16, total size of the TLV fields that follow
+*   14  TLVs       type(1) length(1) value(length)
+*
+* Optional schema fields are sent as TLV type WIRE_TLV_FIELD_BASE + Field.
+* A TLV value is at most 255 bytes; a message with a longer value cannot be
+* encoded.
+* Events and sources without an enum value are sent as Other with their
+* text in a WIRE_TLV_EVENT_TEXT / WIRE_TLV_SOURCE_TEXT field.
+*/
+
+#ifndef SLAL_WIRE_H
+#define SLAL_WIRE_H
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include "slal_protocol.h"
+
+const uint8_t WIRE_MAGIC = SLAL_WIRE_MAGIC;
+const uint8_t WIRE_VERSION = SLAL_WIRE_VERSION;
+const size_t WIRE_HEADER_SIZE = SLAL_WIRE_HEADER_SIZE;
+
+const uint8_t WIRE_TLV_EVENT_TEXT = SLAL_WIRE_TLV_EVENT_TEXT;
+const uint8_t WIRE_TLV_SOURCE_TEXT = SLAL_WIRE_TLV_SOURCE_TEXT;
+const uint8_t WIRE_TLV_FIELD_BASE = SLAL_WIRE_TLV_FIELD_BASE;
+
+class WireCodec {
+private:
+    static bool putTLV(std::string& out, uint8_t type, const std::string& value) {
+        if (value.empty()) return true;
+        if (value.size() > SLAL_WIRE_TLV_MAX_VALUE) return false;
+        out.push_back((char)type);
+        out.push_back((char)value.size());
+        out += value;
+        return true;
+    }
+
+public:
+    // "YYYY-MM-DD HH:MM:SS" (UTC, as the STM32 stamps it) <-> milliseconds
+    // since the epoch. timegm/gmtime dominate the codec cost, and consecutive
+    // messages usually share a timestamp, so the last conversion is cached.
+    static int64_t timestampToEpochMs(const std::string& timestamp) {
+        thread_local std::string cached_timestamp;
+        thread_local int64_t cached_epoch_ms = 0;
+        if (timestamp == cached_timestamp) return cached_epoch_ms;
+
+        struct tm timeinfo = {};
+        if (sscanf(timestamp.c_str(), "%d-%d-%d %d:%d:%d", &timeinfo.tm_year, &timeinfo.tm_mon,
+                   &timeinfo.tm_mday, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec) != 6) {
+            return 0;
+        }
+        timeinfo.tm_year -= 1900;
+        timeinfo.tm_mon -= 1;
+        cached_timestamp = timestamp;
+#ifdef _WIN32
+        cached_epoch_ms = (int64_t)_mkgmtime(&timeinfo) * 1000;
+#else
+        cached_epoch_ms = (int64_t)timegm(&timeinfo) * 1000;
+#endif
+        return cached_epoch_ms;
+    }
+
+    static std::string epochMsToTimestamp(int64_t epoch_ms) {
+        thread_local time_t cached_seconds = -1;
+        thread_local std::string cached_timestamp;
+        time_t seconds = (time_t)(epoch_ms / 1000);
+        if (seconds == cached_seconds) return cached_timestamp;
+
+        struct tm timeinfo;
+#ifdef _WIN32
+        gmtime_s(&timeinfo, &seconds);
+#else
+        gmtime_r(&seconds, &timeinfo);
+#endif
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        cached_seconds = seconds;
+        cached_timestamp = buffer;
+        return cached_timestamp;
+    }
+
+    // Returns an empty string if a value is too long for its TLV
+    static std::string encode(const ProtocolMessage& msg) {
+        Event event = msg.event();
+        Source source = msg.source();
+
+        std::string tlv;
+        for (const FieldEntry& entry : FIELD_TABLE) {
+            if (!entry.required &&
+                !putTLV(tlv, (uint8_t)(WIRE_TLV_FIELD_BASE + (uint8_t)entry.field), msg.values[(size_t)entry.field])) {
+                return std::string();
+            }
+        }
+        if ((event == Event::Other && !putTLV(tlv, WIRE_TLV_EVENT_TEXT, msg.get<Field::Event>())) ||
+            (source == Source::Other && !putTLV(tlv, WIRE_TLV_SOURCE_TEXT, msg.get<Field::Source>()))) {
+            return std::string();
+        }
+
+        std::string out;
+        out.reserve(WIRE_HEADER_SIZE + tlv.size());
+        out.push_back((char)WIRE_MAGIC);
+        out.push_back((char)WIRE_VERSION);
+        out.push_back((char)event);
+        out.push_back((char)source);
+        uint64_t ts = (uint64_t)timestampToEpochMs(msg.get<Field::Timestamp>());
+        for (int i = 0; i < 8; i++) {
+            out.push_back((char)((ts >> (8 * i)) & 0xFF));
+        }
+        out.push_back((char)(tlv.size() & 0xFF));
+        out.push_back((char)(tlv.size() >> 8));
+        out += tlv;
+        return out;
+    }
+
+    // Decode one message from the front of data. Returns the number of bytes
+    // consumed, 0 if more data is needed, or -1 if the data is not a valid
+    // binary message.
+    static long decode(const char* data, size_t len, ProtocolMessage& msg) {
+        if (len < WIRE_HEADER_SIZE) return 0;
+        const uint8_t* p = (const uint8_t*)data;
+        if (p[0] != WIRE_MAGIC || p[1] != WIRE_VERSION) return -1;
+
+        size_t tlv_len = p[12] | ((size_t)p[13] << 8);
+        if (len < WIRE_HEADER_SIZE + tlv_len) return 0;
+
+        msg = ProtocolMessage();
+        msg.set<Field::Event>(eventName((Event)p[2]));
+        msg.set<Field::Source>(sourceName((Source)p[3]));
+        uint64_t ts = 0;
+        for (int i = 0; i < 8; i++) {
+            ts |= (uint64_t)p[4 + i] << (8 * i);
+        }
+        msg.set<Field::Timestamp>(epochMsToTimestamp((int64_t)ts));
+
+        size_t pos = WIRE_HEADER_SIZE;
+        size_t end = WIRE_HEADER_SIZE + tlv_len;
+        while (pos + 2 <= end) {
+            uint8_t type = p[pos];
+            uint8_t field_len = p[pos + 1];
+            pos += 2;
+            if (pos + field_len > end) return -1;
+            std::string value(data + pos, field_len);
+            pos += field_len;
+
+            if (type == WIRE_TLV_EVENT_TEXT) {
+                msg.set<Field::Event>(value);
+            } else if (type == WIRE_TLV_SOURCE_TEXT) {
+                msg.set<Field::Source>(value);
+            } else if (type >= WIRE_TLV_FIELD_BASE && type < WIRE_TLV_FIELD_BASE + (uint8_t)Field::Count) {
+                msg.values[type - WIRE_TLV_FIELD_BASE] = value;
+            }
+            // Unknown fields are skipped
+        }
+        return (long)end;
+    }
+};
+
+#endif // SLAL_WIRE_H
@@ -0,0 +1,160 @@
+/*
+* Sir Locks-A-Lot - Headless Linux Client
+*
+* Filename: SLAL-headless.cpp
+*
+* Description:
+* Runs many door clients without a user interface against the Raspberry Pi
+* server, for load and latency testing from Linux hosts. Each client
+* connects, then sends status requests back to back and times each reply.
+* Lock/unlock traffic is only sent when --commands is given, because it
+* moves real doors.
+*
+* Compilation:
+* g++ -std=c++17 -O2 -o SLAL-headless SLAL-headless.cpp -lpthread
+*
+* Usage:
+* ./SLAL-headless [--host <ip>] [--port <n>] [--clients <n>] [--requests <n>]
+*                 [--commands] [--json]
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+#include "../Common/slal_client.h"
+
+using namespace std;
+
+struct DriverConfig {
+    string host;
+    int port;
+    int clients;
+    int requests;
+    bool commands;
+    bool binary;
+
+    DriverConfig() : host("10.0.0.8"), port(8080), clients(1), requests(100), commands(false), binary(true) {}
+};
+
+class HeadlessDriver {
+private:
+    DriverConfig config;
+    mutex results_mutex;
+    LatencyRecorder latencies;
+    int failed_connects;
+    int timeouts;
+
+    static bool isStatusReply(const string& json) {
+        switch (Protocol::parseJSON(json).event()) {
+        case Event::StatusLocked:
+        case Event::StatusUnlocked:
+        case Event::StatusError:
+        case Event::StatusUnknown:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void runClient(int id) {
+        DoorClient client(config.host, config.port, false);
+        client.setPreferBinary(config.binary);
+        if (!client.connectToServer()) {
+            lock_guard<mutex> lock(results_mutex);
+            failed_connects++;
+            return;
+        }
+
+        LatencyRecorder local_latencies;
+        int local_timeouts = 0;
+        for (int i = 0; i < config.requests && client.isConnected(); i++) {
+            if (config.commands) {
+                Event command = ((i + id) % 2 == 0) ? Event::Lock : Event::Unlock;
+                client.sendJSON(client.createJSON(Source::Laptop, command));
+            }
+
+            auto start = chrono::steady_clock::now();
+            if (!client.sendJSON(client.createJSON(Source::Laptop, Event::StatusRequest))) break;
+
+            // Skip forwarded STM32 traffic until the server's status reply arrives
+            bool answered = false;
+            while (client.isConnected() && chrono::steady_clock::now() - start < chrono::seconds(5)) {
+                string reply = client.receiveJSON();
+                if (!reply.empty() && isStatusReply(reply)) {
+                    answered = true;
+                    break;
+                }
+            }
+            if (answered) {
+                local_latencies.add(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            } else {
+                local_timeouts++;
+            }
+        }
+
+        lock_guard<mutex> lock(results_mutex);
+        latencies.merge(local_latencies);
+        timeouts += local_timeouts;
+    }
+
+public:
+    HeadlessDriver(const DriverConfig& driverConfig) : config(driverConfig), failed_connects(0), timeouts(0) {}
+
+    void run() {
+        cout << "Starting " << config.clients << " client(s) against " << config.host << ":" << config.port
+             << ", " << config.requests << " request(s) each" << endl;
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int i = 0; i < config.clients; i++) {
+            threads.emplace_back(&HeadlessDriver::runClient, this, i);
+        }
+        for (thread& t : threads) {
+            t.join();
+        }
+        double elapsed_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << fixed << setprecision(2);
+        cout << "Replies: " << latencies.count() << ", timeouts: " << timeouts
+             << ", failed connects: " << failed_connects << endl;
+        cout << "Elapsed: " << elapsed_s << " s, throughput: "
+             << (elapsed_s > 0 ? latencies.count() / elapsed_s : 0.0) << " replies/s" << endl;
+        latencies.print(cout);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    DriverConfig config;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            config.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            config.port = atoi(argv[++i]);
+        } else if (arg == "--clients" && i + 1 < argc) {
+            config.clients = max(1, atoi(argv[++i]));
+        } else if (arg == "--requests" && i + 1 < argc) {
+            config.requests = max(1, atoi(argv[++i]));
+        } else if (arg == "--commands") {
+            config.commands = true;
+        } else if (arg == "--json") {
+            config.binary = false;
+        } else {
+            cerr << "Unknown option: " << arg << endl;
+            cerr << "Usage: " << argv[0] << " [--host <ip>] [--port <n>] [--clients <n>] [--requests <n>]"
+                 << " [--commands] [--json]" << endl;
+            return 1;
+        }
+    }
+
+    HeadlessDriver driver(config);
+    driver.run();
+
+    return 0;
+}
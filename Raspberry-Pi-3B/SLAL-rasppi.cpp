@@ -12,9 +12,107 @@
 * Compilation:
 * sudo apt-get install libsqlite3-dev libserialport-dev
 * g++ -o door_server door_server.cpp -lsqlite3 -lserialport -lpthread
+* Add -DSLAL_LOG_MIN_LEVEL=1 to compile out the per-message debug diagnostics.
 *
 * Usage:
-* ./door_server
+* ./door_server [--coalesce-window <ms>] [--aging-interval <ms>]
+*               [--reliable-link] [--link-rto <ms>] [--link-error-rate <p>]
+*               [--serial-binary] [--time-sync-interval <s>]
+*               [--serial-port <path>] [--source-rate <n>[:<burst>]]
+*               [--door-rate <n>[:<burst>]] [--client-rate <n>[:<burst>]]
+*               [--rate-summary-interval <s>] [--log-level <level>]
+* ./door_server --codec-benchmark
+* ./door_server --registry-benchmark
+* ./door_server --diagnostics-benchmark
+*
+* Options:
+* --coalesce-window <ms>  Window in which redundant commands to the STM32 are
+*                         collapsed before being sent (default 50, 0 disables)
+* --aging-interval <ms>   Head start each serial priority class has over the
+*                         next lower one (default 200)
+* --reliable-link         Talk to the STM32 through the sequenced, CRC checked
+*                         link layer instead of plain JSON lines
+* --link-rto <ms>         Link retransmit timeout (default 250)
+* --link-error-rate <p>   Flip one random bit in this fraction of outgoing link
+*                         frames, for testing retransmission (default 0)
+* --serial-binary         Send binary wire messages (see slal_wire.h) over the
+*                         reliable link instead of JSON; requires --reliable-link
+* --time-sync-interval <s> How often the STM32's RTC is set from this clock
+*                         (default 600, 0 disables)
+* --serial-port <path>    Open only this serial port instead of searching
+*                         /dev/ttyACM* and /dev/ttyUSB*; e.g. the pseudo
+*                         terminal of the firmware running under
+*                         STM32F746/Host on this machine
+* --source-rate <n>[:<burst>]  Logged events per second accepted from each
+*                         source (default 50, burst twice the rate, 0 disables)
+* --door-rate <n>[:<burst>]    The same for each door (default 10)
+* --client-rate <n>[:<burst>]  The same for each laptop connection (default 10)
+* --rate-summary-interval <s>  How often events held back by the rate limits
+*                         are logged as one summary each (default 10)
+* --log-level <level>     Least severe diagnostics printed: debug (every message
+*                         received and sent), info, warn, error or off
+*                         (default info)
+* --codec-benchmark       Compare JSON and binary encode/decode speed and size,
+*                         then exit
+* --registry-benchmark    Measure door status reads and updates from several
+*                         threads at 1, 100 and 10000 doors, then exit
+* --diagnostics-benchmark Measure message handling with diagnostics off, through
+*                         the logger and through cout, then exit
+*
+* Laptop clients may send a "hello" message listing the encodings they
+* support ("encodings":"binary,json"); the server answers with the one it
+* picked and both sides switch to it. Clients that skip the hello use JSON.
+* A laptop message may carry an "id": status replies echo it, and lock and
+* unlock are answered with an "ack" carrying it once they are queued.
+* Status requests from several laptops for one door share one query to the
+* STM32, and its reply is sent to each of them under their own "id".
+* Logged events carry their database id as "seq". A "history_request" with
+* "since":"<seq>" replays the logged events after that seq, followed by a
+* "history_end" holding the newest one, so clients fetch only what they missed.
+* The whole gap is replayed in batches, from memory for recent events and
+* otherwise from the database a page at a time, so a reconnect costs what was
+* missed rather than the size of the log. Live events for that client wait
+* until the replay has caught up, and none is lost or sent twice.
+*
+* Up to 64 laptops may be connected at once. Each receives every STM32 event
+* until it sends a "subscribe" naming the "doors", "events" and "sources" it
+* wants (comma separated, empty for all) and the least "severity" (info,
+* warning or error); the server acknowledges with an "ack" carrying its "id".
+* A subscribe replaces the previous one. Replies to a client's own requests
+* are always sent to it.
+*
+* Every door's state has a "version" that goes up on each change, and status
+* replies carry it. A "status_request" that includes the "version" the client
+* already has is answered from the server's state without asking the STM32:
+* at once if the door has moved on, otherwise when it next changes or after
+* "wait_ms" (at most 60000), whichever comes first. Clients can long-poll this
+* way instead of polling in a loop.
+*
+* The STM32 stamps its events with "device_ms", its RTC time of the actuation
+* in ms since the epoch. The server keeps the RTC in step by sending it a
+* "time_sync" whose "sent_ms" is stamped just before the write, and stores
+* each event's device time next to its own receive time. A laptop's lock or
+* unlock is stored with the "device_ms" of the STM32's LOCKED/UNLOCKED reply,
+* so each command's row shows when it was received and when it took effect.
+* Commands without an "id" are sent to the STM32 with one of the server's
+* own, which is removed from the reply before it is published. A command with
+* an "id" is acknowledged once queued; if a newer command for the door
+* replaces it within the coalescing window, a second "ack" with
+* "superseded_by" (the newer command's id) says it was never sent.
+*
+* Events the STM32 could not deliver are kept in a flash journal and sent on
+* reconnect as "journal" batches ("entries":"event,door,device_ms;...").
+* Each batch is stored in one transaction and acknowledged with an "ack"
+* carrying the batch's "id". The last journal seq stored is kept per device
+* ("door") and journal "epoch", which the STM32 changes whenever its seqs
+* could start again.
+*
+* Lock, unlock and error events pass token-bucket rate limits per source, per
+* door and per laptop connection before they are logged and published. An event
+* over a limit still updates the door's state and is still forwarded to the
+* STM32, but is only counted. Each interval the counts are logged and published
+* as one event per source, door and event carrying a "count", in place of the
+* flood ("error x 4312 in last 10s").
 */
 
 #include <iostream>
@@ -24,31 +122,1621 @@
 #include <fstream>
 #include <sstream>
 #include <mutex>
+#include <shared_mutex>
 #include <queue>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <condition_variable>
 #include <algorithm>
+#include <random>
+#include <cstdint>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
 #include <cstring>
+#include <cstdlib>
 #include <sqlite3.h>
 #include <libserialport.h>
 #include <ctime>
 #include <iomanip>
 #include <signal.h>
+#include "../Common/slal_protocol.h"
+#include "../Common/slal_wire.h"
 
 using namespace std;
 
+// Door used when a message does not carry a "door" field
+const string DEFAULT_DOOR = "1";
+
+// Longest line the STM32 may send without a newline before it is dropped
+const size_t SERIAL_LINE_MAX = 4096;
+
+// Logged events per batch of a history replay
+const int HISTORY_BATCH = 200;
+
+// Empty database pages in a row, for events the ring no longer holds,
+// before a history replay gives up; the wait before a retry grows by
+// HISTORY_DB_BACKOFF_MS each time
+const int HISTORY_DB_RETRIES = 3;
+const int HISTORY_DB_BACKOFF_MS = 50;
+
+// Longest a database call waits for a lock held by another process, such
+// as a backup or the sqlite3 shell
+const int DB_BUSY_TIMEOUT_MS = 250;
+
+// Longest a write to a laptop may wait for room in its socket
+const int CLIENT_SEND_TIMEOUT_MS = 1000;
+
+// Diagnostics. A DIAG_* line is formatted by the thread that logs it into a
+// ring of that thread's own and written out in batches by a background
+// thread, so message handling never waits on the console or journald.
+// Levels below SLAL_LOG_MIN_LEVEL are dead code the compiler removes (build
+// with -DSLAL_LOG_MIN_LEVEL=1 to drop the per-message debug lines); the rest are
+// filtered by --log-level at run time. Each call site lets through
+// DIAG_SITE_LINES_PER_S lines a second and reports how many more it held back.
+//
+//   DIAG_INFO(DIAG_CLIENT) << "Client " << slot << " connected" << kv("from", address);
+#ifndef SLAL_LOG_MIN_LEVEL
+#define SLAL_LOG_MIN_LEVEL 0
+#endif
+
+enum DiagLevel {
+    DIAG_LEVEL_DEBUG = 0,
+    DIAG_LEVEL_INFO,
+    DIAG_LEVEL_WARN,
+    DIAG_LEVEL_ERROR,
+    DIAG_LEVEL_OFF
+};
+
+const char* const DIAG_LEVEL_NAMES[DIAG_LEVEL_OFF + 1] = {"debug", "info", "warn", "error", "off"};
+
+// Where a line comes from, so the output can be filtered by part of the server
+enum DiagComponent {
+    DIAG_SERVER = 0,
+    DIAG_SERIAL,
+    DIAG_CLIENT,
+    DIAG_DB,
+    DIAG_COMPONENT_COUNT
+};
+
+const char* const DIAG_COMPONENT_NAMES[DIAG_COMPONENT_COUNT] = {"server", "serial", "client", "db"};
+
+const size_t DIAG_TEXT_MAX = 232;           // Longer lines are cut short
+const uint32_t DIAG_RING_SLOTS = 256;       // Records per logging thread
+const unsigned DIAG_SITE_LINES_PER_S = 50;
+const int DIAG_FLUSH_INTERVAL_MS = 20;
+
+struct DiagRecord {
+    int64_t time_us;            // Wall clock, for ordering and the printed time
+    uint8_t level;
+    uint8_t component;
+    uint16_t len;
+    char text[DIAG_TEXT_MAX];
+};
+
+// One logging thread's records. Only that thread moves head and only the
+// flusher moves tail, so neither side takes a lock.
+struct DiagRing {
+    DiagRecord slots[DIAG_RING_SLOTS];
+    atomic<uint32_t> head;
+    atomic<uint32_t> tail;
+    atomic<unsigned long> dropped;      // Records lost to a full ring
+    atomic<bool> orphaned;              // The thread has exited
+
+    DiagRing() : head(0), tail(0), dropped(0), orphaned(false) {}
+};
+
+// A DIAG_* call site, created on its first use
+struct DiagSite {
+    DiagLevel level;
+    DiagComponent component;
+    int line;
+    atomic<int64_t> window_ms;          // Start of the current second
+    atomic<unsigned> in_window;
+    atomic<unsigned long> held;         // Held back and not yet reported
+    DiagSite* next;                     // Every site, for the flusher's reports
+
+    DiagSite(DiagLevel level_, DiagComponent component_, int line_);
+    bool admit();
+};
+
+class Diagnostics {
+private:
+    atomic<int> min_level;
+    atomic<unsigned> site_limit;        // 0 for no limit
+    atomic<DiagSite*> sites;
+    
+    // Taken by the consumer side: the flusher, flush() and new threads
+    // registering their ring
+    mutex rings_mutex;
+    vector<shared_ptr<DiagRing>> rings;
+    int out_fd;
+    int err_fd;
+    unsigned long written_count;
+    unsigned long dropped_count;
+    chrono::steady_clock::time_point next_site_report;
+    int64_t clock_second;               // The second clock_text shows
+    char clock_text[9];                 // "HH:MM:SS"
+    
+    thread flusher;
+    atomic<bool> running;
+    mutex wake_mutex;
+    condition_variable wake;
+
+    Diagnostics() : min_level(DIAG_LEVEL_INFO), site_limit(DIAG_SITE_LINES_PER_S), sites(nullptr),
+                    out_fd(STDOUT_FILENO), err_fd(STDERR_FILENO), written_count(0), dropped_count(0),
+                    clock_second(-1), running(false) {}
+
+    ~Diagnostics() {
+        stop();
+    }
+
+    DiagRing& threadRing() {
+        struct Handle {
+            shared_ptr<DiagRing> ring;
+            ~Handle() { if (ring) ring->orphaned = true; }
+        };
+        thread_local Handle handle;
+        if (!handle.ring) {
+            handle.ring = make_shared<DiagRing>();
+            lock_guard<mutex> lock(rings_mutex);
+            rings.push_back(handle.ring);
+        }
+        return *handle.ring;
+    }
+
+    static void writeAll(int fd, const string& text) {
+        size_t done = 0;
+        while (done < text.size()) {
+            ssize_t result = write(fd, text.data() + done, text.size() - done);
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) return;
+            done += result;
+        }
+    }
+
+    // "HH:MM:SS.mmm level component: text". Caller holds rings_mutex.
+    void format(const DiagRecord& rec, string& out) {
+        time_t seconds = rec.time_us / 1000000;
+        if (seconds != clock_second) {
+            struct tm timeinfo;
+            localtime_r(&seconds, &timeinfo);
+            strftime(clock_text, sizeof(clock_text), "%H:%M:%S", &timeinfo);
+            clock_second = seconds;
+        }
+        char millis[6] = {'.', (char)('0' + rec.time_us / 100000 % 10), (char)('0' + rec.time_us / 10000 % 10),
+                          (char)('0' + rec.time_us / 1000 % 10), ' ', 0};
+        const char* level = DIAG_LEVEL_NAMES[rec.level];
+        out.append(clock_text, 8).append(millis, 5).append(level).append(6 - strlen(level), ' ')
+           .append(DIAG_COMPONENT_NAMES[rec.component]).append(": ").append(rec.text, rec.len).push_back('\n');
+    }
+
+    static DiagRecord note(DiagLevel level, DiagComponent component, const string& text) {
+        DiagRecord rec;
+        rec.time_us = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        rec.level = level;
+        rec.component = component;
+        rec.len = (uint16_t)min(text.size(), DIAG_TEXT_MAX);
+        memcpy(rec.text, text.data(), rec.len);
+        return rec;
+    }
+
+    // Everything logged so far, merged across threads oldest first, straight
+    // out of the rings. Caller holds rings_mutex.
+    void drainLocked() {
+        struct Cursor {
+            DiagRing* ring;
+            uint32_t tail;
+            uint32_t head;
+        };
+        vector<Cursor> cursors;
+        unsigned long dropped = 0;
+        for (const shared_ptr<DiagRing>& ring : rings) {
+            cursors.push_back({ring.get(), ring->tail.load(memory_order_relaxed), ring->head.load(memory_order_acquire)});
+            dropped += ring->dropped.exchange(0, memory_order_relaxed);
+        }
+        
+        string out, err;
+        size_t lines = 0;
+        for (;;) {
+            Cursor* oldest = nullptr;
+            for (Cursor& cursor : cursors) {
+                if (cursor.tail != cursor.head &&
+                    (!oldest || cursor.ring->slots[cursor.tail % DIAG_RING_SLOTS].time_us <
+                                oldest->ring->slots[oldest->tail % DIAG_RING_SLOTS].time_us)) {
+                    oldest = &cursor;
+                }
+            }
+            if (!oldest) break;
+            const DiagRecord& rec = oldest->ring->slots[oldest->tail++ % DIAG_RING_SLOTS];
+            format(rec, rec.level >= DIAG_LEVEL_WARN ? err : out);
+            lines++;
+        }
+        for (const Cursor& cursor : cursors) {
+            cursor.ring->tail.store(cursor.tail, memory_order_release);
+        }
+        
+        vector<DiagRecord> notes;
+        auto now = chrono::steady_clock::now();
+        if (now >= next_site_report) {
+            next_site_report = now + chrono::seconds(1);
+            for (DiagSite* site = sites.load(memory_order_acquire); site; site = site->next) {
+                unsigned long held = site->held.exchange(0, memory_order_relaxed);
+                if (held == 0) continue;
+                notes.push_back(note(site->level, site->component,
+                                     to_string(held) + " more lines like line " + to_string(site->line) + " held back"));
+            }
+        }
+        if (dropped > 0) {
+            dropped_count += dropped;
+            notes.push_back(note(DIAG_LEVEL_WARN, DIAG_SERVER, to_string(dropped) + " lines dropped, log buffer full"));
+        }
+        for (const DiagRecord& rec : notes) {
+            format(rec, rec.level >= DIAG_LEVEL_WARN ? err : out);
+        }
+        
+        // Rings of threads that have exited go once they are empty
+        rings.erase(remove_if(rings.begin(), rings.end(), [](const shared_ptr<DiagRing>& ring) {
+            return ring->orphaned.load(memory_order_acquire) &&
+                   ring->tail.load(memory_order_relaxed) == ring->head.load(memory_order_acquire);
+        }), rings.end());
+        
+        writeAll(out_fd, out);
+        writeAll(err_fd, err);
+        written_count += lines + notes.size();
+    }
+
+    void run() {
+        while (running) {
+            {
+                unique_lock<mutex> lock(wake_mutex);
+                wake.wait_for(lock, chrono::milliseconds(DIAG_FLUSH_INTERVAL_MS));
+            }
+            flush();
+        }
+        flush();
+    }
+
+public:
+    static Diagnostics& instance() {
+        static Diagnostics diagnostics;
+        return diagnostics;
+    }
+
+    int level() const { return min_level.load(memory_order_relaxed); }
+    void setLevel(DiagLevel level) { min_level = level; }
+    unsigned siteLimit() const { return site_limit.load(memory_order_relaxed); }
+    void setSiteLimit(unsigned lines_per_s) { site_limit = lines_per_s; }
+
+    // Level from its name; false if there is no such level
+    static bool parseLevel(const string& name, DiagLevel& level) {
+        for (int i = 0; i <= DIAG_LEVEL_OFF; i++) {
+            if (name == DIAG_LEVEL_NAMES[i]) {
+                level = (DiagLevel)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void addSite(DiagSite* site) {
+        site->next = sites.load(memory_order_relaxed);
+        while (!sites.compare_exchange_weak(site->next, site, memory_order_release, memory_order_relaxed)) {}
+    }
+
+    // Never blocks: a line that finds the thread's ring full is counted and dropped
+    void push(const DiagRecord& rec) {
+        DiagRing& ring = threadRing();
+        uint32_t head = ring.head.load(memory_order_relaxed);
+        uint32_t used = head - ring.tail.load(memory_order_acquire);
+        if (used >= DIAG_RING_SLOTS) {
+            ring.dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        memcpy(&ring.slots[head % DIAG_RING_SLOTS], &rec, offsetof(DiagRecord, text) + rec.len);
+        ring.head.store(head + 1, memory_order_release);
+        if (used + 1 == DIAG_RING_SLOTS / 2) wake.notify_one();
+    }
+
+    // Lines go to out_fd, warnings and errors to err_fd
+    void start(int out = STDOUT_FILENO, int err = STDERR_FILENO) {
+        out_fd = out;
+        err_fd = err;
+        running = true;
+        flusher = thread(&Diagnostics::run, this);
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        wake.notify_one();
+        flusher.join();
+    }
+
+    // Write out everything logged so far, from any thread
+    void flush() {
+        lock_guard<mutex> lock(rings_mutex);
+        drainLocked();
+    }
+
+    // Lines written and dropped since the last call
+    void takeCounts(unsigned long& written, unsigned long& dropped) {
+        lock_guard<mutex> lock(rings_mutex);
+        written = written_count;
+        dropped = dropped_count;
+        written_count = dropped_count = 0;
+    }
+};
+
+DiagSite::DiagSite(DiagLevel level_, DiagComponent component_, int line_)
+    : level(level_), component(component_), line(line_), window_ms(0), in_window(0), held(0), next(nullptr) {
+    Diagnostics::instance().addSite(this);
+}
+
+bool DiagSite::admit() {
+    Diagnostics& diagnostics = Diagnostics::instance();
+    if (level < diagnostics.level()) return false;
+    unsigned limit = diagnostics.siteLimit();
+    if (limit == 0) return true;
+    
+    int64_t now = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t start = window_ms.load(memory_order_relaxed);
+    if (now - start >= 1000 && window_ms.compare_exchange_strong(start, now, memory_order_relaxed)) {
+        in_window.store(0, memory_order_relaxed);
+    }
+    if (in_window.fetch_add(1, memory_order_relaxed) < limit) return true;
+    held.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+// A " key=value" pair in a DIAG_* line
+template <typename T>
+struct DiagField {
+    const char* key;
+    const T& value;
+};
+
+template <typename T>
+DiagField<T> kv(const char* key, const T& value) {
+    return {key, value};
+}
+
+// One line, built in place and handed to the logger when the statement ends
+class DiagLine {
+private:
+    DiagRecord rec;
+
+    void append(const char* text, size_t len) {
+        len = min(len, DIAG_TEXT_MAX - rec.len);
+        memcpy(rec.text + rec.len, text, len);
+        rec.len += len;
+    }
+
+public:
+    explicit DiagLine(const DiagSite& site) {
+        rec.time_us = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        rec.level = site.level;
+        rec.component = site.component;
+        rec.len = 0;
+    }
+
+    ~DiagLine() {
+        Diagnostics::instance().push(rec);
+    }
+
+    DiagLine& operator<<(const char* text) { append(text, strlen(text)); return *this; }
+    DiagLine& operator<<(const string& text) { append(text.data(), text.size()); return *this; }
+    DiagLine& operator<<(char c) { append(&c, 1); return *this; }
+
+    DiagLine& operator<<(double value) {
+        char buffer[32];
+        append(buffer, snprintf(buffer, sizeof(buffer), "%g", value));
+        return *this;
+    }
+
+    template <typename T>
+    typename enable_if<is_integral<T>::value, DiagLine&>::type operator<<(T value) {
+        char buffer[24];
+        append(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr - buffer);
+        return *this;
+    }
+
+    template <typename T>
+    DiagLine& operator<<(const DiagField<T>& field) {
+        return *this << ' ' << field.key << '=' << field.value;
+    }
+};
+
+// The site is a static of its own lambda, so each DIAG_* use has one. The
+// expansion is a single for statement, so it nests under an unbraced if/else
+// like any other statement: the loop runs once when the line is admitted and
+// the DiagLine temporary is logged at the end of the caller's full expression.
+// Below SLAL_LOG_MIN_LEVEL the start value is a constant null, so the site is
+// never created and the optimizer drops the loop and everything streamed into
+// it; the operands are still type checked but never evaluated.
+#define DIAG(level, component)                                                          \
+    for (DiagSite* diag_site_ = ((level) < SLAL_LOG_MIN_LEVEL) ? nullptr : []() {       \
+             static DiagSite site(level, component, __LINE__);                          \
+             return &site;                                                              \
+         }();                                                                           \
+         diag_site_ != nullptr && diag_site_->admit(); diag_site_ = nullptr)            \
+        DiagLine{*diag_site_}
+
+#define DIAG_DEBUG(component) DIAG(DIAG_LEVEL_DEBUG, component)
+#define DIAG_INFO(component)  DIAG(DIAG_LEVEL_INFO, component)
+#define DIAG_WARN(component)  DIAG(DIAG_LEVEL_WARN, component)
+#define DIAG_ERROR(component) DIAG(DIAG_LEVEL_ERROR, component)
+
+// A token bucket's refill rate in events per second and its depth; a rate
+// of 0 turns the limit off
+struct RateLimit {
+    double rate;
+    double burst;
+
+    RateLimit(double rate_ = 0, double burst_ = 0) : rate(rate_), burst(burst_) {}
+
+    // "<rate>[:<burst>]"; the burst defaults to twice the rate, and at least one
+    static RateLimit parse(const string& spec) {
+        double rate = max(0.0, atof(spec.c_str()));
+        size_t colon = spec.find(':');
+        double burst = (colon == string::npos) ? rate * 2 : atof(spec.c_str() + colon + 1);
+        return RateLimit(rate, max(1.0, burst));
+    }
+};
+
+struct ServerConfig {
+    int coalesce_window_ms;
+    int aging_interval_ms;
+    bool reliable_link;
+    int link_rto_ms;
+    double link_error_rate;
+    bool serial_binary;
+    int time_sync_interval_s;
+    string serial_port;         // Empty to search the usual names
+    RateLimit source_rate;
+    RateLimit door_rate;
+    RateLimit client_rate;
+    int rate_summary_interval_s;
+
+    ServerConfig() : coalesce_window_ms(50), aging_interval_ms(200), reliable_link(false),
+                     link_rto_ms(250), link_error_rate(0.0), serial_binary(false),
+                     time_sync_interval_s(600), source_rate(50, 100), door_rate(10, 20),
+                     client_rate(10, 20), rate_summary_interval_s(10) {}
+};
+
+// Collapses redundant commands before they are written to the STM32.
+// Within the window only the last lock/unlock for a door is kept
+// (unlock -> lock -> unlock becomes a single unlock), and repeated
+// status requests for a door are merged into one upstream query.
+// Everything else, and emergency locks, passes straight through in arrival
+// order on a queue of its own, so it never waits behind a window. add()
+// hands back the lock/unlock a newer one replaced, so its sender can be
+// told it was never sent.
+class CommandCoalescer {
+private:
+    struct PendingCommand {
+        string key;
+        string message;
+        int merged;
+        chrono::steady_clock::time_point deadline;
+    };
+
+    chrono::milliseconds window;
+    deque<PendingCommand> immediate;    // Pass-through and emergency, arrival order
+    deque<PendingCommand> windowed;     // Ordered by first arrival, so by deadline
+    unsigned long forwarded_count;
+    unsigned long suppressed_count;
+
+    static string coalesceKey(const string& door, Event event) {
+        switch (event) {
+            case Event::Lock:
+            case Event::Unlock:
+                return door + "/command";
+            case Event::StatusRequest:
+                return door + "/status";
+            default:
+                return "";
+        }
+    }
+
+public:
+    CommandCoalescer(int window_ms) : window(window_ms), forwarded_count(0), suppressed_count(0) {}
+
+    // Returns the lock/unlock message this one superseded, or ""
+    string add(const string& door, Event event, const string& message, bool emergency = false) {
+        auto now = chrono::steady_clock::now();
+        string superseded;
+
+        if (emergency) {
+            // An emergency lock overrides anything still pending for the door
+            string key = coalesceKey(door, Event::Lock);
+            for (auto it = windowed.begin(); it != windowed.end(); ++it) {
+                if (it->key == key) {
+                    suppressed_count += it->merged;
+                    superseded = it->message;
+                    windowed.erase(it);
+                    break;
+                }
+            }
+            immediate.push_back({"", message, 1, now});
+            return superseded;
+        }
+
+        string key = coalesceKey(door, event);
+
+        if (!key.empty() && window.count() > 0) {
+            for (PendingCommand& cmd : windowed) {
+                if (cmd.key == key) {
+                    // Superseded: keep the newest command, keep the original deadline
+                    if (event != Event::StatusRequest) superseded = cmd.message;
+                    cmd.message = message;
+                    cmd.merged++;
+                    suppressed_count++;
+                    return superseded;
+                }
+            }
+            windowed.push_back({key, message, 1, now + window});
+        } else {
+            immediate.push_back({key, message, 1, now});
+        }
+        return superseded;
+    }
+
+    // Remove and return every pass-through message, then every message
+    // whose window has closed
+    vector<string> takeReady(chrono::steady_clock::time_point now) {
+        vector<string> ready;
+        while (!immediate.empty()) {
+            ready.push_back(immediate.front().message);
+            immediate.pop_front();
+            forwarded_count++;
+        }
+        while (!windowed.empty() && windowed.front().deadline <= now) {
+            if (windowed.front().merged > 1) {
+                DIAG_DEBUG(DIAG_SERIAL) << "Coalesced " << windowed.front().merged << " commands ("
+                     << windowed.front().key << ") into one";
+            }
+            ready.push_back(windowed.front().message);
+            windowed.pop_front();
+            forwarded_count++;
+        }
+        return ready;
+    }
+
+    bool empty() const {
+        return immediate.empty() && windowed.empty();
+    }
+
+    chrono::steady_clock::time_point nextDeadline() const {
+        return immediate.empty() ? windowed.front().deadline : immediate.front().deadline;
+    }
+
+    chrono::milliseconds windowLength() const { return window; }
+    unsigned long forwarded() const { return forwarded_count; }
+    unsigned long suppressed() const { return suppressed_count; }
+};
+
+// Serial traffic classes, highest priority first
+enum SerialPriority {
+    PRIORITY_EMERGENCY = 0,
+    PRIORITY_COMMAND,
+    PRIORITY_STATUS,
+    PRIORITY_DIAGNOSTIC,
+    PRIORITY_CLASS_COUNT
+};
+
+const char* const PRIORITY_NAMES[PRIORITY_CLASS_COUNT] = {"emergency", "command", "status", "diagnostic"};
+
+// Orders messages waiting for the serial writer. Emergency locks always go
+// first. The other classes are FIFO internally and are picked by
+// enqueue time + class * aging interval, so a lower class is only ever
+// overtaken by a bounded amount of higher-class traffic and cannot starve.
+class SerialScheduler {
+private:
+    struct QueuedMessage {
+        string message;
+        chrono::steady_clock::time_point enqueued;
+    };
+
+    struct ClassStats {
+        unsigned long sent;
+        double total_wait_ms;
+        double max_wait_ms;
+    };
+
+    chrono::milliseconds aging_interval;
+    deque<QueuedMessage> queues[PRIORITY_CLASS_COUNT];
+    ClassStats stats[PRIORITY_CLASS_COUNT];
+
+public:
+    SerialScheduler(int aging_interval_ms) : aging_interval(aging_interval_ms) {
+        for (ClassStats& s : stats) {
+            s = {0, 0.0, 0.0};
+        }
+    }
+
+    void push(SerialPriority priority, const string& message) {
+        queues[priority].push_back({message, chrono::steady_clock::now()});
+    }
+
+    bool empty() const {
+        for (const auto& q : queues) {
+            if (!q.empty()) return false;
+        }
+        return true;
+    }
+
+    // Remove the next message to send; the queue must not be empty
+    string pop() {
+        int chosen = -1;
+        if (!queues[PRIORITY_EMERGENCY].empty()) {
+            chosen = PRIORITY_EMERGENCY;
+        } else {
+            chrono::steady_clock::time_point best;
+            for (int p = PRIORITY_COMMAND; p < PRIORITY_CLASS_COUNT; p++) {
+                if (queues[p].empty()) continue;
+                auto score = queues[p].front().enqueued + aging_interval * (p - PRIORITY_COMMAND);
+                if (chosen == -1 || score < best) {
+                    chosen = p;
+                    best = score;
+                }
+            }
+        }
+
+        QueuedMessage next = queues[chosen].front();
+        queues[chosen].pop_front();
+
+        double wait_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - next.enqueued).count();
+        ClassStats& s = stats[chosen];
+        s.sent++;
+        s.total_wait_ms += wait_ms;
+        s.max_wait_ms = max(s.max_wait_ms, wait_ms);
+
+        return next.message;
+    }
+
+    void printStats() const {
+        cout << "Serial queueing delay per class:" << endl;
+        for (int p = 0; p < PRIORITY_CLASS_COUNT; p++) {
+            const ClassStats& s = stats[p];
+            cout << "  " << left << setw(11) << PRIORITY_NAMES[p] << right
+                 << " sent " << s.sent << fixed << setprecision(2)
+                 << ", avg " << (s.sent ? s.total_wait_ms / s.sent : 0.0) << " ms"
+                 << ", max " << s.max_wait_ms << " ms" << endl;
+        }
+    }
+};
+
+// Reliable link layer for the STM32 serial port (--reliable-link).
+// Must match STM32F746/Core/Inc/slal_link.h.
+//
+// Each frame is COBS encoded and terminated by a 0x00 byte on the wire:
+//   type(1) seq(1) ack(1) payload(0..LINK_MAX_PAYLOAD) crc16(2, big endian)
+// ack is the next sequence number expected from the peer (cumulative) and
+// is piggybacked on every frame. The CRC is CRC-16/CCITT-FALSE over
+// type..payload. Data frames use Go-Back-N with a LINK_WINDOW frame window:
+// the receiver only accepts the next in-order frame, and the sender resends
+// everything unacknowledged when the oldest frame times out. A RESET frame
+// tells the receiver which sequence number comes next; it is sent before the
+// first data frame and again after LINK_MAX_RETRIES timeouts in a row, so a
+// rebooted peer resynchronises (frames in flight may then be delivered twice).
+// Until a side has had a RESET or the DATA frame it expects, its ack means
+// nothing and it sets LINK_NO_ACK in the type of its frames; the ack of a
+// RESET frame is ignored too. Otherwise a restarted peer's ack of 0 could
+// release a window of frames it never received.
+const uint8_t LINK_DATA = 0x01;
+const uint8_t LINK_ACK = 0x02;
+const uint8_t LINK_RESET = 0x03;
+const uint8_t LINK_NO_ACK = 0x80;
+const int LINK_WINDOW = 8;
+const int LINK_MAX_RETRIES = 5;
+const size_t LINK_MAX_PAYLOAD = SLAL_LINK_MAX_PAYLOAD;  // shared with the STM32 (slal_protocol.h)
+
+class SerialLink {
+private:
+    struct OutstandingFrame {
+        uint8_t seq;
+        string payload;
+    };
+
+    uint8_t next_seq;
+    uint8_t rx_expected;
+    bool rx_synced;  // Had a RESET or the DATA expected since starting
+    deque<OutstandingFrame> unacked;  // Oldest first
+    chrono::steady_clock::time_point oldest_sent;
+    int retries;
+    bool need_reset;
+    bool ack_pending;
+    vector<uint8_t> rx_buffer;
+    bool rx_overflow;
+
+    chrono::milliseconds rto;
+    double bit_error_rate;
+    mt19937 rng;
+
+    unsigned long frames_sent;
+    unsigned long retransmissions;
+    unsigned long crc_errors;
+    unsigned long out_of_order;
+
+    static uint16_t crc16(const uint8_t* data, size_t len) {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < len; i++) {
+            crc ^= (uint16_t)data[i] << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    static vector<uint8_t> cobsEncode(const vector<uint8_t>& data) {
+        vector<uint8_t> out;
+        out.reserve(data.size() + data.size() / 254 + 2);
+        size_t code_pos = out.size();
+        out.push_back(0);
+        uint8_t code = 1;
+        for (uint8_t byte : data) {
+            if (byte == 0) {
+                out[code_pos] = code;
+                code_pos = out.size();
+                out.push_back(0);
+                code = 1;
+            } else {
+                out.push_back(byte);
+                if (++code == 0xFF) {
+                    out[code_pos] = code;
+                    code_pos = out.size();
+                    out.push_back(0);
+                    code = 1;
+                }
+            }
+        }
+        out[code_pos] = code;
+        out.push_back(0);  // Frame delimiter
+        return out;
+    }
+
+    static bool cobsDecode(const vector<uint8_t>& data, vector<uint8_t>& out) {
+        out.clear();
+        size_t i = 0;
+        while (i < data.size()) {
+            uint8_t code = data[i++];
+            if (code == 0 || i + code - 1 > data.size()) return false;
+            for (int j = 1; j < code; j++) {
+                out.push_back(data[i++]);
+            }
+            if (code != 0xFF && i < data.size()) {
+                out.push_back(0);
+            }
+        }
+        return true;
+    }
+
+    vector<uint8_t> buildFrame(uint8_t type, uint8_t seq, const string& payload) {
+        vector<uint8_t> raw;
+        raw.reserve(payload.size() + 5);
+        raw.push_back(rx_synced ? type : (uint8_t)(type | LINK_NO_ACK));
+        raw.push_back(seq);
+        raw.push_back(rx_expected);
+        raw.insert(raw.end(), payload.begin(), payload.end());
+        uint16_t crc = crc16(raw.data(), raw.size());
+        raw.push_back(crc >> 8);
+        raw.push_back(crc & 0xFF);
+
+        vector<uint8_t> wire = cobsEncode(raw);
+        ack_pending = false;  // Every frame carries the current ack
+        frames_sent++;
+
+        if (bit_error_rate > 0.0 && uniform_real_distribution<double>(0.0, 1.0)(rng) < bit_error_rate) {
+            size_t bit = uniform_int_distribution<size_t>(0, (wire.size() - 1) * 8 - 1)(rng);
+            wire[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        }
+        return wire;
+    }
+
+    void handleAck(uint8_t ack) {
+        bool progress = false;
+        while (!unacked.empty()) {
+            uint8_t distance = (uint8_t)(ack - unacked.front().seq);
+            if (distance == 0 || distance > unacked.size()) break;
+            unacked.pop_front();
+            progress = true;
+        }
+        if (progress) {
+            retries = 0;
+            oldest_sent = chrono::steady_clock::now();
+        }
+    }
+
+    void processFrame(vector<string>& delivered) {
+        vector<uint8_t> frame;
+        if (!cobsDecode(rx_buffer, frame) || frame.size() < 5) {
+            crc_errors++;
+            return;
+        }
+        uint16_t crc = (uint16_t)(frame[frame.size() - 2] << 8) | frame[frame.size() - 1];
+        if (crc16(frame.data(), frame.size() - 2) != crc) {
+            crc_errors++;
+            return;
+        }
+
+        uint8_t type = frame[0] & ~LINK_NO_ACK;
+        uint8_t seq = frame[1];
+        if (type != LINK_RESET && !(frame[0] & LINK_NO_ACK)) {
+            handleAck(frame[2]);
+        }
+
+        if (type == LINK_RESET) {
+            rx_expected = seq;
+            rx_synced = true;
+            ack_pending = true;
+        } else if (type == LINK_DATA) {
+            if (seq == rx_expected) {
+                delivered.push_back(string(frame.begin() + 3, frame.end() - 2));
+                rx_expected++;
+                rx_synced = true;
+            } else {
+                out_of_order++;
+            }
+            ack_pending = rx_synced;
+        }
+    }
+
+public:
+    SerialLink(int rto_ms, double error_rate)
+        : rx_expected(0), rx_synced(false), retries(0), need_reset(true), ack_pending(false), rx_overflow(false),
+          rto(rto_ms), bit_error_rate(error_rate), rng(random_device()()),
+          frames_sent(0), retransmissions(0), crc_errors(0), out_of_order(0) {
+        next_seq = (uint8_t)rng();
+    }
+
+    bool canSend() const {
+        return (int)unacked.size() < LINK_WINDOW;
+    }
+
+    // Frames to write for a new payload (preceded by a RESET if needed);
+    // the payload is tracked until acknowledged
+    vector<vector<uint8_t>> sendData(const string& payload) {
+        vector<vector<uint8_t>> frames;
+        if (payload.size() > LINK_MAX_PAYLOAD) {
+            DIAG_WARN(DIAG_SERIAL) << "Link payload too large, dropped (" << payload.size() << " bytes)";
+            return frames;
+        }
+        if (need_reset) {
+            frames.push_back(buildFrame(LINK_RESET, next_seq, ""));
+            need_reset = false;
+        }
+        if (unacked.empty()) {
+            oldest_sent = chrono::steady_clock::now();
+        }
+        unacked.push_back({next_seq, payload});
+        frames.push_back(buildFrame(LINK_DATA, next_seq, payload));
+        next_seq++;
+        return frames;
+    }
+
+    // Go-Back-N: resend the whole window once the oldest frame has timed out
+    vector<vector<uint8_t>> takeRetransmits(chrono::steady_clock::time_point now) {
+        vector<vector<uint8_t>> frames;
+        if (unacked.empty() || now < oldest_sent + rto) return frames;
+
+        if (++retries >= LINK_MAX_RETRIES) {
+            DIAG_WARN(DIAG_SERIAL) << "Link: no ack after " << retries << " retransmits, resynchronising";
+            frames.push_back(buildFrame(LINK_RESET, unacked.front().seq, ""));
+            retries = 0;
+        }
+        for (const OutstandingFrame& f : unacked) {
+            frames.push_back(buildFrame(LINK_DATA, f.seq, f.payload));
+            retransmissions++;
+        }
+        oldest_sent = now;
+        return frames;
+    }
+
+    // Standalone ack, if something was received since our last frame
+    vector<uint8_t> takeAck() {
+        if (!ack_pending) return vector<uint8_t>();
+        return buildFrame(LINK_ACK, next_seq, "");
+    }
+
+    // Feed raw bytes from the serial port; returns payloads delivered in order
+    vector<string> receiveBytes(const uint8_t* data, size_t len) {
+        vector<string> delivered;
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] == 0) {
+                if (!rx_overflow && !rx_buffer.empty()) {
+                    processFrame(delivered);
+                }
+                rx_buffer.clear();
+                rx_overflow = false;
+            } else if (rx_buffer.size() < LINK_MAX_PAYLOAD + 16) {
+                rx_buffer.push_back(data[i]);
+            } else {
+                rx_overflow = true;
+            }
+        }
+        return delivered;
+    }
+
+    bool hasUnacked() const {
+        return !unacked.empty();
+    }
+
+    chrono::steady_clock::time_point nextTimeout() const {
+        return oldest_sent + rto;
+    }
+
+    void printStats() const {
+        cout << "Link frames sent: " << frames_sent << ", retransmitted: " << retransmissions
+             << ", bad CRC/framing: " << crc_errors << ", out of order: " << out_of_order << endl;
+    }
+};
+
+// Last known state of one door
+struct DoorState {
+    Event status;               // One of the Status* events
+    long long changed_ms;       // When status last changed, 0 if never
+    Source last_source;         // Who made the last update
+    Event pending_command;      // Lock/unlock not yet confirmed by the STM32, or Other
+    unsigned long errors;       // Error events reported for the door
+    unsigned long long version; // Bumped on every change; 0 for a door never seen
+
+    DoorState() : status(Event::StatusUnknown), changed_ms(0), last_source(Source::Other),
+                  pending_command(Event::Other), errors(0), version(0) {}
+};
+
+// Door states keyed by door id. Status queries read it while the serial
+// threads update it, so the table is split into shards by hash, each with
+// its own reader/writer lock on its own cache line: readers never block
+// each other, and a writer only holds up readers of its own shard.
+class DoorRegistry {
+private:
+    static const size_t CACHE_LINE = 64;
+
+    struct alignas(CACHE_LINE) Shard {
+        mutable shared_mutex mutex;
+        unordered_map<string, DoorState> doors;
+    };
+
+    size_t shard_mask;
+    unique_ptr<Shard[]> shards;
+
+    Shard& shardFor(const string& door) const {
+        return shards[hash<string>()(door) & shard_mask];
+    }
+
+    // The status an event leaves the door in, or Other if it says nothing
+    static Event statusAfter(Event event, Source source) {
+        switch (event) {
+            case Event::Lock:   return Event::StatusLocked;
+            case Event::Unlock: return Event::StatusUnlocked;
+            case Event::Error:  return Event::StatusError;
+            case Event::StatusLocked:
+            case Event::StatusUnlocked:
+            case Event::StatusError:
+                // Only the STM32 reports what the lock actually did
+                return source == Source::Stm32 ? event : Event::Other;
+            default:
+                return Event::Other;
+        }
+    }
+
+public:
+    static const size_t DEFAULT_SHARDS = 16;
+
+    // shard_count is rounded up to a power of two
+    DoorRegistry(size_t shard_count = DEFAULT_SHARDS) {
+        size_t count = 1;
+        while (count < shard_count) count <<= 1;
+        shard_mask = count - 1;
+        shards.reset(new Shard[count]);
+    }
+
+    // Apply a message about door. Commands from the laptop stay pending
+    // until the STM32 next reports on the door. Returns true if the door's
+    // state, and so its version, changed.
+    bool record(const string& door, Event event, Source source, long long now_ms) {
+        Event status = statusAfter(event, source);
+        if (status == Event::Other) return false;
+
+        Shard& shard = shardFor(door);
+        unique_lock<shared_mutex> lock(shard.mutex);
+        DoorState& state = shard.doors[door];
+        bool changed = state.version == 0 || state.status != status || state.last_source != source;
+        if (state.status != status) {
+            state.status = status;
+            state.changed_ms = now_ms;
+        }
+        state.last_source = source;
+        Event pending = state.pending_command;
+        if (source == Source::Stm32) {
+            pending = Event::Other;
+        } else if (event == Event::Lock || event == Event::Unlock) {
+            pending = event;
+        }
+        changed = changed || pending != state.pending_command;
+        state.pending_command = pending;
+        if (event == Event::Error) {
+            state.errors++;
+            changed = true;
+        }
+        if (changed) state.version++;
+        return changed;
+    }
+
+    // A copy of the door's state; StatusUnknown for doors never seen
+    DoorState get(const string& door) const {
+        Shard& shard = shardFor(door);
+        shared_lock<shared_mutex> lock(shard.mutex);
+        auto it = shard.doors.find(door);
+        return it == shard.doors.end() ? DoorState() : it->second;
+    }
+
+    void printStats() const {
+        size_t count = 0, pending = 0;
+        unsigned long errors = 0;
+        for (size_t i = 0; i <= shard_mask; i++) {
+            shared_lock<shared_mutex> lock(shards[i].mutex);
+            count += shards[i].doors.size();
+            for (const auto& entry : shards[i].doors) {
+                if (entry.second.pending_command != Event::Other) pending++;
+                errors += entry.second.errors;
+            }
+        }
+        cout << "Doors tracked: " << count << ", commands unconfirmed: " << pending
+             << ", errors: " << errors << endl;
+    }
+};
+
+// Laptop connections served at once; each has one bit in the subscription masks
+const int MAX_CLIENTS = 64;
+
+// How serious an event is, for subscription filters; least severe first
+enum Severity {
+    SEVERITY_INFO = 0,
+    SEVERITY_WARNING,
+    SEVERITY_ERROR,
+    SEVERITY_COUNT
+};
+
+const char* const SEVERITY_NAMES[SEVERITY_COUNT] = {"info", "warning", "error"};
+
+Severity severityOf(Event event) {
+    switch (event) {
+        case Event::Error:
+        case Event::StatusError:
+            return SEVERITY_ERROR;
+        case Event::StatusUnknown:
+            return SEVERITY_WARNING;
+        default:
+            return SEVERITY_INFO;
+    }
+}
+
+// What one client wants to receive, from its "subscribe" message. Each list
+// is comma separated and an empty or missing list matches everything, so a
+// client that never subscribes receives every event.
+struct SubscriptionFilter {
+    vector<string> doors;
+    uint64_t events;            // Bit per Event
+    uint64_t sources;           // Bit per Source
+    Severity min_severity;
+
+    static_assert((size_t)Event::Count <= 64 && (size_t)Source::Count <= 64, "Filter masks too small");
+
+    SubscriptionFilter() : events(~0ULL), sources(~0ULL), min_severity(SEVERITY_INFO) {}
+
+    static vector<string> splitList(const string& list) {
+        vector<string> items;
+        stringstream ss(list);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (!item.empty()) items.push_back(item);
+        }
+        return items;
+    }
+
+    // Unknown names are ignored; a list of nothing but unknown names matches nothing
+    static SubscriptionFilter parse(const ProtocolMessage& msg) {
+        SubscriptionFilter filter;
+        filter.doors = splitList(msg.get<Field::Doors>());
+        vector<string> events = splitList(msg.get<Field::Events>());
+        if (!events.empty()) {
+            filter.events = 0;
+            for (const string& name : events) {
+                Event event = ProtocolMessage::parseEvent(name);
+                if (event != Event::Other) filter.events |= 1ULL << (size_t)event;
+            }
+        }
+        vector<string> sources = splitList(msg.get<Field::Sources>());
+        if (!sources.empty()) {
+            filter.sources = 0;
+            for (const string& name : sources) {
+                Source source = ProtocolMessage::parseSource(name);
+                if (source != Source::Other) filter.sources |= 1ULL << (size_t)source;
+            }
+        }
+        for (int s = 0; s < SEVERITY_COUNT; s++) {
+            if (msg.get<Field::Severity>() == SEVERITY_NAMES[s]) filter.min_severity = (Severity)s;
+        }
+        return filter;
+    }
+};
+
+// Subscriptions indexed by what they match rather than by client: every
+// event, source, severity and named door has a mask of the client slots
+// that accept it, so matching an event is a few ANDs no matter how many
+// clients are connected or how narrow their filters are.
+class SubscriptionIndex {
+private:
+    mutable shared_mutex mutex;
+    uint64_t active;
+    uint64_t by_event[(size_t)Event::Count];
+    uint64_t by_source[(size_t)Source::Count];
+    uint64_t by_severity[SEVERITY_COUNT];
+    uint64_t any_door;                          // Slots without a door filter
+    unordered_map<string, uint64_t> by_door;
+    vector<string> slot_doors[MAX_CLIENTS];     // To clear by_door on unsubscribe
+
+    void clearSlot(int slot) {
+        uint64_t keep = ~(1ULL << slot);
+        active &= keep;
+        any_door &= keep;
+        for (uint64_t& mask : by_event) mask &= keep;
+        for (uint64_t& mask : by_source) mask &= keep;
+        for (uint64_t& mask : by_severity) mask &= keep;
+        for (const string& door : slot_doors[slot]) {
+            auto it = by_door.find(door);
+            if (it == by_door.end()) continue;
+            it->second &= keep;
+            if (it->second == 0) by_door.erase(it);
+        }
+        slot_doors[slot].clear();
+    }
+
+public:
+    SubscriptionIndex() : active(0), any_door(0) {
+        fill(begin(by_event), end(by_event), 0ULL);
+        fill(begin(by_source), end(by_source), 0ULL);
+        fill(begin(by_severity), end(by_severity), 0ULL);
+    }
+
+    // Replaces the slot's previous filter
+    void subscribe(int slot, const SubscriptionFilter& filter) {
+        uint64_t bit = 1ULL << slot;
+        unique_lock<shared_mutex> lock(mutex);
+        clearSlot(slot);
+        active |= bit;
+        for (size_t e = 0; e < (size_t)Event::Count; e++) {
+            if (filter.events & (1ULL << e)) by_event[e] |= bit;
+        }
+        for (size_t s = 0; s < (size_t)Source::Count; s++) {
+            if (filter.sources & (1ULL << s)) by_source[s] |= bit;
+        }
+        for (int s = filter.min_severity; s < SEVERITY_COUNT; s++) {
+            by_severity[s] |= bit;
+        }
+        if (filter.doors.empty()) {
+            any_door |= bit;
+        }
+        for (const string& door : filter.doors) {
+            by_door[door] |= bit;
+        }
+        slot_doors[slot] = filter.doors;
+    }
+
+    void unsubscribe(int slot) {
+        unique_lock<shared_mutex> lock(mutex);
+        clearSlot(slot);
+    }
+
+    // Slots whose filters accept an event
+    uint64_t match(const string& door, Event event, Source source) const {
+        shared_lock<shared_mutex> lock(mutex);
+        uint64_t doors_mask = any_door;
+        if (!by_door.empty()) {
+            auto it = by_door.find(door);
+            if (it != by_door.end()) doors_mask |= it->second;
+        }
+        return active & doors_mask & by_event[(size_t)event] & by_source[(size_t)source]
+               & by_severity[severityOf(event)];
+    }
+};
+
+// One laptop connection, served by its own thread
+struct ClientConnection : enable_shared_from_this<ClientConnection> {
+    int socket;
+    int slot;                   // Bit in the subscription masks
+    atomic<bool> connected;
+    bool binary;                // Negotiated by the client's hello; guarded by send_mutex
+    bool replaying;             // History replay running, live logged events held back; send_mutex
+    long long last_seq;         // Newest logged event sent; send_mutex
+    string rx_buffer;           // Partial messages, only touched by the client's thread
+    mutex send_mutex;           // Replies and published events come from different threads
+    thread worker;
+
+    ClientConnection(int fd, int client_slot) : socket(fd), slot(client_slot), connected(true), binary(false),
+                                                       replaying(false), last_seq(0) {}
+};
+
+// Longest a status_request may wait for its door to change
+const int STATUS_WAIT_MAX_MS = 60000;
+
+// Longest a laptop's status_request waits for the STM32, on top of the
+// coalescing window, before it is answered from the last known state
+const int STATUS_REPLY_TIMEOUT_MS = 1000;
+
+// Id prefix of the status queries the Pi sends upstream for laptops; a
+// reply carrying it is fanned out to the requesters, not published
+const string STATUS_QUERY_ID_PREFIX = "pi-status-";
+
+// Id prefix the Pi gives lock and unlock commands sent without one, so the
+// STM32's reply can be matched to the command; removed before publishing
+const string COMMAND_ID_PREFIX = "pi-cmd-";
+
+// A status_request waiting for its door to move past a version
+struct StatusWaiter {
+    weak_ptr<ClientConnection> client;
+    string door;
+    string id;
+    unsigned long long version;     // The version the client already has
+    chrono::steady_clock::time_point deadline;
+};
+
+// Status requests parked until their door changes or the STM32 answers a
+// status query. Waiters are table entries, not threads: a change or reply
+// takes its door's waiters, and one thread answers those whose deadline in
+// the heap passes first, skipping entries already answered.
+class StatusWaitList {
+private:
+    typedef pair<chrono::steady_clock::time_point, unsigned long long> Deadline;
+
+    mutex mtx;
+    condition_variable cv;
+    unsigned long long next_ticket;
+    unordered_map<unsigned long long, StatusWaiter> waiters;
+    unordered_map<string, vector<unsigned long long>> by_door;
+    priority_queue<Deadline, vector<Deadline>, greater<Deadline>> deadlines;
+    unsigned long woken_count;
+    unsigned long expired_count;
+
+    // Drop a timed out ticket from its door's list; mtx held
+    void forget(const string& door, unsigned long long ticket) {
+        auto it = by_door.find(door);
+        if (it == by_door.end()) return;
+        vector<unsigned long long>& tickets = it->second;
+        tickets.erase(remove(tickets.begin(), tickets.end(), ticket), tickets.end());
+        if (tickets.empty()) by_door.erase(it);
+    }
+
+public:
+    StatusWaitList() : next_ticket(1), woken_count(0), expired_count(0) {}
+
+    // Returns true if no other waiter was parked on the door
+    bool park(const StatusWaiter& waiter) {
+        lock_guard<mutex> lock(mtx);
+        unsigned long long ticket = next_ticket++;
+        waiters[ticket] = waiter;
+        vector<unsigned long long>& tickets = by_door[waiter.door];
+        tickets.push_back(ticket);
+        bool earliest = deadlines.empty() || waiter.deadline < deadlines.top().first;
+        deadlines.push(Deadline(waiter.deadline, ticket));
+        if (earliest) cv.notify_one();
+        return tickets.size() == 1;
+    }
+
+    // Remove and return all of the door's waiters
+    vector<StatusWaiter> takeAll(const string& door) {
+        vector<StatusWaiter> taken;
+        lock_guard<mutex> lock(mtx);
+        auto it = by_door.find(door);
+        if (it == by_door.end()) return taken;
+        
+        for (unsigned long long ticket : it->second) {
+            auto w = waiters.find(ticket);
+            if (w == waiters.end()) continue;
+            taken.push_back(w->second);
+            waiters.erase(w);
+        }
+        by_door.erase(it);
+        woken_count += taken.size();
+        return taken;
+    }
+
+    // Remove and return the door's waiters whose version is not current
+    vector<StatusWaiter> takeDoor(const string& door, unsigned long long current) {
+        vector<StatusWaiter> taken;
+        lock_guard<mutex> lock(mtx);
+        auto it = by_door.find(door);
+        if (it == by_door.end()) return taken;
+        
+        vector<unsigned long long>& tickets = it->second;
+        size_t kept = 0;
+        for (unsigned long long ticket : tickets) {
+            auto w = waiters.find(ticket);
+            if (w == waiters.end()) continue;
+            if (w->second.version == current) {
+                tickets[kept++] = ticket;
+                continue;
+            }
+            taken.push_back(w->second);
+            waiters.erase(w);
+        }
+        tickets.resize(kept);
+        if (tickets.empty()) by_door.erase(it);
+        woken_count += taken.size();
+        return taken;
+    }
+
+    // Wait until the earliest deadline, but at most max_wait, then remove
+    // and return the waiters that have timed out
+    vector<StatusWaiter> takeExpired(chrono::milliseconds max_wait) {
+        vector<StatusWaiter> expired;
+        unique_lock<mutex> lock(mtx);
+        auto wake = chrono::steady_clock::now() + max_wait;
+        if (!deadlines.empty() && deadlines.top().first < wake) wake = deadlines.top().first;
+        cv.wait_until(lock, wake);
+        
+        auto now = chrono::steady_clock::now();
+        while (!deadlines.empty() && deadlines.top().first <= now) {
+            auto w = waiters.find(deadlines.top().second);
+            deadlines.pop();
+            if (w == waiters.end()) continue;   // Answered by a change
+            forget(w->second.door, w->first);
+            expired.push_back(w->second);
+            waiters.erase(w);
+        }
+        expired_count += expired.size();
+        return expired;
+    }
+
+    // Prints "<what> answered <how>: n, timed out: n, still parked: n"
+    void printStats(const char* what, const char* how) {
+        lock_guard<mutex> lock(mtx);
+        cout << what << " answered " << how << ": " << woken_count << ", timed out: " << expired_count
+             << ", still parked: " << waiters.size() << endl;
+    }
+};
+
+// Logged events kept in memory for replay, newest last
+const size_t EVENT_RING_SIZE = 1024;
+
+// The most recent logged events in seq order, so a client catching up
+// after a short absence is served without touching the database. Events
+// are appended under the database lock, in the order their seqs were given.
+class EventRing {
+private:
+    struct Entry {
+        long long seq;
+        string json;
+    };
+
+    mutable mutex mtx;
+    deque<Entry> entries;
+    long long evicted_seq;      // Highest seq dropped from the front
+
+public:
+    EventRing() : evicted_seq(0) {}
+
+    // Events up to seq were logged before the server started and are only
+    // in the database
+    void startAfter(long long seq) {
+        lock_guard<mutex> lock(mtx);
+        evicted_seq = seq;
+    }
+
+    void append(long long seq, const string& json) {
+        lock_guard<mutex> lock(mtx);
+        entries.push_back({seq, json});
+        if (entries.size() > EVENT_RING_SIZE) {
+            evicted_seq = entries.front().seq;
+            entries.pop_front();
+        }
+    }
+
+    // Replace a logged event that is still held, e.g. once its device_ms is known
+    void update(long long seq, const string& json) {
+        lock_guard<mutex> lock(mtx);
+        auto it = lower_bound(entries.begin(), entries.end(), seq,
+                              [](const Entry& e, long long value) { return e.seq < value; });
+        if (it != entries.end() && it->seq == seq) it->json = json;
+    }
+
+    // Up to max events after cursor; false if some have been evicted and
+    // must come from the database instead
+    bool after(long long cursor, size_t max, vector<pair<long long, string>>& out) const {
+        lock_guard<mutex> lock(mtx);
+        if (evicted_seq > cursor) return false;
+        auto it = upper_bound(entries.begin(), entries.end(), cursor,
+                              [](long long seq, const Entry& e) { return seq < e.seq; });
+        for (; it != entries.end() && out.size() < max; ++it) {
+            out.push_back({it->seq, it->json});
+        }
+        return true;
+    }
+};
+
+// Lock and unlock commands sent to the STM32, until its LOCKED/UNLOCKED
+// reply under the same door and id says when the command took effect, or
+// the coalescer reports it superseded. seq is 0 for a command the rate
+// limits kept out of the log. A command whose reply never comes (lost) is
+// dropped once PENDING_COMMANDS_MAX newer ones wait.
+const size_t PENDING_COMMANDS_MAX = 256;
+
+class PendingCommands {
+public:
+    struct Command {
+        string door;
+        string id;
+        long long seq;
+        ProtocolMessage msg;
+        weak_ptr<ClientConnection> client;
+    };
+
+private:
+    mutex mtx;
+    deque<Command> commands;     // Oldest first, the order replies come in
+
+public:
+    void add(const Command& command) {
+        lock_guard<mutex> lock(mtx);
+        commands.push_back(command);
+        if (commands.size() > PENDING_COMMANDS_MAX) commands.pop_front();
+    }
+
+    // Remove the command a reply answers; false if none is waiting
+    bool take(const string& door, const string& id, Command& command) {
+        lock_guard<mutex> lock(mtx);
+        for (auto it = commands.begin(); it != commands.end(); ++it) {
+            if (it->door == door && it->id == id) {
+                command = *it;
+                commands.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Token buckets in front of the event log, one per source, per door and
+// per laptop connection. An event is let through only if every bucket it
+// falls in has a token, and then takes one from each. Events turned away
+// are counted by source, door and event until takeSummaries() collects
+// them, so a storm costs one log entry per interval instead of one each.
+class EventRateLimiter {
+public:
+    enum Scope {
+        SCOPE_SOURCE = 0,
+        SCOPE_DOOR,
+        SCOPE_CLIENT,
+        SCOPE_COUNT
+    };
+
+    struct Summary {
+        string source;
+        string door;
+        string event;
+        unsigned long count;
+    };
+
+private:
+    struct Bucket {
+        double tokens;
+        chrono::steady_clock::time_point refilled;
+    };
+
+    RateLimit limits[SCOPE_COUNT];
+    mutex mtx;
+    unordered_map<string, Bucket> buckets[SCOPE_COUNT];
+    map<tuple<string, string, string>, unsigned long> held;    // Since the last summary
+    unsigned long passed_count;
+    unsigned long limited_count[SCOPE_COUNT];                  // By the bucket that ran dry
+
+    Bucket& refill(Scope scope, const string& key, chrono::steady_clock::time_point now) {
+        auto it = buckets[scope].find(key);
+        if (it == buckets[scope].end()) {
+            return buckets[scope].emplace(key, Bucket{limits[scope].burst, now}).first->second;
+        }
+        Bucket& bucket = it->second;
+        double elapsed = chrono::duration<double>(now - bucket.refilled).count();
+        bucket.tokens = min(limits[scope].burst, bucket.tokens + elapsed * limits[scope].rate);
+        bucket.refilled = now;
+        return bucket;
+    }
+
+public:
+    EventRateLimiter(const RateLimit& source, const RateLimit& door, const RateLimit& client)
+        : limits{source, door, client}, passed_count(0), limited_count{} {}
+
+    // client is the connection's slot, or -1 for events from the STM32
+    bool admit(const string& source, const string& door, int client, const string& event) {
+        auto now = chrono::steady_clock::now();
+        const string keys[SCOPE_COUNT] = {source, door, client >= 0 ? to_string(client) : string()};
+        Bucket* taken[SCOPE_COUNT] = {};
+        
+        lock_guard<mutex> lock(mtx);
+        for (int scope = 0; scope < SCOPE_COUNT; scope++) {
+            if (limits[scope].rate <= 0 || keys[scope].empty()) continue;
+            Bucket& bucket = refill((Scope)scope, keys[scope], now);
+            if (bucket.tokens < 1.0) {
+                limited_count[scope]++;
+                held[make_tuple(source, door, event)]++;
+                return false;
+            }
+            taken[scope] = &bucket;
+        }
+        for (Bucket* bucket : taken) {
+            if (bucket) bucket->tokens -= 1.0;
+        }
+        passed_count++;
+        return true;
+    }
+
+    // A new connection in the slot starts with a full bucket
+    void forgetClient(int client) {
+        lock_guard<mutex> lock(mtx);
+        buckets[SCOPE_CLIENT].erase(to_string(client));
+    }
+
+    // The counts held back since the last call. Buckets that have refilled
+    // are dropped, as they are no different from new ones, so a flood of
+    // made-up door names does not grow the table for good.
+    vector<Summary> takeSummaries() {
+        auto now = chrono::steady_clock::now();
+        vector<Summary> summaries;
+        lock_guard<mutex> lock(mtx);
+        for (const auto& entry : held) {
+            summaries.push_back({get<0>(entry.first), get<1>(entry.first), get<2>(entry.first), entry.second});
+        }
+        held.clear();
+        
+        for (int scope = 0; scope < SCOPE_COUNT; scope++) {
+            for (auto it = buckets[scope].begin(); it != buckets[scope].end();) {
+                if (refill((Scope)scope, it->first, now).tokens >= limits[scope].burst) {
+                    it = buckets[scope].erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return summaries;
+    }
+
+    void printStats() {
+        lock_guard<mutex> lock(mtx);
+        cout << "Events logged: " << passed_count << ", rate limited by source: " << limited_count[SCOPE_SOURCE]
+             << ", by door: " << limited_count[SCOPE_DOOR] << ", by client: " << limited_count[SCOPE_CLIENT] << endl;
+    }
+};
+
 class DoorServer {
 private:
     // Network variables
     int server_socket;
-    int client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len;
-    bool client_connected;
+    struct sockaddr_in server_addr;
+    
+    // Connected laptops by slot, and what each has subscribed to
+    shared_ptr<ClientConnection> clients[MAX_CLIENTS];
+    mutex clients_mutex;
+    SubscriptionIndex subscriptions;
+    atomic<unsigned long> published_count;
+    atomic<unsigned long> delivered_count;
     
     // Serial variables
     struct sp_port *serial_port;
@@ -56,23 +1744,67 @@ private:
     
     // Database
     sqlite3 *db;
+    // Highest journal seq stored per journalKey(), as in journal_epochs; serial reader thread
+    unordered_map<string, long long> journal_applied;
     
     // Synchronization
     mutex log_mutex;
     mutex db_mutex;
-    mutex status_mutex;
     
-    // Current door status
-    string current_door_status;
-    bool running;
+    // Per-door status, read by status requests and written by the serial threads
+    DoorRegistry doors;
+    StatusWaitList status_waiters;
+    StatusWaitList status_queries;      // Laptops waiting for the STM32's status reply
+    atomic<unsigned long> status_query_count;
+    
+    // Commands waiting for the STM32 to report their actuation time
+    PendingCommands pending_commands;
+    atomic<unsigned long> command_count;
     
-    // Message queue for serial communication
-    queue<string> serial_send_queue;
+    // Recent logged events for history replays
+    EventRing event_ring;
+    // Cleared by the signal handler, read by every thread
+    atomic<bool> running;
+    
+    // Outgoing serial messages, coalesced and then scheduled by priority
+    // before the writer thread sends them
+    CommandCoalescer serial_coalescer;
+    SerialScheduler serial_scheduler;
     mutex serial_queue_mutex;
+    condition_variable serial_queue_cv;
+    
+    // Optional reliable link layer, guarded by serial_queue_mutex
+    bool reliable_link;
+    bool serial_binary;
+    SerialLink serial_link;
+    mutex serial_write_mutex;
+    string serial_rx_buffer;        // Partial line from the STM32; serial reader thread only
+    
+    // RTC sync for the STM32's event timestamps; 0 disables
+    chrono::seconds time_sync_interval;
+    
+    string serial_port_name;    // Empty to search the usual names
+    
+    // Event storm protection in front of the log; summaries of what it held
+    // back are logged by the serial reader thread
+    EventRateLimiter rate_limiter;
+    chrono::seconds rate_summary_interval;
 
 public:
-    DoorServer() : client_connected(false), serial_connected(false), 
-                   current_door_status("UNKNOWN"), running(true) {
+    DoorServer(const ServerConfig& config = ServerConfig())
+        : published_count(0), delivered_count(0), serial_connected(false),
+          status_query_count(0),
+          command_count(0),
+          running(true),
+          serial_coalescer(config.coalesce_window_ms),
+          serial_scheduler(config.aging_interval_ms),
+          reliable_link(config.reliable_link),
+          serial_binary(config.reliable_link && config.serial_binary),
+          serial_link(config.link_rto_ms, config.link_error_rate),
+          time_sync_interval(config.time_sync_interval_s),
+          serial_port_name(config.serial_port),
+          rate_limiter(config.source_rate, config.door_rate, config.client_rate),
+          rate_summary_interval(max(1, config.rate_summary_interval_s)) {
         initializeDatabase();
         initializeNetwork();
         initializeSerial();
@@ -82,24 +1814,30 @@ public:
         cleanup();
     }
     
+    // UTC, as every timestamp in the protocol (slal_protocol.h)
     string getCurrentTimestamp() {
         auto now = chrono::system_clock::now();
         auto time_t = chrono::system_clock::to_time_t(now);
         
         struct tm timeinfo;
-        localtime_r(&time_t, &timeinfo);  // POSIX safe version
+        gmtime_r(&time_t, &timeinfo);  // POSIX safe version
         
         stringstream ss;
         ss << put_time(&timeinfo, "%Y-%m-%d %H:%M:%S");
         return ss.str();
     }
     
+    long long getCurrentEpochMs() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+    
+    // The UTC day, so a text log holds the timestamps of one date
     string getCurrentDate() {
         auto now = chrono::system_clock::now();
         auto time_t = chrono::system_clock::to_time_t(now);
         
         struct tm timeinfo;
-        localtime_r(&time_t, &timeinfo);
+        gmtime_r(&time_t, &timeinfo);
         
         stringstream ss;
         ss << put_time(&timeinfo, "%Y-%m-%d");
@@ -109,9 +1847,10 @@ public:
     void initializeDatabase() {
         int rc = sqlite3_open("door_log.db", &db);
         if (rc) {
-            cerr << "Can't open database: " << sqlite3_errmsg(db) << endl;
+            DIAG_ERROR(DIAG_DB) << "Can't open database: " << sqlite3_errmsg(db);
             return;
         }
+        sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
         
         // Create table if it doesn't exist
         const char* sql = "CREATE TABLE IF NOT EXISTS door_events ("
@@ -124,17 +1863,51 @@ public:
         char* errMsg = 0;
         rc = sqlite3_exec(db, sql, 0, 0, &errMsg);
         if (rc != SQLITE_OK) {
-            cerr << "SQL error: " << errMsg << endl;
+            DIAG_ERROR(DIAG_DB) << "SQL error: " << errMsg;
             sqlite3_free(errMsg);
         } else {
-            cout << "Database initialized successfully" << endl;
+            DIAG_INFO(DIAG_DB) << "Database initialized successfully";
+        }
+        
+        // Databases from older versions lack these columns; the error for
+        // one that already has them is expected and ignored
+        sqlite3_exec(db, "ALTER TABLE door_events ADD COLUMN door TEXT;", 0, 0, 0);
+        sqlite3_exec(db, "ALTER TABLE door_events ADD COLUMN device_ms INTEGER;", 0, 0, 0);
+        sqlite3_exec(db, "ALTER TABLE door_events ADD COLUMN received_ms INTEGER;", 0, 0, 0);
+        sqlite3_exec(db, "ALTER TABLE door_events ADD COLUMN count INTEGER;", 0, 0, 0);
+        
+        // The last journal batch stored for each device and journal epoch,
+        // so one sent again after a lost ack is not stored twice. The
+        // journal_batches table of older versions, keyed by door alone, is
+        // left unused.
+        sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS journal_epochs ("
+                         "device TEXT NOT NULL,"
+                         "epoch INTEGER NOT NULL,"
+                         "seq INTEGER NOT NULL,"
+                         "PRIMARY KEY (device, epoch)"
+                         ");", 0, 0, 0);
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT device, epoch, seq FROM journal_epochs;", -1, &stmt, NULL) == SQLITE_OK) {
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                journal_applied[journalKey((const char*)sqlite3_column_text(stmt, 0), sqlite3_column_int64(stmt, 1))] =
+                    sqlite3_column_int64(stmt, 2);
+            }
+        }
+        sqlite3_finalize(stmt);
+        
+        if (sqlite3_prepare_v2(db, "SELECT MAX(id) FROM door_events;", -1, &stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                event_ring.startAfter(sqlite3_column_int64(stmt, 0));
+            }
         }
+        sqlite3_finalize(stmt);
     }
     
     void initializeNetwork() {
         server_socket = socket(AF_INET, SOCK_STREAM, 0);
         if (server_socket == -1) {
-            cerr << "Failed to create socket" << endl;
+            DIAG_ERROR(DIAG_SERVER) << "Failed to create socket";
             return;
         }
         
@@ -150,24 +1923,27 @@ public:
         server_addr.sin_port = htons(8080);
         
         if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-            cerr << "Bind failed: " << strerror(errno) << endl;
+            DIAG_ERROR(DIAG_SERVER) << "Bind failed: " << strerror(errno);
             return;
         }
         
         if (listen(server_socket, 5) == -1) {  // Increased backlog to 5
-            cerr << "Listen failed: " << strerror(errno) << endl;
+            DIAG_ERROR(DIAG_SERVER) << "Listen failed: " << strerror(errno);
             return;
         }
         
-        cout << "Server listening on port 8080" << endl;
+        DIAG_INFO(DIAG_SERVER) << "Server listening on port 8080";
     }
     
     void initializeSerial() {
-        // Try common serial port names for STM32
-        const char* port_names[] = {"/dev/ttyACM0", "/dev/ttyACM1", "/dev/ttyUSB0", "/dev/ttyUSB1"};
+        // Try common serial port names for STM32, unless one was given
+        vector<string> port_names = {"/dev/ttyACM0", "/dev/ttyACM1", "/dev/ttyUSB0", "/dev/ttyUSB1"};
+        if (!serial_port_name.empty()) {
+            port_names = {serial_port_name};
+        }
         
-        for (const char* port_name : port_names) {
-            sp_return result = sp_get_port_by_name(port_name, &serial_port);
+        for (const string& port_name : port_names) {
+            sp_return result = sp_get_port_by_name(port_name.c_str(), &serial_port);
             if (result == SP_OK) {
                 result = sp_open(serial_port, SP_MODE_READ_WRITE);
                 if (result == SP_OK) {
@@ -179,55 +1955,162 @@ public:
                     sp_set_flowcontrol(serial_port, SP_FLOWCONTROL_NONE);
                     
                     serial_connected = true;
-                    cout << "Serial port connected: " << port_name << endl;
+                    DIAG_INFO(DIAG_SERIAL) << "Serial port connected: " << port_name;
                     break;
                 }
             }
         }
         
         if (!serial_connected) {
-            cout << "Warning: No serial port found. STM32 communication disabled." << endl;
+            DIAG_WARN(DIAG_SERIAL) << "No serial port found. STM32 communication disabled.";
+        }
+    }
+    
+    string createJSON(Source source, Event event) {
+        return Protocol::toJSON(Protocol::create(source, event, getCurrentTimestamp()));
+    }
+    
+    static constexpr const char* INSERT_EVENT_SQL =
+        "INSERT INTO door_events (timestamp, source, event, door, device_ms, received_ms, count) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?);";
+    
+    // device_ms is NULL for events that do not carry one, and count for
+    // anything but rate limit summaries
+    void bindEvent(sqlite3_stmt* stmt, const ProtocolMessage& msg, long long received_ms) {
+        sqlite3_bind_text(stmt, 1, msg.get<Field::Timestamp>().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, msg.get<Field::Source>().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, msg.get<Field::Event>().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, msg.get<Field::Door>().c_str(), -1, SQLITE_STATIC);
+        if (msg.get<Field::DeviceMs>().empty()) {
+            sqlite3_bind_null(stmt, 5);
+        } else {
+            sqlite3_bind_int64(stmt, 5, atoll(msg.get<Field::DeviceMs>().c_str()));
+        }
+        sqlite3_bind_int64(stmt, 6, received_ms);
+        if (msg.get<Field::EventCount>().empty()) {
+            sqlite3_bind_null(stmt, 7);
+        } else {
+            sqlite3_bind_int64(stmt, 7, atoll(msg.get<Field::EventCount>().c_str()));
+        }
+    }
+    
+    // A logged event as replayed: the columns of its door_events row
+    static ProtocolMessage historyEvent(const ProtocolMessage& msg, long long seq) {
+        ProtocolMessage event;
+        event.set<Field::Seq>(to_string(seq))
+             .set<Field::Timestamp>(msg.get<Field::Timestamp>())
+             .set<Field::Source>(msg.get<Field::Source>())
+             .set<Field::Event>(msg.get<Field::Event>())
+             .set<Field::Door>(msg.get<Field::Door>())
+             .set<Field::DeviceMs>(msg.get<Field::DeviceMs>())
+             .set<Field::EventCount>(msg.get<Field::EventCount>());
+        return event;
+    }
+    
+    // Returns the row id, which doubles as the event's "seq", or 0 on failure
+    long long logToDatabase(const ProtocolMessage& msg, long long received_ms) {
+        lock_guard<mutex> lock(db_mutex);
+        
+        sqlite3_stmt* stmt;
+        long long seq = 0;
+        
+        int rc = sqlite3_prepare_v2(db, INSERT_EVENT_SQL, -1, &stmt, NULL);
+        if (rc == SQLITE_OK) {
+            bindEvent(stmt, msg, received_ms);
+            
+            rc = sqlite3_step(stmt);
+            if (rc != SQLITE_DONE) {
+                DIAG_ERROR(DIAG_DB) << "Database insert failed: " << sqlite3_errmsg(db);
+            } else {
+                seq = sqlite3_last_insert_rowid(db);
+                event_ring.append(seq, Protocol::toJSON(historyEvent(msg, seq)));
+            }
+        }
+        sqlite3_finalize(stmt);
+        return seq;
+    }
+    
+    static string journalKey(const string& device, long long epoch) {
+        return device + "/" + to_string(epoch);
+    }
+    
+    // Insert a batch in one transaction, together with the device's last
+    // journal seq in it for the epoch. Sets each event's seq; false (and
+    // nothing stored) if any insert fails.
+    bool logBatchToDatabase(vector<ProtocolMessage>& events, long long received_ms,
+                            const string& device, long long epoch, long long journal_seq) {
+        lock_guard<mutex> lock(db_mutex);
+        
+        sqlite3_stmt* stmt;
+        bool ok = sqlite3_exec(db, "BEGIN;", 0, 0, 0) == SQLITE_OK;
+        if (!ok) {
+            DIAG_ERROR(DIAG_DB) << "Database begin failed: " << sqlite3_errmsg(db);
+            return false;
+        }
+        ok = sqlite3_prepare_v2(db, INSERT_EVENT_SQL, -1, &stmt, NULL) == SQLITE_OK;
+        for (size_t i = 0; ok && i < events.size(); i++) {
+            bindEvent(stmt, events[i], received_ms);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            events[i].set<Field::Seq>(to_string(sqlite3_last_insert_rowid(db)));
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (ok) {
+            ok = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO journal_epochs (device, epoch, seq) VALUES (?, ?, ?);",
+                                    -1, &stmt, NULL) == SQLITE_OK;
+            if (ok) {
+                sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_bind_int64(stmt, 2, epoch);
+                sqlite3_bind_int64(stmt, 3, journal_seq);
+                ok = sqlite3_step(stmt) == SQLITE_DONE;
+            }
+            sqlite3_finalize(stmt);
         }
-    }
-    
-    string createJSON(const string& source, const string& event) {
-        string timestamp = getCurrentTimestamp();
-        return "{\"source\":\"" + source + "\",\"event\":\"" + event + "\",\"timestamp\":\"" + timestamp + "\"}";
-    }
-    
-    // Simple JSON parser
-    string parseJSONValue(const string& json, const string& key) {
-        string searchKey = "\"" + key + "\":\"";
-        size_t pos = json.find(searchKey);
-        if (pos == string::npos) return "";
         
-        pos += searchKey.length();
-        size_t endPos = json.find("\"", pos);
-        if (endPos == string::npos) return "";
-        
-        return json.substr(pos, endPos - pos);
+        if (!ok || sqlite3_exec(db, "COMMIT;", 0, 0, 0) != SQLITE_OK) {
+            DIAG_ERROR(DIAG_DB) << "Database batch insert failed: " << sqlite3_errmsg(db);
+            sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+            return false;
+        }
+        for (const ProtocolMessage& msg : events) {
+            long long seq = atoll(msg.get<Field::Seq>().c_str());
+            event_ring.append(seq, Protocol::toJSON(historyEvent(msg, seq)));
+        }
+        return true;
     }
     
-    void logToDatabase(const string& timestamp, const string& source, const string& event) {
+    // The STM32's time of a command's actuation, stored on the command's row
+    void logActuation(long long seq, const ProtocolMessage& command) {
         lock_guard<mutex> lock(db_mutex);
         
-        const char* sql = "INSERT INTO door_events (timestamp, source, event) VALUES (?, ?, ?);";
         sqlite3_stmt* stmt;
-        
-        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        if (rc == SQLITE_OK) {
-            sqlite3_bind_text(stmt, 1, timestamp.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(stmt, 2, source.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(stmt, 3, event.c_str(), -1, SQLITE_STATIC);
-            
-            rc = sqlite3_step(stmt);
-            if (rc != SQLITE_DONE) {
-                cerr << "Database insert failed: " << sqlite3_errmsg(db) << endl;
+        if (sqlite3_prepare_v2(db, "UPDATE door_events SET device_ms = ? WHERE id = ?;", -1, &stmt, NULL) == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, atoll(command.get<Field::DeviceMs>().c_str()));
+            sqlite3_bind_int64(stmt, 2, seq);
+            if (sqlite3_step(stmt) != SQLITE_DONE) {
+                DIAG_ERROR(DIAG_DB) << "Database update failed: " << sqlite3_errmsg(db);
+            } else {
+                event_ring.update(seq, Protocol::toJSON(historyEvent(command, seq)));
             }
         }
         sqlite3_finalize(stmt);
     }
     
+    // A LOCKED/UNLOCKED reply to a logged command gives the command its
+    // device_ms. The id the Pi gave the command is not passed on.
+    void handleCommandReply(ProtocolMessage& reply) {
+        const string& device_ms = reply.get<Field::DeviceMs>();
+        PendingCommands::Command command;
+        if (pending_commands.take(doorOf(reply), reply.get<Field::Id>(), command) && command.seq > 0 &&
+            !device_ms.empty()) {
+            command.msg.set<Field::DeviceMs>(device_ms);
+            logActuation(command.seq, command.msg);
+        }
+        if (reply.get<Field::Id>().compare(0, COMMAND_ID_PREFIX.size(), COMMAND_ID_PREFIX) == 0) {
+            reply.set<Field::Id>("");
+        }
+    }
+    
     void logToTextFile(const string& timestamp, const string& source, const string& event) {
         lock_guard<mutex> lock(log_mutex);
         
@@ -240,165 +2123,875 @@ public:
         }
     }
     
-    void logEvent(const string& timestamp, const string& source, const string& event) {
-        // Only log state changes (lock, unlock, error)
-        if (event == "lock" || event == "unlock" || event == "error") {
-            logToDatabase(timestamp, source, event);
-            logToTextFile(timestamp, source, event);
+    static string doorOf(const ProtocolMessage& msg) {
+        const string& door = msg.get<Field::Door>();
+        return door.empty() ? DEFAULT_DOOR : door;
+    }
+    
+    // Only state changes (lock, unlock, error) are logged
+    static bool isLogged(Event event) {
+        return event == Event::Lock || event == Event::Unlock || event == Event::Error;
+    }
+    
+    // Returns the event's seq, or 0 if it was not logged
+    long long logEvent(const ProtocolMessage& msg, long long received_ms) {
+        if (!isLogged(msg.event())) return 0;
+        
+        const string& timestamp = msg.get<Field::Timestamp>();
+        const string& source = msg.get<Field::Source>();
+        const string& event = msg.get<Field::Event>();
+        long long seq = logToDatabase(msg, received_ms);
+        logToTextFile(timestamp, source, event);
+        return seq;
+    }
+    
+    // Events the STM32 journalled while the Pi was unreachable, as
+    // "event,door,device_ms" entries separated by ';'. The batch is stored
+    // in one transaction and acknowledged with its id (the firmware's last
+    // journal seq in it); without the ack the firmware sends it again.
+    // Journal seqs are consecutive, so entry i of n has seq id - n + 1 + i.
+    // Entries at or below the last seq stored for the device in the batch's
+    // epoch were stored from an earlier copy of the batch and are only
+    // acknowledged again. Firmware without epochs sends neither a door nor
+    // an epoch; its batches count as epoch 0 of an unnamed device.
+    void handleJournalBatch(const ProtocolMessage& batch, long long received_ms) {
+        long long last_seq = atoll(batch.get<Field::Id>().c_str());
+        const string& device = batch.get<Field::Door>();
+        long long epoch = atoll(batch.get<Field::Epoch>().c_str());
+        string key = journalKey(device, epoch);
+        long long applied = journal_applied.count(key) ? journal_applied[key] : 0;
+        vector<string> entries;
+        stringstream list(batch.get<Field::Entries>());
+        string entry;
+        while (getline(list, entry, ';')) {
+            entries.push_back(entry);
+        }
+        
+        vector<ProtocolMessage> events;
+        long long entry_seq = last_seq - (long long)entries.size();
+        for (const string& text : entries) {
+            entry_seq++;
+            stringstream parts(text);
+            string event, door, device_ms;
+            getline(parts, event, ',');
+            getline(parts, door, ',');
+            getline(parts, device_ms, ',');
             
-            // Update current status
-            lock_guard<mutex> lock(status_mutex);
-            if (event == "lock") {
-                current_door_status = "LOCKED";
-            } else if (event == "unlock") {
-                current_door_status = "UNLOCKED";
-            } else if (event == "error") {
-                current_door_status = "ERROR";
+            if (entry_seq <= applied) continue;
+            Event type = ProtocolMessage::parseEvent(event);
+            if (type != Event::Lock && type != Event::Unlock && type != Event::Error) continue;
+            long long device_time = atoll(device_ms.c_str());
+            ProtocolMessage msg = Protocol::create(Source::Stm32, type, WireCodec::epochMsToTimestamp(device_time));
+            msg.set<Field::Door>(door).set<Field::DeviceMs>(device_ms);
+            events.push_back(msg);
+        }
+        
+        size_t duplicates = entries.size() - events.size();
+        if (applied < last_seq) {
+            if (!logBatchToDatabase(events, received_ms, device, epoch, last_seq)) return;
+            journal_applied[key] = last_seq;
+        }
+        
+        for (const ProtocolMessage& msg : events) {
+            logToTextFile(msg.get<Field::Timestamp>(), msg.get<Field::Source>(), msg.get<Field::Event>());
+            if (doors.record(doorOf(msg), msg.event(), Source::Stm32, received_ms)) {
+                wakeStatusWaiters(doorOf(msg));
+            }
+            publish(Protocol::toJSON(msg));
+        }
+        
+        ProtocolMessage ack = Protocol::create(Source::RaspberryPi, Event::Ack, getCurrentTimestamp());
+        ack.set<Field::Id>(batch.get<Field::Id>());
+        queueForSerial(Protocol::toJSON(ack));
+        DIAG_INFO(DIAG_DB) << "Stored " << events.size() << " journalled STM32 events (batch " << batch.get<Field::Id>() << ")"
+                           << ", " << duplicates << " already stored";
+    }
+    
+    // Up to max logged events after cursor, oldest first. The id is the
+    // primary key, so this reads only the rows it returns.
+    vector<pair<long long, string>> loadHistoryPage(long long cursor, int max) {
+        vector<pair<long long, string>> page;
+        lock_guard<mutex> lock(db_mutex);
+        const char* sql = "SELECT id, timestamp, source, event, door, device_ms, count FROM door_events "
+                          "WHERE id > ? ORDER BY id LIMIT ?;";
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, cursor);
+            sqlite3_bind_int(stmt, 2, max);
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                ProtocolMessage event;
+                long long seq = sqlite3_column_int64(stmt, 0);
+                event.set<Field::Seq>(to_string(seq))
+                     .set<Field::Timestamp>((const char*)sqlite3_column_text(stmt, 1))
+                     .set<Field::Source>((const char*)sqlite3_column_text(stmt, 2))
+                     .set<Field::Event>((const char*)sqlite3_column_text(stmt, 3));
+                const unsigned char* door = sqlite3_column_text(stmt, 4);
+                if (door) event.set<Field::Door>((const char*)door);
+                if (sqlite3_column_type(stmt, 5) != SQLITE_NULL) {
+                    event.set<Field::DeviceMs>(to_string(sqlite3_column_int64(stmt, 5)));
+                }
+                if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+                    event.set<Field::EventCount>(to_string(sqlite3_column_int64(stmt, 6)));
+                }
+                page.push_back({seq, Protocol::toJSON(event)});
+            }
+            if (rc != SQLITE_DONE) {
+                DIAG_WARN(DIAG_DB) << "History query stopped after " << page.size() << " rows: " << sqlite3_errmsg(db);
+            }
+        } else {
+            DIAG_ERROR(DIAG_DB) << "History query failed: " << sqlite3_errmsg(db);
+        }
+        sqlite3_finalize(stmt);
+        return page;
+    }
+    
+    // Send the events of a replay batch the client's subscription accepts
+    // in one write. Caller holds client.send_mutex. Returns the number sent.
+    size_t sendReplayLocked(ClientConnection& client, const vector<pair<long long, string>>& batch) {
+        string wire;
+        size_t sent = 0;
+        for (const auto& entry : batch) {
+            ProtocolMessage msg = Protocol::parseJSON(entry.second);
+            if (!(subscriptions.match(doorOf(msg), msg.event(), msg.source()) & (1ULL << client.slot))) continue;
+            wire += wireFor(client, entry.second);
+            sent++;
+        }
+        if (!wire.empty()) writeLocked(client, wire);
+        return sent;
+    }
+    
+    // Replay the logged events after the client's "since" cursor, oldest
+    // first and HISTORY_BATCH at a time: from the event ring while it still
+    // holds them, otherwise from the database. Each batch is copied out
+    // before it is written, so a slow laptop never holds the ring the serial
+    // reader appends to. Live logged events for the client are held back
+    // meanwhile. Once a batch comes back empty the client goes live under
+    // its send_mutex, after checking the ring again: publish() needs that
+    // mutex too, so an event is either in the replay or delivered live,
+    // never both or neither. Then a history_end carries the newest seq.
+    void sendHistory(const ProtocolMessage& request, ClientConnection& client) {
+        long long since = atoll(request.get<Field::Since>().c_str());
+        long long cursor = since;
+        size_t replayed = 0, batches = 0;
+        int db_misses = 0;
+        {
+            lock_guard<mutex> lock(client.send_mutex);
+            client.replaying = true;
+        }
+        
+        while (running && client.connected) {
+            vector<pair<long long, string>> batch;
+            if (!event_ring.after(cursor, HISTORY_BATCH, batch)) {
+                batch = loadHistoryPage(cursor, HISTORY_BATCH);
+                if (batch.empty()) {
+                    // The ring dropped them, so they should be in the database
+                    if (++db_misses < HISTORY_DB_RETRIES) {
+                        this_thread::sleep_for(chrono::milliseconds(HISTORY_DB_BACKOFF_MS * db_misses));
+                        continue;
+                    }
+                    DIAG_ERROR(DIAG_DB) << "History after seq " << cursor << " not in the database after "
+                                        << db_misses << " tries, replay to client " << client.slot << " stops there";
+                    lock_guard<mutex> lock(client.send_mutex);
+                    client.replaying = false;
+                    break;
+                }
+                db_misses = 0;
             }
+            lock_guard<mutex> lock(client.send_mutex);
+            if (batch.empty()) {
+                vector<pair<long long, string>> probe;
+                if (!event_ring.after(cursor, 1, probe) || !probe.empty()) continue;   // Logged since
+                client.last_seq = max(client.last_seq, cursor);
+                client.replaying = false;
+                break;
+            }
+            replayed += sendReplayLocked(client, batch);
+            cursor = batch.back().first;
+            batches++;
         }
+        
+        ProtocolMessage end = Protocol::create(Source::RaspberryPi, Event::HistoryEnd, getCurrentTimestamp());
+        end.set<Field::Seq>(to_string(cursor)).set<Field::Id>(request.get<Field::Id>());
+        sendToClient(client, Protocol::toJSON(end));
+        DIAG_INFO(DIAG_CLIENT) << "Replayed " << replayed << " events after seq " << since << " to client " << client.slot
+             << " in " << batches + 1 << " batches";
     }
     
     void sendToSerial(const string& message) {
         if (!serial_connected) {
-            cout << "Serial not connected - cannot send to STM32" << endl;
+            DIAG_WARN(DIAG_SERIAL) << "Serial not connected - cannot send to STM32";
             return;
         }
         
         string msg_with_newline = message + "\n";
-        cout << "Sending to STM32: " << message << endl;
+        DIAG_DEBUG(DIAG_SERIAL) << "Sending to STM32: " << message;
         
+        lock_guard<mutex> lock(serial_write_mutex);
         sp_return result = sp_blocking_write(serial_port, msg_with_newline.c_str(), msg_with_newline.length(), 1000);
         if (result < 0) {
-            cerr << "Serial write failed: " << sp_last_error_message() << endl;
+            DIAG_ERROR(DIAG_SERIAL) << "Serial write failed: " << sp_last_error_message();
         } else {
-            cout << "Sent to STM32: " << message << endl;
+            DIAG_DEBUG(DIAG_SERIAL) << "Sent to STM32: " << message;
+        }
+    }
+    
+    void writeLinkFrames(const vector<vector<uint8_t>>& frames) {
+        if (!serial_connected) return;
+        
+        lock_guard<mutex> lock(serial_write_mutex);
+        for (const vector<uint8_t>& frame : frames) {
+            if (frame.empty()) continue;
+            sp_return result = sp_blocking_write(serial_port, frame.data(), frame.size(), 1000);
+            if (result < 0) {
+                DIAG_ERROR(DIAG_SERIAL) << "Serial write failed: " << sp_last_error_message();
+            }
+        }
+    }
+    
+    SerialPriority classifySerialMessage(const ProtocolMessage& msg) {
+        switch (msg.event()) {
+            case Event::Lock:
+                if (msg.get<Field::Priority>() == "emergency") return PRIORITY_EMERGENCY;
+                return PRIORITY_COMMAND;
+            case Event::Unlock:
+                return PRIORITY_COMMAND;
+            case Event::StatusRequest:
+                return PRIORITY_STATUS;
+            default:
+                break;
+        }
+        if (msg.source() == Source::RaspberryPi) {
+            return PRIORITY_STATUS;
+        }
+        return PRIORITY_DIAGNOSTIC;
+    }
+    
+    // Queue a message for the STM32; the writer thread sends it once its
+    // coalescing window has closed, in priority order
+    // Returns false if the message would not fit in one link frame; it is
+    // then dropped here rather than after waiting its turn in the queue
+    bool queueForSerial(const string& message) {
+        ProtocolMessage msg = Protocol::parseJSON(message);
+        string door = doorOf(msg);
+        bool emergency = classifySerialMessage(msg) == PRIORITY_EMERGENCY;
+
+        if (reliable_link) {
+            // An empty binary encoding means a value too long for its TLV
+            size_t size = serial_binary ? WireCodec::encode(msg).size() : message.size();
+            if (size == 0 || size > LINK_MAX_PAYLOAD) {
+                DIAG_WARN(DIAG_SERIAL) << "Message too large for the serial link, not queued"
+                                       << kv("event", msg.get<Field::Event>())
+                                       << kv("bytes", size > 0 ? size : message.size());
+                return false;
+            }
+        }
+
+        string superseded;
+        {
+            lock_guard<mutex> lock(serial_queue_mutex);
+            superseded = serial_coalescer.add(door, msg.event(), message, emergency);
+        }
+        serial_queue_cv.notify_one();
+        if (!superseded.empty()) commandSuperseded(Protocol::parseJSON(superseded), msg);
+        return true;
+    }
+    
+    // A lock/unlock the coalescer dropped for a newer one never gets a
+    // reply from the STM32. A laptop that sent it with an id is told with
+    // a second ack naming the command sent in its place.
+    void commandSuperseded(const ProtocolMessage& command, const ProtocolMessage& winner) {
+        PendingCommands::Command pending;
+        if (!pending_commands.take(doorOf(command), command.get<Field::Id>(), pending)) return;
+        shared_ptr<ClientConnection> client = pending.client.lock();
+        const string& id = command.get<Field::Id>();
+        if (!client || id.compare(0, COMMAND_ID_PREFIX.size(), COMMAND_ID_PREFIX) == 0) return;
+        
+        ProtocolMessage ack = Protocol::create(Source::RaspberryPi, Event::Ack, getCurrentTimestamp());
+        ack.set<Field::Id>(id).set<Field::Door>(command.get<Field::Door>())
+           .set<Field::SupersededBy>(winner.get<Field::Id>());
+        sendToClient(*client, Protocol::toJSON(ack));
+    }
+
+    // A time_sync carries the time it is actually written, not when queued.
+    // Link retransmits resend the original stamp.
+    string stampTimeSync(const string& message) {
+        ProtocolMessage msg = Protocol::parseJSON(message);
+        if (msg.event() != Event::TimeSync) return message;
+        msg.set<Field::SentMs>(to_string(getCurrentEpochMs()));
+        return Protocol::toJSON(msg);
+    }
+    
+    void queueTimeSync() {
+        ProtocolMessage sync = Protocol::create(Source::RaspberryPi, Event::TimeSync, getCurrentTimestamp());
+        queueForSerial(Protocol::toJSON(sync));
+    }
+    
+    void handleSerialWriter() {
+        while (running) {
+            string next;
+            vector<vector<uint8_t>> frames;
+            {
+                unique_lock<mutex> lock(serial_queue_mutex);
+                bool can_send = !reliable_link || serial_link.canSend();
+                if (serial_scheduler.empty() || !can_send) {
+                    // Wake at least every 100 ms so shutdown is noticed
+                    auto wake = chrono::steady_clock::now() + chrono::milliseconds(100);
+                    if (!serial_coalescer.empty() && serial_coalescer.nextDeadline() < wake) {
+                        wake = serial_coalescer.nextDeadline();
+                    }
+                    if (reliable_link && serial_link.hasUnacked() && serial_link.nextTimeout() < wake) {
+                        wake = serial_link.nextTimeout();
+                    }
+                    serial_queue_cv.wait_until(lock, wake);
+                }
+
+                auto now = chrono::steady_clock::now();
+                for (const string& message : serial_coalescer.takeReady(now)) {
+                    serial_scheduler.push(classifySerialMessage(Protocol::parseJSON(message)), message);
+                }
+                
+                if (reliable_link) {
+                    frames = serial_link.takeRetransmits(now);
+                    if (!serial_scheduler.empty() && serial_link.canSend()) {
+                        next = stampTimeSync(serial_scheduler.pop());
+                        string payload = serial_binary ? WireCodec::encode(Protocol::parseJSON(next)) : next;
+                        if (!payload.empty()) {
+                            vector<vector<uint8_t>> data = serial_link.sendData(payload);
+                            frames.insert(frames.end(), data.begin(), data.end());
+                        }
+                    }
+                } else if (!serial_scheduler.empty()) {
+                    next = stampTimeSync(serial_scheduler.pop());
+                }
+            }
+
+            if (reliable_link) {
+                if (!next.empty()) {
+                    DIAG_DEBUG(DIAG_SERIAL) << "Sending to STM32 (link): " << next;
+                }
+                writeLinkFrames(frames);
+            } else if (!next.empty()) {
+                sendToSerial(next);
+            }
         }
     }
     
-    string readFromSerial() {
-        if (!serial_connected) return "";
+    // Read what the STM32 has sent and return the complete lines in it. A
+    // read may hold several lines or part of one, so the rest is kept for
+    // the next read, as takeJSON does for laptops.
+    vector<string> readFromSerial() {
+        vector<string> lines;
+        if (!serial_connected) return lines;
         
         char buffer[1024];
-        sp_return result = sp_nonblocking_read(serial_port, buffer, sizeof(buffer) - 1);
+        sp_return result = sp_nonblocking_read(serial_port, buffer, sizeof(buffer));
+        if (result <= 0) return lines;
+        serial_rx_buffer.append(buffer, result);
         
-        if (result > 0) {
-            buffer[result] = '\0';
-            string received(buffer);
-            // Remove newline characters using std::remove
-            received.erase(std::remove(received.begin(), received.end(), '\n'), received.end());
-            received.erase(std::remove(received.begin(), received.end(), '\r'), received.end());
-            
-            if (!received.empty()) {
-                cout << "Received from STM32: " << received << endl;
-                return received;
+        size_t start = 0, end;
+        while ((end = serial_rx_buffer.find('\n', start)) != string::npos) {
+            string line = serial_rx_buffer.substr(start, end - start);
+            start = end + 1;
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+            if (line.empty()) continue;
+            DIAG_DEBUG(DIAG_SERIAL) << "Received from STM32: " << line;
+            lines.push_back(line);
+        }
+        serial_rx_buffer.erase(0, start);
+        if (serial_rx_buffer.size() > SERIAL_LINE_MAX) {
+            DIAG_WARN(DIAG_SERIAL) << "Dropped " << serial_rx_buffer.size() << " bytes from STM32 without a newline";
+            serial_rx_buffer.clear();
+        }
+        return lines;
+    }
+    
+    // Read raw link bytes and return the payloads delivered by the link layer
+    vector<string> readFromSerialLink() {
+        vector<string> delivered;
+        if (!serial_connected) return delivered;
+        
+        uint8_t buffer[1024];
+        sp_return result = sp_nonblocking_read(serial_port, buffer, sizeof(buffer));
+        if (result <= 0) return delivered;
+        
+        vector<uint8_t> ack;
+        {
+            lock_guard<mutex> lock(serial_queue_mutex);
+            delivered = serial_link.receiveBytes(buffer, result);
+            ack = serial_link.takeAck();
+        }
+        serial_queue_cv.notify_one();  // Acks may have opened the send window
+        writeLinkFrames({ack});
+        
+        for (string& message : delivered) {
+            if (serial_binary) {
+                ProtocolMessage msg;
+                if (WireCodec::decode(message.data(), message.size(), msg) <= 0) {
+                    DIAG_WARN(DIAG_SERIAL) << "Invalid binary message from STM32";
+                    message.clear();
+                    continue;
+                }
+                message = Protocol::toJSON(msg);
             }
+            DIAG_DEBUG(DIAG_SERIAL) << "Received from STM32 (link): " << message;
+        }
+        return delivered;
+    }
+    
+    // The message in the client's encoding, stamped with the send time so
+    // the laptop can measure Pi-to-screen latency
+    string wireFor(const ClientConnection& client, const string& message) {
+        ProtocolMessage msg = Protocol::parseJSON(message);
+        msg.set<Field::SentMs>(to_string(getCurrentEpochMs()));
+        if (!client.binary) return Protocol::toJSON(msg);
+        string wire = WireCodec::encode(msg);
+        if (wire.empty()) {
+            DIAG_WARN(DIAG_CLIENT) << "Message too long for the binary encoding, not sent" << kv("client", client.slot);
+        }
+        return wire;
+    }
+    
+    // Caller holds client.send_mutex. The socket is non-blocking, so a long
+    // write goes out in pieces as the socket drains.
+    bool writeLocked(ClientConnection& client, const string& wire) {
+        size_t done = 0;
+        while (done < wire.size()) {
+            ssize_t result = send(client.socket, wire.data() + done, wire.size() - done, MSG_NOSIGNAL);
+            if (result >= 0) {
+                done += result;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = {client.socket, POLLOUT, 0};
+                if (poll(&pfd, 1, CLIENT_SEND_TIMEOUT_MS) > 0) continue;
+            }
+            DIAG_WARN(DIAG_CLIENT) << "Failed to send to client " << client.slot;
+            client.connected = false;
+            return false;
+        }
+        return true;
+    }
+    
+    // Caller holds client.send_mutex
+    void sendLocked(ClientConnection& client, const string& message) {
+        if (!client.connected) return;
+        if (writeLocked(client, wireFor(client, message))) {
+            DIAG_DEBUG(DIAG_CLIENT) << "Sent to laptop " << client.slot << ": " << message;
         }
-        return "";
     }
     
-    void sendToClient(const string& message) {
-        if (!client_connected) return;
+    void sendToClient(ClientConnection& client, const string& message) {
+        lock_guard<mutex> lock(client.send_mutex);
+        sendLocked(client, message);
+    }
+    
+    // Send an event to every client whose subscription matches it. A logged
+    // event (with a seq) skips clients still replaying history and clients
+    // the replay has already given it to.
+    void publish(const string& message) {
+        ProtocolMessage msg = Protocol::parseJSON(message);
+        uint64_t mask = subscriptions.match(doorOf(msg), msg.event(), msg.source());
+        long long seq = atoll(msg.get<Field::Seq>().c_str());
+        published_count++;
         
-        ssize_t result = send(client_socket, message.c_str(), message.length(), 0);
-        if (result == -1) {
-            cerr << "Failed to send to client" << endl;
-            client_connected = false;
-        } else {
-            cout << "Sent to laptop: " << message << endl;
+        vector<shared_ptr<ClientConnection>> targets;
+        {
+            lock_guard<mutex> lock(clients_mutex);
+            for (uint64_t bits = mask; bits != 0; bits &= bits - 1) {
+                int slot = __builtin_ctzll(bits);
+                if (clients[slot]) targets.push_back(clients[slot]);
+            }
+        }
+        for (const shared_ptr<ClientConnection>& client : targets) {
+            lock_guard<mutex> lock(client->send_mutex);
+            if (seq > 0) {
+                if (client->replaying || seq <= client->last_seq) continue;
+                client->last_seq = seq;
+            }
+            sendLocked(*client, message);
+            delivered_count++;
         }
     }
     
-    string readFromClient() {
-        if (!client_connected) return "";
+    string readFromClient(ClientConnection& client) {
+        if (!client.connected) return "";
         
         char buffer[1024];
-        ssize_t result = recv(client_socket, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+        ssize_t result = recv(client.socket, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
         
         if (result > 0) {
-            buffer[result] = '\0';
-            string received(buffer);
-            cout << "Received from laptop: " << received << endl;
+            // Binary messages contain zero bytes, so keep the length
+            string received(buffer, result);
+            if (client.binary) {
+                DIAG_DEBUG(DIAG_CLIENT) << "Received from laptop: " << (long)result << " binary bytes";
+            } else {
+                DIAG_DEBUG(DIAG_CLIENT) << "Received from laptop: " << received;
+            }
             return received;
         } else if (result == 0) {
-            cout << "Client disconnected gracefully" << endl;
-            client_connected = false;
+            DIAG_INFO(DIAG_CLIENT) << "Client " << client.slot << " disconnected gracefully";
+            client.connected = false;
         } else {
             int error = errno;
             if (error != EAGAIN && error != EWOULDBLOCK) {
-                cout << "Client receive error: " << strerror(error) << endl;
-                client_connected = false;
+                DIAG_WARN(DIAG_CLIENT) << "Client " << client.slot << " receive error: " << strerror(error);
+                client.connected = false;
             }
             // EAGAIN/EWOULDBLOCK means no data available - not an error
         }
         return "";
     }
     
-    void processMessage(const string& jsonMessage, const string& sourceDevice) {
-        string source = parseJSONValue(jsonMessage, "source");
-        string event = parseJSONValue(jsonMessage, "event");
-        string timestamp = parseJSONValue(jsonMessage, "timestamp");
+    // Split raw client data into JSON messages, decoding binary ones
+    vector<string> decodeClientMessages(ClientConnection& client, const string& data) {
+        vector<string> messages;
+        string& client_rx_buffer = client.rx_buffer;
+        client_rx_buffer += data;
+        if (!client.binary) {
+            // Several JSON messages can arrive in one read
+            string message;
+            while (!(message = Protocol::takeJSON(client_rx_buffer)).empty()) {
+                messages.push_back(message);
+            }
+            return messages;
+        }
+        
+        size_t pos = 0;
+        while (pos < client_rx_buffer.size()) {
+            ProtocolMessage msg;
+            long used = WireCodec::decode(client_rx_buffer.data() + pos, client_rx_buffer.size() - pos, msg);
+            if (used == 0) break;
+            if (used < 0) {
+                DIAG_WARN(DIAG_CLIENT) << "Invalid binary message from laptop, dropping buffer";
+                pos = client_rx_buffer.size();
+                break;
+            }
+            messages.push_back(Protocol::toJSON(msg));
+            pos += used;
+        }
+        client_rx_buffer.erase(0, pos);
+        return messages;
+    }
+    
+    // Pick the client's encoding; the reply goes out before the switch
+    void handleHello(const ProtocolMessage& msg, ClientConnection& client) {
+        bool binary = msg.get<Field::Encodings>().find("binary") != string::npos;
+        
+        ProtocolMessage reply = Protocol::create(Source::RaspberryPi, Event::Hello, getCurrentTimestamp());
+        reply.set<Field::Encoding>(binary ? "binary" : "json");
+        {
+            // No published event may slip in between the reply and the switch
+            lock_guard<mutex> lock(client.send_mutex);
+            sendLocked(client, Protocol::toJSON(reply));
+            client.binary = binary;
+        }
+        DIAG_INFO(DIAG_CLIENT) << "Client " << client.slot << " encoding: " << (binary ? "binary" : "json");
+    }
+    
+    // Replace the client's filter and acknowledge with the request's id
+    void handleSubscribe(const ProtocolMessage& msg, ClientConnection& client) {
+        subscriptions.subscribe(client.slot, SubscriptionFilter::parse(msg));
+        
+        ProtocolMessage ack = Protocol::create(Source::RaspberryPi, Event::Ack, getCurrentTimestamp());
+        ack.set<Field::Id>(msg.get<Field::Id>());
+        sendToClient(client, Protocol::toJSON(ack));
+        DIAG_INFO(DIAG_CLIENT) << "Client " << client.slot << " subscribed: doors [" << msg.get<Field::Doors>()
+             << "] events [" << msg.get<Field::Events>() << "] sources [" << msg.get<Field::Sources>()
+             << "] severity " << (msg.get<Field::Severity>().empty() ? "info" : msg.get<Field::Severity>());
+    }
+    
+    // client is the laptop connection the message came from, null for the STM32
+    void processMessage(const string& jsonMessage, const string& sourceDevice, ClientConnection* client = nullptr) {
+        long long received_ms = getCurrentEpochMs();
+        ProtocolMessage msg = Protocol::parseJSON(jsonMessage);
+        
+        if (!Protocol::isComplete(msg)) {
+            DIAG_WARN(DIAG_SERVER) << "Malformed JSON received from " << sourceDevice;
+            return;
+        }
         
-        if (source.empty() || event.empty() || timestamp.empty()) {
-            cerr << "Malformed JSON received from " << sourceDevice << endl;
+        Event event = msg.event();
+        if (event == Event::Hello && client) {
+            handleHello(msg, *client);
+            return;
+        }
+        if (event == Event::HistoryRequest && client) {
+            sendHistory(msg, *client);
+            return;
+        }
+        if (event == Event::Subscribe && client) {
+            handleSubscribe(msg, *client);
+            return;
+        }
+        if (event == Event::Journal && sourceDevice == "stm32") {
+            handleJournalBatch(msg, received_ms);
+            return;
+        }
+        if (event == Event::StatusRequest && client) {
+            if (msg.get<Field::Version>().empty()) {
+                handleStatusQuery(msg, *client);
+            } else {
+                handleStatusWait(msg, *client);
+            }
+            return;
+        }
+        if (isStatusReply(msg) && sourceDevice == "stm32") {
+            if (doors.record(doorOf(msg), event, msg.source(), received_ms)) {
+                wakeStatusWaiters(doorOf(msg));
+            }
+            answerStatusQueries(msg);
             return;
         }
         
-        cout << "Processing: " << event << " from " << source << " at " << timestamp << endl;
+        // Over the rate limits the event is still applied and routed, but
+        // only counted towards the next summary instead of logged and published
+        bool limited = isLogged(event) &&
+                       !rate_limiter.admit(msg.get<Field::Source>(), doorOf(msg), client ? client->slot : -1,
+                                           msg.get<Field::Event>());
+        if (!limited) {
+            DIAG_DEBUG(DIAG_SERVER) << "Processing: " << msg.get<Field::Event>() << " from " << msg.get<Field::Source>()
+                 << " at " << msg.get<Field::Timestamp>();
+            
+            const string& device_ms = msg.get<Field::DeviceMs>();
+            if (!device_ms.empty()) {
+                DIAG_DEBUG(DIAG_SERVER) << "Device time " << device_ms << ", received " << received_ms - atoll(device_ms.c_str())
+                     << " ms later";
+            }
+        }
         
         // Log the event if it's a state change
-        logEvent(timestamp, source, event);
+        long long seq = limited ? 0 : logEvent(msg, received_ms);
+        if (doors.record(doorOf(msg), event, msg.source(), received_ms)) {
+            wakeStatusWaiters(doorOf(msg));
+        }
         
         // Route message to other devices
-        if (sourceDevice == "laptop") {
-            // Forward to STM32
-            sendToSerial(jsonMessage);
-        } else if (sourceDevice == "stm32") {
-            // Forward to laptop
-            sendToClient(jsonMessage);
+        if (sourceDevice == "laptop" && client) {
+            // Forward to STM32. Commands go with an id, so the reply can be
+            // matched to the logged command.
+            bool command = event == Event::Lock || event == Event::Unlock;
+            const string& id = msg.get<Field::Id>();
+            string command_id = id;
+            string forward = jsonMessage;
+            if (command && id.empty()) {
+                command_id = COMMAND_ID_PREFIX + to_string(++command_count);
+                ProtocolMessage tagged = msg;
+                forward = Protocol::toJSON(tagged.set<Field::Id>(command_id));
+            }
+            // Waiting before it is queued, as the reply may come at once
+            if (command) {
+                pending_commands.add({doorOf(msg), command_id, seq, msg, client->shared_from_this()});
+            }
+            bool queued = queueForSerial(forward);
+            
+            // Commands carrying an id are acknowledged once queued, so
+            // pipelining clients can match replies to requests. One that a
+            // newer command supersedes before it is sent gets a second ack
+            // with "superseded_by" (commandSuperseded()).
+            if (queued && command && !id.empty()) {
+                ProtocolMessage ack = Protocol::create(Source::RaspberryPi, Event::Ack, getCurrentTimestamp());
+                ack.set<Field::Id>(id).set<Field::Door>(msg.get<Field::Door>());
+                sendToClient(*client, Protocol::toJSON(ack));
+            }
+        } else if (sourceDevice == "stm32" && !limited) {
+            if (event == Event::StatusLocked || event == Event::StatusUnlocked) {
+                handleCommandReply(msg);
+            }
+            // Forward to subscribed laptops, with the seq so their event caches can advance
+            if (seq > 0) msg.set<Field::Seq>(to_string(seq));
+            publish(Protocol::toJSON(msg));
         }
         
-        // Handle status requests
-        if (event == "status_request") {
-            string status_response;
-            {
-                lock_guard<mutex> lock(status_mutex);
-                status_response = createJSON("raspberry_pi", current_door_status);
-            }
+        // The STM32 asking for the state the Pi knows
+        if (event == Event::StatusRequest && sourceDevice == "stm32") {
+            queueForSerial(statusResponse(doorOf(msg), msg.get<Field::Id>()));
+        }
+    }
+    
+    // The door's status and version, as the reply to a status_request
+    string statusResponse(const string& door, const string& id) {
+        DoorState state = doors.get(door);
+        ProtocolMessage response = Protocol::create(Source::RaspberryPi, state.status, getCurrentTimestamp());
+        response.set<Field::Door>(door).set<Field::Id>(id).set<Field::Version>(to_string(state.version));
+        return Protocol::toJSON(response);
+    }
+    
+    void answerStatusWaiter(const StatusWaiter& waiter) {
+        shared_ptr<ClientConnection> client = waiter.client.lock();
+        if (client) sendToClient(*client, statusResponse(waiter.door, waiter.id));
+    }
+    
+    void wakeStatusWaiters(const string& door) {
+        for (const StatusWaiter& waiter : status_waiters.takeDoor(door, doors.get(door).version)) {
+            answerStatusWaiter(waiter);
+        }
+    }
+    
+    // The STM32's reply to a status query the Pi sent for laptops
+    static bool isStatusReply(const ProtocolMessage& msg) {
+        Event event = msg.event();
+        return (event == Event::StatusLocked || event == Event::StatusUnlocked) &&
+               msg.get<Field::Id>().compare(0, STATUS_QUERY_ID_PREFIX.size(), STATUS_QUERY_ID_PREFIX) == 0;
+    }
+    
+    // A plain status_request: the requester is parked and, unless a query
+    // for the door is already on its way, one goes to the STM32 under an id
+    // of the Pi's own. Its reply answers every requester parked on the door
+    // by then, each under its own id. Without a serial link, or if the
+    // reply does not come in time, the last known state is the answer.
+    void handleStatusQuery(const ProtocolMessage& msg, ClientConnection& client) {
+        string door = doorOf(msg);
+        if (!serial_connected) {
+            sendToClient(client, statusResponse(door, msg.get<Field::Id>()));
+            return;
+        }
+        
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(STATUS_REPLY_TIMEOUT_MS) +
+                        serial_coalescer.windowLength();
+        if (!status_queries.park({client.weak_from_this(), door, msg.get<Field::Id>(), 0, deadline})) return;
+        
+        ProtocolMessage query = msg;
+        query.set<Field::Id>(STATUS_QUERY_ID_PREFIX + to_string(++status_query_count));
+        queueForSerial(Protocol::toJSON(query));
+    }
+    
+    void answerStatusQueries(ProtocolMessage reply) {
+        string door = doorOf(reply);
+        reply.set<Field::Version>(to_string(doors.get(door).version));
+        for (const StatusWaiter& waiter : status_queries.takeAll(door)) {
+            shared_ptr<ClientConnection> client = waiter.client.lock();
+            if (!client) continue;
+            reply.set<Field::Id>(waiter.id);
+            sendToClient(*client, Protocol::toJSON(reply));
+        }
+    }
+    
+    // A status_request carrying the version the client has: answered at
+    // once if the door has moved on, otherwise parked until it does or
+    // "wait_ms" passes. Answered here only; the STM32 is not asked.
+    void handleStatusWait(const ProtocolMessage& msg, ClientConnection& client) {
+        string door = doorOf(msg);
+        unsigned long long known = strtoull(msg.get<Field::Version>().c_str(), nullptr, 10);
+        int wait_ms = min(STATUS_WAIT_MAX_MS, max(0, atoi(msg.get<Field::WaitMs>().c_str())));
+        
+        if (doors.get(door).version != known || wait_ms == 0) {
+            sendToClient(client, statusResponse(door, msg.get<Field::Id>()));
+            return;
+        }
+        status_waiters.park({client.weak_from_this(), door, msg.get<Field::Id>(), known,
+                             chrono::steady_clock::now() + chrono::milliseconds(wait_ms)});
+        // A change that landed before the park would otherwise wait out the timeout
+        wakeStatusWaiters(door);
+    }
+    
+    // Log and publish one event per source, door and event the rate limits
+    // held back, with how many there were. Called from the serial reader
+    // thread, which publishes every other logged event, so laptops see
+    // seqs in order.
+    void logRateSummaries() {
+        for (const EventRateLimiter::Summary& held : rate_limiter.takeSummaries()) {
+            ProtocolMessage summary;
+            summary.set<Field::Source>(held.source)
+                   .set<Field::Event>(held.event)
+                   .set<Field::Door>(held.door)
+                   .set<Field::Timestamp>(getCurrentTimestamp())
+                   .set<Field::EventCount>(to_string(held.count));
             
-            if (sourceDevice == "laptop") {
-                sendToClient(status_response);
-            } else if (sourceDevice == "stm32") {
-                sendToSerial(status_response);
+            long long seq = logToDatabase(summary, getCurrentEpochMs());
+            string text = held.event + " x " + to_string(held.count) + " in last " +
+                          to_string(rate_summary_interval.count()) + "s, door " + held.door + " (rate limited)";
+            logToTextFile(summary.get<Field::Timestamp>(), held.source, text);
+            DIAG_WARN(DIAG_SERVER) << "Rate limited: " << text << " from " << held.source;
+            
+            // Laptops are sent STM32 events only, as when they pass one by one
+            if (seq > 0) summary.set<Field::Seq>(to_string(seq));
+            if (summary.source() == Source::Stm32) publish(Protocol::toJSON(summary));
+        }
+    }
+    
+    void handleStatusTimeouts() {
+        while (running) {
+            for (const StatusWaiter& waiter : status_waiters.takeExpired(chrono::milliseconds(100))) {
+                answerStatusWaiter(waiter);
+            }
+            for (const StatusWaiter& waiter : status_queries.takeExpired(chrono::milliseconds(0))) {
+                answerStatusWaiter(waiter);
             }
         }
     }
     
-    void handleClient() {
-        while (running && client_connected) {
-            string message = readFromClient();
-            if (!message.empty()) {
-                processMessage(message, "laptop");
+    void handleClient(shared_ptr<ClientConnection> client) {
+        while (running && client->connected) {
+            for (const string& message : decodeClientMessages(*client, readFromClient(*client))) {
+                processMessage(message, "laptop", client.get());
             }
             this_thread::sleep_for(chrono::milliseconds(100));
         }
+        
+        subscriptions.unsubscribe(client->slot);
+        rate_limiter.forgetClient(client->slot);
+        lock_guard<mutex> lock(client->send_mutex);
+        client->connected = false;
+        close(client->socket);
+        DIAG_INFO(DIAG_CLIENT) << "Client " << client->slot << " disconnected";
+    }
+    
+    // Join the threads of clients that have gone and free their slots.
+    // Returns the lowest free slot, or -1 if all are taken.
+    int reapClients() {
+        int free_slot = -1;
+        for (int slot = MAX_CLIENTS - 1; slot >= 0; slot--) {
+            shared_ptr<ClientConnection> client;
+            {
+                lock_guard<mutex> lock(clients_mutex);
+                if (clients[slot] && !clients[slot]->connected) {
+                    client = clients[slot];
+                    clients[slot].reset();
+                }
+                if (!clients[slot]) free_slot = slot;
+            }
+            if (client) client->worker.join();
+        }
+        return free_slot;
     }
     
     void handleSerial() {
+        auto next_time_sync = chrono::steady_clock::now();
+        auto next_rate_summary = chrono::steady_clock::now() + rate_summary_interval;
         while (running) {
+            if (serial_connected && time_sync_interval.count() > 0 && chrono::steady_clock::now() >= next_time_sync) {
+                queueTimeSync();
+                next_time_sync = chrono::steady_clock::now() + time_sync_interval;
+            }
+            if (chrono::steady_clock::now() >= next_rate_summary) {
+                logRateSummaries();
+                next_rate_summary += rate_summary_interval;
+            }
+            if (serial_connected && reliable_link) {
+                for (const string& message : readFromSerialLink()) {
+                    processMessage(message, "stm32");
+                }
+                // Poll faster so acks go out well inside the peer's retransmit timeout
+                this_thread::sleep_for(chrono::milliseconds(10));
+                continue;
+            }
             if (serial_connected) {
-                string message = readFromSerial();
-                if (!message.empty()) {
+                for (const string& message : readFromSerial()) {
                     processMessage(message, "stm32");
                 }
             }
             this_thread::sleep_for(chrono::milliseconds(100));
         }
+        logRateSummaries();
     }
     
     void acceptConnections() {
         while (running) {
-            cout << "Waiting for client connection..." << endl;
-            client_len = sizeof(client_addr);
+            int slot = reapClients();
+            DIAG_DEBUG(DIAG_CLIENT) << "Waiting for client connection...";
+            struct sockaddr_in client_addr;
+            socklen_t client_len = sizeof(client_addr);
             
             // Set accept timeout to prevent blocking forever
             struct timeval timeout;
@@ -406,27 +2999,33 @@ public:
             timeout.tv_usec = 0;
             setsockopt(server_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
             
-            client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
+            int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
             
-            if (client_socket != -1) {
-                client_connected = true;
-                cout << "Client connected from " << inet_ntoa(client_addr.sin_addr) << endl;
+            if (client_socket != -1 && slot < 0) {
+                DIAG_WARN(DIAG_CLIENT) << "Refusing client from " << inet_ntoa(client_addr.sin_addr) << ": "
+                     << MAX_CLIENTS << " clients already connected";
+                close(client_socket);
+            } else if (client_socket != -1) {
+                DIAG_INFO(DIAG_CLIENT) << "Client " << slot << " connected from " << inet_ntoa(client_addr.sin_addr);
                 
                 // Set client socket to non-blocking for better handling
                 int flags = fcntl(client_socket, F_GETFL, 0);
                 fcntl(client_socket, F_SETFL, flags | O_NONBLOCK);
                 
-                // Handle this client in a separate thread
-                thread client_thread(&DoorServer::handleClient, this);
-                client_thread.join();
+                // Every event until the client subscribes to fewer
+                auto client = make_shared<ClientConnection>(client_socket, slot);
+                subscriptions.subscribe(slot, SubscriptionFilter());
+                {
+                    lock_guard<mutex> lock(clients_mutex);
+                    clients[slot] = client;
+                }
                 
-                cout << "Closing client connection..." << endl;
-                close(client_socket);
-                client_connected = false;
-                cout << "Client disconnected" << endl;
+                // Handle this client in a separate thread
+                client->worker = thread(&DoorServer::handleClient, this, client);
+                continue;
             } else {
                 if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    cerr << "Accept failed: " << strerror(errno) << endl;
+                    DIAG_ERROR(DIAG_SERVER) << "Accept failed: " << strerror(errno);
                 }
             }
             
@@ -435,19 +3034,42 @@ public:
     }
     
     void run() {
-        cout << "Door Control Server Starting..." << endl;
-        cout << "Database: " << (db ? "Connected" : "Failed") << endl;
-        cout << "Serial: " << (serial_connected ? "Connected" : "Disconnected") << endl;
-        cout << "Network: Listening on port 8080" << endl;
+        DIAG_INFO(DIAG_SERVER) << "Door Control Server Starting...";
+        DIAG_INFO(DIAG_SERVER) << "Database: " << (db ? "Connected" : "Failed");
+        DIAG_INFO(DIAG_SERVER) << "Serial: " << (serial_connected ? "Connected" : "Disconnected")
+                               << (reliable_link ? " (reliable link)" : "");
+        DIAG_INFO(DIAG_SERVER) << "Network: Listening on port 8080";
         
-        // Start serial handler thread
+        // Start serial handler threads
         thread serial_thread(&DoorServer::handleSerial, this);
+        thread serial_writer_thread(&DoorServer::handleSerialWriter, this);
+        thread status_timeout_thread(&DoorServer::handleStatusTimeouts, this);
         
         // Start accepting connections (blocking)
         acceptConnections();
         
         // Cleanup
         serial_thread.join();
+        serial_writer_thread.join();
+        status_timeout_thread.join();
+        for (shared_ptr<ClientConnection>& client : clients) {
+            if (client) client->worker.join();
+        }
+        
+        // The statistics go straight to stdout, after the last diagnostics
+        Diagnostics::instance().flush();
+        cout << "Events published: " << published_count << ", deliveries to laptops: " << delivered_count << endl;
+        
+        cout << "Serial commands forwarded: " << serial_coalescer.forwarded()
+             << ", coalesced away: " << serial_coalescer.suppressed() << endl;
+        serial_scheduler.printStats();
+        if (reliable_link) {
+            serial_link.printStats();
+        }
+        doors.printStats();
+        status_waiters.printStats("Status waits", "on change");
+        status_queries.printStats("Status requests", "by the STM32");
+        rate_limiter.printStats();
     }
     
     void stop() {
@@ -457,9 +3079,6 @@ public:
     void cleanup() {
         running = false;
         
-        if (client_connected) {
-            close(client_socket);
-        }
         if (server_socket != -1) {
             close(server_socket);
         }
@@ -473,9 +3092,154 @@ public:
     }
 };
 
+// Compare encode + decode cost and size of the JSON and binary formats
+void runCodecBenchmark() {
+    const int iterations = 200000;
+    const string json = "{\"source\":\"laptop\",\"event\":\"lock\",\"timestamp\":\"2025-01-01 12:00:00\"}";
+    ProtocolMessage msg = Protocol::parseJSON(json);
+    size_t checksum = 0;
+    
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        string encoded = Protocol::toJSON(msg);
+        ProtocolMessage decoded = Protocol::parseJSON(encoded);
+        checksum += decoded.get<Field::Event>().size();
+    }
+    double json_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+    
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        string encoded = WireCodec::encode(msg);
+        ProtocolMessage decoded;
+        WireCodec::decode(encoded.data(), encoded.size(), decoded);
+        checksum += decoded.get<Field::Event>().size();
+    }
+    double binary_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+    
+    size_t json_bytes = json.size() + 1;  // Plus newline on the serial port
+    size_t binary_bytes = WireCodec::encode(msg).size();
+    
+    // 10 bits per byte on the wire at 115200 baud, 8N1
+    cout << fixed << setprecision(1);
+    cout << "Format   bytes/msg   encode+decode ns/msg   serial ms/msg @115200" << endl;
+    cout << "JSON     " << setw(9) << json_bytes << setw(23) << json_ns
+         << setw(24) << json_bytes * 10 * 1000.0 / 115200 << endl;
+    cout << "binary   " << setw(9) << binary_bytes << setw(23) << binary_ns
+         << setw(24) << binary_bytes * 10 * 1000.0 / 115200 << endl;
+    cout << "(checksum " << checksum << ")" << endl;
+}
+
+// Status reads against serial-thread writes on the door registry, with
+// one shard (a single lock) and with the default sharding
+void runRegistryBenchmark() {
+    const int door_counts[] = {1, 100, 10000};
+    const size_t shard_counts[] = {1, DoorRegistry::DEFAULT_SHARDS};
+    const int writers = 2;      // The serial reader and writer threads
+    const int readers = max(2, (int)thread::hardware_concurrency() - writers);
+    const chrono::milliseconds duration(500);
+    
+    cout << "Door registry, " << writers << " writer and " << readers << " reader threads, "
+         << duration.count() << " ms per run" << endl;
+    cout << "doors   shards   reads/s (M)   writes/s (M)" << endl;
+    for (int door_count : door_counts) {
+        vector<string> ids;
+        for (int i = 0; i < door_count; i++) {
+            ids.push_back("door-" + to_string(i));
+        }
+        for (size_t shard_count : shard_counts) {
+            DoorRegistry registry(shard_count);
+            for (const string& id : ids) {
+                registry.record(id, Event::Unlock, Source::Stm32, 0);
+            }
+            
+            atomic<bool> stop(false);
+            atomic<unsigned long> reads(0), writes(0);
+            vector<thread> threads;
+            for (int t = 0; t < writers + readers; t++) {
+                threads.emplace_back([&, t]() {
+                    minstd_rand rng(t + 1);
+                    unsigned long ops = 0;
+                    while (!stop.load(memory_order_relaxed)) {
+                        const string& id = ids[rng() % ids.size()];
+                        if (t < writers) {
+                            registry.record(id, (ops & 1) ? Event::Lock : Event::Unlock, Source::Stm32, ops);
+                        } else if (registry.get(id).status == Event::StatusUnknown) {
+                            break;
+                        }
+                        ops++;
+                    }
+                    (t < writers ? writes : reads) += ops;
+                });
+            }
+            this_thread::sleep_for(duration);
+            stop = true;
+            for (thread& t : threads) {
+                t.join();
+            }
+            
+            double seconds = chrono::duration<double>(duration).count();
+            cout << fixed << setprecision(2) << setw(5) << door_count << setw(9) << shard_count
+                 << setw(14) << reads / seconds / 1e6 << setw(15) << writes / seconds / 1e6 << endl;
+        }
+    }
+}
+
 // Global server instance for signal handling
 DoorServer* global_server = nullptr;
 
+// Message handling with its per-message diagnostics filtered out, going
+// through the logger, and written with cout and endl as before the logger.
+// Output goes to /dev/null, so this is the cost on the handling thread.
+void runDiagnosticsBenchmark() {
+    const int messages = 200000;
+    const string json = "{\"source\":\"laptop\",\"event\":\"lock\",\"door\":\"front_door\","
+                        "\"timestamp\":\"2025-01-01 12:00:00\"}";
+    const char* const modes[] = {"off (level info)", "logger", "logger, rate limited", "cout + endl"};
+    Diagnostics& diagnostics = Diagnostics::instance();
+    int null_fd = open("/dev/null", O_WRONLY);
+    ofstream null_stream("/dev/null");
+    size_t checksum = 0;
+    
+    diagnostics.start(null_fd, null_fd);
+    cout << "Diagnostics             msgs/s (k)   ns/msg   lines written   dropped" << endl;
+    for (int mode = 0; mode < 4; mode++) {
+        diagnostics.setLevel(mode == 0 ? DIAG_LEVEL_INFO : DIAG_LEVEL_DEBUG);
+        diagnostics.setSiteLimit(mode == 2 ? DIAG_SITE_LINES_PER_S : 0);
+        unsigned long written, dropped;
+        diagnostics.takeCounts(written, dropped);
+        
+        // The lines processMessage and sendToSerial write for a forwarded lock
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < messages; i++) {
+            ProtocolMessage msg = Protocol::parseJSON(json);
+            string forwarded = Protocol::toJSON(msg);
+            checksum += forwarded.size();
+            if (mode == 3) {
+                null_stream << "Received from laptop: " << json << endl;
+                null_stream << "Processing: " << msg.get<Field::Event>() << " from " << msg.get<Field::Source>()
+                            << " at " << msg.get<Field::Timestamp>() << endl;
+                null_stream << "Sent to STM32: " << forwarded << endl;
+            } else {
+                DIAG_DEBUG(DIAG_CLIENT) << "Received from laptop: " << json;
+                DIAG_DEBUG(DIAG_SERVER) << "Processing: " << msg.get<Field::Event>() << " from "
+                                        << msg.get<Field::Source>() << " at " << msg.get<Field::Timestamp>();
+                DIAG_DEBUG(DIAG_SERIAL) << "Sent to STM32: " << forwarded;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        diagnostics.flush();
+        diagnostics.takeCounts(written, dropped);
+        if (mode == 3) written = 3UL * messages;
+        cout << fixed << setprecision(0) << left << setw(22) << modes[mode] << right
+             << setw(12) << messages / seconds / 1000 << setw(10) << seconds * 1e9 / messages
+             << setw(16) << written << setw(10) << dropped << endl;
+    }
+    diagnostics.stop();
+    close(null_fd);
+    cout << "(checksum " << checksum << "; build with -DSLAL_LOG_MIN_LEVEL=1 to compile the debug lines out)" << endl;
+}
+
 void signalHandler(int signal) {
     cout << "\nShutting down server..." << endl;
     if (global_server) {
@@ -483,15 +3247,79 @@ void signalHandler(int signal) {
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    DiagLevel log_level = DIAG_LEVEL_INFO;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--coalesce-window" && i + 1 < argc) {
+            config.coalesce_window_ms = max(0, atoi(argv[++i]));
+        } else if (arg == "--aging-interval" && i + 1 < argc) {
+            config.aging_interval_ms = max(0, atoi(argv[++i]));
+        } else if (arg == "--reliable-link") {
+            config.reliable_link = true;
+        } else if (arg == "--link-rto" && i + 1 < argc) {
+            config.link_rto_ms = max(10, atoi(argv[++i]));
+        } else if (arg == "--link-error-rate" && i + 1 < argc) {
+            config.link_error_rate = atof(argv[++i]);
+        } else if (arg == "--serial-binary") {
+            config.serial_binary = true;
+        } else if (arg == "--time-sync-interval" && i + 1 < argc) {
+            config.time_sync_interval_s = max(0, atoi(argv[++i]));
+        } else if (arg == "--serial-port" && i + 1 < argc) {
+            config.serial_port = argv[++i];
+        } else if (arg == "--source-rate" && i + 1 < argc) {
+            config.source_rate = RateLimit::parse(argv[++i]);
+        } else if (arg == "--door-rate" && i + 1 < argc) {
+            config.door_rate = RateLimit::parse(argv[++i]);
+        } else if (arg == "--client-rate" && i + 1 < argc) {
+            config.client_rate = RateLimit::parse(argv[++i]);
+        } else if (arg == "--rate-summary-interval" && i + 1 < argc) {
+            config.rate_summary_interval_s = max(1, atoi(argv[++i]));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            if (!Diagnostics::parseLevel(argv[++i], log_level)) {
+                cerr << "Unknown log level: " << argv[i] << " (debug, info, warn, error or off)" << endl;
+                return 1;
+            }
+        } else if (arg == "--codec-benchmark") {
+            runCodecBenchmark();
+            return 0;
+        } else if (arg == "--registry-benchmark") {
+            runRegistryBenchmark();
+            return 0;
+        } else if (arg == "--diagnostics-benchmark") {
+            runDiagnosticsBenchmark();
+            return 0;
+        } else {
+            cerr << "Unknown option: " << arg << endl;
+            cerr << "Usage: " << argv[0] << " [--coalesce-window <ms>] [--aging-interval <ms>]"
+                 << " [--reliable-link] [--link-rto <ms>] [--link-error-rate <p>]"
+                 << " [--serial-binary] [--time-sync-interval <s>] [--serial-port <path>]"
+                 << " [--source-rate <n>[:<burst>]] [--door-rate <n>[:<burst>]]"
+                 << " [--client-rate <n>[:<burst>]] [--rate-summary-interval <s>]"
+                 << " [--log-level <level>] [--codec-benchmark] [--registry-benchmark]"
+                 << " [--diagnostics-benchmark]" << endl;
+            return 1;
+        }
+    }
+    
     // Setup signal handlers for graceful shutdown
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
     
-    DoorServer server;
+    if (config.serial_binary && !config.reliable_link) {
+        cerr << "--serial-binary requires --reliable-link" << endl;
+        return 1;
+    }
+    
+    Diagnostics::instance().setLevel(log_level);
+    Diagnostics::instance().start();
+    
+    DoorServer server(config);
     global_server = &server;
     
     server.run();
+    Diagnostics::instance().stop();
     
     return 0;
 }
\ No newline at end of file
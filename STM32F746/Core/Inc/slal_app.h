@@ -0,0 +1,88 @@
+/**
+  ******************************************************************************
+  * @file    slal_app.h
+  * @brief   Door controller application: commands from the Pi, local inputs.
+  *
+  *          Ties the firmware modules together for one door:
+  *            - JSON lines from the Pi arrive through slal_uart_rx and are
+  *              decoded with slal_msg. "lock" and "unlock" drive the lock
+  *              output; these and "status_request" are answered with the
+  *              resulting "LOCKED" / "UNLOCKED" status, echoing the "id".
+  *              "time_sync" sets the RTC and "ack" releases journal entries.
+  *            - Local inputs (slal_input) lock and unlock the door, and a
+  *              door opened while locked is an "error". These events are
+  *              written to the flash journal and sent to the Pi as "journal"
+  *              batches, one at a time, until each is acknowledged.
+  *              Every event goes through the journal, link up or not: one
+  *              path keeps them in order and lets the Pi drop a batch it
+  *              has already stored. The cost is a sector erase every couple
+  *              of thousand events, which stalls code running from flash for
+  *              one to two seconds. It is only started after the Pi has
+  *              been quiet for SLAL_APP_ERASE_IDLE_MS with no batch in
+  *              flight. Input edges meanwhile are stamped when it ends,
+  *              and bytes from the Pi wait in the DMA buffer.
+  *
+  *          The serial framing follows the Pi's options, and Serial in the
+  *          configuration must match them:
+  *            - SLAL_APP_SERIAL_LINES: JSON lines (the Pi's default)
+  *            - SLAL_APP_SERIAL_LINK: JSON payloads over slal_link
+  *              (--reliable-link)
+  *            - SLAL_APP_SERIAL_BINARY: slal_wire.h payloads over slal_link
+  *              (--reliable-link --serial-binary)
+  *
+  *          Written against the HAL only, so it runs unchanged on the board
+  *          and on a host against the emulated HAL in STM32F746/Host.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_APP_H
+#define SLAL_APP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "stm32f7xx_hal.h"
+#include "slal_input.h"
+
+#define SLAL_APP_ACK_TIMEOUT_MS  2000U    /* Journal batch resent after this */
+#define SLAL_APP_ERASE_IDLE_MS   1000U    /* Link quiet this long before a journal erase */
+
+/* SLAL_AppConfigTypeDef.Serial */
+#define SLAL_APP_SERIAL_LINES    0U
+#define SLAL_APP_SERIAL_LINK     1U
+#define SLAL_APP_SERIAL_BINARY   2U
+
+typedef struct
+{
+  const char                    *Door;
+  UART_HandleTypeDef            *Uart;
+  uint8_t                        Serial;        /* SLAL_APP_SERIAL_* */
+  RTC_HandleTypeDef             *Rtc;
+  GPIO_TypeDef                  *LockPort;      /* Set while locked */
+  uint16_t                       LockPin;
+  const SLAL_InputConfigTypeDef *Inputs;
+  uint8_t                        InputCount;
+} SLAL_AppConfigTypeDef;
+
+typedef struct
+{
+  uint32_t Commands;
+  uint32_t Malformed;
+  uint32_t LocalEvents;
+  uint32_t Batches;
+  uint32_t Resends;             /* Batches not acknowledged in time */
+  uint32_t TxDropped;           /* Replies with no room in the link window */
+} SLAL_AppStatsTypeDef;
+
+void    SLAL_App_Init(const SLAL_AppConfigTypeDef *config);
+void    SLAL_App_Poll(void);
+uint8_t SLAL_App_IsLocked(void);
+const SLAL_AppStatsTypeDef *SLAL_App_GetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_APP_H */
@@ -0,0 +1,92 @@
+/**
+  ******************************************************************************
+  * @file    slal_input.h
+  * @brief   Local lock buttons and door sensors on EXTI interrupts.
+  *
+  *          Every input pin raises an EXTI interrupt on both edges. The
+  *          interrupt only samples the pin, stamps it with the tick and puts
+  *          the edge in a single-producer single-consumer ring; the main
+  *          loop drains the ring in SLAL_Input_Poll() and debounces there.
+  *
+  *          Debouncing acts on the leading edge: the first change after a
+  *          quiet input is delivered at once, then further edges are only
+  *          counted as bounces until the input's debounce time has passed.
+  *          At the end of that window the pin is read again, and if it
+  *          settled on the other level that change is delivered too. So a
+  *          press is seen as soon as the main loop runs, not a debounce
+  *          time later, and no input is polled while it is quiet.
+  *
+  *          The ring has one producer, so all EXTI interrupts used here must
+  *          share one preemption priority (0 in STM32F746.ioc).
+  *
+  *          Pin access is a callback and time is passed in, so the ring and
+  *          the debounce state machine also build and run on a host.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_INPUT_H
+#define SLAL_INPUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifdef USE_HAL_DRIVER
+#include "stm32f7xx_hal.h"
+#endif
+
+#define SLAL_INPUT_MAX          8U
+#define SLAL_INPUT_QUEUE_SIZE   32U       /* Power of two */
+#define SLAL_INPUT_DEBOUNCE_MS  20U
+
+typedef enum
+{
+  SLAL_INPUT_LOCK_TOGGLE = 0,   /* Push button: lock if unlocked and vice versa */
+  SLAL_INPUT_LOCK,
+  SLAL_INPUT_UNLOCK,
+  SLAL_INPUT_DOOR_SENSOR        /* Active while the door is closed */
+} SLAL_InputKind;
+
+typedef struct
+{
+  const char     *Door;
+  SLAL_InputKind  Kind;
+  uint8_t         ActiveLow;    /* Pulled up, switch to ground */
+  uint16_t        DebounceMs;   /* 0 for SLAL_INPUT_DEBOUNCE_MS */
+#ifdef USE_HAL_DRIVER
+  GPIO_TypeDef   *Port;
+  uint16_t        Pin;          /* GPIO_PIN_x; one input per EXTI line */
+#endif
+} SLAL_InputConfigTypeDef;
+
+/* Raw pin level, 0 or 1 */
+typedef uint8_t (*SLAL_InputReadFn)(uint8_t input);
+/* A debounced change; edge_ms is when the interrupt saw it */
+typedef void (*SLAL_InputFn)(const SLAL_InputConfigTypeDef *input, uint8_t active, uint32_t edge_ms);
+
+typedef struct
+{
+  uint32_t Edges;
+  uint32_t Changes;             /* Delivered */
+  uint32_t Bounces;             /* Edges inside a debounce window */
+  uint32_t Overflows;           /* Edges lost to a full queue; inputs were read again */
+} SLAL_InputStatsTypeDef;
+
+void    SLAL_Input_Init(const SLAL_InputConfigTypeDef *inputs, uint8_t count,
+                        SLAL_InputReadFn read, SLAL_InputFn deliver);
+void    SLAL_Input_Edge(uint8_t input, uint8_t level, uint32_t now_ms);
+void    SLAL_Input_Poll(uint32_t now_ms);
+uint8_t SLAL_Input_IsActive(uint8_t input);
+const SLAL_InputStatsTypeDef *SLAL_Input_GetStats(void);
+
+#ifdef USE_HAL_DRIVER
+void    SLAL_Input_Start(const SLAL_InputConfigTypeDef *inputs, uint8_t count, SLAL_InputFn deliver);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_INPUT_H */
@@ -0,0 +1,89 @@
+/**
+  ******************************************************************************
+  * @file    slal_journal.h
+  * @brief   Flash journal of door events the Pi has not acknowledged.
+  *
+  *          Events are appended as fixed 32-byte records to the flash sector
+  *          reserved as JOURNAL in STM32F746NGHX_FLASH.ld. Writes move through
+  *          the whole sector before it is erased again, which spreads the
+  *          wear. An acknowledgement from the Pi is appended as another
+  *          record, so nothing is ever rewritten in place. After a reset the
+  *          sector is scanned to rebuild the state; a record cut short by a
+  *          power loss fails its CRC and is skipped.
+  *
+  *          On reconnect the backlog goes to the Pi as "journal" messages of
+  *          several events each. The Pi stores each batch in one transaction
+  *          and answers with an "ack" carrying the batch's id, which is the
+  *          journal seq of its last event. Seqs carry on from the sector, so
+  *          they only start again with an empty one; each batch also carries
+  *          the journal's "epoch", which changes then, and the Pi keeps the
+  *          last seq it stored per device and epoch.
+  *
+  *          Erasing the sector takes one to two seconds, and any fetch from
+  *          flash stalls until it ends. So the erase runs in the background
+  *          and is only started from SLAL_Journal_Poll() when the caller says
+  *          the link is idle. Events appended meanwhile wait in RAM, up to
+  *          SLAL_JOURNAL_HOLD of them, and are written once it has finished.
+  *
+  *          Flash access goes through SLAL_JournalFlashTypeDef, so the
+  *          journal also runs on a host against a RAM copy of the sector.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_JOURNAL_H
+#define SLAL_JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "slal_protocol.h"
+#include "slal_msg.h"
+
+#define SLAL_JOURNAL_RECORD_SIZE  32U
+#define SLAL_JOURNAL_DOOR_LEN     12U
+#define SLAL_JOURNAL_HOLD         8U      /* Events kept in RAM while erasing */
+
+/* EraseStatus() results */
+#define SLAL_JOURNAL_ERASE_BUSY    0U
+#define SLAL_JOURNAL_ERASE_DONE    1U
+#define SLAL_JOURNAL_ERASE_FAILED  2U
+
+typedef struct
+{
+  uint8_t  (*EraseStart)(void);                             /* Whole region, in the background; 1 if started */
+  uint8_t  (*EraseStatus)(void);                            /* SLAL_JOURNAL_ERASE_* */
+  uint8_t  (*Program)(uint32_t offset, const uint32_t *words, uint16_t count);
+  const uint8_t *Base;                                      /* Region as mapped for reading */
+  uint32_t Size;
+} SLAL_JournalFlashTypeDef;
+
+typedef struct
+{
+  uint32_t Appended;
+  uint32_t Dropped;         /* Journal full of unacknowledged events */
+  uint32_t Erases;
+  uint32_t EraseFailures;
+  uint32_t Corrupt;         /* Records skipped by the last scan */
+} SLAL_JournalStatsTypeDef;
+
+void     SLAL_Journal_Init(const SLAL_JournalFlashTypeDef *flash);
+uint8_t  SLAL_Journal_Append(SLAL_Event event, const char *door, int64_t device_ms);
+uint32_t SLAL_Journal_Pending(void);
+uint16_t SLAL_Journal_NextBatch(char *out, uint16_t max, SLAL_MsgEncodeFn encode, const char *device,
+                                uint32_t *last_seq);
+void     SLAL_Journal_Rewind(void);
+void     SLAL_Journal_Ack(uint32_t seq);
+void     SLAL_Journal_Poll(uint8_t link_idle);
+const SLAL_JournalStatsTypeDef *SLAL_Journal_GetStats(void);
+
+#ifdef USE_HAL_DRIVER
+void     SLAL_Journal_InitFlash(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_JOURNAL_H */
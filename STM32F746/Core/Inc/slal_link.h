@@ -0,0 +1,70 @@
+/**
+  ******************************************************************************
+  * @file    slal_link.h
+  * @brief   Reliable serial link layer between the STM32 and the Raspberry Pi.
+  *
+  *          Must match SerialLink in Raspberry-Pi-3B/SLAL-rasppi.cpp.
+  *          Each frame is COBS encoded and terminated by a 0x00 byte:
+  *            type(1) seq(1) ack(1) payload(0..SLAL_LINK_MAX_PAYLOAD) crc16(2)
+  *          ack is the next sequence number expected from the peer
+  *          (cumulative), the CRC is CRC-16/CCITT-FALSE over type..payload,
+  *          big endian. Data frames use Go-Back-N with a SLAL_LINK_WINDOW
+  *          frame window; a RESET frame announces the next sequence number.
+  *          Until a side has had a RESET or the DATA frame it expects, its
+  *          ack means nothing, and it sets SLAL_LINK_NO_ACK in the type of
+  *          its frames. The ack of a RESET frame is ignored too.
+  *
+  *          The module is HAL independent: bytes go out through a callback
+  *          and time is passed in, so it also builds on a host.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_LINK_H
+#define SLAL_LINK_H
+
+#include <stdint.h>
+#include "slal_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLAL_LINK_DATA          0x01U
+#define SLAL_LINK_ACK           0x02U
+#define SLAL_LINK_RESET         0x03U
+#define SLAL_LINK_NO_ACK        0x80U     /* Type flag: ignore this frame's ack */
+
+#define SLAL_LINK_WINDOW        8U
+#define SLAL_LINK_MAX_RETRIES   5U
+#define SLAL_LINK_RTO_MS        250U
+
+/* Encoded frame size beyond the payload: header, CRC, COBS overhead and
+   delimiter */
+#define SLAL_LINK_OVERHEAD      (3U + 2U + 2U + 1U)
+#define SLAL_LINK_MAX_FRAME     (SLAL_LINK_MAX_PAYLOAD + SLAL_LINK_OVERHEAD)
+
+typedef void (*SLAL_LinkWriteFn)(const uint8_t *data, uint16_t len);
+typedef void (*SLAL_LinkDeliverFn)(const uint8_t *payload, uint16_t len);
+
+typedef struct
+{
+  uint32_t FramesSent;
+  uint32_t Retransmissions;
+  uint32_t CrcErrors;
+  uint32_t OutOfOrder;
+} SLAL_LinkStatsTypeDef;
+
+void     SLAL_Link_Init(SLAL_LinkWriteFn write, SLAL_LinkDeliverFn deliver, uint8_t initial_seq);
+void     SLAL_Link_RxByte(uint8_t byte);
+void     SLAL_Link_RxFrame(const uint8_t *frame, uint16_t len);
+uint8_t  SLAL_Link_CanSend(void);
+uint8_t  SLAL_Link_Send(const uint8_t *payload, uint16_t len, uint32_t now_ms);
+void     SLAL_Link_Poll(uint32_t now_ms);
+uint16_t SLAL_Link_Crc16(const uint8_t *data, uint16_t len);
+const SLAL_LinkStatsTypeDef *SLAL_Link_GetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_LINK_H */
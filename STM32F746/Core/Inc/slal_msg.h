@@ -0,0 +1,98 @@
+/**
+  ******************************************************************************
+  * @file    slal_msg.h
+  * @brief   Door protocol JSON encoder and decoder without the heap.
+  *
+  *          Must match Protocol::toJSON() and Protocol::parseJSON() in
+  *          Common/slal_protocol.h byte for byte: fields in schema order,
+  *          required fields always, optional fields only when set, no
+  *          whitespace and no escaping. Keys and event and source names come
+  *          from the schema's C view.
+  *
+  *          A message holds no text of its own. Each field points at its
+  *          value, either in the buffer it was decoded from or in storage
+  *          the caller keeps alive until the message is encoded. Encoding
+  *          writes into a caller buffer and fails rather than truncate, so
+  *          nothing is allocated and the bounds are fixed at compile time.
+  *
+  *          SLAL_Msg_EncodeWire() and SLAL_Msg_DecodeWire() do the same for
+  *          the binary format of Common/slal_wire.h (WireCodec), which the
+  *          Pi uses on the link with --serial-binary. The timestamp travels
+  *          as UTC milliseconds; decoding formats it into a caller buffer.
+  *
+  *          With USE_HAL_DRIVER each encode and decode is timed with the DWT
+  *          cycle counter (core_cm7.h); a host build can define
+  *          SLAL_MSG_CYCLES() to any counter of its own.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_MSG_H
+#define SLAL_MSG_H
+
+#include <stdint.h>
+#include "slal_protocol.h"
+#include "slal_rtc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest message either way; a link payload or a received line */
+#define SLAL_MSG_MAX_JSON   256U
+
+/* Encoded size of a field other than its value: the ',' before it, the
+   quoted key, ':' and the quotes around the value. A message adds
+   SLAL_MSG_BRACES. Key lengths come from the schema, e.g.
+   SLAL_MSG_FIELD_SIZE(Entries). */
+#define SLAL_MSG_KEY_LEN(name, key, req)  SLAL_MSG_KEY_LEN_##name = sizeof(key) - 1U,
+enum { SLAL_FIELD_LIST(SLAL_MSG_KEY_LEN) SLAL_MSG_KEY_LEN_END };
+#define SLAL_MSG_FIELD_SIZE(name)         ((uint16_t)SLAL_MSG_KEY_LEN_##name + 6U)
+#define SLAL_MSG_BRACES                   2U
+
+typedef struct
+{
+  const char *Value;            /* Not terminated; NULL when unset */
+  uint16_t    Len;
+} SLAL_MsgFieldTypeDef;
+
+typedef struct
+{
+  SLAL_MsgFieldTypeDef Fields[SLAL_FIELD_COUNT];
+} SLAL_MessageTypeDef;
+
+/* SLAL_Msg_Encode or SLAL_Msg_EncodeWire */
+typedef uint16_t (*SLAL_MsgEncodeFn)(const SLAL_MessageTypeDef *msg, char *out, uint16_t max);
+
+typedef struct
+{
+  uint32_t Encodes;
+  uint32_t Decodes;
+  uint32_t Rejected;            /* Did not fit, or not a complete message */
+  uint32_t LastEncodeCycles;
+  uint32_t MaxEncodeCycles;
+  uint32_t LastDecodeCycles;
+  uint32_t MaxDecodeCycles;
+} SLAL_MsgStatsTypeDef;
+
+void        SLAL_Msg_Init(SLAL_MessageTypeDef *msg, SLAL_Source source, SLAL_Event event, const char *timestamp);
+void        SLAL_Msg_Set(SLAL_MessageTypeDef *msg, SLAL_Field field, const char *value, uint16_t len);
+void        SLAL_Msg_SetText(SLAL_MessageTypeDef *msg, SLAL_Field field, const char *value);
+uint8_t     SLAL_Msg_Is(const SLAL_MessageTypeDef *msg, SLAL_Field field, const char *text);
+SLAL_Event  SLAL_Msg_Event(const SLAL_MessageTypeDef *msg);
+SLAL_Source SLAL_Msg_Source(const SLAL_MessageTypeDef *msg);
+uint16_t    SLAL_Msg_Encode(const SLAL_MessageTypeDef *msg, char *out, uint16_t max);
+uint8_t     SLAL_Msg_Decode(const char *json, uint16_t len, SLAL_MessageTypeDef *msg);
+uint16_t    SLAL_Msg_EncodeWire(const SLAL_MessageTypeDef *msg, char *out, uint16_t max);
+uint8_t     SLAL_Msg_DecodeWire(const char *data, uint16_t len, SLAL_MessageTypeDef *msg,
+                                char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U]);
+const SLAL_MsgStatsTypeDef *SLAL_Msg_GetStats(void);
+
+#ifdef USE_HAL_DRIVER
+void        SLAL_Msg_ProfileInit(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_MSG_H */
@@ -0,0 +1,74 @@
+/**
+  ******************************************************************************
+  * @file    slal_rtc.h
+  * @brief   Sub-second event timestamps from the RTC, synced from the Pi.
+  *
+  *          The RTC runs in UTC, and so do the "YYYY-MM-DD HH:MM:SS"
+  *          timestamps formatted from it, as the Pi and the clients stamp
+  *          theirs. SLAL_Rtc_NowMs() reads it as milliseconds
+  *          since the Unix epoch, using the sub-second register, so events
+  *          can carry their actuation time in the "device_ms" field.
+  *          The Pi sends a "time_sync" whose "sent_ms" is stamped just
+  *          before it is written; SLAL_Rtc_Sync() adds the time the message
+  *          took on the wire and sets the RTC to the result.
+  *
+  *          Calendar conversion and number formatting do not use the HAL and
+  *          also build on a host; the RTC access needs USE_HAL_DRIVER.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_RTC_H
+#define SLAL_RTC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifdef USE_HAL_DRIVER
+#include "stm32f7xx_hal.h"
+#endif
+
+#define SLAL_RTC_LINK_BAUD      115200U   /* USART1, for the sync transit time */
+#define SLAL_RTC_MS_DIGITS      20U       /* Longest formatted int64 with sign */
+#define SLAL_RTC_TIMESTAMP_LEN  19U       /* "YYYY-MM-DD HH:MM:SS" */
+
+typedef struct
+{
+  uint16_t Year;        /* 1970.. */
+  uint8_t  Month;       /* 1..12 */
+  uint8_t  Day;         /* 1..31 */
+  uint8_t  WeekDay;     /* 1 = Monday .. 7 = Sunday, as the RTC counts */
+  uint8_t  Hours;
+  uint8_t  Minutes;
+  uint8_t  Seconds;
+  uint16_t Millis;
+} SLAL_CalendarTypeDef;
+
+typedef struct
+{
+  uint32_t Syncs;
+  int32_t  LastCorrectionMs;    /* Pi time minus RTC time at the last sync */
+} SLAL_RtcStatsTypeDef;
+
+int64_t  SLAL_Rtc_ToEpochMs(const SLAL_CalendarTypeDef *cal);
+void     SLAL_Rtc_FromEpochMs(int64_t epoch_ms, SLAL_CalendarTypeDef *cal);
+uint16_t SLAL_Rtc_FormatMs(int64_t ms, char *out);
+void     SLAL_Rtc_FormatTimestamp(int64_t epoch_ms, char *out);
+uint8_t  SLAL_Rtc_ParseMs(const char *text, uint16_t len, int64_t *ms);
+uint8_t  SLAL_Rtc_ParseTimestamp(const char *text, uint16_t len, int64_t *epoch_ms);
+uint32_t SLAL_Rtc_TransitMs(uint16_t wire_len);
+
+#ifdef USE_HAL_DRIVER
+void     SLAL_Rtc_Init(RTC_HandleTypeDef *hrtc);
+int64_t  SLAL_Rtc_NowMs(void);
+uint8_t  SLAL_Rtc_Sync(int64_t pi_ms, uint16_t wire_len);
+const SLAL_RtcStatsTypeDef *SLAL_Rtc_GetStats(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_RTC_H */
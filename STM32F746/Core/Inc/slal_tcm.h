@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file    slal_tcm.h
+  * @brief   Placement of hot code and data in the tightly coupled memories.
+  *
+  *          Code runs from flash at 0x08000000 through the ART accelerator,
+  *          with wait states on every miss, and data lives in SRAM1 behind
+  *          the AXI bus and the D-cache. The 16K ITCM at 0x00000000 and the
+  *          64K DTCM at 0x20000000 are zero wait state and sit beside the
+  *          core, so interrupt handlers and the receive path tagged below
+  *          run in a fixed number of cycles.
+  *
+  *          SLAL_ITCM puts a function in .itcm_text, SLAL_DTCM_DATA an
+  *          initialised variable in .dtcm_data and SLAL_DTCM_BSS a zeroed
+  *          one in .dtcm_bss (STM32F746NGHX_FLASH.ld). DTCM is for buffers
+  *          only the CPU touches; DMA buffers stay in SRAM1.
+  *
+  *          Nothing is in the TCMs until SLAL_Tcm_Init() copies it there,
+  *          which main() must call before HAL_Init() (see slal_tcm.c).
+  *
+  *          check_tcm.sh reads the map file after linking and fails the
+  *          build if a tagged object's section did not land in its TCM.
+  *
+  *          Without USE_HAL_DRIVER the macros are empty, so tagged code
+  *          still builds on a host.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_TCM_H
+#define SLAL_TCM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef USE_HAL_DRIVER
+/* noinline, or the body is copied into flash callers and the tag is moot */
+#define SLAL_ITCM       __attribute__((section(".itcm_text"), noinline))
+#define SLAL_DTCM_DATA  __attribute__((section(".dtcm_data")))
+#define SLAL_DTCM_BSS   __attribute__((section(".dtcm_bss")))
+
+void SLAL_Tcm_Init(void);
+#else
+#define SLAL_ITCM
+#define SLAL_DTCM_DATA
+#define SLAL_DTCM_BSS
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_TCM_H */
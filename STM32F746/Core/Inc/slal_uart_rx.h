@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file    slal_uart_rx.h
+  * @brief   USART1 reception through circular DMA and the idle-line event.
+  *
+  *          The DMA writes every received byte into a circular buffer with
+  *          no CPU involvement. The HAL reports the write position on idle
+  *          line, half transfer and transfer complete, and the callback only
+  *          adds the bytes since the last report to a counter. The main loop
+  *          calls SLAL_UartRx_Poll(), which hands the new bytes to a frame
+  *          extractor in at most two contiguous runs. The extractor finds
+  *          delimiters with memchr and delivers whole frames: '\n' ends a
+  *          JSON line, 0x00 ends a link frame (slal_link.h).
+  *
+  *          Only SLAL_UartRx_Start() and the HAL callbacks need the HAL; they
+  *          are built when USE_HAL_DRIVER is defined, so the extractor and the
+  *          ring bookkeeping also build and run on a host.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_UART_RX_H
+#define SLAL_UART_RX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifdef USE_HAL_DRIVER
+#include "stm32f7xx_hal.h"
+#endif
+
+/* Power of two. At 115200 baud 512 bytes last 44 ms; the main loop must
+   poll at least that often or bytes are overwritten (counted as Overruns). */
+#define SLAL_UART_RX_DMA_SIZE   512U
+#define SLAL_UART_RX_MAX_FRAME  256U
+
+typedef void (*SLAL_RxFrameFn)(const uint8_t *frame, uint16_t len);
+
+typedef struct
+{
+  uint8_t        Delimiter;
+  SLAL_RxFrameFn Deliver;
+  uint8_t        Frame[SLAL_UART_RX_MAX_FRAME];
+  uint16_t       Len;
+  uint8_t        Oversized;     /* Current frame too long; dropped at its delimiter */
+  uint32_t       Frames;
+  uint32_t       OversizedFrames;
+} SLAL_FrameExtractorTypeDef;
+
+typedef struct
+{
+  uint32_t Bytes;
+  uint32_t Frames;
+  uint32_t OversizedFrames;
+  uint32_t Overruns;            /* Reader lapped by the DMA; bytes lost */
+  uint32_t UartErrors;          /* Reception restarted after an error */
+} SLAL_UartRxStatsTypeDef;
+
+void SLAL_Frame_Init(SLAL_FrameExtractorTypeDef *fx, uint8_t delimiter, SLAL_RxFrameFn deliver);
+void SLAL_Frame_Reset(SLAL_FrameExtractorTypeDef *fx);
+void SLAL_Frame_Feed(SLAL_FrameExtractorTypeDef *fx, const uint8_t *data, uint16_t len);
+
+void     SLAL_UartRx_Init(uint8_t delimiter, SLAL_RxFrameFn deliver);
+uint8_t *SLAL_UartRx_Buffer(void);
+void     SLAL_UartRx_Event(uint16_t write_pos);
+void     SLAL_UartRx_Error(void);
+void     SLAL_UartRx_Poll(void);
+const SLAL_UartRxStatsTypeDef *SLAL_UartRx_GetStats(void);
+
+#ifdef USE_HAL_DRIVER
+HAL_StatusTypeDef SLAL_UartRx_Start(UART_HandleTypeDef *huart);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAL_UART_RX_H */
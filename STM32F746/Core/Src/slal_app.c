@@ -0,0 +1,315 @@
+/**
+  ******************************************************************************
+  * @file    slal_app.c
+  * @brief   Door controller application: commands from the Pi, local inputs.
+  *          See slal_app.h.
+  *
+  *          Usage:
+  *            - SLAL_Tcm_Init() at the top of main(), see slal_tcm.c
+  *            - after the MX_*_Init() calls: SLAL_App_Init() with a static
+  *              configuration naming the door, USART1 and its framing, the
+  *              RTC, the lock output and the input table
+  *            - SLAL_App_Poll() from the main loop, as often as possible
+  ******************************************************************************
+  */
+
+#include "slal_app.h"
+#include "slal_journal.h"
+#include "slal_link.h"
+#include "slal_msg.h"
+#include "slal_rtc.h"
+#include "slal_uart_rx.h"
+#include <string.h>
+
+#define APP_TX_TIMEOUT_MS  100U
+
+/* A whole link frame fits the UART frame extractor */
+typedef char AppLinkFrameCheck[(SLAL_LINK_MAX_FRAME <= SLAL_UART_RX_MAX_FRAME) ? 1 : -1];
+
+static const SLAL_AppConfigTypeDef *app;
+static SLAL_MsgEncodeFn app_encode;
+static uint16_t tx_max;
+static uint8_t locked;
+static uint8_t batch_in_flight;
+static uint32_t batch_seq;
+static uint32_t batch_sent_ms;
+static uint32_t last_rx_ms;
+static char tx_line[SLAL_MSG_MAX_JSON + 1U];
+static char rx_timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+static SLAL_AppStatsTypeDef app_stats;
+
+/* Send the len bytes encoded in tx_line as a line or a link payload;
+   returns 0 if the link window is full */
+static uint8_t App_Write(uint16_t len)
+{
+  if (app->Serial == SLAL_APP_SERIAL_LINES)
+  {
+    tx_line[len++] = '\n';
+    (void)HAL_UART_Transmit(app->Uart, (uint8_t *)tx_line, len, APP_TX_TIMEOUT_MS);
+    return 1U;
+  }
+  return SLAL_Link_Send((const uint8_t *)tx_line, len, HAL_GetTick());
+}
+
+static void App_Send(const SLAL_MessageTypeDef *msg)
+{
+  uint16_t len = app_encode(msg, tx_line, tx_max);
+
+  if ((len > 0U) && (App_Write(len) == 0U))
+  {
+    app_stats.TxDropped++;
+  }
+}
+
+/* Encoded link frames out to the Pi */
+static void App_LinkWrite(const uint8_t *data, uint16_t len)
+{
+  (void)HAL_UART_Transmit(app->Uart, (uint8_t *)data, len, APP_TX_TIMEOUT_MS);
+}
+
+/* Stamped in UTC from the RTC, the timestamp to the second and device_ms
+   to the millisecond */
+static void App_SendStatus(const SLAL_MsgFieldTypeDef *id)
+{
+  SLAL_MessageTypeDef msg;
+  char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  char device_ms[SLAL_RTC_MS_DIGITS + 1U];
+  int64_t now = SLAL_Rtc_NowMs();
+
+  SLAL_Rtc_FormatTimestamp(now, timestamp);
+  SLAL_Msg_Init(&msg, SLAL_SOURCE_Stm32, (locked != 0U) ? SLAL_EVENT_StatusLocked : SLAL_EVENT_StatusUnlocked,
+                timestamp);
+  SLAL_Msg_SetText(&msg, SLAL_FIELD_Door, app->Door);
+  SLAL_Msg_Set(&msg, SLAL_FIELD_DeviceMs, device_ms, SLAL_Rtc_FormatMs(now, device_ms));
+  SLAL_Msg_Set(&msg, SLAL_FIELD_Id, id->Value, id->Len);
+  App_Send(&msg);
+}
+
+static void App_SetLock(uint8_t lock)
+{
+  locked = lock;
+  HAL_GPIO_WritePin(app->LockPort, app->LockPin, (lock != 0U) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+/* A message from the Pi; the fields point into the receive buffer.
+   wire_len is the number of bytes it took on USART1. */
+static void App_Handle(const SLAL_MessageTypeDef *msg, uint16_t wire_len)
+{
+  const SLAL_MsgFieldTypeDef *door = &msg->Fields[SLAL_FIELD_Door];
+  int64_t value;
+
+  if ((door->Len > 0U) && (SLAL_Msg_Is(msg, SLAL_FIELD_Door, app->Door) == 0U))
+  {
+    return;     /* Another door on the same line */
+  }
+
+  switch (SLAL_Msg_Event(msg))
+  {
+    case SLAL_EVENT_Lock:
+    case SLAL_EVENT_Unlock:
+      app_stats.Commands++;
+      App_SetLock((SLAL_Msg_Event(msg) == SLAL_EVENT_Lock) ? 1U : 0U);
+      App_SendStatus(&msg->Fields[SLAL_FIELD_Id]);
+      break;
+
+    case SLAL_EVENT_StatusRequest:
+      app_stats.Commands++;
+      App_SendStatus(&msg->Fields[SLAL_FIELD_Id]);
+      break;
+
+    case SLAL_EVENT_TimeSync:
+      if (SLAL_Rtc_ParseMs(msg->Fields[SLAL_FIELD_SentMs].Value, msg->Fields[SLAL_FIELD_SentMs].Len, &value) != 0U)
+      {
+        (void)SLAL_Rtc_Sync(value, wire_len);
+      }
+      break;
+
+    case SLAL_EVENT_Ack:
+      if ((SLAL_Msg_Source(msg) == SLAL_SOURCE_RaspberryPi) &&
+          (SLAL_Rtc_ParseMs(msg->Fields[SLAL_FIELD_Id].Value, msg->Fields[SLAL_FIELD_Id].Len, &value) != 0U))
+      {
+        SLAL_Journal_Ack((uint32_t)value);
+        if ((batch_in_flight != 0U) && ((uint32_t)value == batch_seq))
+        {
+          batch_in_flight = 0U;
+        }
+      }
+      break;
+
+    default:
+      break;    /* Status replies from the Pi and anything newer */
+  }
+}
+
+/* A JSON line (SLAL_APP_SERIAL_LINES) */
+static void App_RxLine(const uint8_t *frame, uint16_t len)
+{
+  SLAL_MessageTypeDef msg;
+
+  last_rx_ms = HAL_GetTick();
+  if (SLAL_Msg_Decode((const char *)frame, len, &msg) == 0U)
+  {
+    app_stats.Malformed++;
+    return;
+  }
+  App_Handle(&msg, (uint16_t)(len + 1U));
+}
+
+/* A payload the link delivered in order, JSON or binary */
+static void App_RxPayload(const uint8_t *payload, uint16_t len)
+{
+  SLAL_MessageTypeDef msg;
+  uint8_t decoded;
+
+  if (app->Serial == SLAL_APP_SERIAL_BINARY)
+  {
+    decoded = SLAL_Msg_DecodeWire((const char *)payload, len, &msg, rx_timestamp);
+  }
+  else
+  {
+    decoded = SLAL_Msg_Decode((const char *)payload, len, &msg);
+  }
+  if (decoded == 0U)
+  {
+    app_stats.Malformed++;
+    return;
+  }
+  App_Handle(&msg, (uint16_t)(len + SLAL_LINK_OVERHEAD));
+}
+
+/* A link frame without its 0x00 delimiter; acks count as traffic too */
+static void App_RxFrame(const uint8_t *frame, uint16_t len)
+{
+  last_rx_ms = HAL_GetTick();
+  SLAL_Link_RxFrame(frame, len);
+}
+
+/* edge_ms is the HAL tick of the input edge. The event is stamped with
+   the RTC time (UTC) of that edge, not of the poll that reported it after
+   the debounce. */
+static void App_Journal(SLAL_Event event, uint32_t edge_ms)
+{
+  int64_t device_ms = SLAL_Rtc_NowMs() - (int64_t)(HAL_GetTick() - edge_ms);
+
+  app_stats.LocalEvents++;
+  (void)SLAL_Journal_Append(event, app->Door, device_ms);
+}
+
+static void App_Input(const SLAL_InputConfigTypeDef *input, uint8_t active, uint32_t edge_ms)
+{
+  switch (input->Kind)
+  {
+    case SLAL_INPUT_LOCK_TOGGLE:
+    case SLAL_INPUT_LOCK:
+    case SLAL_INPUT_UNLOCK:
+      if (active == 0U)
+      {
+        break;
+      }
+      if (input->Kind == SLAL_INPUT_LOCK_TOGGLE)
+      {
+        App_SetLock((locked != 0U) ? 0U : 1U);
+      }
+      else
+      {
+        App_SetLock((input->Kind == SLAL_INPUT_LOCK) ? 1U : 0U);
+      }
+      App_Journal((locked != 0U) ? SLAL_EVENT_Lock : SLAL_EVENT_Unlock, edge_ms);
+      break;
+
+    case SLAL_INPUT_DOOR_SENSOR:
+      if ((active == 0U) && (locked != 0U))
+      {
+        App_Journal(SLAL_EVENT_Error, edge_ms);    /* Opened while locked */
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* One journal batch at a time; a lost batch or ack is sent again */
+static void App_FlushJournal(uint32_t now_ms)
+{
+  uint16_t len;
+
+  if (batch_in_flight != 0U)
+  {
+    if ((now_ms - batch_sent_ms) < SLAL_APP_ACK_TIMEOUT_MS)
+    {
+      return;
+    }
+    app_stats.Resends++;
+    batch_in_flight = 0U;
+    SLAL_Journal_Rewind();
+  }
+  if ((SLAL_Journal_Pending() == 0U) ||
+      ((app->Serial != SLAL_APP_SERIAL_LINES) && (SLAL_Link_CanSend() == 0U)))
+  {
+    return;
+  }
+
+  len = SLAL_Journal_NextBatch(tx_line, tx_max, app_encode, app->Door, &batch_seq);
+  if (len > 0U)
+  {
+    (void)App_Write(len);
+    batch_in_flight = 1U;
+    batch_sent_ms = now_ms;
+    app_stats.Batches++;
+  }
+}
+
+void SLAL_App_Init(const SLAL_AppConfigTypeDef *config)
+{
+  app = config;
+  memset(&app_stats, 0, sizeof(app_stats));
+  batch_in_flight = 0U;
+  last_rx_ms = HAL_GetTick();
+  locked = (HAL_GPIO_ReadPin(config->LockPort, config->LockPin) == GPIO_PIN_SET) ? 1U : 0U;
+
+  SLAL_Rtc_Init(config->Rtc);
+  SLAL_Journal_InitFlash();
+  SLAL_Input_Start(config->Inputs, config->InputCount, App_Input);
+
+  if (config->Serial == SLAL_APP_SERIAL_LINES)
+  {
+    app_encode = SLAL_Msg_Encode;
+    tx_max = SLAL_MSG_MAX_JSON;
+    SLAL_UartRx_Init((uint8_t)'\n', App_RxLine);
+  }
+  else
+  {
+    app_encode = (config->Serial == SLAL_APP_SERIAL_BINARY) ? SLAL_Msg_EncodeWire : SLAL_Msg_Encode;
+    tx_max = SLAL_LINK_MAX_PAYLOAD;
+    /* The RTC keeps running through a reset, so a restarted board starts
+       from another sequence number */
+    SLAL_Link_Init(App_LinkWrite, App_RxPayload, (uint8_t)SLAL_Rtc_NowMs());
+    SLAL_UartRx_Init(0U, App_RxFrame);
+  }
+  (void)SLAL_UartRx_Start(config->Uart);
+}
+
+void SLAL_App_Poll(void)
+{
+  uint32_t now = HAL_GetTick();
+
+  SLAL_UartRx_Poll();
+  if (app->Serial != SLAL_APP_SERIAL_LINES)
+  {
+    SLAL_Link_Poll(now);
+  }
+  SLAL_Input_Poll(now);
+  App_FlushJournal(now);
+  SLAL_Journal_Poll(((batch_in_flight == 0U) && ((now - last_rx_ms) >= SLAL_APP_ERASE_IDLE_MS)) ? 1U : 0U);
+}
+
+uint8_t SLAL_App_IsLocked(void)
+{
+  return locked;
+}
+
+const SLAL_AppStatsTypeDef *SLAL_App_GetStats(void)
+{
+  return &app_stats;
+}
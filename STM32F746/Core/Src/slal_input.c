@@ -0,0 +1,243 @@
+/**
+  ******************************************************************************
+  * @file    slal_input.c
+  * @brief   Local lock buttons and door sensors on EXTI interrupts.
+  *          See slal_input.h for the design.
+  *
+  *          Usage:
+  *            - each input pin in STM32F746.ioc as GPIO_EXTIx, rising and
+  *              falling edge, with its EXTI interrupt enabled; B1 (PI11) is
+  *              the local lock button, PG6 (Arduino D2) a door sensor
+  *            - SLAL_Input_Start() after MX_GPIO_Init() with a static table
+  *              of the inputs
+  *            - SLAL_Input_Poll() from the main loop; changes are delivered
+  *              from there, never from interrupt context
+  *
+  *          The queue indices are free running. Only the interrupt writes
+  *          the head and only the main loop writes the tail, so neither side
+  *          needs to mask interrupts.
+  ******************************************************************************
+  */
+
+#include "slal_input.h"
+#include "slal_tcm.h"
+#include <string.h>
+
+#if (SLAL_INPUT_QUEUE_SIZE & (SLAL_INPUT_QUEUE_SIZE - 1U)) != 0U
+#error "SLAL_INPUT_QUEUE_SIZE must be a power of two"
+#endif
+
+#define QUEUE_MASK  (SLAL_INPUT_QUEUE_SIZE - 1U)
+
+/* Orders the slot write before the head update that publishes it */
+#ifdef USE_HAL_DRIVER
+#define INPUT_BARRIER()  __DMB()
+#else
+#define INPUT_BARRIER()  ((void)0)
+#endif
+
+typedef struct
+{
+  uint8_t  Input;
+  uint8_t  Level;
+  uint32_t Ms;
+} InputEdge;
+
+typedef struct
+{
+  uint8_t  Level;               /* Debounced raw level */
+  uint8_t  Settling;
+  uint32_t Until;
+} InputState;
+
+static InputEdge edge_queue[SLAL_INPUT_QUEUE_SIZE] SLAL_DTCM_BSS;
+static volatile uint32_t queue_head SLAL_DTCM_BSS;    /* Written by the interrupt */
+static volatile uint32_t queue_tail SLAL_DTCM_BSS;
+static volatile uint32_t queue_overflows SLAL_DTCM_BSS;
+static uint32_t overflows_seen;
+
+static const SLAL_InputConfigTypeDef *input_table;
+static uint8_t input_count;
+static InputState input_state[SLAL_INPUT_MAX];
+static SLAL_InputReadFn input_read;
+static SLAL_InputFn input_deliver;
+static SLAL_InputStatsTypeDef input_stats;
+
+static uint32_t Input_DebounceMs(uint8_t input)
+{
+  uint16_t ms = input_table[input].DebounceMs;
+  return (ms != 0U) ? ms : SLAL_INPUT_DEBOUNCE_MS;
+}
+
+/* Take the new level and ignore the input until it has settled */
+static void Input_Change(uint8_t input, uint8_t level, uint32_t ms)
+{
+  InputState *state = &input_state[input];
+
+  state->Level = level;
+  state->Settling = 1U;
+  state->Until = ms + Input_DebounceMs(input);
+  input_stats.Changes++;
+  input_deliver(&input_table[input], (uint8_t)(level ^ input_table[input].ActiveLow), ms);
+}
+
+static void Input_HandleEdge(const InputEdge *edge)
+{
+  InputState *state = &input_state[edge->Input];
+
+  input_stats.Edges++;
+  if ((state->Settling != 0U) && ((int32_t)(edge->Ms - state->Until) >= 0))
+  {
+    state->Settling = 0U;        /* Window ended before this edge */
+  }
+  if ((state->Settling != 0U) || (edge->Level == state->Level))
+  {
+    input_stats.Bounces++;
+    return;
+  }
+  Input_Change(edge->Input, edge->Level, edge->Ms);
+}
+
+void SLAL_Input_Init(const SLAL_InputConfigTypeDef *inputs, uint8_t count,
+                     SLAL_InputReadFn read, SLAL_InputFn deliver)
+{
+  uint8_t i;
+
+  input_table = inputs;
+  input_count = (count > SLAL_INPUT_MAX) ? SLAL_INPUT_MAX : count;
+  input_read = read;
+  input_deliver = deliver;
+  queue_head = 0U;
+  queue_tail = 0U;
+  queue_overflows = 0U;
+  overflows_seen = 0U;
+  memset(&input_stats, 0, sizeof(input_stats));
+  memset(input_state, 0, sizeof(input_state));
+
+  /* The levels at startup are not changes */
+  for (i = 0U; i < input_count; i++)
+  {
+    input_state[i].Level = input_read(i);
+  }
+}
+
+/* Interrupt context: input changed to level at now_ms */
+SLAL_ITCM void SLAL_Input_Edge(uint8_t input, uint8_t level, uint32_t now_ms)
+{
+  uint32_t head = queue_head;
+  InputEdge *slot;
+
+  if (head - queue_tail >= SLAL_INPUT_QUEUE_SIZE)
+  {
+    queue_overflows++;
+    return;
+  }
+  slot = &edge_queue[head & QUEUE_MASK];
+  slot->Input = input;
+  slot->Level = level;
+  slot->Ms = now_ms;
+  INPUT_BARRIER();
+  queue_head = head + 1U;
+}
+
+void SLAL_Input_Poll(uint32_t now_ms)
+{
+  uint32_t head = queue_head;
+  uint32_t tail = queue_tail;
+  uint32_t overflows = queue_overflows;
+  InputEdge edge;
+  uint8_t level;
+  uint8_t i;
+
+  INPUT_BARRIER();
+  while (tail != head)
+  {
+    edge = edge_queue[tail & QUEUE_MASK];
+    tail++;
+    INPUT_BARRIER();            /* Slot read before it is handed back */
+    queue_tail = tail;
+    if (edge.Input < input_count)
+    {
+      Input_HandleEdge(&edge);
+    }
+  }
+
+  /* Edges were lost, so the queue no longer tells the whole story */
+  if (overflows != overflows_seen)
+  {
+    input_stats.Overflows += overflows - overflows_seen;
+    overflows_seen = overflows;
+    for (i = 0U; i < input_count; i++)
+    {
+      if (input_state[i].Settling == 0U)
+      {
+        level = input_read(i);
+        if (level != input_state[i].Level)
+        {
+          Input_Change(i, level, now_ms);
+        }
+      }
+    }
+  }
+
+  /* An input may have settled on the other level inside its window */
+  for (i = 0U; i < input_count; i++)
+  {
+    if ((input_state[i].Settling != 0U) && ((int32_t)(now_ms - input_state[i].Until) >= 0))
+    {
+      input_state[i].Settling = 0U;
+      level = input_read(i);
+      if (level != input_state[i].Level)
+      {
+        Input_Change(i, level, now_ms);
+      }
+    }
+  }
+}
+
+/* Debounced state, with ActiveLow applied */
+uint8_t SLAL_Input_IsActive(uint8_t input)
+{
+  if (input >= input_count)
+  {
+    return 0U;
+  }
+  return (uint8_t)(input_state[input].Level ^ input_table[input].ActiveLow);
+}
+
+const SLAL_InputStatsTypeDef *SLAL_Input_GetStats(void)
+{
+  return &input_stats;
+}
+
+#ifdef USE_HAL_DRIVER
+
+/* The EXTI path reads IDR and uwTick itself: HAL_GPIO_ReadPin() and
+   HAL_GetTick() are in flash, and a call from ITCM to them would wait on
+   flash as if the callback were there too */
+static SLAL_ITCM uint8_t Input_HalRead(uint8_t input)
+{
+  return ((input_table[input].Port->IDR & input_table[input].Pin) != 0U) ? 1U : 0U;
+}
+
+void SLAL_Input_Start(const SLAL_InputConfigTypeDef *inputs, uint8_t count, SLAL_InputFn deliver)
+{
+  SLAL_Input_Init(inputs, count, Input_HalRead, deliver);
+}
+
+/* EXTI lines are per pin number, so the pin mask names the input */
+SLAL_ITCM void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  uint8_t i;
+
+  for (i = 0U; i < input_count; i++)
+  {
+    if (input_table[i].Pin == GPIO_Pin)
+    {
+      SLAL_Input_Edge(i, Input_HalRead(i), uwTick);
+      return;
+    }
+  }
+}
+
+#endif /* USE_HAL_DRIVER */
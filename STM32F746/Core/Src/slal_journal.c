@@ -0,0 +1,655 @@
+/**
+  ******************************************************************************
+  * @file    slal_journal.c
+  * @brief   Flash journal of door events the Pi has not acknowledged.
+  *          See slal_journal.h.
+  *
+  *          Usage:
+  *            - SLAL_Journal_InitFlash() once at startup (scans the sector)
+  *            - SLAL_Journal_Append() for each event the link could not
+  *              deliver, with its RTC time from SLAL_Rtc_NowMs()
+  *            - once the link is back, SLAL_Journal_NextBatch() while the
+  *              link has room, sending each batch as a payload
+  *            - SLAL_Journal_Ack() for each "ack" from the Pi, and
+  *              SLAL_Journal_Rewind() after a link reset so unacknowledged
+  *              batches are sent again
+  *            - SLAL_Journal_Poll() from the main loop, saying whether the
+  *              link has been quiet long enough to start an erase
+  *            - on the target, the FLASH global interrupt enabled
+  *              (STM32F746.ioc) so HAL_FLASH_IRQHandler() ends the erase
+  *
+  *          Record layout, 32 bytes, CRC-16 (slal_link.c) over the first 30:
+  *            magic(2) type(1) event(1) seq(4) device_ms(8) door(12)
+  *            reserved(2) crc(2)
+  *          An ack record carries the journal epoch in device_ms. The epoch
+  *          is taken from the RTC when a sector without one gets its first
+  *          event, so a reflashed board or one whose sector was lost starts
+  *          a new epoch rather than reusing seqs the Pi has already seen.
+  *          The sector is erased only when every event in it has been
+  *          acknowledged and it is at least half full, or full. An erase is
+  *          asked for there and started by the next SLAL_Journal_Poll() on
+  *          an idle link; while it runs nothing is read from or written to
+  *          the sector.
+  ******************************************************************************
+  */
+
+#include "slal_journal.h"
+#include "slal_link.h"
+#include "slal_msg.h"
+#include "slal_rtc.h"
+#include <string.h>
+
+#define JOURNAL_MAGIC       0x4A53U
+#define JOURNAL_TYPE_EVENT  0x01U
+#define JOURNAL_TYPE_ACK    0x02U
+
+/* Longest batch id and epoch, uint32_t values */
+#define JOURNAL_ID_DIGITS   10U
+
+/* Epoch values that mean none: never set, or an ack from older firmware */
+#define JOURNAL_NO_EPOCH    0U
+#define JOURNAL_OLD_EPOCH   0xFFFFFFFFU
+
+#define ERASE_NONE          0U
+#define ERASE_WANTED        1U
+#define ERASE_RUNNING       2U
+
+#define SLOT_EMPTY          0U
+#define SLOT_VALID          1U
+#define SLOT_CORRUPT        2U
+
+typedef struct
+{
+  uint16_t Magic;
+  uint8_t  Type;
+  uint8_t  Event;
+  uint32_t Seq;         /* Event: its seq. Ack: highest seq acknowledged */
+  int64_t  DeviceMs;    /* Event: its RTC time. Ack: the epoch */
+  char     Door[SLAL_JOURNAL_DOOR_LEN];
+  uint16_t Reserved;
+  uint16_t Crc;
+} JournalRecord;
+
+typedef char JournalRecordSizeCheck[(sizeof(JournalRecord) == SLAL_JOURNAL_RECORD_SIZE) ? 1 : -1];
+
+static const SLAL_JournalFlashTypeDef *journal_flash;
+static uint32_t write_offset;       /* First erased slot */
+static uint32_t pending_offset;     /* No unacknowledged event before this */
+static uint32_t send_offset;        /* Next event to put in a batch */
+static uint32_t next_seq;
+static uint32_t acked_seq;
+static uint32_t epoch;
+static uint32_t pending;
+static uint8_t erase_state;
+static JournalRecord held[SLAL_JOURNAL_HOLD];   /* Appended while erasing; no seq yet */
+static uint8_t held_count;
+
+static SLAL_JournalStatsTypeDef journal_stats;
+
+static uint8_t Journal_Read(uint32_t offset, JournalRecord *record)
+{
+  const uint8_t *slot = journal_flash->Base + offset;
+  uint32_t i;
+
+  for (i = 0U; i < SLAL_JOURNAL_RECORD_SIZE; i++)
+  {
+    if (slot[i] != 0xFFU)
+    {
+      break;
+    }
+  }
+  if (i == SLAL_JOURNAL_RECORD_SIZE)
+  {
+    return SLOT_EMPTY;
+  }
+
+  memcpy(record, slot, sizeof(*record));
+  if ((record->Magic != JOURNAL_MAGIC) ||
+      (SLAL_Link_Crc16((const uint8_t *)record, SLAL_JOURNAL_RECORD_SIZE - 2U) != record->Crc))
+  {
+    return SLOT_CORRUPT;
+  }
+  return SLOT_VALID;
+}
+
+static uint8_t Journal_Write(JournalRecord *record)
+{
+  uint32_t words[SLAL_JOURNAL_RECORD_SIZE / 4U];
+  uint8_t ok;
+
+  if (write_offset + SLAL_JOURNAL_RECORD_SIZE > journal_flash->Size)
+  {
+    return 0U;
+  }
+  record->Magic = JOURNAL_MAGIC;
+  record->Reserved = 0xFFFFU;
+  record->Crc = SLAL_Link_Crc16((const uint8_t *)record, SLAL_JOURNAL_RECORD_SIZE - 2U);
+  memcpy(words, record, sizeof(words));
+
+  ok = journal_flash->Program(write_offset, words, (uint16_t)(SLAL_JOURNAL_RECORD_SIZE / 4U));
+  write_offset += SLAL_JOURNAL_RECORD_SIZE;   /* A failed slot is skipped, not retried */
+  return ok;
+}
+
+static void Journal_WriteAck(void)
+{
+  JournalRecord record;
+
+  memset(&record, 0xFF, sizeof(record));
+  record.Type = JOURNAL_TYPE_ACK;
+  record.Seq = acked_seq;
+  record.DeviceMs = (int64_t)epoch;
+  (void)Journal_Write(&record);
+}
+
+/* Start an epoch from the RTC time of the event that needs it, and
+   record it before that event */
+static void Journal_NewEpoch(int64_t device_ms)
+{
+  epoch = (uint32_t)device_ms ^ (uint32_t)((uint64_t)device_ms >> 32);
+  if ((epoch == JOURNAL_NO_EPOCH) || (epoch == JOURNAL_OLD_EPOCH))
+  {
+    epoch = 1U;
+  }
+  Journal_WriteAck();
+}
+
+/* Write an event record with the next seq; 0 if it could not be stored */
+static uint8_t Journal_Store(JournalRecord *record)
+{
+  uint32_t offset;
+
+  if (epoch == JOURNAL_NO_EPOCH)
+  {
+    Journal_NewEpoch(record->DeviceMs);
+  }
+  offset = write_offset;
+  record->Seq = next_seq;
+  if (Journal_Write(record) == 0U)
+  {
+    return 0U;
+  }
+  next_seq++;
+  if (pending == 0U)
+  {
+    pending_offset = offset;
+    if (send_offset < offset)
+    {
+      send_offset = offset;
+    }
+  }
+  pending++;
+  return 1U;
+}
+
+static uint8_t Journal_IsPendingEvent(uint32_t offset, JournalRecord *record)
+{
+  return ((Journal_Read(offset, record) == SLOT_VALID) && (record->Type == JOURNAL_TYPE_EVENT) &&
+          (record->Seq > acked_seq)) ? 1U : 0U;
+}
+
+static void Journal_Put(char *out, uint16_t *len, const char *text, uint16_t count)
+{
+  memcpy(&out[*len], text, count);
+  *len = (uint16_t)(*len + count);
+}
+
+static void Journal_PutText(char *out, uint16_t *len, const char *text)
+{
+  Journal_Put(out, len, text, (uint16_t)strlen(text));
+}
+
+static void Journal_PutNumber(char *out, uint16_t *len, int64_t value)
+{
+  char digits[SLAL_RTC_MS_DIGITS + 1U];
+  Journal_Put(out, len, digits, SLAL_Rtc_FormatMs(value, digits));
+}
+
+/* Rebuild the state from the sector. Seqs carry on from the highest one
+   left in it. */
+static void Journal_Scan(void)
+{
+  JournalRecord record;
+  uint32_t offset;
+  uint8_t state;
+  int64_t first_ms = 0;
+
+  pending = 0U;
+
+  /* Records are appended in order, so the first erased slot ends the log */
+  for (offset = 0U; offset + SLAL_JOURNAL_RECORD_SIZE <= journal_flash->Size; offset += SLAL_JOURNAL_RECORD_SIZE)
+  {
+    state = Journal_Read(offset, &record);
+    if (state == SLOT_EMPTY)
+    {
+      break;
+    }
+    if (state == SLOT_CORRUPT)
+    {
+      journal_stats.Corrupt++;
+      continue;
+    }
+    if (record.Type == JOURNAL_TYPE_ACK)
+    {
+      if (record.Seq > acked_seq)
+      {
+        acked_seq = record.Seq;
+      }
+      if ((record.DeviceMs > (int64_t)JOURNAL_NO_EPOCH) && (record.DeviceMs < (int64_t)JOURNAL_OLD_EPOCH))
+      {
+        epoch = (uint32_t)record.DeviceMs;
+      }
+    }
+    if (record.Seq >= next_seq)
+    {
+      next_seq = record.Seq + 1U;
+    }
+  }
+  write_offset = offset;
+
+  pending_offset = write_offset;
+  for (offset = 0U; offset < write_offset; offset += SLAL_JOURNAL_RECORD_SIZE)
+  {
+    if (Journal_IsPendingEvent(offset, &record) != 0U)
+    {
+      if (pending == 0U)
+      {
+        pending_offset = offset;
+        first_ms = record.DeviceMs;
+      }
+      pending++;
+    }
+  }
+  send_offset = pending_offset;
+
+  /* Events left by older firmware, or whose ack records a failed erase
+     took, go to the Pi in an epoch of their own */
+  if ((pending != 0U) && (epoch == JOURNAL_NO_EPOCH))
+  {
+    Journal_NewEpoch(first_ms);
+  }
+}
+
+/* Write the events appended during an erase, in order */
+static void Journal_StoreHeld(void)
+{
+  uint8_t i;
+
+  for (i = 0U; i < held_count; i++)
+  {
+    if (Journal_Store(&held[i]) == 0U)
+    {
+      journal_stats.Appended--;
+      journal_stats.Dropped++;
+    }
+  }
+  held_count = 0U;
+}
+
+void SLAL_Journal_Init(const SLAL_JournalFlashTypeDef *flash)
+{
+  journal_flash = flash;
+  memset(&journal_stats, 0, sizeof(journal_stats));
+  next_seq = 1U;
+  acked_seq = 0U;
+  epoch = JOURNAL_NO_EPOCH;
+  erase_state = ERASE_NONE;
+  held_count = 0U;
+  Journal_Scan();
+}
+
+/* Returns 0 if the event could not be stored */
+uint8_t SLAL_Journal_Append(SLAL_Event event, const char *door, int64_t device_ms)
+{
+  JournalRecord record;
+  uint8_t i;
+
+  if ((erase_state == ERASE_NONE) && (write_offset + SLAL_JOURNAL_RECORD_SIZE > journal_flash->Size))
+  {
+    if (pending != 0U)
+    {
+      journal_stats.Dropped++;
+      return 0U;
+    }
+    erase_state = ERASE_WANTED;
+  }
+
+  /* Characters that would break the batch encoding end the door name */
+  memset(&record, 0xFF, sizeof(record));
+  memset(record.Door, 0, sizeof(record.Door));
+  for (i = 0U; (i < SLAL_JOURNAL_DOOR_LEN) && (door[i] != '\0'); i++)
+  {
+    if ((door[i] == ',') || (door[i] == ';') || (door[i] == '"') || (door[i] == '\\'))
+    {
+      break;
+    }
+    record.Door[i] = door[i];
+  }
+  record.Type = JOURNAL_TYPE_EVENT;
+  record.Event = (uint8_t)event;
+  record.DeviceMs = device_ms;
+
+  if ((erase_state == ERASE_RUNNING) || (write_offset + SLAL_JOURNAL_RECORD_SIZE > journal_flash->Size))
+  {
+    /* Stored, with its seq, once the sector is erased */
+    if (held_count >= SLAL_JOURNAL_HOLD)
+    {
+      journal_stats.Dropped++;
+      return 0U;
+    }
+    held[held_count++] = record;
+  }
+  else if (Journal_Store(&record) == 0U)
+  {
+    journal_stats.Dropped++;
+    return 0U;
+  }
+  journal_stats.Appended++;
+  return 1U;
+}
+
+uint32_t SLAL_Journal_Pending(void)
+{
+  return pending + held_count;
+}
+
+/* Build the next "journal" message from the send cursor into out (max
+   bytes, not terminated) with encode, SLAL_Msg_Encode or
+   SLAL_Msg_EncodeWire. device names the board to the Pi, which keeps the
+   seqs it has stored per device and epoch. Returns its length, or 0 if
+   nothing is left to send; *last_seq is the id the Pi will acknowledge. */
+uint16_t SLAL_Journal_NextBatch(char *out, uint16_t max, SLAL_MsgEncodeFn encode, const char *device,
+                                uint32_t *last_seq)
+{
+  /* The JSON message without the entries' value, for the longest timestamp,
+     id and epoch; the binary one is always smaller */
+  uint16_t overhead = (uint16_t)(SLAL_MSG_BRACES +
+                                 SLAL_MSG_FIELD_SIZE(Source) + strlen(SLAL_SourceName(SLAL_SOURCE_Stm32)) +
+                                 SLAL_MSG_FIELD_SIZE(Event) + strlen(SLAL_EventName(SLAL_EVENT_Journal)) +
+                                 SLAL_MSG_FIELD_SIZE(Door) + strlen(device) +
+                                 SLAL_MSG_FIELD_SIZE(Timestamp) + SLAL_RTC_TIMESTAMP_LEN +
+                                 SLAL_MSG_FIELD_SIZE(Id) + JOURNAL_ID_DIGITS +
+                                 SLAL_MSG_FIELD_SIZE(Entries) +
+                                 SLAL_MSG_FIELD_SIZE(Epoch) + JOURNAL_ID_DIGITS);
+  char entries[SLAL_LINK_MAX_PAYLOAD];
+  uint16_t entries_len = 0U;
+  uint16_t budget;
+  uint16_t len;
+  char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  char id[SLAL_RTC_MS_DIGITS + 1U];
+  uint16_t id_len = 0U;
+  char epoch_text[SLAL_RTC_MS_DIGITS + 1U];
+  uint16_t epoch_len = 0U;
+  SLAL_MessageTypeDef msg;
+  const char *door_end;
+  uint16_t door_len;
+  uint16_t entry_len;
+  char number[SLAL_RTC_MS_DIGITS + 1U];
+  uint16_t number_len;
+  int64_t first_ms = 0;
+  JournalRecord record;
+  uint32_t offset;
+
+  if ((erase_state == ERASE_RUNNING) || (max <= overhead))
+  {
+    return 0U;
+  }
+  budget = (uint16_t)(max - overhead);
+  if (budget > sizeof(entries))
+  {
+    budget = (uint16_t)sizeof(entries);
+  }
+
+  for (offset = send_offset; offset < write_offset; offset += SLAL_JOURNAL_RECORD_SIZE)
+  {
+    if (Journal_IsPendingEvent(offset, &record) == 0U)
+    {
+      continue;
+    }
+    door_end = (const char *)memchr(record.Door, '\0', SLAL_JOURNAL_DOOR_LEN);
+    door_len = (door_end != NULL) ? (uint16_t)(door_end - record.Door) : SLAL_JOURNAL_DOOR_LEN;
+    number_len = SLAL_Rtc_FormatMs(record.DeviceMs, number);
+    entry_len = (uint16_t)(((entries_len > 0U) ? 1U : 0U) + strlen(SLAL_EventName((SLAL_Event)record.Event)) +
+                           1U + door_len + 1U + number_len);
+    if (entries_len + entry_len > budget)
+    {
+      break;
+    }
+
+    if (entries_len > 0U)
+    {
+      entries[entries_len++] = ';';
+    }
+    else
+    {
+      first_ms = record.DeviceMs;
+    }
+    Journal_PutText(entries, &entries_len, SLAL_EventName((SLAL_Event)record.Event));
+    entries[entries_len++] = ',';
+    Journal_Put(entries, &entries_len, record.Door, door_len);
+    entries[entries_len++] = ',';
+    Journal_Put(entries, &entries_len, number, number_len);
+    *last_seq = record.Seq;
+  }
+
+  if (entries_len == 0U)
+  {
+    return 0U;
+  }
+
+  SLAL_Rtc_FormatTimestamp(first_ms, timestamp);
+  Journal_PutNumber(id, &id_len, *last_seq);
+  Journal_PutNumber(epoch_text, &epoch_len, epoch);
+  SLAL_Msg_Init(&msg, SLAL_SOURCE_Stm32, SLAL_EVENT_Journal, timestamp);
+  SLAL_Msg_SetText(&msg, SLAL_FIELD_Door, device);
+  SLAL_Msg_Set(&msg, SLAL_FIELD_Id, id, id_len);
+  SLAL_Msg_Set(&msg, SLAL_FIELD_Entries, entries, entries_len);
+  SLAL_Msg_Set(&msg, SLAL_FIELD_Epoch, epoch_text, epoch_len);
+  len = encode(&msg, out, max);
+  if (len > 0U)
+  {
+    send_offset = offset;
+  }
+  return len;
+}
+
+/* Send everything unacknowledged again, e.g. after the link was reset */
+void SLAL_Journal_Rewind(void)
+{
+  send_offset = pending_offset;
+}
+
+void SLAL_Journal_Ack(uint32_t seq)
+{
+  JournalRecord record;
+
+  if ((erase_state == ERASE_RUNNING) || (seq <= acked_seq) || (seq >= next_seq))
+  {
+    return;     /* Duplicate, or from before an erase */
+  }
+  acked_seq = seq;
+
+  while ((pending_offset < write_offset) && (pending > 0U))
+  {
+    if (Journal_Read(pending_offset, &record) == SLOT_VALID && record.Type == JOURNAL_TYPE_EVENT)
+    {
+      if (record.Seq > acked_seq)
+      {
+        break;
+      }
+      pending--;
+    }
+    pending_offset += SLAL_JOURNAL_RECORD_SIZE;
+  }
+  if (pending == 0U)
+  {
+    pending_offset = write_offset;
+  }
+  if (send_offset < pending_offset)
+  {
+    send_offset = pending_offset;
+  }
+
+  Journal_WriteAck();
+  if ((pending == 0U) && (write_offset + SLAL_JOURNAL_RECORD_SIZE > journal_flash->Size / 2U))
+  {
+    erase_state = ERASE_WANTED;
+  }
+}
+
+/* Start a wanted erase once the link is idle, and pick up after one. A
+   new sector starts with an ack record, which keeps the seq and the epoch
+   running. */
+void SLAL_Journal_Poll(uint8_t link_idle)
+{
+  uint8_t status;
+
+  if ((erase_state == ERASE_WANTED) && (pending != 0U))
+  {
+    erase_state = ERASE_NONE;   /* Events stored since it was asked for */
+    return;
+  }
+  if ((erase_state == ERASE_WANTED) && (link_idle != 0U))
+  {
+    if (journal_flash->EraseStart() != 0U)
+    {
+      erase_state = ERASE_RUNNING;
+    }
+    else
+    {
+      journal_stats.EraseFailures++;
+    }
+    return;
+  }
+  if (erase_state != ERASE_RUNNING)
+  {
+    return;
+  }
+
+  status = journal_flash->EraseStatus();
+  if (status == SLAL_JOURNAL_ERASE_BUSY)
+  {
+    return;
+  }
+  erase_state = ERASE_NONE;
+  if (status == SLAL_JOURNAL_ERASE_DONE)
+  {
+    journal_stats.Erases++;
+    write_offset = 0U;
+    pending_offset = 0U;
+    send_offset = 0U;
+    pending = 0U;
+    Journal_WriteAck();
+  }
+  else
+  {
+    /* Some of the sector may be erased; read back what is left */
+    journal_stats.EraseFailures++;
+    Journal_Scan();
+  }
+  Journal_StoreHeld();
+}
+
+const SLAL_JournalStatsTypeDef *SLAL_Journal_GetStats(void)
+{
+  return &journal_stats;
+}
+
+#ifdef USE_HAL_DRIVER
+
+#include "stm32f7xx_hal.h"
+
+/* JOURNAL region from the linker script */
+extern uint8_t _sjournal[];
+extern uint8_t _journal_size[];
+
+static SLAL_JournalFlashTypeDef hal_flash;
+
+/* Drop cached copies of flash the CPU just changed behind the cache */
+static void Journal_InvalidateCache(uint32_t offset, uint32_t len)
+{
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+  SCB_InvalidateDCache_by_Addr((uint32_t *)(void *)(_sjournal + offset), (int32_t)len);
+#else
+  (void)offset;
+  (void)len;
+#endif
+}
+
+/* Set by the FLASH interrupt when the erase ends */
+static volatile uint8_t hal_erase_status = SLAL_JOURNAL_ERASE_DONE;
+
+static uint8_t Journal_HalEraseStart(void)
+{
+  FLASH_EraseInitTypeDef erase;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Sector = FLASH_SECTOR_7;
+  erase.NbSectors = 1U;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+  HAL_FLASH_Unlock();
+  hal_erase_status = SLAL_JOURNAL_ERASE_BUSY;
+  if (HAL_FLASHEx_Erase_IT(&erase) != HAL_OK)
+  {
+    hal_erase_status = SLAL_JOURNAL_ERASE_FAILED;
+    HAL_FLASH_Lock();
+    return 0U;
+  }
+  return 1U;
+}
+
+static uint8_t Journal_HalEraseStatus(void)
+{
+  uint8_t status = hal_erase_status;
+
+  if (status != SLAL_JOURNAL_ERASE_BUSY)
+  {
+    HAL_FLASH_Lock();
+    Journal_InvalidateCache(0U, hal_flash.Size);
+  }
+  return status;
+}
+
+/* HAL_FLASH_IRQHandler(): 0xFFFFFFFF once the last sector is erased. The
+   journal is the only user of interrupt driven flash operations. */
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+  if (ReturnValue == 0xFFFFFFFFU)
+  {
+    hal_erase_status = SLAL_JOURNAL_ERASE_DONE;
+  }
+}
+
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+  (void)ReturnValue;
+  hal_erase_status = SLAL_JOURNAL_ERASE_FAILED;
+}
+
+static uint8_t Journal_HalProgram(uint32_t offset, const uint32_t *words, uint16_t count)
+{
+  HAL_StatusTypeDef status = HAL_OK;
+  uint16_t i;
+
+  HAL_FLASH_Unlock();
+  for (i = 0U; (i < count) && (status == HAL_OK); i++)
+  {
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uint32_t)(uintptr_t)_sjournal + offset + 4U * i, words[i]);
+  }
+  HAL_FLASH_Lock();
+  Journal_InvalidateCache(offset, 4U * count);
+  return (status == HAL_OK) ? 1U : 0U;
+}
+
+void SLAL_Journal_InitFlash(void)
+{
+  hal_flash.EraseStart = Journal_HalEraseStart;
+  hal_flash.EraseStatus = Journal_HalEraseStatus;
+  hal_flash.Program = Journal_HalProgram;
+  hal_flash.Base = _sjournal;
+  hal_flash.Size = (uint32_t)(uintptr_t)_journal_size;
+  SLAL_Journal_Init(&hal_flash);
+}
+
+#endif /* USE_HAL_DRIVER */
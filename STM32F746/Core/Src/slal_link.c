@@ -0,0 +1,334 @@
+/**
+  ******************************************************************************
+  * @file    slal_link.c
+  * @brief   Reliable serial link layer between the STM32 and the Raspberry Pi.
+  *          See slal_link.h for the frame format.
+  *
+  *          Usage:
+  *            - SLAL_Link_Init() once, with a random initial sequence number
+  *            - SLAL_Link_RxByte() for every byte received from USART1, or
+  *              SLAL_Link_RxFrame() for each frame already split at its 0x00
+  *              delimiter (see slal_uart_rx.h)
+  *            - SLAL_Link_Send() to queue a payload (0 when the window is full)
+  *            - SLAL_Link_Poll() from the main loop for retransmits and acks
+  *          The receive calls must not run concurrently with the other calls;
+  *          feed them from the main loop out of the UART receive buffer. The
+  *          deliver callback may call SLAL_Link_Send() to reply.
+  ******************************************************************************
+  */
+
+#include "slal_link.h"
+#include "slal_tcm.h"
+#include <string.h>
+
+typedef struct
+{
+  uint8_t  Seq;
+  uint16_t Len;
+  uint8_t  Payload[SLAL_LINK_MAX_PAYLOAD];
+} SLAL_LinkSlotTypeDef;
+
+static SLAL_LinkWriteFn   link_write;
+static SLAL_LinkDeliverFn link_deliver;
+
+static SLAL_LinkSlotTypeDef tx_slots[SLAL_LINK_WINDOW];
+static uint8_t  tx_head;          /* Index of the oldest unacked slot */
+static uint8_t  tx_count;
+static uint8_t  next_seq;
+static uint32_t oldest_sent_ms;
+static uint32_t last_now_ms;      /* Time of the latest Send/Poll call */
+static uint8_t  retries;
+static uint8_t  need_reset;
+
+static uint8_t  rx_expected;
+static uint8_t  rx_synced;        /* Had a RESET or the DATA expected since Init */
+static uint8_t  ack_pending;
+static uint8_t  rx_buffer[SLAL_LINK_MAX_FRAME];
+static uint16_t rx_len;
+static uint8_t  rx_overflow;
+
+static uint8_t  frame_buffer[SLAL_LINK_MAX_FRAME];
+static uint8_t  decode_buffer[SLAL_LINK_MAX_FRAME] SLAL_DTCM_BSS;
+
+static SLAL_LinkStatsTypeDef link_stats;
+
+SLAL_ITCM uint16_t SLAL_Link_Crc16(const uint8_t *data, uint16_t len)
+{
+  uint16_t crc = 0xFFFFU;
+  uint16_t i;
+  uint8_t bit;
+
+  for (i = 0U; i < len; i++)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (bit = 0U; bit < 8U; bit++)
+    {
+      crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ 0x1021U) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+/* Build a frame, COBS encode it into frame_buffer and write it out */
+static void Link_WriteFrame(uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len)
+{
+  uint8_t raw[3U + SLAL_LINK_MAX_PAYLOAD + 2U];
+  uint16_t raw_len = 0U;
+  uint16_t crc;
+  uint16_t out = 1U;
+  uint16_t code_pos = 0U;
+  uint8_t code = 1U;
+  uint16_t i;
+
+  raw[raw_len++] = (rx_synced != 0U) ? type : (uint8_t)(type | SLAL_LINK_NO_ACK);
+  raw[raw_len++] = seq;
+  raw[raw_len++] = rx_expected;
+  if (len > 0U)
+  {
+    memcpy(&raw[raw_len], payload, len);
+    raw_len += len;
+  }
+  crc = SLAL_Link_Crc16(raw, raw_len);
+  raw[raw_len++] = (uint8_t)(crc >> 8);
+  raw[raw_len++] = (uint8_t)(crc & 0xFFU);
+
+  /* COBS */
+  for (i = 0U; i < raw_len; i++)
+  {
+    if (raw[i] == 0U)
+    {
+      frame_buffer[code_pos] = code;
+      code_pos = out++;
+      code = 1U;
+    }
+    else
+    {
+      frame_buffer[out++] = raw[i];
+      if (++code == 0xFFU)
+      {
+        frame_buffer[code_pos] = code;
+        code_pos = out++;
+        code = 1U;
+      }
+    }
+  }
+  frame_buffer[code_pos] = code;
+  frame_buffer[out++] = 0U;
+
+  ack_pending = 0U;  /* Every frame carries the current ack */
+  link_stats.FramesSent++;
+  link_write(frame_buffer, out);
+}
+
+static void Link_HandleAck(uint8_t ack)
+{
+  uint8_t progress = 0U;
+  uint8_t distance;
+
+  while (tx_count > 0U)
+  {
+    distance = (uint8_t)(ack - tx_slots[tx_head].Seq);
+    if ((distance == 0U) || (distance > tx_count))
+    {
+      break;
+    }
+    tx_head = (uint8_t)((tx_head + 1U) % SLAL_LINK_WINDOW);
+    tx_count--;
+    progress = 1U;
+  }
+
+  if (progress != 0U)
+  {
+    retries = 0U;
+    oldest_sent_ms = last_now_ms;
+  }
+}
+
+static SLAL_ITCM void Link_ProcessFrame(const uint8_t *frame, uint16_t frame_len)
+{
+  uint16_t len = 0U;
+  uint16_t i = 0U;
+  uint8_t code;
+  uint8_t j;
+  uint8_t type;
+  uint16_t crc;
+
+  /* COBS decode */
+  while (i < frame_len)
+  {
+    code = frame[i++];
+    if ((code == 0U) || ((uint16_t)(i + code - 1U) > frame_len))
+    {
+      link_stats.CrcErrors++;
+      return;
+    }
+    for (j = 1U; j < code; j++)
+    {
+      decode_buffer[len++] = frame[i++];
+    }
+    if ((code != 0xFFU) && (i < frame_len))
+    {
+      decode_buffer[len++] = 0U;
+    }
+  }
+
+  if (len < 5U)
+  {
+    link_stats.CrcErrors++;
+    return;
+  }
+  crc = (uint16_t)((uint16_t)decode_buffer[len - 2U] << 8) | decode_buffer[len - 1U];
+  if (SLAL_Link_Crc16(decode_buffer, (uint16_t)(len - 2U)) != crc)
+  {
+    link_stats.CrcErrors++;
+    return;
+  }
+
+  /* A RESET's ack, or one from a peer that has not heard from us since it
+     started, would release frames it never received */
+  type = (uint8_t)(decode_buffer[0] & (uint8_t)~SLAL_LINK_NO_ACK);
+  if ((type != SLAL_LINK_RESET) && ((decode_buffer[0] & SLAL_LINK_NO_ACK) == 0U))
+  {
+    Link_HandleAck(decode_buffer[2]);
+  }
+
+  if (type == SLAL_LINK_RESET)
+  {
+    rx_expected = decode_buffer[1];
+    rx_synced = 1U;
+    ack_pending = 1U;
+  }
+  else if (type == SLAL_LINK_DATA)
+  {
+    /* Acknowledged before delivery, so a reply sent from the deliver
+       callback carries the ack */
+    if (decode_buffer[1] == rx_expected)
+    {
+      rx_expected++;
+      rx_synced = 1U;
+      ack_pending = 1U;
+      link_deliver(&decode_buffer[3], (uint16_t)(len - 5U));
+    }
+    else
+    {
+      link_stats.OutOfOrder++;
+      ack_pending = rx_synced;
+    }
+  }
+}
+
+void SLAL_Link_Init(SLAL_LinkWriteFn write, SLAL_LinkDeliverFn deliver, uint8_t initial_seq)
+{
+  link_write = write;
+  link_deliver = deliver;
+  tx_head = 0U;
+  tx_count = 0U;
+  next_seq = initial_seq;
+  retries = 0U;
+  need_reset = 1U;
+  rx_expected = 0U;
+  rx_synced = 0U;
+  ack_pending = 0U;
+  rx_len = 0U;
+  rx_overflow = 0U;
+  memset(&link_stats, 0, sizeof(link_stats));
+}
+
+void SLAL_Link_RxByte(uint8_t byte)
+{
+  if (byte == 0U)
+  {
+    if ((rx_overflow == 0U) && (rx_len > 0U))
+    {
+      Link_ProcessFrame(rx_buffer, rx_len);
+    }
+    rx_len = 0U;
+    rx_overflow = 0U;
+  }
+  else if (rx_len < sizeof(rx_buffer))
+  {
+    rx_buffer[rx_len++] = byte;
+  }
+  else
+  {
+    rx_overflow = 1U;
+  }
+}
+
+void SLAL_Link_RxFrame(const uint8_t *frame, uint16_t len)
+{
+  if ((len > 0U) && (len <= SLAL_LINK_MAX_FRAME))
+  {
+    Link_ProcessFrame(frame, len);
+  }
+}
+
+uint8_t SLAL_Link_CanSend(void)
+{
+  return (tx_count < SLAL_LINK_WINDOW) ? 1U : 0U;
+}
+
+uint8_t SLAL_Link_Send(const uint8_t *payload, uint16_t len, uint32_t now_ms)
+{
+  SLAL_LinkSlotTypeDef *slot;
+
+  if ((len > SLAL_LINK_MAX_PAYLOAD) || (SLAL_Link_CanSend() == 0U))
+  {
+    return 0U;
+  }
+  last_now_ms = now_ms;
+
+  if (need_reset != 0U)
+  {
+    Link_WriteFrame(SLAL_LINK_RESET, next_seq, NULL, 0U);
+    need_reset = 0U;
+  }
+  if (tx_count == 0U)
+  {
+    oldest_sent_ms = now_ms;
+  }
+
+  slot = &tx_slots[(tx_head + tx_count) % SLAL_LINK_WINDOW];
+  slot->Seq = next_seq++;
+  slot->Len = len;
+  memcpy(slot->Payload, payload, len);
+  tx_count++;
+
+  Link_WriteFrame(SLAL_LINK_DATA, slot->Seq, slot->Payload, slot->Len);
+  return 1U;
+}
+
+void SLAL_Link_Poll(uint32_t now_ms)
+{
+  uint8_t i;
+  SLAL_LinkSlotTypeDef *slot;
+
+  last_now_ms = now_ms;
+
+  /* Go-Back-N: resend the whole window once the oldest frame timed out */
+  if ((tx_count > 0U) && ((uint32_t)(now_ms - oldest_sent_ms) >= SLAL_LINK_RTO_MS))
+  {
+    if (++retries >= SLAL_LINK_MAX_RETRIES)
+    {
+      Link_WriteFrame(SLAL_LINK_RESET, tx_slots[tx_head].Seq, NULL, 0U);
+      retries = 0U;
+    }
+    for (i = 0U; i < tx_count; i++)
+    {
+      slot = &tx_slots[(tx_head + i) % SLAL_LINK_WINDOW];
+      Link_WriteFrame(SLAL_LINK_DATA, slot->Seq, slot->Payload, slot->Len);
+      link_stats.Retransmissions++;
+    }
+    oldest_sent_ms = now_ms;
+  }
+
+  if (ack_pending != 0U)
+  {
+    Link_WriteFrame(SLAL_LINK_ACK, next_seq, NULL, 0U);
+  }
+}
+
+const SLAL_LinkStatsTypeDef *SLAL_Link_GetStats(void)
+{
+  return &link_stats;
+}
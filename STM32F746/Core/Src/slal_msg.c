@@ -0,0 +1,400 @@
+/**
+  ******************************************************************************
+  * @file    slal_msg.c
+  * @brief   Door protocol JSON encoder and decoder without the heap.
+  *          See slal_msg.h.
+  *
+  *          Usage:
+  *            - SLAL_Msg_Decode() on each received line or link payload; the
+  *              fields point into that buffer, so handle the message before
+  *              the buffer is reused
+  *            - SLAL_Msg_Init() and SLAL_Msg_Set() to build a reply, then
+  *              SLAL_Msg_Encode() into a SLAL_MSG_MAX_JSON byte buffer
+  *            - SLAL_Msg_DecodeWire() and SLAL_Msg_EncodeWire() in place of
+  *              the JSON calls when the Pi runs with --serial-binary
+  *            - SLAL_Msg_ProfileInit() once to start the DWT cycle counter;
+  *              SLAL_Msg_GetStats() then reports cycles per message
+  ******************************************************************************
+  */
+
+#include "slal_msg.h"
+#include "slal_tcm.h"
+#include "slal_link.h"
+#include "slal_uart_rx.h"
+#include <string.h>
+
+#ifdef USE_HAL_DRIVER
+#include "stm32f7xx_hal.h"
+#endif
+
+#ifndef SLAL_MSG_CYCLES
+#ifdef USE_HAL_DRIVER
+#define SLAL_MSG_CYCLES()  (DWT->CYCCNT)
+#else
+#define SLAL_MSG_CYCLES()  0U
+#endif
+#endif
+
+/* Whatever the link or the UART can deliver must fit a message */
+typedef char MsgLinkSizeCheck[(SLAL_LINK_MAX_PAYLOAD <= SLAL_MSG_MAX_JSON) ? 1 : -1];
+typedef char MsgRxSizeCheck[(SLAL_UART_RX_MAX_FRAME <= SLAL_MSG_MAX_JSON) ? 1 : -1];
+
+#define MSG_KEY_LEN(name, key, req)   (uint8_t)(sizeof(key) - 1U),
+#define MSG_REQUIRED(name, key, req)  (uint8_t)(req),
+
+static const uint8_t field_key_len[SLAL_FIELD_COUNT] = { SLAL_FIELD_LIST(MSG_KEY_LEN) };
+static const uint8_t field_required[SLAL_FIELD_COUNT] = { SLAL_FIELD_LIST(MSG_REQUIRED) };
+
+static SLAL_MsgStatsTypeDef msg_stats;
+
+static void Msg_Cycles(uint32_t start, uint32_t *last, uint32_t *max)
+{
+  *last = SLAL_MSG_CYCLES() - start;
+  if (*last > *max)
+  {
+    *max = *last;
+  }
+}
+
+/* Counts the message as rejected if a required field is missing */
+static uint8_t Msg_HasRequired(const SLAL_MessageTypeDef *msg)
+{
+  uint8_t i;
+
+  for (i = 0U; i < SLAL_FIELD_COUNT; i++)
+  {
+    if ((field_required[i] != 0U) && (msg->Fields[i].Len == 0U))
+    {
+      msg_stats.Rejected++;
+      return 0U;
+    }
+  }
+  return 1U;
+}
+
+static SLAL_ITCM int8_t Msg_FieldIndex(const char *key, uint16_t len)
+{
+  uint8_t i;
+
+  for (i = 0U; i < SLAL_FIELD_COUNT; i++)
+  {
+    if ((field_key_len[i] == len) && (memcmp(SLAL_FieldKey((SLAL_Field)i), key, len) == 0))
+    {
+      return (int8_t)i;
+    }
+  }
+  return -1;
+}
+
+void SLAL_Msg_Init(SLAL_MessageTypeDef *msg, SLAL_Source source, SLAL_Event event, const char *timestamp)
+{
+  memset(msg, 0, sizeof(*msg));
+  SLAL_Msg_SetText(msg, SLAL_FIELD_Source, SLAL_SourceName(source));
+  SLAL_Msg_SetText(msg, SLAL_FIELD_Event, SLAL_EventName(event));
+  SLAL_Msg_SetText(msg, SLAL_FIELD_Timestamp, timestamp);
+}
+
+/* value must outlive the message; len 0 clears the field */
+void SLAL_Msg_Set(SLAL_MessageTypeDef *msg, SLAL_Field field, const char *value, uint16_t len)
+{
+  if ((unsigned)field < SLAL_FIELD_COUNT)
+  {
+    msg->Fields[field].Value = (len > 0U) ? value : NULL;
+    msg->Fields[field].Len = len;
+  }
+}
+
+void SLAL_Msg_SetText(SLAL_MessageTypeDef *msg, SLAL_Field field, const char *value)
+{
+  SLAL_Msg_Set(msg, field, value, (value != NULL) ? (uint16_t)strlen(value) : 0U);
+}
+
+/* Returns 1 if the field holds exactly text */
+uint8_t SLAL_Msg_Is(const SLAL_MessageTypeDef *msg, SLAL_Field field, const char *text)
+{
+  const SLAL_MsgFieldTypeDef *f = &msg->Fields[field];
+  size_t len = strlen(text);
+
+  return ((f->Len == len) && ((len == 0U) || (memcmp(f->Value, text, len) == 0))) ? 1U : 0U;
+}
+
+SLAL_Event SLAL_Msg_Event(const SLAL_MessageTypeDef *msg)
+{
+  const SLAL_MsgFieldTypeDef *f = &msg->Fields[SLAL_FIELD_Event];
+  return (f->Len > 0U) ? SLAL_EventFromName(f->Value, f->Len) : SLAL_EVENT_Other;
+}
+
+SLAL_Source SLAL_Msg_Source(const SLAL_MessageTypeDef *msg)
+{
+  const SLAL_MsgFieldTypeDef *f = &msg->Fields[SLAL_FIELD_Source];
+  return (f->Len > 0U) ? SLAL_SourceFromName(f->Value, f->Len) : SLAL_SOURCE_Other;
+}
+
+/* Returns the length written to out (not terminated), or 0 if the message
+   does not fit in max bytes or a value contains a quote */
+uint16_t SLAL_Msg_Encode(const SLAL_MessageTypeDef *msg, char *out, uint16_t max)
+{
+  uint32_t start = SLAL_MSG_CYCLES();
+  const SLAL_MsgFieldTypeDef *f;
+  uint32_t len = 0U;
+  uint8_t i;
+
+  if (max < 2U)
+  {
+    msg_stats.Rejected++;
+    return 0U;
+  }
+  out[len++] = '{';
+  for (i = 0U; i < SLAL_FIELD_COUNT; i++)
+  {
+    f = &msg->Fields[i];
+    if ((f->Len == 0U) && (field_required[i] == 0U))
+    {
+      continue;
+    }
+    /* Separator, quoted key, ":", quoted value, and room for the '}' */
+    if ((len + 1U + 2U + field_key_len[i] + 1U + 2U + f->Len + 1U > max) ||
+        ((f->Len > 0U) && (memchr(f->Value, '"', f->Len) != NULL)))
+    {
+      msg_stats.Rejected++;
+      return 0U;
+    }
+    if (len > 1U)
+    {
+      out[len++] = ',';
+    }
+    out[len++] = '"';
+    memcpy(&out[len], SLAL_FieldKey((SLAL_Field)i), field_key_len[i]);
+    len += field_key_len[i];
+    out[len++] = '"';
+    out[len++] = ':';
+    out[len++] = '"';
+    if (f->Len > 0U)
+    {
+      memcpy(&out[len], f->Value, f->Len);
+      len += f->Len;
+    }
+    out[len++] = '"';
+  }
+  out[len++] = '}';
+
+  msg_stats.Encodes++;
+  Msg_Cycles(start, &msg_stats.LastEncodeCycles, &msg_stats.MaxEncodeCycles);
+  return (uint16_t)len;
+}
+
+/* Same single pass over flat "key":"value" pairs as Protocol::parseJSON();
+   unknown keys are skipped and a repeated key keeps its last value.
+   Returns 1 if every required field is present. */
+SLAL_ITCM uint8_t SLAL_Msg_Decode(const char *json, uint16_t len, SLAL_MessageTypeDef *msg)
+{
+  uint32_t start = SLAL_MSG_CYCLES();
+  const char *end = json + len;
+  const char *pos = json;
+  const char *key;
+  const char *key_end;
+  const char *value;
+  const char *value_end;
+  int8_t index;
+
+  memset(msg, 0, sizeof(*msg));
+  while (pos < end)
+  {
+    key = (const char *)memchr(pos, '"', (size_t)(end - pos));
+    if (key == NULL)
+    {
+      break;
+    }
+    key++;
+    key_end = (const char *)memchr(key, '"', (size_t)(end - key));
+    if (key_end == NULL)
+    {
+      break;
+    }
+    if ((end - key_end < 3) || (key_end[1] != ':') || (key_end[2] != '"'))
+    {
+      pos = key_end + 1;
+      continue;
+    }
+    value = key_end + 3;
+    value_end = (const char *)memchr(value, '"', (size_t)(end - value));
+    if (value_end == NULL)
+    {
+      break;
+    }
+
+    index = Msg_FieldIndex(key, (uint16_t)(key_end - key));
+    if (index >= 0)
+    {
+      SLAL_Msg_Set(msg, (SLAL_Field)index, value, (uint16_t)(value_end - value));
+    }
+    pos = value_end + 1;
+  }
+
+  msg_stats.Decodes++;
+  Msg_Cycles(start, &msg_stats.LastDecodeCycles, &msg_stats.MaxDecodeCycles);
+  return Msg_HasRequired(msg);
+}
+
+/* One TLV; a value a TLV cannot carry is an error, never cut short */
+static uint8_t Msg_PutTlv(char *out, uint32_t *len, uint16_t max, uint8_t type, const SLAL_MsgFieldTypeDef *f)
+{
+  if (f->Len == 0U)
+  {
+    return 1U;
+  }
+  if ((f->Len > SLAL_WIRE_TLV_MAX_VALUE) || (*len + 2U + f->Len > max))
+  {
+    return 0U;
+  }
+  out[(*len)++] = (char)type;
+  out[(*len)++] = (char)f->Len;
+  memcpy(&out[*len], f->Value, f->Len);
+  *len += f->Len;
+  return 1U;
+}
+
+/* Same bytes as WireCodec::encode(): the header, a TLV for each optional
+   field that is set in schema order, then the event and source text if the
+   schema has no enum value for them. Returns the length written to out, or
+   0 if the message does not fit in max bytes. */
+uint16_t SLAL_Msg_EncodeWire(const SLAL_MessageTypeDef *msg, char *out, uint16_t max)
+{
+  uint32_t start = SLAL_MSG_CYCLES();
+  const SLAL_MsgFieldTypeDef *f = &msg->Fields[SLAL_FIELD_Timestamp];
+  SLAL_Event event = SLAL_Msg_Event(msg);
+  SLAL_Source source = SLAL_Msg_Source(msg);
+  int64_t timestamp = 0;
+  uint32_t len = SLAL_WIRE_HEADER_SIZE;
+  uint32_t tlv_len;
+  uint8_t i;
+
+  if (max < SLAL_WIRE_HEADER_SIZE)
+  {
+    msg_stats.Rejected++;
+    return 0U;
+  }
+  for (i = 0U; i < SLAL_FIELD_COUNT; i++)
+  {
+    if ((field_required[i] == 0U) &&
+        (Msg_PutTlv(out, &len, max, (uint8_t)(SLAL_WIRE_TLV_FIELD_BASE + i), &msg->Fields[i]) == 0U))
+    {
+      msg_stats.Rejected++;
+      return 0U;
+    }
+  }
+  if (((event == SLAL_EVENT_Other) &&
+       (Msg_PutTlv(out, &len, max, SLAL_WIRE_TLV_EVENT_TEXT, &msg->Fields[SLAL_FIELD_Event]) == 0U)) ||
+      ((source == SLAL_SOURCE_Other) &&
+       (Msg_PutTlv(out, &len, max, SLAL_WIRE_TLV_SOURCE_TEXT, &msg->Fields[SLAL_FIELD_Source]) == 0U)))
+  {
+    msg_stats.Rejected++;
+    return 0U;
+  }
+
+  /* A timestamp that does not parse goes out as 0, as WireCodec sends it */
+  (void)SLAL_Rtc_ParseTimestamp(f->Value, f->Len, &timestamp);
+  out[0] = (char)SLAL_WIRE_MAGIC;
+  out[1] = (char)SLAL_WIRE_VERSION;
+  out[2] = (char)event;
+  out[3] = (char)source;
+  for (i = 0U; i < 8U; i++)
+  {
+    out[4U + i] = (char)(((uint64_t)timestamp >> (8U * i)) & 0xFFU);
+  }
+  tlv_len = len - SLAL_WIRE_HEADER_SIZE;
+  out[12] = (char)(tlv_len & 0xFFU);
+  out[13] = (char)(tlv_len >> 8);
+
+  msg_stats.Encodes++;
+  Msg_Cycles(start, &msg_stats.LastEncodeCycles, &msg_stats.MaxEncodeCycles);
+  return (uint16_t)len;
+}
+
+/* One message from the whole of data, as WireCodec::decode() reads it;
+   unknown TLVs are skipped. Fields point into data, except the timestamp,
+   which is formatted into timestamp. Returns 1 if every required field is
+   present. */
+uint8_t SLAL_Msg_DecodeWire(const char *data, uint16_t len, SLAL_MessageTypeDef *msg,
+                            char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U])
+{
+  uint32_t start = SLAL_MSG_CYCLES();
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t ms = 0U;
+  uint32_t end;
+  uint32_t pos;
+  uint8_t type;
+  uint8_t value_len;
+  uint8_t i;
+
+  memset(msg, 0, sizeof(*msg));
+  if ((len < SLAL_WIRE_HEADER_SIZE) || (p[0] != SLAL_WIRE_MAGIC) || (p[1] != SLAL_WIRE_VERSION))
+  {
+    msg_stats.Rejected++;
+    return 0U;
+  }
+  end = SLAL_WIRE_HEADER_SIZE + ((uint32_t)p[12] | ((uint32_t)p[13] << 8));
+  if (end > len)
+  {
+    msg_stats.Rejected++;
+    return 0U;
+  }
+
+  SLAL_Msg_SetText(msg, SLAL_FIELD_Event, SLAL_EventName((SLAL_Event)p[2]));
+  SLAL_Msg_SetText(msg, SLAL_FIELD_Source, SLAL_SourceName((SLAL_Source)p[3]));
+  for (i = 0U; i < 8U; i++)
+  {
+    ms |= (uint64_t)p[4U + i] << (8U * i);
+  }
+  SLAL_Rtc_FormatTimestamp((int64_t)ms, timestamp);
+  SLAL_Msg_Set(msg, SLAL_FIELD_Timestamp, timestamp, SLAL_RTC_TIMESTAMP_LEN);
+
+  pos = SLAL_WIRE_HEADER_SIZE;
+  while (pos + 2U <= end)
+  {
+    type = p[pos];
+    value_len = p[pos + 1U];
+    pos += 2U;
+    if (pos + value_len > end)
+    {
+      msg_stats.Rejected++;
+      return 0U;
+    }
+    if (type == SLAL_WIRE_TLV_EVENT_TEXT)
+    {
+      SLAL_Msg_Set(msg, SLAL_FIELD_Event, &data[pos], value_len);
+    }
+    else if (type == SLAL_WIRE_TLV_SOURCE_TEXT)
+    {
+      SLAL_Msg_Set(msg, SLAL_FIELD_Source, &data[pos], value_len);
+    }
+    else if ((type >= SLAL_WIRE_TLV_FIELD_BASE) && (type < SLAL_WIRE_TLV_FIELD_BASE + SLAL_FIELD_COUNT))
+    {
+      SLAL_Msg_Set(msg, (SLAL_Field)(type - SLAL_WIRE_TLV_FIELD_BASE), &data[pos], value_len);
+    }
+    pos += value_len;
+  }
+
+  msg_stats.Decodes++;
+  Msg_Cycles(start, &msg_stats.LastDecodeCycles, &msg_stats.MaxDecodeCycles);
+  return Msg_HasRequired(msg);
+}
+
+const SLAL_MsgStatsTypeDef *SLAL_Msg_GetStats(void)
+{
+  return &msg_stats;
+}
+
+#ifdef USE_HAL_DRIVER
+
+/* The M7 DWT is locked until the lock access register is written */
+void SLAL_Msg_ProfileInit(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55U;
+  DWT->CYCCNT = 0U;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  memset(&msg_stats, 0, sizeof(msg_stats));
+}
+
+#endif /* USE_HAL_DRIVER */
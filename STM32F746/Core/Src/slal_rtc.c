@@ -0,0 +1,307 @@
+/**
+  ******************************************************************************
+  * @file    slal_rtc.c
+  * @brief   Sub-second event timestamps from the RTC, synced from the Pi.
+  *          See slal_rtc.h.
+  *
+  *          Usage:
+  *            - SLAL_Rtc_Init(&hrtc) after MX_RTC_Init()
+  *            - SLAL_Rtc_NowMs() at the moment a lock or unlock takes
+  *              effect; SLAL_Rtc_FormatMs() turns it into "device_ms"
+  *            - SLAL_Rtc_Sync() for each "time_sync" from the Pi, with its
+  *              "sent_ms" and the number of bytes the message took on USART1
+  *
+  *          The RTC keeps whole seconds in its calendar and counts the
+  *          fraction down in the sub-second register from PREDIV_S. A sync
+  *          sets the calendar to the whole second and then shifts the
+  *          sub-second counter forward by the fraction.
+  ******************************************************************************
+  */
+
+#include "slal_rtc.h"
+
+#define MS_PER_DAY  86400000LL
+
+#ifdef USE_HAL_DRIVER
+static RTC_HandleTypeDef *rtc_handle;
+static SLAL_RtcStatsTypeDef rtc_stats;
+#endif
+
+/* Days since 1970-01-01 for a proleptic Gregorian date */
+static int64_t Rtc_DaysFromCivil(int32_t y, uint32_t m, uint32_t d)
+{
+  int32_t era;
+  uint32_t yoe;
+  uint32_t doy;
+  uint32_t doe;
+
+  y -= (m <= 2U) ? 1 : 0;
+  era = ((y >= 0) ? y : (y - 399)) / 400;
+  yoe = (uint32_t)(y - era * 400);
+  doy = (153U * ((m > 2U) ? (m - 3U) : (m + 9U)) + 2U) / 5U + d - 1U;
+  doe = yoe * 365U + yoe / 4U - yoe / 100U + doy;
+  return (int64_t)era * 146097 + (int64_t)doe - 719468;
+}
+
+int64_t SLAL_Rtc_ToEpochMs(const SLAL_CalendarTypeDef *cal)
+{
+  int64_t days = Rtc_DaysFromCivil((int32_t)cal->Year, cal->Month, cal->Day);
+  int64_t secs = (int64_t)cal->Hours * 3600 + (int64_t)cal->Minutes * 60 + cal->Seconds;
+  return days * MS_PER_DAY + secs * 1000 + cal->Millis;
+}
+
+void SLAL_Rtc_FromEpochMs(int64_t epoch_ms, SLAL_CalendarTypeDef *cal)
+{
+  int64_t days = epoch_ms / MS_PER_DAY;
+  int64_t rest = epoch_ms % MS_PER_DAY;
+  int64_t z;
+  int32_t era;
+  uint32_t doe;
+  uint32_t yoe;
+  uint32_t doy;
+  uint32_t mp;
+  int32_t y;
+
+  if (rest < 0)
+  {
+    rest += MS_PER_DAY;
+    days--;
+  }
+
+  cal->Millis = (uint16_t)(rest % 1000);
+  rest /= 1000;
+  cal->Seconds = (uint8_t)(rest % 60);
+  cal->Minutes = (uint8_t)((rest / 60) % 60);
+  cal->Hours = (uint8_t)(rest / 3600);
+  cal->WeekDay = (uint8_t)(((days % 7 + 7 + 3) % 7) + 1);   /* 1970-01-01 was a Thursday */
+
+  z = days + 719468;
+  era = (int32_t)(((z >= 0) ? z : (z - 146096)) / 146097);
+  doe = (uint32_t)(z - (int64_t)era * 146097);
+  yoe = (doe - doe / 1460U + doe / 36524U - doe / 146096U) / 365U;
+  y = (int32_t)yoe + era * 400;
+  doy = doe - (365U * yoe + yoe / 4U - yoe / 100U);
+  mp = (5U * doy + 2U) / 153U;
+  cal->Day = (uint8_t)(doy - (153U * mp + 2U) / 5U + 1U);
+  cal->Month = (uint8_t)((mp < 10U) ? (mp + 3U) : (mp - 9U));
+  cal->Year = (uint16_t)(y + ((cal->Month <= 2U) ? 1 : 0));
+}
+
+/* Decimal text without printf, which lacks 64-bit support in newlib-nano.
+   out needs SLAL_RTC_MS_DIGITS + 1 bytes; returns the length. */
+uint16_t SLAL_Rtc_FormatMs(int64_t ms, char *out)
+{
+  char digits[SLAL_RTC_MS_DIGITS];
+  uint16_t count = 0U;
+  uint16_t len = 0U;
+  uint64_t value = (ms < 0) ? (uint64_t)(-(ms + 1)) + 1U : (uint64_t)ms;
+
+  do
+  {
+    digits[count++] = (char)('0' + (value % 10U));
+    value /= 10U;
+  } while (value != 0U);
+
+  if (ms < 0)
+  {
+    out[len++] = '-';
+  }
+  while (count > 0U)
+  {
+    out[len++] = digits[--count];
+  }
+  out[len] = '\0';
+  return len;
+}
+
+/* "YYYY-MM-DD HH:MM:SS" in UTC, the protocol's "timestamp".
+   out needs SLAL_RTC_TIMESTAMP_LEN + 1 bytes. */
+void SLAL_Rtc_FormatTimestamp(int64_t epoch_ms, char *out)
+{
+  static const char separators[] = "-- ::";
+  SLAL_CalendarTypeDef cal;
+  uint8_t fields[5];
+  uint8_t i;
+
+  SLAL_Rtc_FromEpochMs(epoch_ms, &cal);
+  out[0] = (char)('0' + (cal.Year / 1000U) % 10U);
+  out[1] = (char)('0' + (cal.Year / 100U) % 10U);
+  out[2] = (char)('0' + (cal.Year / 10U) % 10U);
+  out[3] = (char)('0' + cal.Year % 10U);
+  fields[0] = cal.Month;
+  fields[1] = cal.Day;
+  fields[2] = cal.Hours;
+  fields[3] = cal.Minutes;
+  fields[4] = cal.Seconds;
+  for (i = 0U; i < 5U; i++)
+  {
+    out[4U + 3U * i] = separators[i];
+    out[5U + 3U * i] = (char)('0' + fields[i] / 10U);
+    out[6U + 3U * i] = (char)('0' + fields[i] % 10U);
+  }
+  out[SLAL_RTC_TIMESTAMP_LEN] = '\0';
+}
+
+/* Returns 1 if text is a whole non-negative decimal number */
+uint8_t SLAL_Rtc_ParseMs(const char *text, uint16_t len, int64_t *ms)
+{
+  int64_t value = 0;
+  uint16_t i;
+
+  if ((len == 0U) || (len > 18U))
+  {
+    return 0U;
+  }
+  for (i = 0U; i < len; i++)
+  {
+    if ((text[i] < '0') || (text[i] > '9'))
+    {
+      return 0U;
+    }
+    value = value * 10 + (text[i] - '0');
+  }
+  *ms = value;
+  return 1U;
+}
+
+/* Returns 1 if text is "YYYY-MM-DD HH:MM:SS" (UTC), the inverse of
+   SLAL_Rtc_FormatTimestamp() */
+uint8_t SLAL_Rtc_ParseTimestamp(const char *text, uint16_t len, int64_t *epoch_ms)
+{
+  static const char separators[] = "-- ::";
+  SLAL_CalendarTypeDef cal;
+  uint8_t fields[5];
+  uint16_t year = 0U;
+  uint8_t i;
+
+  if (len != SLAL_RTC_TIMESTAMP_LEN)
+  {
+    return 0U;
+  }
+  for (i = 0U; i < 4U; i++)
+  {
+    if ((text[i] < '0') || (text[i] > '9'))
+    {
+      return 0U;
+    }
+    year = (uint16_t)(year * 10U + (uint16_t)(text[i] - '0'));
+  }
+  for (i = 0U; i < 5U; i++)
+  {
+    if ((text[4U + 3U * i] != separators[i]) ||
+        (text[5U + 3U * i] < '0') || (text[5U + 3U * i] > '9') ||
+        (text[6U + 3U * i] < '0') || (text[6U + 3U * i] > '9'))
+    {
+      return 0U;
+    }
+    fields[i] = (uint8_t)((text[5U + 3U * i] - '0') * 10 + (text[6U + 3U * i] - '0'));
+  }
+
+  cal.Year = year;
+  cal.Month = fields[0];
+  cal.Day = fields[1];
+  cal.WeekDay = 0U;
+  cal.Hours = fields[2];
+  cal.Minutes = fields[3];
+  cal.Seconds = fields[4];
+  cal.Millis = 0U;
+  if ((cal.Month < 1U) || (cal.Month > 12U) || (cal.Day < 1U) || (cal.Day > 31U))
+  {
+    return 0U;
+  }
+  *epoch_ms = SLAL_Rtc_ToEpochMs(&cal);
+  return 1U;
+}
+
+/* Time to clock wire_len bytes through the UART at 8N1 */
+uint32_t SLAL_Rtc_TransitMs(uint16_t wire_len)
+{
+  return ((uint32_t)wire_len * 10U * 1000U + SLAL_RTC_LINK_BAUD / 2U) / SLAL_RTC_LINK_BAUD;
+}
+
+#ifdef USE_HAL_DRIVER
+
+void SLAL_Rtc_Init(RTC_HandleTypeDef *hrtc)
+{
+  rtc_handle = hrtc;
+  rtc_stats.Syncs = 0U;
+  rtc_stats.LastCorrectionMs = 0;
+}
+
+int64_t SLAL_Rtc_NowMs(void)
+{
+  RTC_TimeTypeDef time;
+  RTC_DateTypeDef date;
+  SLAL_CalendarTypeDef cal;
+  int32_t fraction;
+
+  /* Reading the time locks the shadow registers until the date is read */
+  HAL_RTC_GetTime(rtc_handle, &time, RTC_FORMAT_BIN);
+  HAL_RTC_GetDate(rtc_handle, &date, RTC_FORMAT_BIN);
+
+  cal.Year = (uint16_t)(2000U + date.Year);
+  cal.Month = date.Month;
+  cal.Day = date.Date;
+  cal.Hours = time.Hours;
+  cal.Minutes = time.Minutes;
+  cal.Seconds = time.Seconds;
+  cal.Millis = 0U;
+
+  /* The sub-second register counts down; after a shift it can briefly
+     exceed PREDIV_S, meaning the fraction belongs to the previous second */
+  fraction = (int32_t)time.SecondFraction - (int32_t)time.SubSeconds;
+  return SLAL_Rtc_ToEpochMs(&cal) + ((int64_t)fraction * 1000) / ((int64_t)time.SecondFraction + 1);
+}
+
+/* Returns 1 once the RTC has been set */
+uint8_t SLAL_Rtc_Sync(int64_t pi_ms, uint16_t wire_len)
+{
+  RTC_TimeTypeDef time = {0};
+  RTC_DateTypeDef date = {0};
+  SLAL_CalendarTypeDef cal;
+  int64_t target = pi_ms + SLAL_Rtc_TransitMs(wire_len);
+  int64_t before = SLAL_Rtc_NowMs();
+  uint32_t prediv_s = rtc_handle->Init.SynchPrediv;
+  uint32_t sub_fs;
+
+  SLAL_Rtc_FromEpochMs(target, &cal);
+  if ((cal.Year < 2000U) || (cal.Year > 2099U))
+  {
+    return 0U;
+  }
+
+  time.Hours = cal.Hours;
+  time.Minutes = cal.Minutes;
+  time.Seconds = cal.Seconds;
+  time.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
+  time.StoreOperation = RTC_STOREOPERATION_RESET;
+  date.Year = (uint8_t)(cal.Year - 2000U);
+  date.Month = cal.Month;
+  date.Date = cal.Day;
+  date.WeekDay = cal.WeekDay;
+
+  if ((HAL_RTC_SetTime(rtc_handle, &time, RTC_FORMAT_BIN) != HAL_OK) ||
+      (HAL_RTC_SetDate(rtc_handle, &date, RTC_FORMAT_BIN) != HAL_OK))
+  {
+    return 0U;
+  }
+
+  /* Setting the calendar restarts the second; adding one second and
+     subtracting the rest of it moves the clock on by the fraction */
+  if (cal.Millis > 0U)
+  {
+    sub_fs = ((1000U - cal.Millis) * (prediv_s + 1U)) / 1000U;
+    (void)HAL_RTCEx_SetSynchroShift(rtc_handle, RTC_SHIFTADD1S_SET, sub_fs);
+  }
+
+  rtc_stats.Syncs++;
+  rtc_stats.LastCorrectionMs = (int32_t)(target - before);
+  return 1U;
+}
+
+const SLAL_RtcStatsTypeDef *SLAL_Rtc_GetStats(void)
+{
+  return &rtc_stats;
+}
+
+#endif /* USE_HAL_DRIVER */
@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file    slal_tcm.c
+  * @brief   Placement of hot code and data in the tightly coupled memories.
+  *          See slal_tcm.h.
+  *
+  *          Usage:
+  *            - in main.c (generated from STM32F746.ioc), #include
+  *              "slal_tcm.h" in the USER CODE Includes block and call
+  *              SLAL_Tcm_Init() in USER CODE block 1, the top of main():
+  *              before HAL_Init() starts SysTick and before MX_GPIO_Init()
+  *              and MX_USART1_UART_Init() enable the EXTI and USART1
+  *              interrupts, whose callbacks run from ITCM. SLAL_App_Init()
+  *              comes after all of these, too late to do the copy itself
+  *            - tag functions with SLAL_ITCM and CPU-only buffers with
+  *              SLAL_DTCM_BSS or SLAL_DTCM_DATA
+  *            - post-build step: ../check_tcm.sh STM32F746.map ../Core/Src
+  *
+  *          The startup code only copies .data and zeroes .bss, so the TCM
+  *          sections get the same treatment here. This function itself must
+  *          stay in flash.
+  ******************************************************************************
+  */
+
+#include "slal_tcm.h"
+
+#ifdef USE_HAL_DRIVER
+
+#include "stm32f7xx_hal.h"
+
+/* Section bounds from the linker script */
+extern uint32_t _siitcm[], _sitcm[], _eitcm[];
+extern uint32_t _sidtcm[], _sdtcm[], _edtcm[];
+extern uint32_t _sdtcm_bss[], _edtcm_bss[];
+
+void SLAL_Tcm_Init(void)
+{
+  const uint32_t *src;
+  uint32_t *dst;
+
+  for (src = _siitcm, dst = _sitcm; dst < _eitcm; )
+  {
+    *dst++ = *src++;
+  }
+  for (src = _sidtcm, dst = _sdtcm; dst < _edtcm; )
+  {
+    *dst++ = *src++;
+  }
+  for (dst = _sdtcm_bss; dst < _edtcm_bss; )
+  {
+    *dst++ = 0U;
+  }
+
+  /* Code was just written through the data side; fetch it fresh */
+  __DSB();
+  __ISB();
+}
+
+#endif /* USE_HAL_DRIVER */
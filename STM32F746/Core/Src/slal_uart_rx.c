@@ -0,0 +1,260 @@
+/**
+  ******************************************************************************
+  * @file    slal_uart_rx.c
+  * @brief   USART1 reception through circular DMA and the idle-line event.
+  *          See slal_uart_rx.h for the design.
+  *
+  *          Usage:
+  *            - USART1_RX on DMA2 Stream 2 channel 4 in circular mode, with
+  *              the DMA2_Stream2 and USART1 interrupts enabled (STM32F746.ioc)
+  *            - SLAL_UartRx_Init() with '\n' for JSON lines, or 0x00 and
+  *              SLAL_Link_RxFrame() for the reliable link
+  *            - SLAL_UartRx_Start(&huart1) after MX_USART1_UART_Init()
+  *            - SLAL_UartRx_Poll() from the main loop; frames are delivered
+  *              from there, never from interrupt context
+  *
+  *          The received byte count is the only state shared with the
+  *          interrupt. It is free running, so with a power of two buffer its
+  *          low bits are the DMA write position.
+  ******************************************************************************
+  */
+
+#include "slal_uart_rx.h"
+#include "slal_tcm.h"
+#include <string.h>
+
+#if (SLAL_UART_RX_DMA_SIZE & (SLAL_UART_RX_DMA_SIZE - 1U)) != 0U
+#error "SLAL_UART_RX_DMA_SIZE must be a power of two"
+#endif
+
+#define RX_MASK  (SLAL_UART_RX_DMA_SIZE - 1U)
+
+/* Cache line aligned so it can be invalidated without touching neighbours */
+static uint8_t rx_dma_buffer[SLAL_UART_RX_DMA_SIZE] __attribute__((aligned(32)));
+
+static volatile uint32_t rx_received SLAL_DTCM_BSS;   /* Written by the interrupt */
+static volatile uint32_t rx_errors SLAL_DTCM_BSS;
+static uint32_t rx_consumed;
+static uint32_t rx_errors_seen;
+
+static SLAL_FrameExtractorTypeDef rx_extractor SLAL_DTCM_BSS;
+static SLAL_UartRxStatsTypeDef rx_stats;
+
+#ifdef USE_HAL_DRIVER
+static UART_HandleTypeDef *rx_huart;
+#endif
+
+void SLAL_Frame_Init(SLAL_FrameExtractorTypeDef *fx, uint8_t delimiter, SLAL_RxFrameFn deliver)
+{
+  memset(fx, 0, sizeof(*fx));
+  fx->Delimiter = delimiter;
+  fx->Deliver = deliver;
+}
+
+/* Drop the partial frame, e.g. after bytes were lost */
+void SLAL_Frame_Reset(SLAL_FrameExtractorTypeDef *fx)
+{
+  fx->Len = 0U;
+  fx->Oversized = 0U;
+}
+
+static SLAL_ITCM void Frame_Append(SLAL_FrameExtractorTypeDef *fx, const uint8_t *data, uint16_t len)
+{
+  if ((fx->Oversized != 0U) || ((uint32_t)fx->Len + len > SLAL_UART_RX_MAX_FRAME))
+  {
+    fx->Oversized = 1U;
+    return;
+  }
+  memcpy(&fx->Frame[fx->Len], data, len);
+  fx->Len = (uint16_t)(fx->Len + len);
+}
+
+static SLAL_ITCM void Frame_End(SLAL_FrameExtractorTypeDef *fx)
+{
+  uint16_t len = fx->Len;
+
+  if (fx->Oversized != 0U)
+  {
+    fx->OversizedFrames++;
+  }
+  else
+  {
+    /* JSON lines from a terminal may end in \r\n */
+    if ((fx->Delimiter == (uint8_t)'\n') && (len > 0U) && (fx->Frame[len - 1U] == (uint8_t)'\r'))
+    {
+      len--;
+    }
+    if (len > 0U)
+    {
+      fx->Frames++;
+      fx->Deliver(fx->Frame, len);
+    }
+  }
+  SLAL_Frame_Reset(fx);
+}
+
+/* Split a run of bytes at the delimiter. Frames that arrive whole in data
+   are delivered straight from it; only a frame spanning runs is copied. */
+SLAL_ITCM void SLAL_Frame_Feed(SLAL_FrameExtractorTypeDef *fx, const uint8_t *data, uint16_t len)
+{
+  const uint8_t *end;
+  uint16_t run;
+
+  while (len > 0U)
+  {
+    end = (const uint8_t *)memchr(data, fx->Delimiter, len);
+    if (end == NULL)
+    {
+      Frame_Append(fx, data, len);
+      return;
+    }
+
+    run = (uint16_t)(end - data);
+    if ((fx->Len == 0U) && (fx->Oversized == 0U) && (run <= SLAL_UART_RX_MAX_FRAME))
+    {
+      if ((fx->Delimiter == (uint8_t)'\n') && (run > 0U) && (data[run - 1U] == (uint8_t)'\r'))
+      {
+        run--;
+      }
+      if (run > 0U)
+      {
+        fx->Frames++;
+        fx->Deliver(data, run);
+      }
+    }
+    else
+    {
+      Frame_Append(fx, data, run);
+      Frame_End(fx);
+    }
+
+    len = (uint16_t)(len - (end - data) - 1U);
+    data = end + 1;
+  }
+}
+
+void SLAL_UartRx_Init(uint8_t delimiter, SLAL_RxFrameFn deliver)
+{
+  SLAL_Frame_Init(&rx_extractor, delimiter, deliver);
+  rx_received = 0U;
+  rx_errors = 0U;
+  rx_consumed = 0U;
+  rx_errors_seen = 0U;
+  memset(&rx_stats, 0, sizeof(rx_stats));
+}
+
+/* DMA target, exposed so host code can play the DMA's part */
+uint8_t *SLAL_UartRx_Buffer(void)
+{
+  return rx_dma_buffer;
+}
+
+/* Interrupt context: the DMA has written up to write_pos (0..buffer size) */
+SLAL_ITCM void SLAL_UartRx_Event(uint16_t write_pos)
+{
+  uint32_t delta = ((uint32_t)write_pos - rx_received) & RX_MASK;
+  rx_received += delta;
+}
+
+/* Interrupt context: reception is restarting at the start of the buffer */
+SLAL_ITCM void SLAL_UartRx_Error(void)
+{
+  rx_received = (rx_received + RX_MASK) & ~RX_MASK;
+  rx_errors++;
+}
+
+void SLAL_UartRx_Poll(void)
+{
+  uint32_t received;
+  uint32_t errors;
+  uint32_t pending;
+  uint32_t start;
+  uint32_t first;
+#ifdef USE_HAL_DRIVER
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+#endif
+  received = rx_received;
+  errors = rx_errors;
+#ifdef USE_HAL_DRIVER
+  __set_PRIMASK(primask);
+#endif
+
+  pending = received - rx_consumed;
+  if ((errors != rx_errors_seen) || (pending > SLAL_UART_RX_DMA_SIZE))
+  {
+    if (errors != rx_errors_seen)
+    {
+      rx_stats.UartErrors += errors - rx_errors_seen;
+    }
+    else
+    {
+      rx_stats.Overruns++;
+    }
+    rx_errors_seen = errors;
+    rx_consumed = received;
+    SLAL_Frame_Reset(&rx_extractor);
+    return;
+  }
+  if (pending == 0U)
+  {
+    return;
+  }
+
+#if defined(USE_HAL_DRIVER) && defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+  /* The DMA wrote behind the data cache */
+  SCB_InvalidateDCache_by_Addr((uint32_t *)(void *)rx_dma_buffer, (int32_t)SLAL_UART_RX_DMA_SIZE);
+#endif
+
+  start = rx_consumed & RX_MASK;
+  first = SLAL_UART_RX_DMA_SIZE - start;
+  if (pending <= first)
+  {
+    SLAL_Frame_Feed(&rx_extractor, &rx_dma_buffer[start], (uint16_t)pending);
+  }
+  else
+  {
+    SLAL_Frame_Feed(&rx_extractor, &rx_dma_buffer[start], (uint16_t)first);
+    SLAL_Frame_Feed(&rx_extractor, rx_dma_buffer, (uint16_t)(pending - first));
+  }
+  rx_consumed = received;
+  rx_stats.Bytes += pending;
+}
+
+const SLAL_UartRxStatsTypeDef *SLAL_UartRx_GetStats(void)
+{
+  rx_stats.Frames = rx_extractor.Frames;
+  rx_stats.OversizedFrames = rx_extractor.OversizedFrames;
+  return &rx_stats;
+}
+
+#ifdef USE_HAL_DRIVER
+
+/* The HAL leaves the half transfer interrupt on, so the position is
+   reported at least every half buffer even on a line that never idles */
+HAL_StatusTypeDef SLAL_UartRx_Start(UART_HandleTypeDef *huart)
+{
+  rx_huart = huart;
+  return HAL_UARTEx_ReceiveToIdle_DMA(huart, rx_dma_buffer, SLAL_UART_RX_DMA_SIZE);
+}
+
+SLAL_ITCM void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+  if (huart == rx_huart)
+  {
+    SLAL_UartRx_Event(Size);
+  }
+}
+
+/* Overrun, framing or noise errors stop the transfer; start it again */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == rx_huart)
+  {
+    SLAL_UartRx_Error();
+    (void)HAL_UARTEx_ReceiveToIdle_DMA(huart, rx_dma_buffer, SLAL_UART_RX_DMA_SIZE);
+  }
+}
+
+#endif /* USE_HAL_DRIVER */
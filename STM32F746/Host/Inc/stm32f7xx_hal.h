@@ -0,0 +1,231 @@
+/**
+  ******************************************************************************
+  * @file    stm32f7xx_hal.h
+  * @brief   Emulated HAL for running the firmware on a Linux host.
+  *
+  *          Stands in for Drivers/STM32F7xx_HAL_Driver in the host build
+  *          (see main_emu.c). Only the types, constants and functions the
+  *          SLAL modules use are provided, with the same names and meaning:
+  *            - UART: HAL_UART_Transmit() and HAL_UARTEx_ReceiveToIdle_DMA()
+  *              on a pseudo terminal; Emu_Poll() plays the DMA and idle line
+  *            - GPIO: pin levels in memory; Emu_SetPin() drives an input and
+  *              raises its EXTI callback on a change
+  *            - RTC: the host clock plus an offset set by HAL_RTC_SetTime(),
+  *              HAL_RTC_SetDate() and HAL_RTCEx_SetSynchroShift()
+  *            - FLASH: the JOURNAL sector, kept in a file across runs; an
+  *              HAL_FLASHEx_Erase_IT() ends EMU_ERASE_MS later, when
+  *              Emu_Poll() runs HAL_FLASH_IRQHandler()
+  *            - HAL_GetTick() from CLOCK_MONOTONIC; uwTick, which code in
+  *              interrupt context reads directly, is brought up to date by
+  *              each HAL_GetTick() and before each EXTI callback
+  *          Interrupt masking and barriers are no-ops: everything runs on
+  *          the one thread that calls Emu_Poll().
+  ******************************************************************************
+  */
+
+#ifndef STM32F7XX_HAL_H
+#define STM32F7XX_HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ------------------------------------------------------------------ Core */
+
+typedef enum
+{
+  HAL_OK       = 0x00U,
+  HAL_ERROR    = 0x01U,
+  HAL_BUSY     = 0x02U,
+  HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+#define __get_PRIMASK()     0U
+#define __set_PRIMASK(x)    ((void)(x))
+#define __disable_irq()     ((void)0)
+#define __enable_irq()      ((void)0)
+#define __DMB()             __sync_synchronize()
+#define __DSB()             __sync_synchronize()
+#define __ISB()             ((void)0)
+
+typedef struct
+{
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+  volatile uint32_t LAR;
+} DWT_Type;
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type Emu_Dwt;
+extern CoreDebug_Type Emu_CoreDebug;
+
+#define DWT                         (&Emu_Dwt)
+#define CoreDebug                   (&Emu_CoreDebug)
+#define DWT_CTRL_CYCCNTENA_Msk      0x1UL
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24U)
+
+/* The emulated DWT does not count; time messages in host nanoseconds */
+#define SLAL_MSG_CYCLES()   Emu_Cycles()
+
+extern volatile uint32_t uwTick;
+
+uint32_t HAL_GetTick(void);
+void     HAL_Delay(uint32_t Delay);
+
+/* ------------------------------------------------------------------ GPIO */
+
+typedef struct
+{
+  uint16_t IDR;
+  uint16_t ODR;
+  char     Name;
+} GPIO_TypeDef;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0U,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef Emu_Gpio[11];
+
+#define GPIOA   (&Emu_Gpio[0])
+#define GPIOB   (&Emu_Gpio[1])
+#define GPIOC   (&Emu_Gpio[2])
+#define GPIOD   (&Emu_Gpio[3])
+#define GPIOE   (&Emu_Gpio[4])
+#define GPIOF   (&Emu_Gpio[5])
+#define GPIOG   (&Emu_Gpio[6])
+#define GPIOH   (&Emu_Gpio[7])
+#define GPIOI   (&Emu_Gpio[8])
+#define GPIOJ   (&Emu_Gpio[9])
+#define GPIOK   (&Emu_Gpio[10])
+
+#define GPIO_PIN_0    ((uint16_t)0x0001)
+#define GPIO_PIN_1    ((uint16_t)0x0002)
+#define GPIO_PIN_2    ((uint16_t)0x0004)
+#define GPIO_PIN_3    ((uint16_t)0x0008)
+#define GPIO_PIN_4    ((uint16_t)0x0010)
+#define GPIO_PIN_5    ((uint16_t)0x0020)
+#define GPIO_PIN_6    ((uint16_t)0x0040)
+#define GPIO_PIN_7    ((uint16_t)0x0080)
+#define GPIO_PIN_8    ((uint16_t)0x0100)
+#define GPIO_PIN_9    ((uint16_t)0x0200)
+#define GPIO_PIN_10   ((uint16_t)0x0400)
+#define GPIO_PIN_11   ((uint16_t)0x0800)
+#define GPIO_PIN_12   ((uint16_t)0x1000)
+#define GPIO_PIN_13   ((uint16_t)0x2000)
+#define GPIO_PIN_14   ((uint16_t)0x4000)
+#define GPIO_PIN_15   ((uint16_t)0x8000)
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void          HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void          HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+/* ------------------------------------------------------------------ UART */
+
+typedef struct
+{
+  int      Fd;                  /* Pseudo terminal master */
+  uint8_t *RxBuffer;
+  uint16_t RxSize;
+  uint16_t RxPos;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size,
+                                    uint32_t Timeout);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void              HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+void              HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+/* ------------------------------------------------------------------- RTC */
+
+typedef struct
+{
+  uint32_t AsynchPrediv;
+  uint32_t SynchPrediv;
+} RTC_InitTypeDef;
+
+typedef struct
+{
+  RTC_InitTypeDef Init;
+} RTC_HandleTypeDef;
+
+typedef struct
+{
+  uint8_t  Hours;
+  uint8_t  Minutes;
+  uint8_t  Seconds;
+  uint32_t SubSeconds;
+  uint32_t SecondFraction;
+  uint32_t DayLightSaving;
+  uint32_t StoreOperation;
+} RTC_TimeTypeDef;
+
+typedef struct
+{
+  uint8_t WeekDay;
+  uint8_t Month;
+  uint8_t Date;
+  uint8_t Year;
+} RTC_DateTypeDef;
+
+#define RTC_FORMAT_BIN              0x00000000U
+#define RTC_DAYLIGHTSAVING_NONE     0x00000000U
+#define RTC_STOREOPERATION_RESET    0x00000000U
+#define RTC_SHIFTADD1S_RESET        0x00000000U
+#define RTC_SHIFTADD1S_SET          0x80000000U
+
+HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_SetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_SetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format);
+HAL_StatusTypeDef HAL_RTCEx_SetSynchroShift(RTC_HandleTypeDef *hrtc, uint32_t ShiftAdd1S, uint32_t ShiftSubFS);
+
+/* ----------------------------------------------------------------- FLASH */
+
+typedef struct
+{
+  uint32_t TypeErase;
+  uint32_t Sector;
+  uint32_t NbSectors;
+  uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS     0x00000000U
+#define FLASH_TYPEPROGRAM_WORD      0x00000002U
+#define FLASH_VOLTAGE_RANGE_3       0x00000002U
+#define FLASH_SECTOR_7              7U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+HAL_StatusTypeDef HAL_FLASHEx_Erase_IT(FLASH_EraseInitTypeDef *pEraseInit);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+void HAL_FLASH_IRQHandler(void);
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue);
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue);
+
+/* ------------------------------------------------------------- Emulation */
+
+#define EMU_JOURNAL_SIZE    (256U * 1024U)    /* Sector 7, as in the linker script */
+#define EMU_ERASE_MS        1000U             /* Sector 7 takes 1-2 s on the board */
+
+uint32_t Emu_Cycles(void);
+int      Emu_Init(UART_HandleTypeDef *huart, const char *link_path, const char *flash_path);
+void     Emu_Poll(int timeout_ms, int fd);
+void     Emu_SetPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void     Emu_Close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32F7XX_HAL_H */
@@ -0,0 +1,472 @@
+/**
+  ******************************************************************************
+  * @file    hal_emu.c
+  * @brief   Emulated HAL for running the firmware on a Linux host.
+  *          See Host/Inc/stm32f7xx_hal.h.
+  *
+  *          USART1 is the master side of a pseudo terminal. Its slave is
+  *          what the Pi server opens as the STM32's serial port; with a link
+  *          path the slave is also reachable under that fixed name. Received
+  *          bytes are copied into the buffer given to
+  *          HAL_UARTEx_ReceiveToIdle_DMA() and reported through
+  *          HAL_UARTEx_RxEventCallback(), as the DMA and the idle line
+  *          interrupt would. Transmission is immediate, not paced at 115200
+  *          baud, so throughput tests measure the protocol and not the wire.
+  ******************************************************************************
+  */
+
+#define _GNU_SOURCE
+#include "stm32f7xx_hal.h"
+#include "slal_rtc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EMU_PREDIV_S  255U      /* SynchPrediv of the board's 32.768 kHz LSE setup */
+
+DWT_Type Emu_Dwt;
+CoreDebug_Type Emu_CoreDebug;
+GPIO_TypeDef Emu_Gpio[11] = {
+  {0U, 0U, 'A'}, {0U, 0U, 'B'}, {0U, 0U, 'C'}, {0U, 0U, 'D'}, {0U, 0U, 'E'}, {0U, 0U, 'F'},
+  {0U, 0U, 'G'}, {0U, 0U, 'H'}, {0U, 0U, 'I'}, {0U, 0U, 'J'}, {0U, 0U, 'K'}
+};
+
+/* The JOURNAL region of STM32F746NGHX_FLASH.ld */
+uint8_t _sjournal[EMU_JOURNAL_SIZE] __attribute__((aligned(4)));
+__asm__(".globl _journal_size\n.set _journal_size, 0x40000");
+
+static UART_HandleTypeDef *emu_uart;
+static int emu_slave = -1;
+static const char *emu_link;
+static int emu_flash_fd = -1;
+static uint8_t emu_flash_unlocked;
+static uint8_t emu_erasing;
+static uint32_t emu_erase_end;
+static int64_t rtc_offset_ms;
+
+static int64_t Emu_RealtimeMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t Emu_Cycles(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+volatile uint32_t uwTick;
+
+uint32_t HAL_GetTick(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uwTick = (uint32_t)((uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U);
+  return uwTick;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+  usleep(Delay * 1000U);
+}
+
+/* ------------------------------------------------------------------ GPIO */
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+  return ((GPIOx->IDR & GPIO_Pin) != 0U) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  uint16_t before = GPIOx->ODR;
+
+  if (PinState != GPIO_PIN_RESET)
+  {
+    GPIOx->ODR |= GPIO_Pin;
+  }
+  else
+  {
+    GPIOx->ODR &= (uint16_t)~GPIO_Pin;
+  }
+  GPIOx->IDR = (uint16_t)((GPIOx->IDR & ~GPIO_Pin) | (GPIOx->ODR & GPIO_Pin));
+  if (GPIOx->ODR != before)
+  {
+    printf("P%c%u -> %u\n", GPIOx->Name, (unsigned)__builtin_ctz(GPIO_Pin), (unsigned)PinState);
+  }
+}
+
+__attribute__((weak)) void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  (void)GPIO_Pin;
+}
+
+/* Drive an input as the outside world would; both edges raise EXTI */
+void Emu_SetPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  uint16_t before = GPIOx->IDR;
+
+  if (PinState != GPIO_PIN_RESET)
+  {
+    GPIOx->IDR |= GPIO_Pin;
+  }
+  else
+  {
+    GPIOx->IDR &= (uint16_t)~GPIO_Pin;
+  }
+  if (GPIOx->IDR != before)
+  {
+    (void)HAL_GetTick();
+    HAL_GPIO_EXTI_Callback(GPIO_Pin);
+  }
+}
+
+/* ------------------------------------------------------------------ UART */
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size,
+                                    uint32_t Timeout)
+{
+  uint32_t start = HAL_GetTick();
+  ssize_t written;
+
+  while (Size > 0U)
+  {
+    written = write(huart->Fd, pData, Size);
+    if (written < 0)
+    {
+      if ((errno == EAGAIN) && ((HAL_GetTick() - start) < Timeout))
+      {
+        struct pollfd pfd = { huart->Fd, POLLOUT, 0 };
+        (void)poll(&pfd, 1, 10);
+        continue;
+      }
+      return (errno == EAGAIN) ? HAL_TIMEOUT : HAL_ERROR;
+    }
+    pData += written;
+    Size = (uint16_t)(Size - written);
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+  huart->RxBuffer = pData;
+  huart->RxSize = Size;
+  huart->RxPos = 0U;
+  return HAL_OK;
+}
+
+__attribute__((weak)) void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+  (void)huart;
+  (void)Size;
+}
+
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  (void)huart;
+}
+
+/* Everything that has arrived, in runs up to the end of the circular buffer */
+static void Emu_UartReceive(UART_HandleTypeDef *huart)
+{
+  ssize_t got;
+
+  if (huart->RxBuffer == NULL)
+  {
+    return;
+  }
+  for (;;)
+  {
+    got = read(huart->Fd, &huart->RxBuffer[huart->RxPos], (size_t)(huart->RxSize - huart->RxPos));
+    if (got <= 0)
+    {
+      return;   /* EAGAIN, or EIO while nothing has the slave open */
+    }
+    huart->RxPos = (uint16_t)(huart->RxPos + got);
+    HAL_UARTEx_RxEventCallback(huart, huart->RxPos);
+    if (huart->RxPos == huart->RxSize)
+    {
+      huart->RxPos = 0U;
+    }
+  }
+}
+
+/* ------------------------------------------------------------------- RTC */
+
+static int64_t Emu_RtcNowMs(void)
+{
+  return Emu_RealtimeMs() + rtc_offset_ms;
+}
+
+HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format)
+{
+  SLAL_CalendarTypeDef cal;
+  uint32_t prediv_s = hrtc->Init.SynchPrediv;
+
+  (void)Format;
+  SLAL_Rtc_FromEpochMs(Emu_RtcNowMs(), &cal);
+  sTime->Hours = cal.Hours;
+  sTime->Minutes = cal.Minutes;
+  sTime->Seconds = cal.Seconds;
+  sTime->SecondFraction = prediv_s;
+  sTime->SubSeconds = prediv_s - ((uint32_t)cal.Millis * (prediv_s + 1U)) / 1000U;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format)
+{
+  SLAL_CalendarTypeDef cal;
+
+  (void)hrtc;
+  (void)Format;
+  SLAL_Rtc_FromEpochMs(Emu_RtcNowMs(), &cal);
+  sDate->Year = (uint8_t)(cal.Year - 2000U);
+  sDate->Month = cal.Month;
+  sDate->Date = cal.Day;
+  sDate->WeekDay = cal.WeekDay;
+  return HAL_OK;
+}
+
+/* Like the hardware, setting the time restarts the current second */
+HAL_StatusTypeDef HAL_RTC_SetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format)
+{
+  SLAL_CalendarTypeDef cal;
+
+  (void)hrtc;
+  (void)Format;
+  SLAL_Rtc_FromEpochMs(Emu_RtcNowMs(), &cal);
+  cal.Hours = sTime->Hours;
+  cal.Minutes = sTime->Minutes;
+  cal.Seconds = sTime->Seconds;
+  cal.Millis = 0U;
+  rtc_offset_ms = SLAL_Rtc_ToEpochMs(&cal) - Emu_RealtimeMs();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_SetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format)
+{
+  SLAL_CalendarTypeDef cal;
+  int64_t now = Emu_RtcNowMs();
+
+  (void)hrtc;
+  (void)Format;
+  SLAL_Rtc_FromEpochMs(now, &cal);
+  cal.Year = (uint16_t)(2000U + sDate->Year);
+  cal.Month = sDate->Month;
+  cal.Day = sDate->Date;
+  rtc_offset_ms += SLAL_Rtc_ToEpochMs(&cal) - now;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTCEx_SetSynchroShift(RTC_HandleTypeDef *hrtc, uint32_t ShiftAdd1S, uint32_t ShiftSubFS)
+{
+  int64_t prediv = (int64_t)hrtc->Init.SynchPrediv + 1;
+
+  if (ShiftAdd1S == RTC_SHIFTADD1S_SET)
+  {
+    rtc_offset_ms += 1000;
+  }
+  rtc_offset_ms -= ((int64_t)ShiftSubFS * 1000) / prediv;
+  return HAL_OK;
+}
+
+/* ----------------------------------------------------------------- FLASH */
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+  emu_flash_unlocked = 1U;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+  emu_flash_unlocked = 0U;
+  return HAL_OK;
+}
+
+static void Emu_FlashSave(uint32_t offset, uint32_t len)
+{
+  if (emu_flash_fd >= 0)
+  {
+    (void)pwrite(emu_flash_fd, &_sjournal[offset], len, (off_t)offset);
+  }
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+  if (emu_erasing != 0U)
+  {
+    return HAL_BUSY;
+  }
+  if ((emu_flash_unlocked == 0U) || (pEraseInit->Sector != FLASH_SECTOR_7))
+  {
+    *SectorError = pEraseInit->Sector;
+    return HAL_ERROR;
+  }
+  memset(_sjournal, 0xFF, sizeof(_sjournal));
+  Emu_FlashSave(0U, sizeof(_sjournal));
+  *SectorError = 0xFFFFFFFFU;
+  return HAL_OK;
+}
+
+/* The sector reads as erased once HAL_FLASH_IRQHandler() reports the end */
+HAL_StatusTypeDef HAL_FLASHEx_Erase_IT(FLASH_EraseInitTypeDef *pEraseInit)
+{
+  if (emu_erasing != 0U)
+  {
+    return HAL_BUSY;
+  }
+  if ((emu_flash_unlocked == 0U) || (pEraseInit->Sector != FLASH_SECTOR_7))
+  {
+    return HAL_ERROR;
+  }
+  emu_erasing = 1U;
+  emu_erase_end = HAL_GetTick() + EMU_ERASE_MS;
+  return HAL_OK;
+}
+
+__attribute__((weak)) void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+  (void)ReturnValue;
+}
+
+__attribute__((weak)) void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+  (void)ReturnValue;
+}
+
+/* The end of operation interrupt, once the erase time has passed */
+void HAL_FLASH_IRQHandler(void)
+{
+  if ((emu_erasing == 0U) || ((int32_t)(HAL_GetTick() - emu_erase_end) < 0))
+  {
+    return;
+  }
+  memset(_sjournal, 0xFF, sizeof(_sjournal));
+  Emu_FlashSave(0U, sizeof(_sjournal));
+  emu_erasing = 0U;
+  HAL_FLASH_EndOfOperationCallback(0xFFFFFFFFU);
+}
+
+/* Addresses are 32 bits on the target, so only the low half of the host
+   address of _sjournal is compared. Programming can only clear bits. */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+  uint32_t offset = Address - (uint32_t)(uintptr_t)_sjournal;
+  uint32_t word;
+
+  if (emu_erasing != 0U)
+  {
+    return HAL_BUSY;
+  }
+  if ((emu_flash_unlocked == 0U) || (TypeProgram != FLASH_TYPEPROGRAM_WORD) ||
+      (offset > EMU_JOURNAL_SIZE - 4U) || ((offset & 3U) != 0U))
+  {
+    return HAL_ERROR;
+  }
+  memcpy(&word, &_sjournal[offset], 4U);
+  word &= (uint32_t)Data;
+  memcpy(&_sjournal[offset], &word, 4U);
+  Emu_FlashSave(offset, 4U);
+  return HAL_OK;
+}
+
+/* ------------------------------------------------------------- Emulation */
+
+/* Returns 0 once USART1 is on a pseudo terminal and the journal is loaded */
+int Emu_Init(UART_HandleTypeDef *huart, const char *link_path, const char *flash_path)
+{
+  struct termios tio;
+  const char *slave_name;
+  ssize_t got;
+
+  emu_uart = huart;
+  huart->Fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if ((huart->Fd < 0) || (grantpt(huart->Fd) != 0) || (unlockpt(huart->Fd) != 0) ||
+      ((slave_name = ptsname(huart->Fd)) == NULL))
+  {
+    perror("pty");
+    return -1;
+  }
+
+  /* Raw bytes both ways, like a UART. Holding the slave open keeps reads
+     on the master from failing while the server is not connected. */
+  emu_slave = open(slave_name, O_RDWR | O_NOCTTY);
+  if ((emu_slave < 0) || (tcgetattr(emu_slave, &tio) != 0))
+  {
+    perror(slave_name);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B115200);
+  (void)tcsetattr(emu_slave, TCSANOW, &tio);
+
+  if (link_path != NULL)
+  {
+    (void)unlink(link_path);
+    if (symlink(slave_name, link_path) != 0)
+    {
+      perror(link_path);
+      return -1;
+    }
+    emu_link = link_path;
+  }
+  printf("USART1 on %s%s%s\n", slave_name, (link_path != NULL) ? " -> " : "", (link_path != NULL) ? link_path : "");
+
+  memset(_sjournal, 0xFF, sizeof(_sjournal));
+  if (flash_path != NULL)
+  {
+    emu_flash_fd = open(flash_path, O_RDWR | O_CREAT, 0644);
+    if (emu_flash_fd < 0)
+    {
+      perror(flash_path);
+      return -1;
+    }
+    got = pread(emu_flash_fd, _sjournal, sizeof(_sjournal), 0);
+    if (got < (ssize_t)sizeof(_sjournal))
+    {
+      /* New or short file: the rest reads as erased */
+      memset(&_sjournal[(got > 0) ? got : 0], 0xFF, sizeof(_sjournal) - (size_t)((got > 0) ? got : 0));
+      Emu_FlashSave(0U, sizeof(_sjournal));
+    }
+  }
+  return 0;
+}
+
+/* Wait up to timeout_ms for serial bytes or for fd (-1 for none) to be
+   readable, then deliver what arrived on USART1 */
+void Emu_Poll(int timeout_ms, int fd)
+{
+  struct pollfd fds[2] = { { emu_uart->Fd, POLLIN, 0 }, { fd, POLLIN, 0 } };
+
+  (void)poll(fds, 2, timeout_ms);
+  Emu_UartReceive(emu_uart);
+  HAL_FLASH_IRQHandler();
+}
+
+void Emu_Close(void)
+{
+  if (emu_link != NULL)
+  {
+    (void)unlink(emu_link);
+  }
+  if (emu_flash_fd >= 0)
+  {
+    (void)close(emu_flash_fd);
+  }
+  if (emu_slave >= 0)
+  {
+    (void)close(emu_slave);
+  }
+  (void)close(emu_uart->Fd);
+}
@@ -0,0 +1,214 @@
+/**
+  ******************************************************************************
+  * @file    main_emu.c
+  * @brief   Runs the door firmware on a Linux host against the emulated HAL.
+  *
+  *          Build with make -C Host (see Host/Makefile), or from STM32F746:
+  *            gcc -std=gnu99 -Wall -no-pie -DUSE_HAL_DRIVER -I Host/Inc \
+  *                -I Core/Inc -I ../Common Host/Src/hal_emu.c \
+  *                Host/Src/main_emu.c \
+  *                Core/Src/slal_app.c Core/Src/slal_input.c \
+  *                Core/Src/slal_journal.c Core/Src/slal_link.c \
+  *                Core/Src/slal_msg.c Core/Src/slal_rtc.c \
+  *                Core/Src/slal_uart_rx.c -o slal_emu
+  *          -no-pie because _journal_size is an absolute symbol, as the
+  *          linker script makes it on the board.
+  *
+  *          Usage:
+  *            ./slal_emu [serial link] [journal file] [door] [framing]
+  *            defaults: /tmp/slal-stm32 slal_journal.bin front_door lines
+  *          framing is lines, link (the Pi's --reliable-link) or binary
+  *          (--reliable-link --serial-binary).
+  *
+  *          Then start the Pi server with --serial-port /tmp/slal-stm32
+  *          and the options matching the framing.
+  *          The board is wired as the discovery kit: lock output on LD1
+  *          (PI1), user button B1 (PI11) toggles the lock, door sensor on
+  *          PG6 pulled up. Commands on stdin stand in for the outside world:
+  *            press, release   B1
+  *            open, close      the door sensor
+  *            stats            module counters
+  *            quit
+  ******************************************************************************
+  */
+
+#include "stm32f7xx_hal.h"
+#include "slal_app.h"
+#include "slal_journal.h"
+#include "slal_link.h"
+#include "slal_msg.h"
+#include "slal_uart_rx.h"
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static UART_HandleTypeDef huart1;
+static RTC_HandleTypeDef hrtc = { { 127U, 255U } };
+
+/* Door names filled in from the configuration at start-up */
+static SLAL_InputConfigTypeDef inputs[] = {
+  { NULL, SLAL_INPUT_LOCK_TOGGLE, 0U, 0U, GPIOI, GPIO_PIN_11 },   /* B1 */
+  { NULL, SLAL_INPUT_DOOR_SENSOR, 1U, 0U, GPIOG, GPIO_PIN_6 }     /* Closed pulls it low */
+};
+
+static SLAL_AppConfigTypeDef config = {
+  "front_door", &huart1, SLAL_APP_SERIAL_LINES, &hrtc, GPIOI, GPIO_PIN_1, inputs,
+  (uint8_t)(sizeof(inputs) / sizeof(inputs[0]))
+};
+
+static const char *const framings[] = { "lines", "link", "binary" };   /* By SLAL_APP_SERIAL_* */
+
+static volatile sig_atomic_t running = 1;
+
+static void Emu_Stop(int sig)
+{
+  (void)sig;
+  running = 0;
+}
+
+static void Emu_PrintStats(void)
+{
+  const SLAL_AppStatsTypeDef *app = SLAL_App_GetStats();
+  const SLAL_JournalStatsTypeDef *journal = SLAL_Journal_GetStats();
+  const SLAL_MsgStatsTypeDef *msg = SLAL_Msg_GetStats();
+  const SLAL_UartRxStatsTypeDef *rx = SLAL_UartRx_GetStats();
+  const SLAL_LinkStatsTypeDef *link = SLAL_Link_GetStats();
+
+  printf("lock %s\n", (SLAL_App_IsLocked() != 0U) ? "LOCKED" : "UNLOCKED");
+  printf("app: commands %lu malformed %lu local %lu batches %lu resends %lu dropped %lu\n",
+         (unsigned long)app->Commands, (unsigned long)app->Malformed, (unsigned long)app->LocalEvents,
+         (unsigned long)app->Batches, (unsigned long)app->Resends, (unsigned long)app->TxDropped);
+  printf("journal: pending %lu appended %lu dropped %lu erases %lu failed %lu\n",
+         (unsigned long)SLAL_Journal_Pending(), (unsigned long)journal->Appended,
+         (unsigned long)journal->Dropped, (unsigned long)journal->Erases,
+         (unsigned long)journal->EraseFailures);
+  printf("msg: decodes %lu encodes %lu rejected %lu, last decode %lu ns\n",
+         (unsigned long)msg->Decodes, (unsigned long)msg->Encodes, (unsigned long)msg->Rejected,
+         (unsigned long)msg->LastDecodeCycles);
+  printf("uart: frames %lu overruns %lu\n", (unsigned long)rx->Frames, (unsigned long)rx->Overruns);
+  if (config.Serial != SLAL_APP_SERIAL_LINES)
+  {
+    printf("link: sent %lu retransmits %lu crc errors %lu out of order %lu\n",
+           (unsigned long)link->FramesSent, (unsigned long)link->Retransmissions,
+           (unsigned long)link->CrcErrors, (unsigned long)link->OutOfOrder);
+  }
+}
+
+/* One line from stdin; returns 0 to quit */
+static int Emu_Command(const char *line)
+{
+  if (strcmp(line, "press") == 0)
+  {
+    Emu_SetPin(GPIOI, GPIO_PIN_11, GPIO_PIN_SET);
+  }
+  else if (strcmp(line, "release") == 0)
+  {
+    Emu_SetPin(GPIOI, GPIO_PIN_11, GPIO_PIN_RESET);
+  }
+  else if (strcmp(line, "open") == 0)
+  {
+    Emu_SetPin(GPIOG, GPIO_PIN_6, GPIO_PIN_SET);
+  }
+  else if (strcmp(line, "close") == 0)
+  {
+    Emu_SetPin(GPIOG, GPIO_PIN_6, GPIO_PIN_RESET);
+  }
+  else if (strcmp(line, "stats") == 0)
+  {
+    Emu_PrintStats();
+  }
+  else if (strcmp(line, "quit") == 0)
+  {
+    return 0;
+  }
+  else if (line[0] != '\0')
+  {
+    printf("commands: press release open close stats quit\n");
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *link_path = (argc > 1) ? argv[1] : "/tmp/slal-stm32";
+  const char *flash_path = (argc > 2) ? argv[2] : "slal_journal.bin";
+  char line[64];
+  size_t line_len = 0U;
+  int input_fd = STDIN_FILENO;
+  ssize_t got;
+  uint8_t i;
+
+  if (argc > 3)
+  {
+    config.Door = argv[3];
+  }
+  if (argc > 4)
+  {
+    i = 0U;
+    while ((i < sizeof(framings) / sizeof(framings[0])) && (strcmp(argv[4], framings[i]) != 0))
+    {
+      i++;
+    }
+    if (i == sizeof(framings) / sizeof(framings[0]))
+    {
+      fprintf(stderr, "framing must be lines, link or binary\n");
+      return 1;
+    }
+    config.Serial = i;
+  }
+  for (i = 0U; i < config.InputCount; i++)
+  {
+    inputs[i].Door = config.Door;
+  }
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  signal(SIGINT, Emu_Stop);
+  signal(SIGTERM, Emu_Stop);
+  if (Emu_Init(&huart1, link_path, flash_path) != 0)
+  {
+    return 1;
+  }
+
+  SLAL_App_Init(&config);
+  printf("%s ready (%s), %lu journal events pending\n", config.Door, framings[config.Serial],
+         (unsigned long)SLAL_Journal_Pending());
+
+  while (running != 0)
+  {
+    Emu_Poll(1, input_fd);
+
+    /* Non-blocking: poll() said whether stdin had anything */
+    if (input_fd >= 0)
+    {
+      struct pollfd pfd = { input_fd, POLLIN, 0 };
+      if ((poll(&pfd, 1, 0) > 0) && ((pfd.revents & (POLLIN | POLLHUP)) != 0))
+      {
+        got = read(input_fd, &line[line_len], 1U);
+        if (got <= 0)
+        {
+          input_fd = -1;      /* stdin closed; keep running as a plain board */
+        }
+        else if (line[line_len] == '\n')
+        {
+          line[line_len] = '\0';
+          line_len = 0U;
+          if (Emu_Command(line) == 0)
+          {
+            running = 0;
+          }
+        }
+        else if (line_len < sizeof(line) - 1U)
+        {
+          line_len++;
+        }
+      }
+    }
+
+    SLAL_App_Poll();
+  }
+
+  Emu_Close();
+  return 0;
+}
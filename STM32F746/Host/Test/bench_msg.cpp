@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file    bench_msg.cpp
+  * @brief   Host benchmark of the firmware message codec (slal_msg.c) beside
+  *          the Pi's Protocol and WireCodec, for the messages the board
+  *          handles most: a lock command, its reply and a journal batch.
+  *
+  *          Prints nanoseconds per message for each codec and direction.
+  *          Host times only rank the codecs; on the board, cycles per
+  *          message come from SLAL_Msg_GetStats() after
+  *          SLAL_Msg_ProfileInit().
+  *
+  *          Usage: make bench, or build/bench_msg [iterations]
+  ******************************************************************************
+  */
+
+#include "slal_msg.h"
+#include "slal_wire.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#define BENCH_ITERATIONS  200000UL
+
+static volatile uint32_t bench_sink;
+
+static double Now_Ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+template <typename Fn>
+static double Ns_Per_Message(unsigned long iterations, Fn fn)
+{
+  double start = Now_Ns();
+  unsigned long i;
+
+  for (i = 0UL; i < iterations; i++)
+  {
+    bench_sink += fn();
+  }
+  return (Now_Ns() - start) / (double)iterations;
+}
+
+static void Bench(const char *name, const ProtocolMessage &pm, unsigned long iterations)
+{
+  static char out[SLAL_MSG_MAX_JSON];
+  char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  SLAL_MessageTypeDef msg;
+  SLAL_MessageTypeDef decoded;
+  ProtocolMessage pi_decoded;
+  const std::string json = Protocol::toJSON(pm);
+  const std::string wire = WireCodec::encode(pm);
+  size_t i;
+
+  memset(&msg, 0, sizeof(msg));
+  for (i = 0U; i < (size_t)Field::Count; i++)
+  {
+    SLAL_Msg_Set(&msg, (SLAL_Field)i, pm.values[i].data(), (uint16_t)pm.values[i].size());
+  }
+  if ((SLAL_Msg_Encode(&msg, out, sizeof(out)) == 0U) || (SLAL_Msg_EncodeWire(&msg, out, sizeof(out)) == 0U))
+  {
+    printf("%-8s does not fit SLAL_MSG_MAX_JSON\n", name);
+    return;
+  }
+
+  printf("%-8s %3u B json %3u B wire |", name, (unsigned)json.size(), (unsigned)wire.size());
+  printf(" %6.0f %6.0f %6.0f %6.0f |",
+         Ns_Per_Message(iterations, [&] { return SLAL_Msg_Encode(&msg, out, sizeof(out)); }),
+         Ns_Per_Message(iterations, [&] { return SLAL_Msg_Decode(json.data(), (uint16_t)json.size(), &decoded); }),
+         Ns_Per_Message(iterations, [&] { return SLAL_Msg_EncodeWire(&msg, out, sizeof(out)); }),
+         Ns_Per_Message(iterations, [&] {
+           return SLAL_Msg_DecodeWire(wire.data(), (uint16_t)wire.size(), &decoded, timestamp);
+         }));
+  printf(" %6.0f %6.0f %6.0f %6.0f\n",
+         Ns_Per_Message(iterations, [&] { return (uint32_t)Protocol::toJSON(pm).size(); }),
+         Ns_Per_Message(iterations, [&] { return (uint32_t)Protocol::parseJSON(json).values[0].size(); }),
+         Ns_Per_Message(iterations, [&] { return (uint32_t)WireCodec::encode(pm).size(); }),
+         Ns_Per_Message(iterations, [&] {
+           return (uint32_t)WireCodec::decode(wire.data(), wire.size(), pi_decoded);
+         }));
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_ITERATIONS;
+  ProtocolMessage command = Protocol::create(Source::Laptop, Event::Lock, "2026-10-18 12:00:00");
+  ProtocolMessage reply = Protocol::create(Source::Stm32, Event::StatusLocked, "2026-10-18 12:00:00");
+  ProtocolMessage batch = Protocol::create(Source::Stm32, Event::Journal, "2026-10-18 12:00:00");
+  std::string entries;
+
+  command.set<Field::Door>("front_door").set<Field::Id>("pi-cmd-1234");
+  reply.set<Field::Door>("front_door").set<Field::Id>("pi-cmd-1234").set<Field::DeviceMs>("1791633600123");
+  while (entries.size() < 120U)
+  {
+    entries += "lock,front_door,1791633600123;";
+  }
+  batch.set<Field::Door>("front_door").set<Field::Seq>("4711").set<Field::Entries>(entries);
+
+  if (iterations == 0UL)
+  {
+    iterations = BENCH_ITERATIONS;
+  }
+  printf("ns per message, %lu iterations\n", iterations);
+  printf("%-30s | %-27s | %s\n", "", "firmware (slal_msg.c)", "Pi (Protocol, WireCodec)");
+  printf("%-30s | %6s %6s %6s %6s | %6s %6s %6s %6s\n", "message", "enc", "dec", "wenc", "wdec",
+         "enc", "dec", "wenc", "wdec");
+  Bench("command", command, iterations);
+  Bench("reply", reply, iterations);
+  Bench("batch", batch, iterations);
+  return 0;
+}
@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+"""
+Sir Locks-A-Lot - Serial link soak and throughput test
+
+Runs the door firmware under the emulated HAL (slal_emu) against the Pi
+server on a pseudo terminal, in the framing under test, and drives both
+ends: lock and unlock commands from a laptop connection, button presses on
+the board for journal events.
+
+  soak        Commands one at a time, each answered with the new state under
+              its id, with a button press every few commands. Every local
+              event must reach the laptop exactly once.
+  throughput  Commands pipelined; reports commands per second.
+
+--error-rate has the server flip a bit in that fraction of the link frames
+it writes, so the STM32 side has to reject them and the server resend.
+Over the link, the soak also sends a command too large for one link frame
+(SLAL_LINK_MAX_PAYLOAD), which the server must refuse without an ack.
+Exits with 1 on a lost, duplicated or wrong reply.
+
+Usage, normally through Host/Makefile:
+  link_soak.py --emu build/slal_emu --server door_server
+               [--framing lines|link|binary] [--mode soak|throughput]
+               [--commands <n>] [--events <n>] [--error-rate <p>]
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+DOOR = "front_door"
+SERVER_PORT = 8080
+REPLY_TIMEOUT_S = 5.0
+MESSAGE = re.compile(rb"\{[^{}]*\}")
+
+
+class Laptop:
+    """A laptop connection reading the server's JSON messages"""
+
+    def __init__(self, port, timeout):
+        deadline = time.time() + timeout
+        while True:
+            try:
+                self.sock = socket.create_connection(("127.0.0.1", port))
+                break
+            except OSError:
+                if time.time() > deadline:
+                    raise
+                time.sleep(0.1)
+        self.buffer = b""
+        self.journal_events = []
+
+    def send(self, event, command_id):
+        message = {"source": "laptop", "event": event, "door": DOOR,
+                   "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"), "id": command_id}
+        self.sock.sendall(json.dumps(message, separators=(",", ":")).encode())
+
+    def receive(self, timeout):
+        """Messages that arrive within timeout; local events are kept aside"""
+        self.sock.settimeout(timeout)
+        try:
+            data = self.sock.recv(65536)
+        except socket.timeout:
+            return []
+        if not data:
+            raise RuntimeError("server closed the connection")
+        self.buffer += data
+        messages = []
+        end = 0
+        for match in MESSAGE.finditer(self.buffer):
+            message = json.loads(match.group())
+            end = match.end()
+            if message.get("source") == "stm32" and message.get("event") in ("lock", "unlock"):
+                self.journal_events.append(message)
+            else:
+                messages.append(message)
+        self.buffer = self.buffer[end:]
+        return messages
+
+
+def wait_replies(laptop, expected, timeout):
+    """Collect LOCKED/UNLOCKED replies until every id in expected is
+    answered. Returns the problems found."""
+    problems = []
+    answered = set()
+    deadline = time.time() + timeout
+    while len(answered) < len(expected) and time.time() < deadline:
+        for message in laptop.receive(0.1):
+            command_id = message.get("id", "")
+            if message.get("event") not in ("LOCKED", "UNLOCKED") or command_id not in expected:
+                continue
+            if command_id in answered:
+                problems.append("reply to %s twice" % command_id)
+            elif message["event"] != expected[command_id]:
+                problems.append("%s answered %s, expected %s" % (command_id, message["event"],
+                                                                  expected[command_id]))
+            answered.add(command_id)
+    for command_id in sorted(set(expected) - answered):
+        problems.append("no reply to %s" % command_id)
+    return problems
+
+
+def press(emu):
+    emu.stdin.write("press\n")
+    emu.stdin.flush()
+    time.sleep(0.03)
+    emu.stdin.write("release\n")
+    emu.stdin.flush()
+
+
+def oversize(laptop):
+    """A command whose id alone exceeds a link frame is neither acknowledged
+    nor sent"""
+    problems = []
+    laptop.send("lock", "x" * 300)
+    deadline = time.time() + 1.0
+    while time.time() < deadline:
+        for message in laptop.receive(0.1):
+            if message.get("id", "").startswith("xxx"):
+                problems.append("oversize command answered with %s" % message.get("event"))
+    return problems
+
+
+def soak(laptop, emu, args):
+    problems = oversize(laptop) if args.framing != "lines" else []
+    presses = 0
+    every = max(1, args.commands // args.events) if args.events > 0 else 0
+    for i in range(args.commands):
+        event = "lock" if i % 2 == 0 else "unlock"
+        command_id = "s%d" % i
+        laptop.send(event, command_id)
+        problems += wait_replies(laptop, {command_id: event.upper() + "ED"}, REPLY_TIMEOUT_S)
+        if every and i % every == every - 1 and presses < args.events:
+            press(emu)
+            presses += 1
+    while presses < args.events:
+        press(emu)
+        presses += 1
+
+    # Local events travel as journal batches; wait for the last of them
+    deadline = time.time() + 10.0
+    while len(laptop.journal_events) < presses and time.time() < deadline:
+        laptop.receive(0.1)
+    laptop.receive(0.5)
+    seqs = [event.get("seq") for event in laptop.journal_events]
+    if len(set(seqs)) != len(seqs):
+        problems.append("journal events delivered twice")
+    if len(laptop.journal_events) != presses:
+        problems.append("%d local events reached the laptop, expected %d"
+                        % (len(laptop.journal_events), presses))
+    print("soak: %d commands, %d local events" % (args.commands, presses))
+    return problems
+
+
+def throughput(laptop, emu, args):
+    expected = {}
+    start = time.time()
+    for i in range(args.commands):
+        event = "lock" if i % 2 == 0 else "unlock"
+        expected["t%d" % i] = event.upper() + "ED"
+        laptop.send(event, "t%d" % i)
+    problems = wait_replies(laptop, expected, REPLY_TIMEOUT_S + args.commands * 0.05)
+    elapsed = time.time() - start
+    print("throughput: %d commands in %.2f s, %.0f commands/s"
+          % (args.commands, elapsed, args.commands / elapsed))
+    return problems
+
+
+def emu_stats(emu_log):
+    """The counters from the emulator's last "stats" output"""
+    stats = {}
+    with open(emu_log) as log:
+        for line in log:
+            for key, value in re.findall(r"([a-z][a-z ]*?) (\d+)", line):
+                stats[line.split(":")[0] + "." + key.strip()] = int(value)
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Serial link soak and throughput test")
+    parser.add_argument("--emu", required=True)
+    parser.add_argument("--server", required=True)
+    parser.add_argument("--framing", choices=("lines", "link", "binary"), default="link")
+    parser.add_argument("--mode", choices=("soak", "throughput"), default="soak")
+    parser.add_argument("--commands", type=int, default=500)
+    parser.add_argument("--events", type=int, default=50)
+    parser.add_argument("--error-rate", type=float, default=0.0)
+    args = parser.parse_args()
+    if args.error_rate > 0 and args.framing == "lines":
+        parser.error("--error-rate needs the link framing")
+
+    work = tempfile.mkdtemp(prefix="slal-soak-")
+    link_path = os.path.join(work, "stm32")
+    emu_log = os.path.join(work, "emu.log")
+    emu = subprocess.Popen([os.path.abspath(args.emu), link_path, os.path.join(work, "journal.bin"), DOOR,
+                            args.framing], stdin=subprocess.PIPE, stdout=open(emu_log, "w"), text=True)
+    server = None
+    problems = []
+    try:
+        deadline = time.time() + 5.0
+        while not os.path.exists(link_path) and time.time() < deadline:
+            time.sleep(0.05)
+
+        command = [os.path.abspath(args.server), "--serial-port", link_path, "--coalesce-window", "0",
+                   "--source-rate", "0", "--door-rate", "0", "--client-rate", "0", "--log-level", "warn"]
+        if args.framing != "lines":
+            command += ["--reliable-link", "--link-error-rate", str(args.error_rate)]
+        if args.framing == "binary":
+            command.append("--serial-binary")
+        server = subprocess.Popen(command, cwd=work, stdout=open(os.path.join(work, "server.log"), "w"),
+                                  stderr=subprocess.STDOUT)
+        laptop = Laptop(SERVER_PORT, 5.0)
+        time.sleep(0.5)
+
+        problems = (soak if args.mode == "soak" else throughput)(laptop, emu, args)
+
+        emu.stdin.write("stats\n")
+        emu.stdin.flush()
+        time.sleep(0.3)
+        stats = emu_stats(emu_log)
+        for key in ("app.malformed", "app.dropped", "uart.overruns"):
+            if stats.get(key, 0) != 0:
+                problems.append("%s %d" % (key, stats[key]))
+        if args.error_rate > 0:
+            print("link: %d crc errors caught, %d retransmits"
+                  % (stats.get("link.crc errors", 0), stats.get("link.retransmits", 0)))
+            if stats.get("link.crc errors", 0) == 0:
+                problems.append("no corrupted frame reached the STM32")
+    finally:
+        if server is not None:
+            server.send_signal(signal.SIGINT)
+            try:
+                server.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                server.kill()
+        try:
+            emu.stdin.write("quit\n")
+            emu.stdin.flush()
+            emu.wait(timeout=5)
+        except (OSError, subprocess.TimeoutExpired):
+            emu.kill()
+
+    for problem in problems[:20]:
+        print("FAIL: " + problem)
+    if problems:
+        print("logs kept in " + work)
+        return 1
+    shutil.rmtree(work)
+    print("PASS")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
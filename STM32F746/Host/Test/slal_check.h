@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file    slal_check.h
+  * @brief   Checks for the host unit tests in Host/Test.
+  *
+  *          CHECK() counts and reports a failed condition and carries on, so
+  *          one run lists every failure; CHECK_DONE() prints the totals and
+  *          gives the exit status.
+  ******************************************************************************
+  */
+
+#ifndef SLAL_CHECK_H
+#define SLAL_CHECK_H
+
+#include <stdio.h>
+
+static unsigned long check_count;
+static unsigned long check_failed;
+
+#define CHECK(cond)                                                         \
+  do                                                                        \
+  {                                                                         \
+    check_count++;                                                          \
+    if (!(cond))                                                            \
+    {                                                                       \
+      check_failed++;                                                       \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);       \
+    }                                                                       \
+  } while (0)
+
+#define CHECK_DONE(name)                                                    \
+  (printf("%s: %lu checks, %lu failed\n", (name), check_count, check_failed), \
+   (check_failed != 0U) ? 1 : 0)
+
+#endif /* SLAL_CHECK_H */
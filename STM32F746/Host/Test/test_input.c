@@ -0,0 +1,222 @@
+/**
+  ******************************************************************************
+  * @file    test_input.c
+  * @brief   Host tests for the edge queue and the debounce state machine in
+  *          slal_input.c, built without the HAL.
+  *
+  *          The test calls SLAL_Input_Edge() where the EXTI callback would,
+  *          with the pin levels it keeps itself, and SLAL_Input_Poll() where
+  *          the main loop would, at chosen times.
+  ******************************************************************************
+  */
+
+#include "slal_input.h"
+#include "slal_check.h"
+
+#define MAX_CHANGES  64U
+
+typedef struct
+{
+  uint8_t  Input;
+  uint8_t  Active;
+  uint32_t EdgeMs;
+} Change;
+
+static const SLAL_InputConfigTypeDef inputs[] = {
+  { "front_door", SLAL_INPUT_LOCK_TOGGLE, 1U, 0U },     /* Button to ground */
+  { "front_door", SLAL_INPUT_DOOR_SENSOR, 0U, 50U }
+};
+
+static uint8_t pin_level[2];
+static Change changes[MAX_CHANGES];
+static uint32_t change_count;
+
+static uint8_t Read(uint8_t input)
+{
+  return pin_level[input];
+}
+
+static void Deliver(const SLAL_InputConfigTypeDef *input, uint8_t active, uint32_t edge_ms)
+{
+  if (change_count < MAX_CHANGES)
+  {
+    changes[change_count].Input = (uint8_t)(input - inputs);
+    changes[change_count].Active = active;
+    changes[change_count].EdgeMs = edge_ms;
+  }
+  change_count++;
+}
+
+/* The pin changes and the EXTI interrupt sees it */
+static void Pin(uint8_t input, uint8_t level, uint32_t ms)
+{
+  pin_level[input] = level;
+  SLAL_Input_Edge(input, level, ms);
+}
+
+static int Changed(uint32_t i, uint8_t input, uint8_t active, uint32_t edge_ms)
+{
+  return (i < change_count) && (changes[i].Input == input) && (changes[i].Active == active) &&
+         (changes[i].EdgeMs == edge_ms);
+}
+
+static void Start(uint8_t level0, uint8_t level1)
+{
+  pin_level[0] = level0;
+  pin_level[1] = level1;
+  change_count = 0U;
+  SLAL_Input_Init(inputs, 2U, Read, Deliver);
+}
+
+/* The levels at start-up are not changes; ActiveLow inverts */
+static void Test_Init(void)
+{
+  Start(1U, 1U);
+  SLAL_Input_Poll(0U);
+  CHECK(change_count == 0U);
+  CHECK(SLAL_Input_IsActive(0U) == 0U);
+  CHECK(SLAL_Input_IsActive(1U) == 1U);
+  CHECK(SLAL_Input_IsActive(2U) == 0U);
+}
+
+/* The first edge is delivered with its interrupt time, the bounces behind
+   it are only counted, and the release after the window is delivered */
+static void Test_Press(void)
+{
+  const SLAL_InputStatsTypeDef *stats;
+
+  Start(1U, 0U);
+  Pin(0U, 0U, 100U);
+  Pin(0U, 1U, 101U);
+  Pin(0U, 0U, 102U);
+  Pin(0U, 1U, 104U);
+  Pin(0U, 0U, 105U);
+  SLAL_Input_Poll(106U);
+  CHECK(change_count == 1U);
+  CHECK(Changed(0U, 0U, 1U, 100U));
+  CHECK(SLAL_Input_IsActive(0U) == 1U);
+
+  /* Settled pressed: the end of the window changes nothing */
+  SLAL_Input_Poll(100U + SLAL_INPUT_DEBOUNCE_MS);
+  CHECK(change_count == 1U);
+
+  Pin(0U, 1U, 300U);
+  Pin(0U, 0U, 301U);
+  Pin(0U, 1U, 302U);
+  SLAL_Input_Poll(303U);
+  CHECK(change_count == 2U);
+  CHECK(Changed(1U, 0U, 0U, 300U));
+
+  stats = SLAL_Input_GetStats();
+  CHECK(stats->Edges == 8U);
+  CHECK(stats->Changes == 2U);
+  CHECK(stats->Bounces == 6U);
+  CHECK(stats->Overflows == 0U);
+}
+
+/* A tap shorter than the window: pressed at once, released when the
+   window ends and the pin is read again */
+static void Test_ShortTap(void)
+{
+  Start(1U, 0U);
+  Pin(0U, 0U, 10U);
+  Pin(0U, 1U, 15U);
+  SLAL_Input_Poll(16U);
+  CHECK(change_count == 1U);
+  CHECK(Changed(0U, 0U, 1U, 10U));
+  SLAL_Input_Poll(10U + SLAL_INPUT_DEBOUNCE_MS - 1U);
+  CHECK(change_count == 1U);
+  SLAL_Input_Poll(10U + SLAL_INPUT_DEBOUNCE_MS);
+  CHECK(change_count == 2U);
+  CHECK(Changed(1U, 0U, 0U, 10U + SLAL_INPUT_DEBOUNCE_MS));
+  CHECK(SLAL_Input_IsActive(0U) == 0U);
+}
+
+/* An edge exactly at the end of the window is a new change; each input
+   has its own debounce time */
+static void Test_Window(void)
+{
+  Start(1U, 0U);
+  Pin(0U, 0U, 0U);
+  Pin(0U, 1U, SLAL_INPUT_DEBOUNCE_MS);
+  SLAL_Input_Poll(SLAL_INPUT_DEBOUNCE_MS);
+  CHECK(change_count == 2U);
+  CHECK(Changed(1U, 0U, 0U, SLAL_INPUT_DEBOUNCE_MS));
+
+  Pin(1U, 1U, 1000U);
+  Pin(1U, 0U, 1030U);
+  SLAL_Input_Poll(1030U);
+  CHECK(change_count == 3U);
+  CHECK(Changed(2U, 1U, 1U, 1000U));
+  SLAL_Input_Poll(1049U);
+  CHECK(change_count == 3U);
+  SLAL_Input_Poll(1050U);
+  CHECK(change_count == 4U);
+  CHECK(Changed(3U, 1U, 0U, 1050U));
+}
+
+/* The millisecond tick wraps after 49 days */
+static void Test_TickWrap(void)
+{
+  uint32_t t0 = 0xFFFFFFF8U;
+
+  Start(1U, 0U);
+  Pin(0U, 0U, t0);
+  Pin(0U, 1U, t0 + 4U);
+  SLAL_Input_Poll(t0 + 5U);
+  CHECK(Changed(0U, 0U, 1U, t0));
+  SLAL_Input_Poll(t0 + SLAL_INPUT_DEBOUNCE_MS - 1U);
+  CHECK(change_count == 1U);
+  SLAL_Input_Poll(t0 + SLAL_INPUT_DEBOUNCE_MS);
+  CHECK(change_count == 2U);
+  CHECK(Changed(1U, 0U, 0U, t0 + SLAL_INPUT_DEBOUNCE_MS));
+}
+
+/* A full queue drops edges; the poll counts them and reads the pins */
+static void Test_Overflow(void)
+{
+  uint32_t i;
+
+  Start(1U, 0U);
+  for (i = 0U; i < SLAL_INPUT_QUEUE_SIZE + 8U; i++)
+  {
+    Pin(1U, (uint8_t)((i + 1U) & 1U), i);
+  }
+  Pin(0U, 0U, 100U);                      /* Lost with the rest */
+  SLAL_Input_Poll(200U);
+  CHECK(SLAL_Input_GetStats()->Overflows == 9U);
+  CHECK(SLAL_Input_GetStats()->Edges == SLAL_INPUT_QUEUE_SIZE);
+  CHECK(change_count == 3U);
+  CHECK(Changed(0U, 1U, 1U, 0U));
+  CHECK(Changed(1U, 0U, 1U, 200U));
+  CHECK(Changed(2U, 1U, 0U, 200U));       /* Settled on the last lost edge */
+  CHECK(SLAL_Input_IsActive(0U) == 1U);
+
+  /* The queue works again once drained */
+  Pin(0U, 1U, 300U);
+  SLAL_Input_Poll(300U);
+  CHECK(change_count == 4U);
+  CHECK(Changed(3U, 0U, 0U, 300U));
+}
+
+/* An edge for an input outside the table is dropped */
+static void Test_UnknownInput(void)
+{
+  Start(1U, 0U);
+  SLAL_Input_Edge(5U, 1U, 10U);
+  SLAL_Input_Poll(10U);
+  CHECK(change_count == 0U);
+  CHECK(SLAL_Input_GetStats()->Edges == 0U);
+}
+
+int main(void)
+{
+  Test_Init();
+  Test_Press();
+  Test_ShortTap();
+  Test_Window();
+  Test_TickWrap();
+  Test_Overflow();
+  Test_UnknownInput();
+  return CHECK_DONE("test_input");
+}
@@ -0,0 +1,382 @@
+/**
+  ******************************************************************************
+  * @file    test_journal.c
+  * @brief   Host tests for the flash journal in slal_journal.c, built without
+  *          the HAL, against a RAM copy of a small sector.
+  *
+  *          The RAM flash behaves as the part does where the journal relies
+  *          on it: programming only clears bits, and an erase runs in the
+  *          background until a later EraseStatus() call. An erase can be
+  *          made to fail, leaving the first half of the sector erased.
+  ******************************************************************************
+  */
+
+#include "slal_journal.h"
+#include "slal_check.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FLASH_SIZE   (64U * SLAL_JOURNAL_RECORD_SIZE)
+#define DOOR         "front_door"
+#define T0           1791633600000LL     /* 2026-10-10 12:00:00 UTC */
+
+static uint8_t flash_mem[FLASH_SIZE];
+static uint8_t erase_busy_polls;        /* EraseStatus() calls still busy */
+static uint8_t erase_running;
+static uint8_t erase_fail;
+static uint32_t erase_starts;
+static uint32_t program_errors;         /* Attempts to set a cleared bit */
+
+static uint8_t Ram_EraseStart(void)
+{
+  erase_running = 1U;
+  erase_busy_polls = 1U;
+  erase_starts++;
+  return 1U;
+}
+
+static uint8_t Ram_EraseStatus(void)
+{
+  if (erase_running == 0U)
+  {
+    return SLAL_JOURNAL_ERASE_DONE;
+  }
+  if (erase_busy_polls > 0U)
+  {
+    erase_busy_polls--;
+    return SLAL_JOURNAL_ERASE_BUSY;
+  }
+  erase_running = 0U;
+  if (erase_fail != 0U)
+  {
+    memset(flash_mem, 0xFF, FLASH_SIZE / 2U);
+    return SLAL_JOURNAL_ERASE_FAILED;
+  }
+  memset(flash_mem, 0xFF, FLASH_SIZE);
+  return SLAL_JOURNAL_ERASE_DONE;
+}
+
+static uint8_t Ram_Program(uint32_t offset, const uint32_t *words, uint16_t count)
+{
+  uint32_t old;
+  uint16_t i;
+
+  for (i = 0U; i < count; i++)
+  {
+    memcpy(&old, &flash_mem[offset + 4U * i], 4U);
+    if ((old & words[i]) != words[i])
+    {
+      program_errors++;
+      return 0U;
+    }
+    memcpy(&flash_mem[offset + 4U * i], &words[i], 4U);
+  }
+  return 1U;
+}
+
+static const SLAL_JournalFlashTypeDef ram_flash = {
+  Ram_EraseStart, Ram_EraseStatus, Ram_Program, flash_mem, FLASH_SIZE
+};
+
+/* The next batch, decoded; its fields point into out. Returns 0 if there
+   was none. */
+static uint8_t Batch(char *out, SLAL_MessageTypeDef *msg, uint32_t *last_seq)
+{
+  uint16_t len = SLAL_Journal_NextBatch(out, SLAL_MSG_MAX_JSON, SLAL_Msg_Encode, DOOR, last_seq);
+
+  return ((len > 0U) && (SLAL_Msg_Decode(out, len, msg) != 0U)) ? 1U : 0U;
+}
+
+static uint32_t Number(const SLAL_MessageTypeDef *msg, SLAL_Field field)
+{
+  char text[16];
+  uint16_t len = msg->Fields[field].Len;
+
+  if (len >= sizeof(text))
+  {
+    return 0U;
+  }
+  memcpy(text, msg->Fields[field].Value, len);
+  text[len] = '\0';
+  return (uint32_t)strtoul(text, NULL, 10);
+}
+
+/* Count the ';' separated entries of a batch */
+static uint32_t Entries(const SLAL_MessageTypeDef *msg)
+{
+  uint32_t count = (msg->Fields[SLAL_FIELD_Entries].Len > 0U) ? 1U : 0U;
+  uint16_t i;
+
+  for (i = 0U; i < msg->Fields[SLAL_FIELD_Entries].Len; i++)
+  {
+    count += (msg->Fields[SLAL_FIELD_Entries].Value[i] == ';') ? 1U : 0U;
+  }
+  return count;
+}
+
+static void Reflash(void)
+{
+  memset(flash_mem, 0xFF, FLASH_SIZE);
+  erase_running = 0U;
+  erase_fail = 0U;
+  erase_starts = 0U;
+  SLAL_Journal_Init(&ram_flash);
+}
+
+/* Events go out in one batch with the device, an epoch and the last seq */
+static void Test_Append(void)
+{
+  static const char entries[] =
+    "lock,front_door,1791633600000;unlock,front_door,1791633600500;error,front_door,1791633601000";
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+
+  Reflash();
+  CHECK(SLAL_Journal_Pending() == 0U);
+  CHECK(Batch(out, &msg, &last_seq) == 0U);
+
+  CHECK(SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0) == 1U);
+  CHECK(SLAL_Journal_Append(SLAL_EVENT_Unlock, DOOR, T0 + 500) == 1U);
+  CHECK(SLAL_Journal_Append(SLAL_EVENT_Error, "front_door,x", T0 + 1000) == 1U);   /* ',' ends the name */
+  CHECK(SLAL_Journal_Pending() == 3U);
+
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(last_seq == 3U);
+  CHECK(SLAL_Msg_Event(&msg) == SLAL_EVENT_Journal);
+  CHECK(SLAL_Msg_Is(&msg, SLAL_FIELD_Door, DOOR));
+  CHECK(SLAL_Msg_Is(&msg, SLAL_FIELD_Id, "3"));
+  CHECK(SLAL_Msg_Is(&msg, SLAL_FIELD_Timestamp, "2026-10-10 12:00:00"));
+  CHECK(SLAL_Msg_Is(&msg, SLAL_FIELD_Entries, entries));
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) != 0U);
+
+  /* Sent but not acknowledged: nothing more to send, still pending */
+  CHECK(Batch(out, &msg, &last_seq) == 0U);
+  CHECK(SLAL_Journal_Pending() == 3U);
+  CHECK(SLAL_Journal_GetStats()->Appended == 3U);
+  CHECK(program_errors == 0U);
+}
+
+/* A reset rebuilds the pending events, the seq and the epoch */
+static void Test_Restart(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+  uint32_t epoch;
+
+  Reflash();
+  (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0);
+  (void)SLAL_Journal_Append(SLAL_EVENT_Unlock, DOOR, T0 + 1);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  epoch = Number(&msg, SLAL_FIELD_Epoch);
+
+  SLAL_Journal_Init(&ram_flash);
+  CHECK(SLAL_Journal_Pending() == 2U);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(last_seq == 2U);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) == epoch);
+
+  SLAL_Journal_Ack(2U);
+  CHECK(SLAL_Journal_Pending() == 0U);
+  SLAL_Journal_Init(&ram_flash);
+  CHECK(SLAL_Journal_Pending() == 0U);
+
+  (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0 + 2);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(last_seq == 3U);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) == epoch);
+  CHECK(SLAL_Journal_GetStats()->Corrupt == 0U);
+
+  /* A record cut short by a power loss is skipped */
+  memset(&flash_mem[4U * SLAL_JOURNAL_RECORD_SIZE + 8U], 0x00, 4U);
+  SLAL_Journal_Init(&ram_flash);
+  CHECK(SLAL_Journal_GetStats()->Corrupt == 1U);
+  CHECK(SLAL_Journal_Pending() == 0U);
+}
+
+/* Batches fill the budget; a rewind sends everything unacknowledged again,
+   and an ack releases up to its seq */
+static void Test_BatchRewindAck(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+  uint32_t first_seq;
+  uint32_t sent = 0U;
+  uint32_t i;
+
+  Reflash();
+  for (i = 0U; i < 20U; i++)
+  {
+    (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0 + i);
+  }
+  CHECK(Batch(out, &msg, &first_seq) == 1U);
+  CHECK(Entries(&msg) < 20U);
+  sent = Entries(&msg);
+  while (Batch(out, &msg, &last_seq) != 0U)
+  {
+    sent += Entries(&msg);
+  }
+  CHECK(sent == 20U);
+  CHECK(last_seq == 20U);
+
+  SLAL_Journal_Rewind();
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(last_seq == first_seq);
+
+  SLAL_Journal_Ack(first_seq);
+  CHECK(SLAL_Journal_Pending() == 20U - first_seq);
+  SLAL_Journal_Ack(first_seq);                  /* Duplicate */
+  SLAL_Journal_Ack(21U);                        /* Not sent yet */
+  CHECK(SLAL_Journal_Pending() == 20U - first_seq);
+
+  SLAL_Journal_Rewind();
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(strncmp(msg.Fields[SLAL_FIELD_Entries].Value, "lock,front_door,", 16U) == 0);
+  CHECK(Number(&msg, SLAL_FIELD_Id) - Entries(&msg) == first_seq);
+
+  SLAL_Journal_Ack(20U);
+  CHECK(SLAL_Journal_Pending() == 0U);
+  CHECK(Batch(out, &msg, &last_seq) == 0U);
+}
+
+/* Append, send and acknowledge one event at a time until the journal asks
+   for an erase and a poll on an idle link starts it */
+static uint32_t Run_Until_Erase(uint32_t *seq, int64_t *ms)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t epoch = 0U;
+  uint32_t starts = erase_starts;
+  uint32_t i;
+
+  for (i = 0U; (i < FLASH_SIZE / SLAL_JOURNAL_RECORD_SIZE) && (erase_starts == starts); i++)
+  {
+    (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, (*ms)++);
+    if (Batch(out, &msg, seq) != 0U)
+    {
+      epoch = Number(&msg, SLAL_FIELD_Epoch);
+      SLAL_Journal_Ack(*seq);
+    }
+    SLAL_Journal_Poll(0U);
+    CHECK(erase_starts == starts);              /* Not while the link is busy */
+    SLAL_Journal_Poll(1U);
+  }
+  return epoch;
+}
+
+/* Events appended during the erase wait in RAM and are written after it
+   with the next seqs, in the same epoch, which a reset keeps too */
+static void Test_Erase(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+  uint32_t epoch;
+  int64_t ms = T0;
+  uint32_t i;
+
+  Reflash();
+  epoch = Run_Until_Erase(&last_seq, &ms);
+  CHECK(erase_starts == 1U);
+  CHECK(SLAL_Journal_Pending() == 0U);
+
+  for (i = 0U; i < SLAL_JOURNAL_HOLD + 1U; i++)
+  {
+    (void)SLAL_Journal_Append(SLAL_EVENT_Unlock, DOOR, ms++);
+  }
+  CHECK(SLAL_Journal_Pending() == SLAL_JOURNAL_HOLD);
+  CHECK(SLAL_Journal_GetStats()->Dropped == 1U);
+  CHECK(Batch(out, &msg, &i) == 0U);            /* Nothing read while erasing */
+
+  SLAL_Journal_Poll(1U);                        /* Still busy */
+  CHECK(SLAL_Journal_GetStats()->Erases == 0U);
+  SLAL_Journal_Poll(1U);
+  CHECK(SLAL_Journal_GetStats()->Erases == 1U);
+  CHECK(SLAL_Journal_Pending() == SLAL_JOURNAL_HOLD);
+
+  CHECK(Batch(out, &msg, &i) == 1U);
+  CHECK(Number(&msg, SLAL_FIELD_Id) - Entries(&msg) == last_seq);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) == epoch);
+
+  SLAL_Journal_Init(&ram_flash);
+  CHECK(SLAL_Journal_Pending() == SLAL_JOURNAL_HOLD);
+  CHECK(Batch(out, &msg, &i) == 1U);
+  CHECK(Number(&msg, SLAL_FIELD_Id) - Entries(&msg) == last_seq);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) == epoch);
+  CHECK(program_errors == 0U);
+}
+
+/* A failed erase leaves the sector as it finds it; the seq carries on */
+static void Test_EraseFailed(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+  uint32_t epoch;
+  int64_t ms = T0;
+
+  Reflash();
+  erase_fail = 1U;
+  epoch = Run_Until_Erase(&last_seq, &ms);
+  SLAL_Journal_Poll(1U);
+  SLAL_Journal_Poll(1U);
+  CHECK(SLAL_Journal_GetStats()->EraseFailures == 1U);
+  CHECK(SLAL_Journal_Pending() == 0U);
+
+  (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, ms++);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(Entries(&msg) == 1U);
+  CHECK(Number(&msg, SLAL_FIELD_Id) == last_seq);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) == epoch);
+}
+
+/* An empty sector after a reflash starts the seqs again, in a new epoch */
+static void Test_NewEpoch(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  uint32_t last_seq = 0U;
+  uint32_t epoch;
+
+  Reflash();
+  (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  epoch = Number(&msg, SLAL_FIELD_Epoch);
+
+  Reflash();
+  (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0 + 86400000LL);
+  CHECK(Batch(out, &msg, &last_seq) == 1U);
+  CHECK(last_seq == 1U);
+  CHECK(Number(&msg, SLAL_FIELD_Epoch) != epoch);
+}
+
+/* A sector full of unacknowledged events drops new ones */
+static void Test_Full(void)
+{
+  uint32_t i;
+
+  Reflash();
+  for (i = 0U; i < FLASH_SIZE / SLAL_JOURNAL_RECORD_SIZE; i++)
+  {
+    (void)SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0 + i);
+  }
+  CHECK(SLAL_Journal_Pending() == FLASH_SIZE / SLAL_JOURNAL_RECORD_SIZE - 1U);    /* After the epoch record */
+  CHECK(SLAL_Journal_Append(SLAL_EVENT_Lock, DOOR, T0) == 0U);
+  CHECK(SLAL_Journal_GetStats()->Dropped == 2U);
+  SLAL_Journal_Poll(1U);
+  CHECK(erase_starts == 0U);
+}
+
+int main(void)
+{
+  Test_Append();
+  Test_Restart();
+  Test_BatchRewindAck();
+  Test_Erase();
+  Test_EraseFailed();
+  Test_NewEpoch();
+  Test_Full();
+  return CHECK_DONE("test_journal");
+}
@@ -0,0 +1,291 @@
+/**
+  ******************************************************************************
+  * @file    test_msg.cpp
+  * @brief   Host tests for the firmware message codec in slal_msg.c against
+  *          the Pi's: Protocol::toJSON() and Protocol::parseJSON() in
+  *          Common/slal_protocol.h and WireCodec in Common/slal_wire.h.
+  *
+  *          C++ only to call the Pi's codec; slal_msg.c and slal_rtc.c are
+  *          built as C without USE_HAL_DRIVER, as the firmware builds them
+  *          apart from the HAL. Random messages, every field in the schema,
+  *          must encode to the same bytes both ways and decode to the same
+  *          fields, in JSON and in the binary format. Timestamps must
+  *          convert as UTC whatever the local time zone.
+  ******************************************************************************
+  */
+
+#include "slal_msg.h"
+#include "slal_wire.h"
+#include "slal_check.h"
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#define RANDOM_MESSAGES  2000U
+
+static const char *const other_events[] = { "door_forced", "x" };
+static const char *const other_sources[] = { "keypad", "y" };
+
+static std::string Random_Text(size_t max)
+{
+  std::string text;
+  size_t len = 1U + (size_t)rand() % max;
+
+  while (text.size() < len)
+  {
+    char c = (char)(' ' + rand() % 95);
+    if (c != '"')
+    {
+      text += c;
+    }
+  }
+  return text;
+}
+
+static std::string Random_Timestamp(void)
+{
+  char text[32];
+
+  snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d", 1970 + rand() % 130, 1 + rand() % 12,
+           1 + rand() % 28, rand() % 24, rand() % 60, rand() % 60);
+  return text;
+}
+
+/* Known and unknown event and source names, each optional field set one
+   time in three */
+static ProtocolMessage Random_Message(void)
+{
+  ProtocolMessage msg;
+  size_t i;
+
+  if (rand() % 4 == 0)
+  {
+    msg.set<Field::Event>(other_events[rand() % 2]);
+  }
+  else
+  {
+    msg.set<Field::Event>(eventName((Event)(1 + rand() % ((int)Event::Count - 1))));
+  }
+  if (rand() % 4 == 0)
+  {
+    msg.set<Field::Source>(other_sources[rand() % 2]);
+  }
+  else
+  {
+    msg.set<Field::Source>(sourceName((Source)(1 + rand() % ((int)Source::Count - 1))));
+  }
+  msg.set<Field::Timestamp>(Random_Timestamp());
+  for (i = 0U; i < (size_t)Field::Count; i++)
+  {
+    if (!FIELD_TABLE[i].required && (rand() % 3 == 0))
+    {
+      msg.values[i] = Random_Text(12U);
+    }
+  }
+  return msg;
+}
+
+/* The firmware message points into the Pi message's strings */
+static void To_Firmware(const ProtocolMessage &pm, SLAL_MessageTypeDef *msg)
+{
+  size_t i;
+
+  memset(msg, 0, sizeof(*msg));
+  for (i = 0U; i < (size_t)Field::Count; i++)
+  {
+    SLAL_Msg_Set(msg, (SLAL_Field)i, pm.values[i].data(), (uint16_t)pm.values[i].size());
+  }
+}
+
+static int Same_Fields(const SLAL_MessageTypeDef *msg, const ProtocolMessage &pm)
+{
+  size_t i;
+
+  for (i = 0U; i < (size_t)Field::Count; i++)
+  {
+    if (std::string(msg->Fields[i].Len > 0U ? msg->Fields[i].Value : "", msg->Fields[i].Len) != pm.values[i])
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void Test_Random(void)
+{
+  char out[1024];
+  char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  SLAL_MessageTypeDef msg;
+  SLAL_MessageTypeDef decoded;
+  ProtocolMessage pm;
+  ProtocolMessage pi_decoded;
+  std::string json;
+  std::string wire;
+  uint16_t len;
+  unsigned json_same = 0U;
+  unsigned wire_same = 0U;
+  unsigned json_decoded = 0U;
+  unsigned wire_decoded = 0U;
+  unsigned i;
+
+  for (i = 0U; i < RANDOM_MESSAGES; i++)
+  {
+    pm = Random_Message();
+    To_Firmware(pm, &msg);
+
+    json = Protocol::toJSON(pm);
+    len = SLAL_Msg_Encode(&msg, out, (uint16_t)sizeof(out));
+    json_same += (std::string(out, len) == json) ? 1U : 0U;
+    json_decoded += ((SLAL_Msg_Decode(json.data(), (uint16_t)json.size(), &decoded) != 0U) &&
+                     Same_Fields(&decoded, Protocol::parseJSON(json))) ? 1U : 0U;
+
+    wire = WireCodec::encode(pm);
+    len = SLAL_Msg_EncodeWire(&msg, out, (uint16_t)sizeof(out));
+    wire_same += (!wire.empty() && (std::string(out, len) == wire)) ? 1U : 0U;
+    wire_decoded += ((SLAL_Msg_DecodeWire(wire.data(), (uint16_t)wire.size(), &decoded, timestamp) != 0U) &&
+                     (WireCodec::decode(wire.data(), wire.size(), pi_decoded) == (long)wire.size()) &&
+                     Same_Fields(&decoded, pi_decoded)) ? 1U : 0U;
+  }
+  CHECK(json_same == RANDOM_MESSAGES);
+  CHECK(json_decoded == RANDOM_MESSAGES);
+  CHECK(wire_same == RANDOM_MESSAGES);
+  CHECK(wire_decoded == RANDOM_MESSAGES);
+}
+
+/* parseJSON()'s tolerance: unknown keys skipped, the last of a repeated
+   key kept, a key without ":\"" after it passed over */
+static void Test_DecodeQuirks(void)
+{
+  static const char *const lines[] = {
+    "{\"source\":\"laptop\",\"colour\":\"red\",\"event\":\"lock\",\"timestamp\":\"2026-10-18 12:00:00\"}",
+    "{\"source\":\"laptop\",\"event\":\"lock\",\"event\":\"unlock\",\"timestamp\":\"t\",\"id\":\"1\"}",
+    "{\"note\" , \"source\":\"stm32\",\"event\":\"LOCKED\",\"timestamp\":\"t\",\"door\":\"\"}",
+    "{\"source\":\"stm32\",\"event\":\"LOCKED\",\"timestamp\":\"t\",\"id\":\"unterminated}"
+  };
+  SLAL_MessageTypeDef msg;
+  size_t i;
+
+  for (i = 0U; i < sizeof(lines) / sizeof(lines[0]); i++)
+  {
+    CHECK(SLAL_Msg_Decode(lines[i], (uint16_t)strlen(lines[i]), &msg) == 1U);
+    CHECK(Same_Fields(&msg, Protocol::parseJSON(lines[i])));
+  }
+  CHECK(SLAL_Msg_Event(&msg) == SLAL_EVENT_StatusLocked);
+  CHECK(SLAL_Msg_Source(&msg) == SLAL_SOURCE_Stm32);
+  CHECK(SLAL_Msg_Is(&msg, SLAL_FIELD_Door, ""));
+}
+
+static void Test_Rejects(void)
+{
+  static const char missing[] = "{\"source\":\"laptop\",\"event\":\"lock\"}";
+  static const char json[] = "{\"source\":\"stm32\",\"event\":\"LOCKED\",\"timestamp\":\"2026-10-18 12:00:00\"}";
+  char out[SLAL_MSG_MAX_JSON];
+  char timestamp[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  std::string long_value(SLAL_WIRE_TLV_MAX_VALUE + 1U, 'v');
+  uint32_t rejected = SLAL_Msg_GetStats()->Rejected;
+  SLAL_MessageTypeDef msg;
+  ProtocolMessage pm;
+  uint16_t len;
+
+  CHECK(SLAL_Msg_Decode(missing, (uint16_t)strlen(missing), &msg) == 0U);
+
+  /* Encoding fails rather than cut a message short */
+  CHECK(SLAL_Msg_Decode(json, (uint16_t)strlen(json), &msg) == 1U);
+  CHECK(SLAL_Msg_Encode(&msg, out, (uint16_t)(strlen(json) - 1U)) == 0U);
+  CHECK(SLAL_Msg_Encode(&msg, out, (uint16_t)strlen(json)) == strlen(json));
+  len = SLAL_Msg_EncodeWire(&msg, out, (uint16_t)sizeof(out));
+  CHECK(len == SLAL_WIRE_HEADER_SIZE);
+  CHECK(SLAL_Msg_EncodeWire(&msg, out, (uint16_t)(len - 1U)) == 0U);
+
+  /* A quote would end the value early */
+  SLAL_Msg_SetText(&msg, SLAL_FIELD_Id, "a\"b");
+  CHECK(SLAL_Msg_Encode(&msg, out, (uint16_t)sizeof(out)) == 0U);
+
+  /* A TLV carries at most 255 bytes, on both sides */
+  SLAL_Msg_Set(&msg, SLAL_FIELD_Id, long_value.data(), (uint16_t)long_value.size());
+  CHECK(SLAL_Msg_EncodeWire(&msg, out, (uint16_t)sizeof(out)) == 0U);
+  pm = Protocol::parseJSON(json);
+  pm.set<Field::Id>(long_value);
+  CHECK(WireCodec::encode(pm).empty());
+
+  /* Bad magic, a TLV running past the end, a short header */
+  SLAL_Msg_SetText(&msg, SLAL_FIELD_Id, "42");
+  len = SLAL_Msg_EncodeWire(&msg, out, (uint16_t)sizeof(out));
+  CHECK(SLAL_Msg_DecodeWire(out, len, &msg, timestamp) == 1U);
+  out[SLAL_WIRE_HEADER_SIZE + 1U] = 3;
+  CHECK(SLAL_Msg_DecodeWire(out, len, &msg, timestamp) == 0U);
+  out[0] = 0;
+  CHECK(SLAL_Msg_DecodeWire(out, len, &msg, timestamp) == 0U);
+  CHECK(SLAL_Msg_DecodeWire(out, SLAL_WIRE_HEADER_SIZE - 1U, &msg, timestamp) == 0U);
+
+  CHECK(SLAL_Msg_GetStats()->Rejected == rejected + 8U);
+}
+
+/* A timestamp that does not parse travels as 0 both ways */
+static void Test_BadTimestamp(void)
+{
+  char out[SLAL_MSG_MAX_JSON];
+  SLAL_MessageTypeDef msg;
+  ProtocolMessage pm = Protocol::create(Source::Stm32, Event::Journal, "not a time");
+  uint16_t len;
+
+  To_Firmware(pm, &msg);
+  len = SLAL_Msg_EncodeWire(&msg, out, (uint16_t)sizeof(out));
+  CHECK(std::string(out, len) == WireCodec::encode(pm));
+}
+
+/* Protocol timestamps are UTC whatever the local zone: a round trip
+   through milliseconds gives the same text, and a stamp made with
+   gmtime_r(), as the Pi and the clients make them, converts back to
+   the time it was made. The firmware's own conversion agrees. Each zone converts other times, so none comes
+   from the codec's cache. */
+static void Test_TimestampUtc(void)
+{
+  static const char *const zones[] = { "EST5EDT,M3.2.0,M11.1.0", "IST-5:30", "NZST-12NZDT,M9.5.0,M4.1.0/3" };
+  const int64_t day_ms = 86400000LL;
+  int64_t ms;
+  time_t now = time(NULL);
+  struct tm timeinfo;
+  char text[32];
+  char firmware[SLAL_RTC_TIMESTAMP_LEN + 1U];
+  int64_t parsed;
+  size_t i;
+
+  for (i = 0U; i < sizeof(zones) / sizeof(zones[0]); i++)
+  {
+    setenv("TZ", zones[i], 1);
+    tzset();
+    ms = 1791633600123LL + (int64_t)i * day_ms;       /* 2026-10-10 12:00:00.123 UTC on */
+    snprintf(text, sizeof(text), "2026-10-%02u 12:00:00", (unsigned)(10U + i));
+    CHECK(WireCodec::epochMsToTimestamp(ms) == text);
+    CHECK(WireCodec::timestampToEpochMs(text) == ms - 123);
+
+    /* The firmware stamps the same text from its RTC */
+    SLAL_Rtc_FormatTimestamp(ms, firmware);
+    CHECK(strcmp(firmware, text) == 0);
+    CHECK((SLAL_Rtc_ParseTimestamp(text, SLAL_RTC_TIMESTAMP_LEN, &parsed) == 1U) && (parsed == ms - 123));
+
+    /* Not a local time in EST5EDT, skipped by the change to summer time */
+    snprintf(text, sizeof(text), "2026-03-08 02:30:%02u", (unsigned)i);
+    CHECK(WireCodec::epochMsToTimestamp(WireCodec::timestampToEpochMs(text)) == text);
+
+    gmtime_r(&now, &timeinfo);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    CHECK(WireCodec::timestampToEpochMs(text) == (int64_t)now * 1000);
+    now += 1;
+  }
+  unsetenv("TZ");
+  tzset();
+}
+
+int main(void)
+{
+  srand(42U);
+  Test_Random();
+  Test_DecodeQuirks();
+  Test_Rejects();
+  Test_BadTimestamp();
+  Test_TimestampUtc();
+  return CHECK_DONE("test_msg");
+}
@@ -0,0 +1,317 @@
+/**
+  ******************************************************************************
+  * @file    test_uart_rx.c
+  * @brief   Host tests for the UART frame extractor and the DMA ring
+  *          bookkeeping in slal_uart_rx.c, built without the HAL.
+  *
+  *          The last test plays the DMA at 115200 baud: a synthetic stream
+  *          of lines written into the ring in idle-line, half and complete
+  *          transfer events, polled every millisecond of simulated time.
+  ******************************************************************************
+  */
+
+#include "slal_uart_rx.h"
+#include "slal_check.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FRAMES  4096U
+
+typedef struct
+{
+  uint32_t Start;
+  uint16_t Len;
+} FrameRef;
+
+static uint8_t frame_data[MAX_FRAMES * 64U];
+static FrameRef frames[MAX_FRAMES];
+static uint32_t frame_count;
+static uint32_t frame_bytes;
+
+static void Collect(const uint8_t *frame, uint16_t len)
+{
+  if ((frame_count < MAX_FRAMES) && (frame_bytes + len <= sizeof(frame_data)))
+  {
+    memcpy(&frame_data[frame_bytes], frame, len);
+    frames[frame_count].Start = frame_bytes;
+    frames[frame_count].Len = len;
+    frame_bytes += len;
+  }
+  frame_count++;
+}
+
+static void Collect_Reset(void)
+{
+  frame_count = 0U;
+  frame_bytes = 0U;
+}
+
+static int Frame_Is(uint32_t i, const char *text)
+{
+  size_t len = strlen(text);
+  return (i < frame_count) && (frames[i].Len == len) && (memcmp(&frame_data[frames[i].Start], text, len) == 0);
+}
+
+static void Feed(SLAL_FrameExtractorTypeDef *fx, const char *text)
+{
+  SLAL_Frame_Feed(fx, (const uint8_t *)text, (uint16_t)strlen(text));
+}
+
+static void Test_Lines(void)
+{
+  SLAL_FrameExtractorTypeDef fx;
+
+  SLAL_Frame_Init(&fx, (uint8_t)'\n', Collect);
+  Collect_Reset();
+  Feed(&fx, "{\"a\":\"1\"}\n{\"b\":\"2\"}\r\n\n\r\n{\"c\"");
+  CHECK(frame_count == 2U);
+  CHECK(Frame_Is(0U, "{\"a\":\"1\"}"));
+  CHECK(Frame_Is(1U, "{\"b\":\"2\"}"));
+  Feed(&fx, ":\"3\"}");
+  CHECK(frame_count == 2U);
+  Feed(&fx, "\r");
+  Feed(&fx, "\n");
+  CHECK(frame_count == 3U);
+  CHECK(Frame_Is(2U, "{\"c\":\"3\"}"));
+  CHECK(fx.Frames == 3U);
+  CHECK(fx.OversizedFrames == 0U);
+}
+
+/* Every split of a stream into two feeds gives the same frames */
+static void Test_Splits(void)
+{
+  static const char stream[] = "one\ntwo\r\nthree\n\nfour\n";
+  SLAL_FrameExtractorTypeDef fx;
+  uint16_t len = (uint16_t)strlen(stream);
+  uint16_t split;
+
+  for (split = 0U; split <= len; split++)
+  {
+    SLAL_Frame_Init(&fx, (uint8_t)'\n', Collect);
+    Collect_Reset();
+    SLAL_Frame_Feed(&fx, (const uint8_t *)stream, split);
+    SLAL_Frame_Feed(&fx, (const uint8_t *)&stream[split], (uint16_t)(len - split));
+    CHECK(frame_count == 4U);
+    CHECK(Frame_Is(0U, "one") && Frame_Is(1U, "two") && Frame_Is(2U, "three") && Frame_Is(3U, "four"));
+    CHECK(fx.Len == 0U);
+  }
+}
+
+/* SLAL_UART_RX_MAX_FRAME bytes fit; one more drops that frame only */
+static void Test_Oversized(void)
+{
+  static uint8_t data[2U * SLAL_UART_RX_MAX_FRAME + 8U];
+  SLAL_FrameExtractorTypeDef fx;
+  uint16_t half = SLAL_UART_RX_MAX_FRAME / 2U;
+
+  memset(data, 'x', sizeof(data));
+  SLAL_Frame_Init(&fx, (uint8_t)'\n', Collect);
+  Collect_Reset();
+
+  data[SLAL_UART_RX_MAX_FRAME] = (uint8_t)'\n';
+  SLAL_Frame_Feed(&fx, data, SLAL_UART_RX_MAX_FRAME + 1U);
+  CHECK(frame_count == 1U);
+  CHECK((frame_count == 1U) && (frames[0].Len == SLAL_UART_RX_MAX_FRAME));
+
+  /* Whole in one feed */
+  data[SLAL_UART_RX_MAX_FRAME] = (uint8_t)'x';
+  data[SLAL_UART_RX_MAX_FRAME + 1U] = (uint8_t)'\n';
+  SLAL_Frame_Feed(&fx, data, SLAL_UART_RX_MAX_FRAME + 2U);
+  CHECK(frame_count == 1U);
+  CHECK(fx.OversizedFrames == 1U);
+
+  /* Spanning feeds, with the next frame behind it in the same feed */
+  SLAL_Frame_Feed(&fx, data, half);
+  SLAL_Frame_Feed(&fx, data, half);
+  SLAL_Frame_Feed(&fx, data, 1U);
+  Feed(&fx, "\nok\n");
+  CHECK(frame_count == 2U);
+  CHECK(Frame_Is(1U, "ok"));
+  CHECK(fx.OversizedFrames == 2U);
+
+  /* Reset drops a partial frame */
+  Feed(&fx, "partial");
+  SLAL_Frame_Reset(&fx);
+  Feed(&fx, "whole\n");
+  CHECK(Frame_Is(2U, "whole"));
+}
+
+/* Link frames end in 0x00 and may contain '\r' and '\n' */
+static void Test_LinkDelimiter(void)
+{
+  static const uint8_t data[] = { 0x01U, '\r', '\n', 0x02U, 0x00U, 0x00U, 0x03U, '\r', 0x00U };
+  SLAL_FrameExtractorTypeDef fx;
+
+  SLAL_Frame_Init(&fx, 0x00U, Collect);
+  Collect_Reset();
+  SLAL_Frame_Feed(&fx, data, (uint16_t)sizeof(data));
+  CHECK(frame_count == 2U);
+  CHECK((frames[0].Len == 4U) && (memcmp(&frame_data[frames[0].Start], data, 4U) == 0));
+  CHECK((frames[1].Len == 2U) && (memcmp(&frame_data[frames[1].Start], &data[6], 2U) == 0));
+}
+
+/* Host stand-in for the DMA: write text at the ring position pos */
+static uint32_t Dma_Write(uint32_t pos, const char *text, uint32_t len)
+{
+  uint8_t *ring = SLAL_UartRx_Buffer();
+  uint32_t i;
+
+  for (i = 0U; i < len; i++)
+  {
+    ring[(pos + i) & (SLAL_UART_RX_DMA_SIZE - 1U)] = (uint8_t)text[i];
+  }
+  return pos + len;
+}
+
+static uint16_t Dma_Pos(uint32_t pos)
+{
+  uint16_t write_pos = (uint16_t)(pos & (SLAL_UART_RX_DMA_SIZE - 1U));
+  /* The complete transfer event reports the full size, not 0 */
+  return ((write_pos == 0U) && (pos != 0U)) ? (uint16_t)SLAL_UART_RX_DMA_SIZE : write_pos;
+}
+
+static void Test_Ring(void)
+{
+  const SLAL_UartRxStatsTypeDef *stats;
+  char line[SLAL_UART_RX_DMA_SIZE + 16U];
+  uint32_t pos;
+
+  SLAL_UartRx_Init((uint8_t)'\n', Collect);
+  Collect_Reset();
+
+  /* Up to just before the end of the ring, then a line across the wrap */
+  memset(line, 'a', sizeof(line));
+  line[SLAL_UART_RX_DMA_SIZE - 11U] = '\n';
+  pos = Dma_Write(0U, line, SLAL_UART_RX_DMA_SIZE - 10U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  CHECK(frame_count == 0U);                 /* Longer than a frame: dropped */
+  pos = Dma_Write(pos, "wrapped line\n", 13U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  CHECK(frame_count == 1U);
+  CHECK(Frame_Is(0U, "wrapped line"));
+  stats = SLAL_UartRx_GetStats();
+  CHECK(stats->Bytes == pos);
+  CHECK(stats->OversizedFrames == 1U);
+  CHECK(stats->Overruns == 0U);
+
+  /* Nothing new, nothing delivered */
+  SLAL_UartRx_Poll();
+  CHECK(frame_count == 1U);
+
+  /* The DMA laps the reader: the bytes are lost and counted */
+  pos = Dma_Write(pos, "lost", 4U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  pos = Dma_Write(pos, line, SLAL_UART_RX_DMA_SIZE / 2U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  pos = Dma_Write(pos, line, SLAL_UART_RX_DMA_SIZE / 2U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  CHECK(SLAL_UartRx_GetStats()->Overruns == 1U);
+  pos = Dma_Write(pos, "after\n", 6U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  CHECK(frame_count == 2U);
+  CHECK(Frame_Is(1U, "after"));
+
+  /* A UART error restarts the DMA at the start of the ring */
+  pos = Dma_Write(pos, "cut sh", 6U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  SLAL_UartRx_Error();
+  SLAL_UartRx_Poll();
+  CHECK(SLAL_UartRx_GetStats()->UartErrors == 1U);
+  pos = Dma_Write(0U, "fresh\n", 6U);
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+  CHECK(frame_count == 3U);
+  CHECK(Frame_Is(2U, "fresh"));
+}
+
+/* Ten simulated seconds at 115200 baud (11520 bytes/s, 8N1): random
+   lines, an event at every idle line and every half buffer, a poll every
+   millisecond. Every line must come out whole and in order. */
+static void Test_FullBaud(void)
+{
+  static char stream[115200U];
+  static uint32_t line_start[MAX_FRAMES];
+  static uint16_t line_len[MAX_FRAMES];
+  const SLAL_UartRxStatsTypeDef *stats;
+  uint32_t lines = 0U;
+  uint32_t stream_len = 0U;
+  uint32_t pos = 0U;
+  uint32_t ms;
+  uint32_t next_byte_us = 0U;
+  uint32_t i;
+  uint16_t len;
+  int ok = 1;
+
+  srand(38U);
+  while (lines < MAX_FRAMES)
+  {
+    len = (uint16_t)(1U + (uint32_t)rand() % 200U);
+    if (stream_len + len + 2U > sizeof(stream))
+    {
+      break;
+    }
+    line_start[lines] = stream_len;
+    line_len[lines] = len;
+    for (i = 0U; i < len; i++)
+    {
+      stream[stream_len++] = (char)(' ' + rand() % 94);
+    }
+    if ((rand() & 1) != 0)
+    {
+      stream[stream_len++] = '\r';
+    }
+    stream[stream_len++] = '\n';
+    lines++;
+  }
+
+  SLAL_UartRx_Init((uint8_t)'\n', Collect);
+  Collect_Reset();
+  for (ms = 0U; pos < stream_len; ms++)
+  {
+    /* 86.8 us per byte; the line idles after each '\n' */
+    while ((pos < stream_len) && (next_byte_us < (ms + 1U) * 1000U))
+    {
+      pos = Dma_Write(pos, &stream[pos], 1U);
+      next_byte_us += 87U;
+      if ((stream[pos - 1U] == '\n') || ((pos & (SLAL_UART_RX_DMA_SIZE / 2U - 1U)) == 0U))
+      {
+        SLAL_UartRx_Event(Dma_Pos(pos));
+      }
+    }
+    SLAL_UartRx_Poll();
+  }
+  SLAL_UartRx_Event(Dma_Pos(pos));
+  SLAL_UartRx_Poll();
+
+  stats = SLAL_UartRx_GetStats();
+  CHECK(stats->Bytes == stream_len);
+  CHECK(stats->Overruns == 0U);
+  CHECK(frame_count == lines);
+  for (i = 0U; (i < lines) && (i < frame_count); i++)
+  {
+    if ((frames[i].Len != line_len[i]) ||
+        (memcmp(&frame_data[frames[i].Start], &stream[line_start[i]], line_len[i]) != 0))
+    {
+      ok = 0;
+    }
+  }
+  CHECK(ok);
+  printf("full baud: %lu lines, %lu bytes in %lu simulated ms\n",
+         (unsigned long)lines, (unsigned long)stream_len, (unsigned long)ms);
+}
+
+int main(void)
+{
+  Test_Lines();
+  Test_Splits();
+  Test_Oversized();
+  Test_LinkDelimiter();
+  Test_Ring();
+  Test_FullBaud();
+  return CHECK_DONE("test_uart_rx");
+}
@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# Sir Locks-A-Lot - TCM placement check
+#
+# Post-build step: fails unless every object file built from a source that
+# uses SLAL_ITCM has its .itcm_text input section in ITCMRAM, and every one
+# that uses SLAL_DTCM_DATA / SLAL_DTCM_BSS has its .dtcm_data / .dtcm_bss in
+# DTCMRAM, according to the linker map file (see slal_tcm.h). Static
+# functions and variables are covered: the check works on sections, not
+# symbol names. Any other .itcm_text / .dtcm_* input section outside its
+# TCM fails too.
+#
+# Usage: check_tcm.sh <map file> <source dir>...
+#   STM32CubeIDE, Post-build steps (run from Debug/):
+#   ../check_tcm.sh STM32F746.map ../Core/Src
+#
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <map file> <source dir>..." >&2
+    exit 2
+fi
+map=$1
+shift
+
+# "object section" for every source that tags something, comments skipped
+tagged=$(for dir in "$@"; do
+    for src in "$dir"/*.c; do
+        [ -f "$src" ] || continue
+        awk -v obj="$(basename "$src" .c).o" '
+            /^[ \t]*(\/\*|\*|\/\/)/ { next }
+            /SLAL_ITCM/      { itcm = 1 }
+            /SLAL_DTCM_DATA/ { data = 1 }
+            /SLAL_DTCM_BSS/  { bss = 1 }
+            END {
+                if (itcm) print obj, ".itcm_text"
+                if (data) print obj, ".dtcm_data"
+                if (bss)  print obj, ".dtcm_bss"
+            }' "$src"
+    done
+done)
+
+if [ -z "$tagged" ]; then
+    echo "check_tcm: no tagged sources found"
+    exit 0
+fi
+
+echo "$tagged" | awk -v map="$map" '
+    function hex(s,    i, c, v) {
+        v = 0; s = tolower(s); sub(/^0x/, "", s)
+        for (i = 1; i <= length(s); i++) {
+            c = index("0123456789abcdef", substr(s, i, 1)) - 1
+            v = v * 16 + c
+        }
+        return v
+    }
+    function region_of(section) {
+        return (section == ".itcm_text") ? "ITCMRAM" : "DTCMRAM"
+    }
+    # One input section: where it went and which output section holds it
+    function place(section, a, size, file,    obj, key, region) {
+        if (hex(size) == 0) return
+        obj = file; sub(/\)$/, "", obj); sub(/.*[\/(]/, "", obj)
+        key = obj " " section
+        region = region_of(section)
+        if (out != section || hex(a) < origin[region] || hex(a) + hex(size) > origin[region] + length_[region]) {
+            printf "check_tcm: %s of %s at 0x%08x in %s, not in %s\n", section, obj, hex(a), out, region
+            failed = 1
+        }
+        placed[key] = 1
+    }
+    BEGIN {
+        while ((getline line < map) > 0) {
+            n = split(line, f, /[ \t]+/)
+            if (line ~ /^Memory Configuration/) { inmem = 1; continue }
+            if (line ~ /^Linker script and memory map/) {
+                if (!("ITCMRAM" in origin) || !("DTCMRAM" in origin)) break
+                inmem = 0; inmap = 1; continue
+            }
+            if (inmem && n >= 3 && f[2] ~ /^0x/) {
+                origin[f[1]] = hex(f[2]); length_[f[1]] = hex(f[3])
+            }
+            if (!inmap) continue
+            # Output section: name in the first column
+            if (line ~ /^\.[^ \t]/) { out = f[1]; continue }
+            # Input section: " .name addr size file", or the name alone
+            # with the rest wrapped onto the next line
+            if (line ~ /^ \.(itcm_text|dtcm_data|dtcm_bss)([ \t]|$)/) {
+                if (n >= 5 && f[3] ~ /^0x/ && f[4] ~ /^0x/) place(f[2], f[3], f[4], f[5])
+                else pending = f[2]
+                continue
+            }
+            if (pending != "" && n >= 4 && f[1] == "" && f[2] ~ /^0x/ && f[3] ~ /^0x/) {
+                place(pending, f[2], f[3], f[4])
+            }
+            pending = ""
+        }
+        if (!inmap) {
+            print "check_tcm: " map " has no ITCMRAM/DTCMRAM region"
+            failed = 1
+            exit 1
+        }
+    }
+    {
+        if (!(($1 " " $2) in placed)) {
+            print "check_tcm: " $2 " of " $1 " not in " map
+            failed = 1
+        }
+        else {
+            checked++
+        }
+    }
+    END {
+        if (failed) exit 1
+        print "check_tcm: " checked " sections in TCM"
+    }'
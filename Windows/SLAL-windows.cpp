@@ -9,354 +9,708 @@
 * Sends and receives JSON messages to/from Raspberry Pi
 * Features JSON parsing and network communication capabilities
 *
-* JSON Format:
-* {
-*   "source": "laptop|stm32|raspberry_pi",
-*   "event": "lock|unlock|error|status_request",
-*   "timestamp": "YYYY-MM-DD HH:MM:SS"
-* }
+* Networking and protocol handling live in Common/slal_client.h; this file
+* is the console user interface on top of it. Messages from the Pi are read
+* by the client's receiver thread, and the screen is redrawn as soon as one
+* arrives, while keyboard input is collected a key at a time. Drawing goes
+* through ConsoleScreen (Common/slal_console.h), which only sends changed
+* cells, so the same program also runs in Linux terminals.
+*
+* Logged events are kept in a local cache (Common/slal_cache.h), one file per
+* server, so the last known door state and recent history show at once on
+* startup. Each time the connection comes up, only the events logged since
+* the cache's cursor are fetched from the Pi.
+*
+* Usage:
+* SLAL-windows.exe                      Interactive console
+* SLAL-windows.exe --batch <file|->     Run a command script without the UI
+*                  [--window <n>] [--timeout <ms>] [--host <ip>] [--port <n>]
+* SLAL-windows.exe --site <name=host[:port]> [--site ...]
+*                                       Monitor several sites in one view
 */
 
 #include <iostream>
 #include <string>
-#include <cstdlib>
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <chrono>
-#include <iomanip>
-#include <sstream>
 #include <thread>
-
-#pragma comment(lib, "ws2_32.lib")
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unordered_map>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "../Common/slal_client.h"
+#include "../Common/slal_console.h"
+#include "../Common/slal_sites.h"
+#include "../Common/slal_cache.h"
 
 #define WIDTH 100
 #define HEIGHT 50
 #define RASPBERRY_PI_IP "10.0.0.8"  // Change this to your Pi's IP
 #define PORT 8080
-#define BUFFER_SIZE 1024
+#define FRAME_ROWS 31         // Frame, notice line and prompt
+#define HISTORY_ROWS 6        // Recent events shown under the door status
+#define REFRESH_MS 200        // Periodic redraw; unchanged frames send nothing
+#define OFFLINE_TTL_S 30      // How long commands typed while offline stay queued
+#define BATCH_WINDOW 16       // Batch commands in flight at once
+#define BATCH_TIMEOUT_MS 5000 // Batch command without a reply counts as timed out
+#define DEFAULT_DOOR_ID "1"   // Door the Pi reports on when a message names none
 
 using namespace std;
 
 class DoorController {
 private:
-    SOCKET sock;
-    struct sockaddr_in server_addr;
-    string doorStatus;
-    bool connected;
+    DoorClient client;
+    ConsoleScreen screen;
+    ConsoleKeyboard keyboard;
+    EventCache cache;
+    string inputLine;           // Command typed so far
+    string notice;              // Feedback for the last command
+    bool lastConnected;
+    int caughtUp;               // Events the current history replay added
+
+    // Time from the Pi sending a message to it being on screen
+    long long lastPiToScreenMs;
+    long long lastClientMs;     // Of which spent between recv and screen
+    long long totalPiToScreenMs;
+    long long maxPiToScreenMs;
+    int updatesTimed;
 
 public:
-    DoorController() : doorStatus("UNKNOWN"), connected(false) {
-        // Initialize Winsock
-        WSADATA wsaData;
-        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-            cout << "WSAStartup failed" << endl;
-            return;
+    DoorController() : client(RASPBERRY_PI_IP, PORT, false), screen(FRAME_ROWS, WIDTH),
+                       cache(EventCache::fileFor(RASPBERRY_PI_IP, PORT), DEFAULT_DOOR_ID), lastConnected(false),
+                       caughtUp(0), lastPiToScreenMs(-1), lastClientMs(-1), totalPiToScreenMs(0),
+                       maxPiToScreenMs(0), updatesTimed(0) {
+        client.setOfflineTTL(chrono::seconds(OFFLINE_TTL_S));
+        if (!cache.load()) {
+            notice = "Event cache could not be opened; history will not be kept";
         }
+        showCachedStatus(" (cached)");
+        // Connecting happens in the background so the console never waits on it
+        client.startReceiver();
+        client.startAutoReconnect();
+    }
 
-        // Don't create socket here - create it in connectToRaspberryPi()
-        sock = INVALID_SOCKET;
+    void drawFrame() {
+        screen.clear();
 
-        // Setup server address
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(PORT);
-        inet_pton(AF_INET, RASPBERRY_PI_IP, &server_addr.sin_addr);
+        // Top border
+        screen.border(0, '=');
 
-        connectToRaspberryPi();
-    }
+        // Menu section
+        screen.boxLine(1, 38, "DOOR CONTROL MENU");
+        screen.boxLine(2, 1, "");
+        screen.boxLine(3, 5, "Available Commands:");
+        screen.boxLine(4, 1, "");
+        screen.boxLine(5, 5, "1. status   - Check current door status");
+        screen.boxLine(6, 5, "2. lock     - Lock the door");
+        screen.boxLine(7, 5, "3. unlock   - Unlock the door");
+        screen.boxLine(8, 5, "4. connect  - Retry connecting to Raspberry Pi now");
+        screen.boxLine(9, 5, "5. quit     - Exit program");
+        screen.boxLine(10, 1, "");
 
-    ~DoorController() {
-        if (sock != INVALID_SOCKET) {
-            closesocket(sock);
-        }
-        WSACleanup();
-    }
+        // Middle divider
+        screen.border(11, '-');
 
-    bool connectToRaspberryPi() {
-        // Close existing socket if open
-        if (sock != INVALID_SOCKET) {
-            closesocket(sock);
+        // Status section
+        screen.boxLine(12, 38, "CURRENT DOOR STATUS");
+        screen.boxLine(13, 1, "");
+
+        // Door and connection status start at the same column
+        int padding = 40;
+        screen.boxLine(14, 1 + padding, client.getDoorStatus());
+        screen.boxLine(15, 1, "");
+        string connectionStatus = "CONNECTED TO RASPBERRY PI";
+        if (!client.isConnected()) {
+            connectionStatus = "OFFLINE MODE - RECONNECTING";
+            size_t queued = client.getOfflineQueueSize();
+            if (queued > 0) connectionStatus += " (" + to_string(queued) + " QUEUED)";
         }
+        screen.boxLine(16, 1 + padding, connectionStatus);
+        screen.boxLine(17, 1, "");
 
-        // Create new socket
-        sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock == INVALID_SOCKET) {
-            cout << "Socket creation failed. Error: " << WSAGetLastError() << endl;
-            connected = false;
-            return false;
+        string latency = "LAST UPDATE: -";
+        if (lastPiToScreenMs >= 0) {
+            latency = "LAST UPDATE: " + to_string(lastPiToScreenMs) + " ms after Pi send ("
+                    + to_string(lastClientMs) + " ms in client)";
+        }
+        screen.boxLine(18, 1 + padding, latency);
+        screen.boxLine(19, 1, "");
+
+        // Newest logged events, from the cache
+        screen.border(20, '-');
+        screen.boxLine(21, 39, "RECENT EVENTS");
+        const deque<ProtocolMessage>& recent = cache.getRecent();
+        size_t first = recent.size() > HISTORY_ROWS ? recent.size() - HISTORY_ROWS : 0;
+        int row = 22;
+        for (size_t i = recent.size(); i > first; i--) {
+            const ProtocolMessage& event = recent[i - 1];
+            string door = event.get<Field::Door>().empty() ? DEFAULT_DOOR_ID : event.get<Field::Door>();
+            screen.boxLine(row, 5, "#" + event.get<Field::Seq>());
+            screen.text(row, 15, event.get<Field::Timestamp>());
+            screen.text(row, 37, event.get<Field::Event>());
+            screen.text(row, 47, "door " + door);
+            string via = "via " + event.get<Field::Source>();
+            if (!event.get<Field::EventCount>().empty()) via += " (x" + event.get<Field::EventCount>() + ", rate limited)";
+            screen.text(row, 60, via);
+            row++;
+        }
+        if (recent.empty()) {
+            screen.boxLine(row++, 5, "No events cached yet");
+        }
+        while (row < 22 + HISTORY_ROWS) {
+            screen.boxLine(row++, 1, "");
         }
 
-        // Set socket options for better reconnection
-        int opt = 1;
-        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+        // Bottom border
+        screen.border(28, '=');
 
-        // Set connection timeout
-        DWORD timeout = 5000; // 5 seconds
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+        screen.text(29, 0, notice);
+        string prompt = "Enter command: " + inputLine;
+        screen.text(30, 0, prompt);
+        screen.setCursor(30, (int)prompt.length());
+        screen.present();
+    }
+
+    // Door status from the newest cached event for the default door
+    void showCachedStatus(const string& suffix) {
+        auto latest = cache.getDoors().find(DEFAULT_DOOR_ID);
+        if (latest == cache.getDoors().end()) return;
+        string status = describeDoorStatus(latest->second);
+        client.setDoorStatus(status + " (via " + latest->second.get<Field::Source>() + ")" + suffix);
+    }
+
+    // Ask for the events logged since the cache's cursor
+    void requestHistory() {
+        caughtUp = 0;
+        string request = Protocol::toJSON(cache.historyRequest(DoorClient::getCurrentTimestamp()));
+        if (client.sendJSON(request)) {
+            notice = "Fetching events after #" + to_string(cache.getCursor());
+        }
+    }
 
-        cout << "Attempting to connect to " << RASPBERRY_PI_IP << ":" << PORT << endl;
+    // Logged events and history_end go into the cache
+    void cacheMessage(const string& json) {
+        ProtocolMessage msg = Protocol::parseJSON(json);
+        if (msg.get<Field::Seq>().empty()) return;
 
-        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-            int error = WSAGetLastError();
-            cout << "Connection to Raspberry Pi failed. Error: " << error << endl;
-            cout << "Operating in offline mode." << endl;
-            closesocket(sock);
-            sock = INVALID_SOCKET;
-            connected = false;
-            this_thread::sleep_for(chrono::seconds(1));
+        bool added = cache.add(msg);
+        if (msg.event() != Event::HistoryEnd) {
+            if (added) caughtUp++;
+            return;
+        }
+        showCachedStatus("");
+        notice = "Up to date at #" + to_string(cache.getCursor()) + " (" + to_string(caughtUp) + " new events)";
+    }
+
+    // Apply everything the receiver has queued; true if anything arrived
+    bool handleIncomingMessages(chrono::milliseconds wait) {
+        ReceivedMessage received;
+        if (!client.waitForMessage(received, wait)) {
             return false;
         }
 
-        connected = true;
-        doorStatus = "CONNECTED";
-        cout << "Successfully connected to Raspberry Pi!" << endl;
+        do {
+            client.processReceivedMessage(received.json);
+            cacheMessage(received.json);
+        } while (client.waitForMessage(received, chrono::milliseconds(0)));
+
+        drawFrame();
+        recordLatency(received);
+        // Only the latency digits change, so this second present is a few bytes
+        drawFrame();
         return true;
     }
 
-    string getCurrentTimestamp() {
-        auto now = chrono::system_clock::now();
-        auto time_t = chrono::system_clock::to_time_t(now);
+    // Sent time is the Pi's wall clock, so this assumes both clocks are synced
+    void recordLatency(const ReceivedMessage& received) {
+        lastClientMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - received.receivedAt).count();
+        if (received.sentMs <= 0) return;
 
-        struct tm timeinfo;
-        localtime_s(&timeinfo, &time_t);  // Safe version for Windows
+        long long nowMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        lastPiToScreenMs = nowMs - received.sentMs;
+        totalPiToScreenMs += lastPiToScreenMs;
+        if (lastPiToScreenMs > maxPiToScreenMs) maxPiToScreenMs = lastPiToScreenMs;
+        updatesTimed++;
+    }
 
-        stringstream ss;
-        ss << put_time(&timeinfo, "%Y-%m-%d %H:%M:%S");
-        return ss.str();
+    // Collect keys without blocking; true once Enter completes a line
+    bool readKeyboard(string& line) {
+        bool typed = false;
+        bool entered = keyboard.editLine(inputLine, line, typed);
+        if (typed) drawFrame();
+        return entered;
     }
 
-    string createJSON(const string& source, const string& event) {
-        string timestamp = getCurrentTimestamp();
-        return "{\"source\":\"" + source + "\",\"event\":\"" + event + "\",\"timestamp\":\"" + timestamp + "\"}";
+    // Commands typed while offline wait for the reconnect, up to the TTL
+    void sendCommand(Event event, const string& name) {
+        string jsonMsg = client.createJSON(Source::Laptop, event);
+        switch (client.submitJSON(jsonMsg)) {
+        case SendResult::Sent:
+            client.setDoorStatus(name + " COMMAND SENT");
+            notice = name + " command sent to Raspberry Pi";
+            break;
+        case SendResult::Queued:
+            client.setDoorStatus(name + " COMMAND QUEUED");
+            notice = name + " command queued until the Raspberry Pi is back (" + to_string(OFFLINE_TTL_S) + " s)";
+            break;
+        case SendResult::Failed:
+            client.setDoorStatus("FAILED TO SEND " + name + " COMMAND");
+            notice = "";
+            break;
+        }
     }
 
-    // Simple JSON parser - extracts values between quotes after key
-    string parseJSONValue(const string& json, const string& key) {
-        string searchKey = "\"" + key + "\":\"";
-        size_t pos = json.find(searchKey);
-        if (pos == string::npos) return "";
+    void run() {
+        string userInput;
 
-        pos += searchKey.length();
-        size_t endPos = json.find("\"", pos);
-        if (endPos == string::npos) return "";
+        drawFrame();
+        auto lastDraw = chrono::steady_clock::now();
 
-        return json.substr(pos, endPos - pos);
-    }
+        while (true) {
+            // Redraw as soon as the receiver delivers something from the Pi
+            if (handleIncomingMessages(chrono::milliseconds(20))) {
+                lastDraw = chrono::steady_clock::now();
+            }
+
+            // The client reports lost connections on the console itself
+            if (client.isConnected() != lastConnected) {
+                lastConnected = client.isConnected();
+                if (lastConnected) requestHistory();
+                screen.invalidate();
+                drawFrame();
+                lastDraw = chrono::steady_clock::now();
+            }
 
-    bool sendJSON(const string& jsonMessage) {
-        if (!connected) {
-            cout << "Not connected to Raspberry Pi. Attempting to reconnect..." << endl;
-            if (!connectToRaspberryPi()) {
-                return false;
+            if (!readKeyboard(userInput)) {
+                if (chrono::steady_clock::now() - lastDraw >= chrono::milliseconds(REFRESH_MS)) {
+                    drawFrame();
+                    lastDraw = chrono::steady_clock::now();
+                }
+                continue;
+            }
+
+            if (userInput == "quit") {
+                break;
+            }
+            else if (userInput == "status") {
+                // The reply is shown when the receiver delivers it
+                sendCommand(Event::StatusRequest, "STATUS");
             }
+            else if (userInput == "lock") {
+                sendCommand(Event::Lock, "LOCK");
+            }
+            else if (userInput == "unlock") {
+                sendCommand(Event::Unlock, "UNLOCK");
+            }
+            else if (userInput == "connect") {
+                if (client.isConnected()) {
+                    notice = "Already connected to Raspberry Pi";
+                }
+                else {
+                    client.requestReconnect();
+                    notice = "Retrying connection to Raspberry Pi now...";
+                }
+            }
+            else {
+                client.setDoorStatus("ERROR - Invalid command");
+                notice = "";
+            }
+            drawFrame();
+            lastDraw = chrono::steady_clock::now();
         }
 
-        int result = send(sock, jsonMessage.c_str(), jsonMessage.length(), 0);
-        if (result == SOCKET_ERROR) {
-            int error = WSAGetLastError();
-            cout << "Send failed. Error: " << error << ". Connection may be lost." << endl;
-            connected = false;
-            return false;
+        client.stopAutoReconnect();
+        client.stopReceiver();
+        screen.setCursor(FRAME_ROWS, 0);
+        screen.present();
+        if (updatesTimed > 0) {
+            cout << "Pi-to-screen latency over " << updatesTimed << " updates: avg "
+                 << totalPiToScreenMs / updatesTimed << " ms, max " << maxPiToScreenMs << " ms" << endl;
         }
+        cout << "System shutting down..." << endl;
+    }
+};
 
-        cout << "Sent to Pi: " << jsonMessage << endl;
-        return true;
+// Security desk view of several Pi servers at once. Doors are keyed by site
+// and door, so the same door number in two buildings stays separate.
+class SiteConsole {
+private:
+    struct DoorView {
+        string status;
+        string source;
+        string time;
+    };
+
+    SiteMonitor monitor;
+    ConsoleScreen screen;
+    ConsoleKeyboard keyboard;
+    vector<EventCache> caches;                  // One per site
+    vector<SiteState> lastStates;
+    map<pair<size_t, string>, DoorView> doors;   // Ordered by site, then door
+    string inputLine;
+    string notice;
+
+    static const char* stateName(SiteState state) {
+        switch (state) {
+        case SiteState::Online: return "ONLINE";
+        case SiteState::Negotiating: return "CONNECTED";
+        case SiteState::Connecting: return "CONNECTING";
+        default: return "OFFLINE - RETRYING";
+        }
     }
 
-    string receiveJSON() {
-        if (!connected) return "";
+    void apply(const ReceivedMessage& received) {
+        ProtocolMessage msg = Protocol::parseJSON(received.json);
+        if (!msg.get<Field::Seq>().empty()) caches[received.site].add(msg);
+        string status = describeDoorStatus(msg);
+        if (status.empty()) return;
 
-        char buffer[BUFFER_SIZE];
-        int bytesReceived = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+        string door = msg.get<Field::Door>().empty() ? DEFAULT_DOOR_ID : msg.get<Field::Door>();
+        doors[make_pair(received.site, door)] = {status, msg.get<Field::Source>(), msg.get<Field::Timestamp>()};
+    }
 
-        if (bytesReceived > 0) {
-            buffer[bytesReceived] = '\0';
-            cout << "Received from Pi: " << string(buffer) << endl;
-            return string(buffer);
+    int findSite(const string& name) {
+        for (size_t i = 0; i < monitor.siteCount(); i++) {
+            if (monitor.address(i).name == name) return (int)i;
         }
-        else if (bytesReceived == 0) {
-            cout << "Connection closed by Raspberry Pi" << endl;
-            connected = false;
+        return -1;
+    }
+
+    void sendToSite(size_t site, Event event, const string& door) {
+        ProtocolMessage msg = Protocol::create(Source::Laptop, event, DoorClient::getCurrentTimestamp());
+        msg.set<Field::Door>(door);
+        if (monitor.send(site, Protocol::toJSON(msg))) {
+            notice = string(eventName(event)) + " sent to " + monitor.address(site).name;
         }
         else {
-            int error = WSAGetLastError();
-            if (error == WSAEWOULDBLOCK || error == WSAETIMEDOUT) {
-                // No data available or timeout - not an error
-                return "";
-            }
-            cout << "Receive failed. Error: " << error << endl;
-            connected = false;
+            notice = monitor.address(site).name + " is offline";
         }
-        return "";
     }
 
-    void processReceivedMessage(const string& jsonMessage) {
-        string source = parseJSONValue(jsonMessage, "source");
-        string event = parseJSONValue(jsonMessage, "event");
-        string timestamp = parseJSONValue(jsonMessage, "timestamp");
+    void handleCommand(const string& line) {
+        istringstream words(line);
+        string command, siteName, door;
+        words >> command >> siteName >> door;
 
-        if (event == "lock") {
-            doorStatus = "LOCKED (via " + source + ")";
+        if (command == "status") {
+            for (size_t i = 0; i < monitor.siteCount(); i++) {
+                if (siteName.empty() || monitor.address(i).name == siteName) {
+                    sendToSite(i, Event::StatusRequest, door);
+                }
+            }
+            if (siteName.empty()) notice = "Status requested from every online site";
         }
-        else if (event == "unlock") {
-            doorStatus = "UNLOCKED (via " + source + ")";
+        else if (command == "lock" || command == "unlock") {
+            int site = findSite(siteName);
+            if (site < 0) {
+                notice = "Unknown site '" + siteName + "'";
+                return;
+            }
+            sendToSite(site, command == "lock" ? Event::Lock : Event::Unlock, door);
         }
-        else if (event == "error") {
-            doorStatus = "ERROR (from " + source + ")";
+        else if (!command.empty()) {
+            notice = "ERROR - Invalid command";
         }
     }
 
-    void clearScreen() {
-        system("cls");
-    }
-
     void drawFrame() {
-        clearScreen();
-
-        // Top border
-        cout << "+";
-        for (int i = 0; i < WIDTH - 2; i++) cout << "=";
-        cout << "+" << endl;
+        screen.clear();
+        int row = 0;
+        screen.border(row++, '=');
+        screen.boxLine(row++, 40, "SITE MONITOR");
+        screen.boxLine(row++, 5, "Commands: status [site [door]] | lock <site> [door] | unlock <site> [door] | quit");
+        screen.border(row++, '-');
+
+        screen.boxLine(row++, 5, "SITE                ADDRESS                 LINK");
+        for (size_t i = 0; i < monitor.siteCount(); i++) {
+            const SiteAddress& address = monitor.address(i);
+            screen.boxLine(row, 5, address.name);
+            screen.text(row, 25, address.host + ":" + to_string(address.port));
+            screen.text(row, 49, stateName(monitor.state(i)));
+            row++;
+        }
+        screen.border(row++, '-');
+
+        // Keep the last rows for the bottom border, notice and prompt
+        int lastDoorRow = screen.getRows() - 4;
+        screen.boxLine(row++, 5, "SITE                DOOR      STATUS      VIA           AT");
+        int shown = 0;
+        for (const auto& entry : doors) {
+            if (row > lastDoorRow) break;
+            screen.boxLine(row, 5, monitor.address(entry.first.first).name);
+            screen.text(row, 25, entry.first.second);
+            screen.text(row, 35, entry.second.status);
+            screen.text(row, 47, entry.second.source);
+            screen.text(row, 61, entry.second.time);
+            row++;
+            shown++;
+        }
+        if (shown < (int)doors.size()) {
+            screen.boxLine(lastDoorRow, 5, "... " + to_string(doors.size() - shown + 1) + " more doors");
+        }
+        while (row <= lastDoorRow) {
+            screen.boxLine(row++, 1, "");
+        }
+        screen.border(row++, '=');
 
-        // Menu section
-        cout << "|                                      DOOR CONTROL MENU                                           |" << endl;
-        cout << "|                                                                                                  |" << endl;
-        cout << "|    Available Commands:                                                                           |" << endl;
-        cout << "|                                                                                                  |" << endl;
-        cout << "|    1. status   - Check current door status                                                       |" << endl;
-        cout << "|    2. lock     - Lock the door                                                                   |" << endl;
-        cout << "|    3. unlock   - Unlock the door                                                                 |" << endl;
-        cout << "|    4. connect  - Reconnect to Raspberry Pi                                                       |" << endl;
-        cout << "|    5. quit     - Exit program                                                                    |" << endl;
-        cout << "|                                                                                                  |" << endl;
+        screen.text(row++, 0, notice);
+        string prompt = "Enter command: " + inputLine;
+        screen.text(row, 0, prompt);
+        screen.setCursor(row, (int)prompt.length());
+        screen.present();
+    }
 
-        // Middle divider
-        cout << "|";
-        for (int i = 0; i < WIDTH - 2; i++) cout << "-";
-        cout << "|" << endl;
+public:
+    // Doors start out as the caches last saw them
+    SiteConsole(const vector<SiteAddress>& sites) : monitor(sites), screen(HEIGHT, WIDTH) {
+        for (size_t i = 0; i < sites.size(); i++) {
+            caches.emplace_back(EventCache::fileFor(sites[i].host, sites[i].port), DEFAULT_DOOR_ID);
+            caches[i].load();
+            for (const auto& entry : caches[i].getDoors()) {
+                const ProtocolMessage& msg = entry.second;
+                doors[make_pair(i, entry.first)] = {describeDoorStatus(msg), msg.get<Field::Source>(),
+                                                    msg.get<Field::Timestamp>() + " (cached)"};
+            }
+            lastStates.push_back(SiteState::Offline);
+        }
+    }
 
-        // Status section
-        cout << "|                                      CURRENT DOOR STATUS                                         |" << endl;
-        cout << "|                                                                                                  |" << endl;
+    // Each site that has just come online is asked for what it logged since
+    void requestHistory() {
+        for (size_t i = 0; i < monitor.siteCount(); i++) {
+            SiteState state = monitor.state(i);
+            if (state == SiteState::Online && lastStates[i] != SiteState::Online) {
+                monitor.send(i, Protocol::toJSON(caches[i].historyRequest(DoorClient::getCurrentTimestamp())));
+            }
+            lastStates[i] = state;
+        }
+    }
 
-        // Center the door status
-        int padding = 40;
-        cout << "|";
-        for (int i = 0; i < padding; i++) cout << " ";
-        cout << doorStatus;
-        for (int i = 0; i < (WIDTH - 2 - padding - doorStatus.length()); i++) cout << " ";
-        cout << "|" << endl;
+    void run() {
+        monitor.start();
+        drawFrame();
 
-        cout << "|                                                                                                  |" << endl;
+        string line;
+        while (true) {
+            ReceivedMessage received;
+            if (monitor.waitForMessage(received, chrono::milliseconds(20))) {
+                do {
+                    apply(received);
+                } while (monitor.waitForMessage(received, chrono::milliseconds(0)));
+            }
+            requestHistory();
 
-        // Connection status
-        string connectionStatus = connected ? "CONNECTED TO RASPBERRY PI" : "OFFLINE MODE";
-        cout << "|";
-        for (int i = 0; i < padding; i++) cout << " ";
-        cout << connectionStatus;
-        for (int i = 0; i < (WIDTH - 2 - padding - connectionStatus.length()); i++) cout << " ";
-        cout << "|" << endl;
+            bool typed = false;
+            if (keyboard.editLine(inputLine, line, typed)) {
+                if (line == "quit") break;
+                handleCommand(line);
+            }
 
-        cout << "|                                                                                                  |" << endl;
+            // Unchanged frames cost nothing, so link states just refresh here
+            drawFrame();
+        }
 
-        // Bottom border
-        cout << "+";
-        for (int i = 0; i < WIDTH - 2; i++) cout << "=";
-        cout << "+" << endl;
+        monitor.stop();
+        screen.setCursor(screen.getRows(), 0);
+        screen.present();
+        cout << "System shutting down..." << endl;
     }
+};
 
-    void checkForIncomingMessages() {
-        if (!connected) return;
-
-        // Set socket to non-blocking mode to check for messages without waiting
-        u_long mode = 1;
-        ioctlsocket(sock, FIONBIO, &mode);
-
-        string received = receiveJSON();
-        if (!received.empty()) {
-            processReceivedMessage(received);
+// Non-interactive mode for scripts and commissioning tests. Reads one
+// command per line ("lock [door]", "unlock [door]", "status [door]",
+// "wait <ms>", "#" comments) and keeps up to `window` of them in flight.
+// Each carries an id that the Pi echoes in its ack or status reply.
+class BatchRunner {
+private:
+    struct PendingCommand {
+        int line;
+        chrono::steady_clock::time_point sent;
+    };
+
+    DoorClient client;
+    int window;
+    chrono::milliseconds timeout;
+    unordered_map<string, PendingCommand> inFlight;
+    LatencyRecorder latencies;
+    unsigned long nextId;
+    int sentCount;
+    int answeredCount;
+    int timedOutCount;
+    int failedCount;
+    int invalidCount;
+
+    // Match replies to in-flight commands, then expire the overdue ones
+    void collect(chrono::milliseconds wait) {
+        ReceivedMessage received;
+        while (client.waitForMessage(received, wait)) {
+            wait = chrono::milliseconds(0);
+            auto it = inFlight.find(Protocol::parseJSON(received.json).get<Field::Id>());
+            if (it == inFlight.end()) continue;     // Forwarded STM32 traffic, late replies
+            latencies.add(chrono::duration<double, milli>(received.receivedAt - it->second.sent).count());
+            answeredCount++;
+            inFlight.erase(it);
         }
 
-        // Set back to blocking mode
-        mode = 0;
-        ioctlsocket(sock, FIONBIO, &mode);
+        auto now = chrono::steady_clock::now();
+        for (auto it = inFlight.begin(); it != inFlight.end();) {
+            if (now - it->second.sent > timeout) {
+                cout << "Line " << it->second.line << ": no reply within " << timeout.count() << " ms" << endl;
+                timedOutCount++;
+                it = inFlight.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
     }
 
-    void run() {
-        string userInput;
-
-        while (true) {
-            // Check for incoming messages from Raspberry Pi
-            if (connected) {
-                checkForIncomingMessages();
-            }
+    void waitFor(chrono::milliseconds delay) {
+        auto until = chrono::steady_clock::now() + delay;
+        while (chrono::steady_clock::now() < until) {
+            collect(chrono::milliseconds(10));
+        }
+    }
 
-            drawFrame();
+    void send(int line, Event event, const string& door) {
+        while ((int)inFlight.size() >= window) {
+            collect(chrono::milliseconds(10));
+        }
 
-            cout << "Enter command: ";
-            getline(cin, userInput);
+        string id = "b" + to_string(nextId++);
+        ProtocolMessage msg = Protocol::create(Source::Laptop, event, DoorClient::getCurrentTimestamp());
+        msg.set<Field::Id>(id).set<Field::Door>(door);
+        auto sent = chrono::steady_clock::now();
+        if (!client.sendJSON(Protocol::toJSON(msg))) {
+            cout << "Line " << line << ": send failed" << endl;
+            failedCount++;
+            return;
+        }
+        inFlight[id] = {line, sent};
+        sentCount++;
+    }
 
-            if (userInput == "quit") {
-                break;
+public:
+    BatchRunner(const string& host, int port, int maxInFlight, int timeoutMs)
+        : client(host, port, false), window(maxInFlight), timeout(timeoutMs), nextId(1),
+          sentCount(0), answeredCount(0), timedOutCount(0), failedCount(0), invalidCount(0) {}
+
+    // Returns the process exit code: 0 when every command was answered
+    int run(istream& script) {
+        if (!client.connectToServer()) {
+            return 1;
+        }
+        client.startReceiver();
+
+        auto start = chrono::steady_clock::now();
+        string text;
+        int line = 0;
+        while (getline(script, text)) {
+            line++;
+            size_t comment = text.find('#');
+            if (comment != string::npos) text.erase(comment);
+
+            istringstream words(text);
+            string command, argument;
+            words >> command >> argument;
+            if (command.empty()) continue;
+
+            if (command == "lock") {
+                send(line, Event::Lock, argument);
             }
-            else if (userInput == "status") {
-                // Send status request to Raspberry Pi
-                string jsonMsg = createJSON("laptop", "status_request");
-                if (sendJSON(jsonMsg)) {
-                    cout << "Status request sent to Raspberry Pi..." << endl;
-                    this_thread::sleep_for(chrono::milliseconds(500));
-
-                    // Try to receive response
-                    string response = receiveJSON();
-                    if (!response.empty()) {
-                        processReceivedMessage(response);
-                    }
-                }
+            else if (command == "unlock") {
+                send(line, Event::Unlock, argument);
             }
-            else if (userInput == "lock") {
-                string jsonMsg = createJSON("laptop", "lock");
-                if (sendJSON(jsonMsg)) {
-                    doorStatus = "LOCK COMMAND SENT";
-                    cout << "Lock command sent to Raspberry Pi..." << endl;
-                    this_thread::sleep_for(chrono::milliseconds(500));
-                }
-                else {
-                    doorStatus = "FAILED TO SEND LOCK COMMAND";
-                }
-            }
-            else if (userInput == "unlock") {
-                string jsonMsg = createJSON("laptop", "unlock");
-                if (sendJSON(jsonMsg)) {
-                    doorStatus = "UNLOCK COMMAND SENT";
-                    cout << "Unlock command sent to Raspberry Pi..." << endl;
-                    this_thread::sleep_for(chrono::milliseconds(500));
-                }
-                else {
-                    doorStatus = "FAILED TO SEND UNLOCK COMMAND";
-                }
+            else if (command == "status") {
+                send(line, Event::StatusRequest, argument);
             }
-            else if (userInput == "connect") {
-                cout << "Attempting to connect to Raspberry Pi..." << endl;
-                if (connectToRaspberryPi()) {
-                    doorStatus = "RECONNECTED";
-                    cout << "Reconnection successful!" << endl;
-                }
-                else {
-                    doorStatus = "CONNECTION FAILED";
-                    cout << "Reconnection failed. Check Pi server and network." << endl;
-                }
-                this_thread::sleep_for(chrono::seconds(1));
+            else if (command == "wait") {
+                waitFor(chrono::milliseconds(atoi(argument.c_str())));
             }
             else {
-                doorStatus = "ERROR - Invalid command";
+                cout << "Line " << line << ": unknown command '" << command << "'" << endl;
+                invalidCount++;
             }
         }
+        while (!inFlight.empty()) {
+            collect(chrono::milliseconds(10));
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        client.stopReceiver();
 
-        cout << "System shutting down..." << endl;
+        cout << fixed << setprecision(2);
+        cout << "Sent: " << sentCount << ", answered: " << answeredCount << ", timed out: " << timedOutCount
+             << ", send failures: " << failedCount << ", invalid lines: " << invalidCount << endl;
+        cout << "Elapsed: " << elapsed << " s, throughput: "
+             << (elapsed > 0 ? answeredCount / elapsed : 0.0) << " commands/s" << endl;
+        latencies.print(cout);
+
+        return (timedOutCount == 0 && failedCount == 0 && invalidCount == 0) ? 0 : 1;
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    string batchFile;
+    vector<SiteAddress> sites;
+    string host = RASPBERRY_PI_IP;
+    int port = PORT;
+    int window = BATCH_WINDOW;
+    int timeoutMs = BATCH_TIMEOUT_MS;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            batchFile = argv[++i];
+        }
+        else if (arg == "--site" && i + 1 < argc) {
+            SiteAddress site;
+            if (!parseSiteAddress(argv[++i], PORT, site)) {
+                cerr << "Bad site '" << argv[i] << "', expected name=host[:port]" << endl;
+                return 1;
+            }
+            sites.push_back(site);
+        }
+        else if (arg == "--host" && i + 1 < argc) {
+            host = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        }
+        else if (arg == "--window" && i + 1 < argc) {
+            window = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--timeout" && i + 1 < argc) {
+            timeoutMs = max(1, atoi(argv[++i]));
+        }
+        else {
+            cerr << "Usage: " << argv[0] << " [--batch <file|->] [--window <n>] [--timeout <ms>]"
+                 << " [--host <ip>] [--port <n>]" << endl;
+            cerr << "       " << argv[0] << " --site <name=host[:port]> [--site ...]" << endl;
+            return 1;
+        }
+    }
+
+    if (!batchFile.empty()) {
+        BatchRunner runner(host, port, window, timeoutMs);
+        if (batchFile == "-") {
+            return runner.run(cin);
+        }
+        ifstream script(batchFile);
+        if (!script) {
+            cerr << "Cannot open " << batchFile << endl;
+            return 1;
+        }
+        return runner.run(script);
+    }
+
+    if (!sites.empty()) {
+        SiteConsole console(sites);
+        console.run();
+        return 0;
+    }
+
     cout << "Sir Locks-A-Lot - Enhanced Version" << endl;
     cout << "Initializing network connection..." << endl;
 
@@ -364,4 +718,4 @@ int main() {
     controller.run();
 
     return 0;
-}
\ No newline at end of file
+}